@@ -1,5 +1,18 @@
+#include <sched.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
 #include <sstream>
 #include <new>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
 
 #include <rrid/scope_exit.h>
 #include <common/utils.h>
@@ -12,7 +25,135 @@
 
 
 #include "async_redis_client/async_redis_client.h"
+#include "async_redis_client/cluster.h"
+#include "async_redis_client/cpu_topology.h"
+
+namespace {
+
+// counter 只由当前线程写入, 因此不需要原子的 RMW 操作.
+inline void AddCounter(std::atomic<uint64_t> &counter, uint64_t delta) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    return ;
+}
+
+inline void SubCounter(std::atomic<uint64_t> &counter, uint64_t delta) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) - delta, std::memory_order_relaxed);
+    return ;
+}
+
+inline uint64_t GetMonotonicNs() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* 若 *addr 仍为 expected, 则睡眠直至被唤醒或者 timeout_ns 之后, 0 表示不超时. 可能会被虚假唤醒, 调用者需要
+ * 重新检查条件.
+ */
+inline void FutexWait(std::atomic<uint32_t> *addr, uint32_t expected, uint64_t timeout_ns) noexcept {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ns / 1000000000;
+    timeout.tv_nsec = timeout_ns % 1000000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected,
+            timeout_ns > 0 ? &timeout : nullptr, nullptr, 0);
+    return ;
+}
+
+inline void FutexWakeAll(std::atomic<uint32_t> *addr) noexcept {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    return ;
+}
+
+inline void CpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    return ;
+}
+
+/* 由 callback_thread_num 创建的内置 executor. 每个线程有自己的队列, 来自第 i 个 work thread 的 CompletionBatch
+ * 总是交给第 i % thread_num 个线程, 因此同一个 work thread 上完成的回调按照完成的顺序串行执行. 析构时执行完队列
+ * 中剩余的 batch 之后再退出.
+ */
+class CallbackThreadPool : public AsyncRedisClient::CallbackExecutor {
+public:
+    explicit CallbackThreadPool(size_t thread_num):
+        workers_(new Worker[thread_num]),
+        worker_num_(thread_num) {
+        try {
+            threads_.reserve(thread_num);
+            for (size_t idx = 0; idx < thread_num; ++idx) {
+                Worker *worker = &workers_[idx];
+                threads_.emplace_back([worker] () noexcept { Run(worker); });
+            }
+        } catch (...) {
+            StopAndJoin();
+            throw;
+        }
+    }
+
+    ~CallbackThreadPool() noexcept override {
+        StopAndJoin();
+    }
 
+    void Post(AsyncRedisClient::CompletionBatch &&batch) noexcept override {
+        Worker &worker = workers_[batch.thread_idx() % worker_num_];
+        try {
+            std::lock_guard<std::mutex> guard(worker.mux);
+            worker.batches.push_back(std::move(batch));
+        } catch (...) { // 内存不足, 只能在当前线程中执行.
+            batch.Run();
+            return ;
+        }
+        worker.cv.notify_one();
+        return ;
+    }
+
+private:
+    struct Worker {
+        std::mutex mux;
+        std::condition_variable cv;
+        std::deque<AsyncRedisClient::CompletionBatch> batches;
+        bool stopped = false;
+    };
+
+    std::unique_ptr<Worker[]> workers_;
+    size_t worker_num_;
+    std::vector<std::thread> threads_;
+
+private:
+    static void Run(Worker *worker) noexcept {
+        std::unique_lock<std::mutex> lock(worker->mux);
+        while (true) {
+            worker->cv.wait(lock, [worker] () { return worker->stopped || !worker->batches.empty(); });
+            if (worker->batches.empty()) {
+                return ;
+            }
+            AsyncRedisClient::CompletionBatch batch(std::move(worker->batches.front()));
+            worker->batches.pop_front();
+            lock.unlock();
+            batch.Run();
+            lock.lock();
+        }
+    }
+
+    void StopAndJoin() noexcept {
+        for (size_t idx = 0; idx < worker_num_; ++idx) {
+            {
+                std::lock_guard<std::mutex> guard(workers_[idx].mux);
+                workers_[idx].stopped = true;
+            }
+            workers_[idx].cv.notify_all();
+        }
+        for (std::thread &thread : threads_) {
+            thread.join();
+        }
+        threads_.clear();
+        return ;
+    }
+};
+
+} // namespace
 
 
 
@@ -20,6 +161,32 @@ void AsyncRedisClient::Start() {
     if (thread_num <= 0 || conn_per_thread <= 0 || host.empty()) {
         THROW(EINVAL, "INVALID ARGUMENTS;");
     }
+    if (near_cache_max_bytes > 0 && cluster_mode) {
+        THROW(EINVAL, "INVALID ARGUMENTS; near cache does not support cluster_mode");
+    }
+    for (const std::vector<int> &cpus : thread_cpus) {
+        for (int cpu : cpus) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                THROW(EINVAL, "INVALID ARGUMENTS; cpu: %d", cpu);
+            }
+        }
+    }
+
+    if (numa_aware_routing) {
+        cpu_nodes_ = cpu_nodes.empty() ? GetCpuNodes() : cpu_nodes;
+        node_threads_.clear();
+        for (size_t idx = 0; idx < thread_num && !thread_cpus.empty(); ++idx) {
+            const std::vector<int> &cpus = thread_cpus[idx % thread_cpus.size()];
+            if (cpus.empty() || static_cast<size_t>(cpus.front()) >= cpu_nodes_.size() || cpu_nodes_[cpus.front()] < 0) {
+                continue;
+            }
+            size_t node = cpu_nodes_[cpus.front()];
+            if (node >= node_threads_.size()) {
+                node_threads_.resize(node + 1);
+            }
+            node_threads_[node].push_back(idx);
+        }
+    }
 
     std::vector<std::promise<void>> promises(thread_num);
     std::vector<std::future<void>> futures(thread_num);
@@ -27,7 +194,23 @@ void AsyncRedisClient::Start() {
         futures[idx] = promises[idx].get_future();
     }
 
+    {
+        std::lock_guard<std::mutex> guard(ready_mux_);
+        ready_conn_num_ = 0;
+        auth_error_.clear();
+    }
+
+    callback_executor_ = callback_executor;
+    if (!callback_executor_ && callback_thread_num > 0) {
+        owned_callback_executor_.reset(new CallbackThreadPool(callback_thread_num));
+        callback_executor_ = owned_callback_executor_.get();
+    }
+
     work_threads_.reset(new std::vector<WorkThread>(thread_num));
+    if (collect_command_latency) {
+        TscClock::GetNsPerTick(); // 校准放在这里, 而不是第一个请求上.
+    }
+
     for (size_t idx = 0; idx < thread_num; ++idx) {
         try {
             (*work_threads_)[idx].thread = std::thread(WorkThreadMain, this, idx, &promises[idx]);
@@ -45,6 +228,28 @@ void AsyncRedisClient::Start() {
     return ;
 }
 
+size_t AsyncRedisClient::Start(size_t min_ready_conn_num, uint64_t timeout_ms) {
+    Start();
+
+    min_ready_conn_num = std::min(min_ready_conn_num, thread_num * conn_per_thread);
+    size_t ready_conn_num;
+    std::string auth_error;
+    {
+        std::unique_lock<std::mutex> lock(ready_mux_);
+        ready_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] () noexcept {
+            return ready_conn_num_ >= min_ready_conn_num || !auth_error_.empty();
+        });
+        ready_conn_num = ready_conn_num_;
+        auth_error = auth_error_;
+    }
+
+    if (!auth_error.empty()) {
+        Stop();
+        THROW(EACCES, "AUTH FAILED; error: %s", auth_error.c_str());
+    }
+    return ready_conn_num;
+}
+
 
 void AsyncRedisClient::DoStopOrJoin(ClientStatus op) {
     ClientStatus expect_status = ClientStatus::kStarted;
@@ -60,11 +265,23 @@ void AsyncRedisClient::DoStopOrJoin(ClientStatus op) {
         if (!work_thread.started)
             continue;
 
-        work_thread.AsyncSend();
+        work_thread.Notify();
     }
 
     JoinAllThread();
 
+    // work thread 都已经退出, 不会再有新的 CompletionBatch. 内置线程池在析构时执行完剩余的回调.
+    owned_callback_executor_.reset();
+    callback_executor_ = nullptr;
+
+    /* 用户提供的 executor 可能仍持有尚未执行的 batch, 其中的请求引用着 work_threads_ 中的容量计数, 回调也可能
+     * 仍在使用 client. 因此等待所有 batch 执行完毕, 使得返回之后 client 可以被安全地析构.
+     */
+    {
+        std::unique_lock<std::mutex> lock(batch_mux_);
+        batch_cv_.wait(lock, [this] () noexcept { return outstanding_batch_num_ == 0; });
+    }
+
     return ;
 }
 
@@ -79,186 +296,1916 @@ AsyncRedisClient::~AsyncRedisClient() noexcept {
     return ;
 }
 
-void AsyncRedisClient::WorkThread::AddRequest(std::unique_ptr<RedisRequest> &req) {
-    vec_mux.lock();
-    ON_SCOPE_EXIT(unlock_vec_mux) {
-        vec_mux.unlock();
-    };
+void AsyncRedisClient::RedisRequest::Recycle() noexcept {
+    constexpr size_t kMaxRetainedArgNum = 64;
+    constexpr size_t kMaxRetainedBytes = 4096;
+
+    callback = nullptr;
+    next = nullptr;
+    frame.Clear();
+    batch = nullptr;
+    idx_in_batch = 0;
+    deadline_ms = 0;
+    timed_out = false;
+    parked = false;
+    redirect_num = 0;
+    retry_num = 0;
+    submit_tsc = 0;
+    key_thread = kNoKeyThread;
+    near_cache_kind = NearCache::kNone;
+    near_cache_token = 0;
+    near_cache_invalidation = false;
+    coalesce = false;
+    coalesce_leader = false;
+    coalesce_key.clear();
+    followers = nullptr;
+    merged_num = 0;
+    inline_callback = false;
+    deferred_reply.reset();
+    ReleaseCapacity();
+    ref_num.store(1, std::memory_order_relaxed);
+    sync_state.store(kSyncPending, std::memory_order_relaxed);
+    sync_reply.reset();
+
+    size_t retained_bytes = 0;
+    for (const std::string &arg : cmd) {
+        retained_bytes += arg.capacity();
+    }
+    if (cmd.size() > kMaxRetainedArgNum || retained_bytes > kMaxRetainedBytes) {
+        std::vector<std::string>().swap(cmd);
+    }
+    return ;
+}
 
-    if (!request_vec) {
-        return ;
+void AsyncRedisClient::RedisRequest::ReleaseCapacity() noexcept {
+    if (admitted_thread) {
+        admitted_thread->ReleaseCapacity(1, admitted_bytes);
+        admitted_thread = nullptr;
     }
+    admitted_bytes = 0;
+    return ;
+}
 
-    request_vec->emplace_back(std::move(req));
+/* 只会被调用一次, 此时 work thread 仍持有着请求对象的引用.
+ *
+ * 容量在唤醒等待者之前归还, 而不是等到 Recycle(): 最后一个引用可能由 ReplyFuture 持有, 其销毁时 admitted_thread
+ * 指向的 WorkThread 可能已经随着再次 Start() 或者 AsyncRedisClient 的销毁而被释放.
+ */
+void AsyncRedisClient::RedisRequest::CompleteSync(redisReply *reply) noexcept {
+    if (reply) {
+        sync_reply = TakeReply(reply);
+    }
+    ReleaseCapacity();
+    if (sync_state.exchange(kSyncDone, std::memory_order_acq_rel) == kSyncWaiting) {
+        FutexWakeAll(&sync_state);
+    }
     return ;
 }
 
-namespace {
+AsyncRedisClient::ReplyFuture::~ReplyFuture() noexcept {
+    Release();
+}
 
-struct WorkThreadContext;
+AsyncRedisClient::ReplyFuture& AsyncRedisClient::ReplyFuture::operator=(ReplyFuture &&other) noexcept {
+    if (this != &other) {
+        Release();
+        req_ = other.req_;
+        spin_us_ = other.spin_us_;
+        other.req_ = nullptr;
+    }
+    return *this;
+}
 
-struct RedisConnectionContext {
-    WorkThreadContext *thread_ctx = nullptr;
-    size_t idx_in_thread_ctx;
+void AsyncRedisClient::ReplyFuture::Release() noexcept {
+    if (req_) {
+        RedisRequestRecycler()(req_);
+        req_ = nullptr;
+    }
+    return ;
+}
 
-    // 不变量 36: 若不为 nullptr, 则表明其指向着的 ctx 可用;
-    redisAsyncContext *hiredis_async_ctx = nullptr;
-};
+bool AsyncRedisClient::ReplyFuture::IsReady() const noexcept {
+    return req_->sync_state.load(std::memory_order_acquire) == RedisRequest::kSyncDone;
+}
 
-struct WorkThreadContext {
-    AsyncRedisClient *client = nullptr;
-    AsyncRedisClient::WorkThread *work_thread = nullptr;
+void AsyncRedisClient::ReplyFuture::Wait() const noexcept {
+    WaitFor(0);
+    return ;
+}
 
-    bool no_new_request = false;
+/* 先自旋 spin_us_, 然后将 sync_state 由 kSyncPending 改为 kSyncWaiting 并进入 futex 等待. CompleteSync() 只有在
+ * 看到 kSyncWaiting 时才会调用 futex wake, 因此在无人等待时完成请求不需要任何系统调用.
+ */
+bool AsyncRedisClient::ReplyFuture::WaitFor(uint32_t timeout_ms) const noexcept {
+    std::atomic<uint32_t> &state = req_->sync_state;
+    if (state.load(std::memory_order_acquire) == RedisRequest::kSyncDone) {
+        return true;
+    }
 
-    // 序列号, 用来实现 Round-robin 算法.
-    size_t seq_num{0};
+    uint64_t begin_ns = GetMonotonicNs();
+    uint64_t deadline_ns = timeout_ms > 0 ? begin_ns + timeout_ms * 1000000ULL : 0;
+    if (spin_us_ > 0) {
+        uint64_t spin_end_ns = begin_ns + spin_us_ * 1000ULL;
+        if (deadline_ns != 0 && deadline_ns < spin_end_ns) {
+            spin_end_ns = deadline_ns;
+        }
+        do {
+            for (int i = 0; i < 64; ++i) {
+                if (state.load(std::memory_order_acquire) == RedisRequest::kSyncDone) {
+                    return true;
+                }
+                CpuRelax();
+            }
+        } while (GetMonotonicNs() < spin_end_ns);
+    }
 
-    /* conn_ctx, uv_loop 由使用者来负责释放内存.
-     */
-    std::vector<RedisConnectionContext> conn_ctxs;
-    uv_loop_t uv_loop;
-};
+    while (true) {
+        uint32_t expected = RedisRequest::kSyncPending;
+        if (!state.compare_exchange_strong(expected, RedisRequest::kSyncWaiting, std::memory_order_acq_rel,
+                                           std::memory_order_acquire) &&
+            expected == RedisRequest::kSyncDone) {
+            return true;
+        }
 
-void OnRedisDisconnect(const struct redisAsyncContext *hiredis_async_ctx, int /* status */) noexcept;
+        uint64_t timeout_ns = 0;
+        if (deadline_ns != 0) {
+            uint64_t now_ns = GetMonotonicNs();
+            if (now_ns >= deadline_ns) {
+                return false;
+            }
+            timeout_ns = deadline_ns - now_ns;
+        }
+        FutexWait(&state, RedisRequest::kSyncWaiting, timeout_ns);
+    }
+}
 
-redisAsyncContext* GetHIRedisAsyncCtx(/* const */ RedisConnectionContext *conn_ctx) noexcept {
-    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
-    AsyncRedisClient *client = thread_ctx->client;
+AsyncRedisClient::redisReply_unique_ptr_t AsyncRedisClient::ReplyFuture::Get() noexcept {
+    Wait();
+    redisReply_unique_ptr_t reply = std::move(req_->sync_reply);
+    Release();
+    return reply;
+}
 
-    redisAsyncContext *ac = redisAsyncConnect(client->host.c_str(), client->port);
-    if (!ac) {
-        return nullptr;
-    }
+/* 定义了 ASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST 时, 每次压入请求都会调用 uv_async_send(), 即唤醒合并之前的行为,
+ * 只用于压测对比, 参见 test/run_bench.sh. 此时所有生产者都在压入请求之前增加 notifier_num, 完成唤醒之后减少,
+ * 由此与 work thread 关闭 async_handle 同步.
+ */
+void AsyncRedisClient::WorkThread::AddRequest(request_ptr_t &req) {
+#ifdef ASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST
+    notifier_num.fetch_add(1, std::memory_order_seq_cst);
+    ON_SCOPE_EXIT(on_add_exit) {
+        notifier_num.fetch_sub(1, std::memory_order_release);
+    };
+#endif
 
-    // 注意对 ac 调用 redisAsyncFree();
-    if (ac->err != 0) {
-        redisAsyncFree(ac);
-        return nullptr;
+    auto push_result = request_queue.Push(req.get());
+    if (push_result == IntrusiveMpscQueue<RedisRequest>::PushResult::kClosed) {
+        return ;
     }
 
-    if (redisLibuvAttach(ac, &thread_ctx->uv_loop) != REDIS_OK) {
-        redisAsyncFree(ac);
-        return nullptr;
+    req.release(); // 此后 RedisRequest 对象由 work thread 来负责管理.
+    if (push_result == IntrusiveMpscQueue<RedisRequest>::PushResult::kFirst) {
+        uv_async_send(async_handle); // 当 send() 失败了怎么办???
+        wakeup_num.fetch_add(1, std::memory_order_release);
     }
-
-    if (!client->passwd.empty()) {
-        int hiredis_rc = redisAsyncCommand(ac, nullptr, nullptr, "AUTH %b",
-                          client->passwd.data(),
-                          static_cast<size_t>(client->passwd.size()));
-        if (hiredis_rc != REDIS_OK) {
-            redisAsyncFree(ac);
-            return nullptr;
-        }
+#ifdef ASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST
+    if (push_result != IntrusiveMpscQueue<RedisRequest>::PushResult::kFirst) {
+        uv_async_send(async_handle);
     }
+#endif
+    return ;
+}
 
-    ac->data = conn_ctx;
-    if (redisAsyncSetDisconnectCallback(ac, OnRedisDisconnect) != REDIS_OK) { // unreachable
-        throw std::runtime_error("redisAsyncSetDisconnectCallback FAILED");
+void AsyncRedisClient::WorkThread::AddRequests(std::vector<request_ptr_t> &reqs) {
+    if (reqs.empty()) {
+        return ;
     }
-    return ac;
-}
 
+    // 参见 IntrusiveMpscQueue::PushChain() 对串联顺序的要求.
+    for (size_t idx = 1; idx < reqs.size(); ++idx) {
+        reqs[idx]->next = reqs[idx - 1].get();
+    }
 
-void OnRedisDisconnect(const struct redisAsyncContext *hiredis_async_ctx, int /* status */) noexcept {
-    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)hiredis_async_ctx->data;
-    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+#ifdef ASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST
+    notifier_num.fetch_add(1, std::memory_order_seq_cst);
+    ON_SCOPE_EXIT(on_add_exit) {
+        notifier_num.fetch_sub(1, std::memory_order_release);
+    };
+#endif
 
-    if (thread_ctx->no_new_request) {
-        conn_ctx->hiredis_async_ctx = nullptr;
+    auto push_result = request_queue.PushChain(reqs.front().get(), reqs.back().get());
+    if (push_result == IntrusiveMpscQueue<RedisRequest>::PushResult::kClosed) {
+        for (request_ptr_t &req : reqs) {
+            req->next = nullptr;
+        }
         return ;
     }
 
-    conn_ctx->hiredis_async_ctx = GetHIRedisAsyncCtx(conn_ctx);
+    for (request_ptr_t &req : reqs) {
+        req.release();
+    }
+    if (push_result == IntrusiveMpscQueue<RedisRequest>::PushResult::kFirst) {
+        uv_async_send(async_handle); // 当 send() 失败了怎么办???
+        wakeup_num.fetch_add(1, std::memory_order_release);
+    }
+#ifdef ASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST
+    if (push_result != IntrusiveMpscQueue<RedisRequest>::PushResult::kFirst) {
+        uv_async_send(async_handle);
+    }
+#endif
     return ;
 }
 
-/// 参见实现
-uv_async_t* GetAsyncHandle(uv_loop_t *loop, uv_async_cb async_cb) noexcept {
-    uv_async_t *handle = static_cast<uv_async_t*>(malloc(sizeof(uv_async_t)));
-    if (handle == nullptr)
-        return nullptr;
+/* 以 CAS 增加, 因此 admitted_num, admitted_bytes 不会因为并发的 TryAdmit() 而暂时超出上限, 使其他调用者误以为
+ * 容量已满. 先占用请求数目, 再占用字节数; 后者失败时归还前者, 此时可能有等待者因为这段短暂的占用而失败并进入
+ * wait(), 因此需要像 ReleaseCapacity() 一样唤醒它们. 调用者持有 capacity_mux 时, 其他等待者不会在此期间检查
+ * 容量, 不需要唤醒.
+ *
+ * old_num, old_bytes 为 0 表明 work thread 上没有其他请求, 此时不检查上限, 否则超出上限的请求永远无法提交.
+ */
+bool AsyncRedisClient::WorkThread::TryAdmit(uint64_t num, uint64_t bytes, size_t max_num, size_t max_bytes,
+                                            bool capacity_locked) noexcept {
+    uint64_t old_num = admitted_num.load(std::memory_order_seq_cst);
+    do {
+        if (max_num > 0 && old_num > 0 && old_num + num > max_num) {
+            return false;
+        }
+    } while (!admitted_num.compare_exchange_weak(old_num, old_num + num, std::memory_order_seq_cst));
+
+    uint64_t old_bytes = admitted_bytes.load(std::memory_order_seq_cst);
+    do {
+        if (max_bytes > 0 && old_bytes > 0 && old_bytes + bytes > max_bytes) {
+            if (capacity_locked) {
+                admitted_num.fetch_sub(num, std::memory_order_seq_cst);
+            } else {
+                ReleaseCapacity(num, 0);
+            }
+            return false;
+        }
+    } while (!admitted_bytes.compare_exchange_weak(old_bytes, old_bytes + bytes, std::memory_order_seq_cst));
+    return true;
+}
 
-    int uv_rc = uv_async_init(loop, handle, async_cb);
-    if (uv_rc < 0) {
-        free(handle);
-        return nullptr;
-    }
+/* 等待者持有 capacity_mux, 增加 blocked_num, 然后 TryAdmit(); ReleaseCapacity() 先归还容量, 然后读取
+ * blocked_num. 这些操作都是 seq_cst 的, 因此要么等待者看到了归还的容量, 要么 ReleaseCapacity() 看到了等待者;
+ * 后者在 capacity_mux 下 notify, 此时等待者已经进入 wait().
+ */
+bool AsyncRedisClient::WorkThread::WaitAdmit(uint64_t num, uint64_t bytes, size_t max_num, size_t max_bytes,
+                                             uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> lock(capacity_mux);
+    blocked_num.fetch_add(1, std::memory_order_seq_cst);
+    ON_SCOPE_EXIT(on_wait_exit) {
+        blocked_num.fetch_sub(1, std::memory_order_relaxed);
+    };
 
-    return handle;
+    bool admitted = false;
+    auto IsDone = [&] () noexcept -> bool {
+        admitted = TryAdmit(num, bytes, max_num, max_bytes, true);
+        return admitted || request_queue.IsClosed();
+    };
+    if (timeout_ms == 0) {
+        capacity_cv.wait(lock, IsDone);
+    } else {
+        capacity_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), IsDone);
+    }
+    return admitted;
 }
 
-void OnAsyncHandleClose(uv_handle_t* handle) noexcept {
-    free(handle);
+void AsyncRedisClient::WorkThread::ReleaseCapacity(uint64_t num, uint64_t bytes) noexcept {
+    admitted_num.fetch_sub(num, std::memory_order_seq_cst);
+    admitted_bytes.fetch_sub(bytes, std::memory_order_seq_cst);
+    if (blocked_num.load(std::memory_order_seq_cst) != 0) {
+        std::lock_guard<std::mutex> guard(capacity_mux);
+        capacity_cv.notify_all();
+    }
     return ;
 }
 
-void CloseAsyncHandle(uv_async_t *handle) noexcept {
-    uv_close((uv_handle_t*)handle, OnAsyncHandleClose);
-    return ;
-}
+struct AsyncRedisClient::RedisConnectionContext {
+    WorkThreadContext *thread_ctx = nullptr;
+    size_t idx_in_thread_ctx;
 
-inline void SetValueOn(std::promise<void> *p) noexcept {
-    p->set_value();
-    return ;
-}
+    // 集群模式下连接所属的节点. 为 nullptr 表明是到 host:port 的连接.
+    ClusterNode *node = nullptr;
 
-} // namespace
+    // 不变量 36: 若不为 nullptr, 则表明其指向着的 ctx 可用;
+    redisAsyncContext *hiredis_async_ctx = nullptr;
 
+    // 已经发送但尚未收到响应的请求数目, 及其编码之后的总长度. 会同步到 stats 中.
+    size_t in_flight_num = 0;
+    size_t pending_bytes = 0;
+    ConnStats *stats = nullptr;
+    ThreadStats *thread_stats = nullptr; // 所属 work thread 的统计信息.
 
-/* 根据 AsyncRedisClient::~AsyncRedisClient() 得知在 AsyncRedisClient 对象被销毁之前已经调用了 Stop()
- * 或者 Join() 因此在 WorkThreadMain() 运行期间, client 指向的内存始终有效.
- *
- * 注意 p 的生命周期.
- */
-void AsyncRedisClient::WorkThreadMain(AsyncRedisClient *client, size_t idx, std::promise<void> *p) noexcept {
-    WorkThreadContext thread_ctx;
-    thread_ctx.client = client;
-    WorkThread *work_thread = &(*client->work_threads_)[idx];
-    thread_ctx.work_thread = work_thread;
+    // 是否已经开启了 CLIENT TRACKING, 只有此时发送的请求才会填充 near cache.
+    bool tracking = false;
 
-    ON_SCOPE_EXIT(on_thread_exit_1){
-        if (p) {
-            // 不变量 123: 若 p != nullptr, 则表明尚未对 p 调用过 set_xxx() 系列.
-            SetValueOn(p);
-            p = nullptr;
-        }
-    };
+    /* 连接状态, 参见 ConnState. connect_failed 表明最近一次连接未能建立或者 AUTH 失败, 此时正在进行的重新连接
+     * 不会让请求等待, 直至连接就绪. on_disconnect 为 ConnectRedis() 设置的 disconnect callback.
+     */
+    ConnState state = ConnState::kDisconnected;
+    bool connect_failed = false;
+    redisDisconnectCallback *on_disconnect = nullptr;
 
-    if (uv_loop_init(&thread_ctx.uv_loop) < 0) {
-        return ;
+    /* 重新连接. reconnect_attempt 为连续失败的次数, 连接就绪时清零; reconnect_at_ms 不为 0 表明将在该时间重新
+     * 连接, 参见 ScheduleReconnect().
+     */
+    uint32_t reconnect_attempt = 0;
+    uint64_t reconnect_at_ms = 0;
+
+public:
+    /* 更新 state, 同步到 stats, 并在连接就绪或者建立失败时重新分发 parked_requests. 参见
+     * AsyncRedisClient::Start(size_t, uint64_t).
+     */
+    void SetState(ConnState new_state) noexcept;
+
+    // 记录密码错误时 AUTH 的错误信息, 并将状态置为 kAuthFailed.
+    void SetAuthFailed(const redisReply *reply) noexcept;
+
+    // 请求是否可以在该连接上发送. 参见 WorkThreadContext::wait_ready.
+    bool IsUsable() const noexcept;
+
+    // 连接是否正在建立, 或者即将重新连接, 并且值得等待.
+    bool IsPending() const noexcept {
+        return !connect_failed && (state == ConnState::kConnecting || state == ConnState::kAuthenticating ||
+                                   reconnect_at_ms != 0);
     }
-    thread_ctx.uv_loop.data = &thread_ctx;
-    ON_SCOPE_EXIT(on_thread_exit_2){
-        int uv_rc = uv_loop_close(&thread_ctx.uv_loop);
-        if (uv_rc < 0) {
-            THROW(uv_rc, "uv_loop_close ERROR");
-        }
-    };
 
-    uv_async_t *async_handle = GetAsyncHandle(&thread_ctx.uv_loop, AsyncRedisClient::OnAsyncHandle);
-    if (async_handle == nullptr) {
+    void OnRequestSent(const RedisRequest *request) noexcept {
+        ++in_flight_num;
+        pending_bytes += request->bytes;
+
+        // stats, thread_stats 只会被当前线程写入, 因此不需要原子的 RMW 操作.
+        stats->in_flight_num.store(in_flight_num, std::memory_order_relaxed);
+        stats->pending_bytes.store(pending_bytes, std::memory_order_relaxed);
+        AddCounter(stats->sent_num, 1);
+
+        AddCounter(thread_stats->in_flight_num, 1);
+        AddCounter(thread_stats->pending_bytes, request->bytes);
+        AddCounter(thread_stats->sent_num, 1);
+        AddCounter(thread_stats->bytes_written, request->bytes);
         return ;
     }
-    // 此后 async_handle 由 uv_loop 来引用.
-    async_handle->data = &thread_ctx;
-
-    bool init_success = true;
-    std::unique_ptr<std::vector<std::unique_ptr<RedisRequest>>> request_vec;
-    try {
-        // 所有可能会抛出异常的初始化操作都放在这里进行. 只要确保这其中分配的资源正确释放就行了.
 
-        request_vec.reset(new std::vector<std::unique_ptr<RedisRequest>>);
-        // 此时动态分配的空间与 request_vec 来负责管理, 因此不需要注册 ON_EXCEPTION.
+    void OnRequestDone(const RedisRequest *request) noexcept {
+        --in_flight_num;
+        pending_bytes -= request->bytes;
 
-        thread_ctx.conn_ctxs.resize(client->conn_per_thread);
+        stats->in_flight_num.store(in_flight_num, std::memory_order_relaxed);
+        stats->pending_bytes.store(pending_bytes, std::memory_order_relaxed);
 
-        // 整个 for 循环不可能抛出异常.
+        SubCounter(thread_stats->in_flight_num, 1);
+        SubCounter(thread_stats->pending_bytes, request->bytes);
+        return ;
+    }
+};
+
+/* 集群模式下的一个 master 节点, 由 work thread 独占.
+ *
+ * 不变量 5: ClusterNode 对象一旦创建便存活至 work thread 退出, conn_ctxs 也不会再扩容, 因此 hiredis 中保存着的
+ * RedisConnectionContext 指针始终有效. 不再负责任何 slot 的节点会被 retired, 此时其连接会被关闭并且不再重连;
+ * 当节点重新出现在集群拓扑中时恢复.
+ */
+struct AsyncRedisClient::ClusterNode {
+    std::string host;
+    in_port_t port = 0;
+    bool retired = false;
+
+    std::vector<RedisConnectionContext> conn_ctxs;
+    std::unique_ptr<ConnStats[]> conn_stats;
+};
+
+struct AsyncRedisClient::WorkThreadContext {
+    AsyncRedisClient *client = nullptr;
+    AsyncRedisClient::WorkThread *work_thread = nullptr;
+    size_t idx = 0; // work_thread 在 work_threads_ 中的下标.
+
+    bool no_new_request = false;
+
+    // 取走非空请求链表的次数, 参见 WorkThread::wakeup_num.
+    uint64_t expected_wakeup_num = 0;
+
+    // 序列号, 用来实现 Round-robin 算法.
+    size_t seq_num{0};
+
+    // xorshift 随机数状态, 用来实现 kPowerOfTwoChoices.
+    uint64_t rand_state = 88172645463325252ULL;
+
+    /* 已发送并且具有截止时间的请求. deadline_timer 是一个单次定时器, 在时间轮中最早的到期时间触发;
+     * armed_expire_ms 为 deadline_timer 当前的触发时间, 0 表示未启动.
+     *
+     * 不变量 4: deadline_timer 在 no_new_request 之后, 所有连接都已经释放时才会被 uv_close(). 此时所有请求都
+     * 已经离开了时间轮.
+     */
+    TimerWheel timer_wheel;
+    uv_timer_t deadline_timer;
+    uint64_t armed_expire_ms = 0;
+    bool deadline_timer_closed = false;
+
+    /* 集群模式. slot_nodes[slot] 为负责 slot 的节点在 cluster_nodes 中的下标, kNoClusterNode 表示未知, 此时
+     * 请求发送到 conn_ctxs 上, 由 MOVED 重定向到正确的节点.
+     *
+     * cluster_refreshing, 是否有尚未返回的 CLUSTER SLOTS 请求.
+     */
+    enum : uint16_t {
+        kNoClusterNode = 0xffff
+    };
+    std::vector<std::unique_ptr<ClusterNode>> cluster_nodes;
+    std::vector<uint16_t> slot_nodes;
+    uv_timer_t cluster_refresh_timer;
+    bool cluster_refresh_timer_closed = true;
+    bool cluster_refreshing = false;
+    uint64_t last_cluster_refresh_ms = 0;
+
+    /* 在 work thread 中未能发送的请求不在当前调用栈中以 nullptr 回调, 而是暂存在 failed_requests 中, 由
+     * failure_idle 在下一轮事件循环中回调. 否则回调中重试的请求若再次失败, 会在同一个调用栈中不断递归.
+     * failure_idle 只在 failed_requests 不为空时启动, 与 deadline_timer 一同被关闭, 之后失败的请求直接回调.
+     */
+    std::vector<request_ptr_t> failed_requests;
+    uv_idle_t failure_idle;
+    bool failure_idle_closed = false;
+
+    /* near cache. tracking_conn 订阅了 __redis__:invalidate, 只用于接收失效消息, 不在 conn_ctxs 中;
+     * tracking_client_id 为其 CLIENT ID. tracking_subscribed 为 true 时, 数据连接才会开启 CLIENT TRACKING.
+     */
+    RedisConnectionContext tracking_conn;
+    long long tracking_client_id = 0;
+    bool tracking_subscribed = false;
+
+    /* near cache. InvalidateWrittenKeys() 中交给其他 work thread 的失效通知, 第 i 个元素交给第 i 个 work thread,
+     * 只在调用期间不为空.
+     */
+    std::vector<request_ptr_t> invalidations;
+
+    // coalesce_reads. 已经发送并且尚未收到响应的可合并请求, 以 RedisRequest::coalesce_key 为 key.
+    std::unordered_map<std::string, RedisRequest*> coalesce_leaders;
+
+    // merge_reads. 本次取走的请求中暂存的 GET(只在 merge_gets 时), HGET, 参见 MergeRequest().
+    std::vector<request_ptr_t> merge_gets;
+    std::vector<request_ptr_t> merge_hgets;
+
+    /* callback_executor. 本轮事件循环中完成的请求按照完成的顺序通过 next 串联在 completions 中, 在
+     * completion_check 中作为一个 CompletionBatch 交给 callback_executor. completion_check 只在 completions
+     * 不为空时启动, 与 deadline_timer 一同被关闭, 之后的回调直接在 work thread 中执行.
+     */
+    CallbackExecutor *callback_executor = nullptr;
+    RedisRequest *completions = nullptr;
+    RedisRequest *completions_tail = nullptr;
+    size_t completion_num = 0;
+    uv_check_t completion_check;
+    bool completion_check_closed = true;
+
+    /* wait_ready 为 true 时请求只发送到 kReady 的连接上; 若没有就绪的连接, 但是有连接正在建立, 则请求暂存在
+     * parked_requests 中, 直至某个连接的状态发生变化. Join() 时 wait_ready 为 false, 此时请求可以发送到尚未就绪
+     * 的连接上, 由 hiredis 在连接建立之后发送.
+     */
+    bool wait_ready = true;
+    std::vector<request_ptr_t> parked_requests;
+
+    /* 单次定时器, 在最早的 RedisConnectionContext::reconnect_at_ms 触发, 同时重新分发 parked_requests 中被重试的
+     * 请求. reconnect_armed_ms 为当前的触发时间, 0 表示未启动. 与 deadline_timer 一同被关闭.
+     */
+    uv_timer_t reconnect_timer;
+    uint64_t reconnect_armed_ms = 0;
+    bool reconnect_timer_closed = false;
+
+    /* conn_ctx, uv_loop 由使用者来负责释放内存.
+     */
+    std::vector<RedisConnectionContext> conn_ctxs;
+    uv_loop_t uv_loop;
+
+public:
+    uint64_t NextRand() noexcept {
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 7;
+        rand_state ^= rand_state << 17;
+        return rand_state;
+    }
+
+    // 对 conn_ctxs 以及所有集群节点中的连接调用 f(conn_ctx).
+    template <typename F>
+    void ForEachConn(F &&f) {
+        for (RedisConnectionContext &conn_ctx : conn_ctxs) {
+            f(conn_ctx);
+        }
+        for (std::unique_ptr<ClusterNode> &node : cluster_nodes) {
+            for (RedisConnectionContext &conn_ctx : node->conn_ctxs) {
+                f(conn_ctx);
+            }
+        }
+        return ;
+    }
+
+    // 重新处理 parked_requests 中的请求, 等待期间已经超时的请求被直接释放.
+    void DispatchParked() noexcept;
+};
+
+bool AsyncRedisClient::RedisConnectionContext::IsUsable() const noexcept {
+    return hiredis_async_ctx && (state == ConnState::kReady || !thread_ctx->wait_ready);
+}
+
+void AsyncRedisClient::RedisConnectionContext::SetState(ConnState new_state) noexcept {
+    ConnState old_state = state;
+    if (old_state == new_state) {
+        return ;
+    }
+    auto IsConnecting = [] (ConnState conn_state) noexcept {
+        return conn_state == ConnState::kConnecting || conn_state == ConnState::kAuthenticating;
+    };
+    state = new_state;
+    if (new_state == ConnState::kReady) {
+        connect_failed = false;
+        reconnect_attempt = 0;
+    }
+    if (!stats) { // tracking_conn.
+        return ;
+    }
+    stats->state.store(new_state, std::memory_order_relaxed);
+
+    if (!node && (old_state == ConnState::kReady || new_state == ConnState::kReady)) {
+        AsyncRedisClient *client = thread_ctx->client;
+        {
+            std::lock_guard<std::mutex> guard(client->ready_mux_);
+            if (new_state == ConnState::kReady) {
+                ++client->ready_conn_num_;
+            } else {
+                --client->ready_conn_num_;
+            }
+        }
+        client->ready_cv_.notify_all();
+    }
+
+    if (new_state == ConnState::kReady || (IsConnecting(old_state) && !IsConnecting(new_state))) {
+        thread_ctx->DispatchParked();
+    }
+    return ;
+}
+
+void AsyncRedisClient::RedisConnectionContext::SetAuthFailed(const redisReply *reply) noexcept {
+    AddCounter(thread_stats->auth_fail_num, 1);
+    connect_failed = true;
+
+    AsyncRedisClient *client = thread_ctx->client;
+    {
+        std::lock_guard<std::mutex> guard(client->ready_mux_);
+        try {
+            client->auth_error_.assign(reply->str ? reply->str : "", reply->str ? reply->len : 0);
+            if (client->auth_error_.empty()) {
+                client->auth_error_ = "AUTH FAILED";
+            }
+        } catch (...) {}
+    }
+    client->ready_cv_.notify_all();
+
+    SetState(ConnState::kAuthFailed);
+    return ;
+}
+
+void AsyncRedisClient::WorkThreadContext::DispatchParked() noexcept {
+    if (parked_requests.empty()) {
+        return ;
+    }
+
+    // HandleRequest() 可能再次将请求放入 parked_requests.
+    std::vector<request_ptr_t> requests;
+    requests.swap(parked_requests);
+    for (request_ptr_t &request : requests) {
+        timer_wheel.Cancel(&request->timer_node);
+        request->parked = false;
+        if (request->timed_out) {
+            request.reset();
+            continue;
+        }
+        AsyncRedisClient::HandleRequest(this, request);
+    }
+    return ;
+}
+
+namespace {
+
+using RedisConnectionContext = AsyncRedisClient::RedisConnectionContext;
+using WorkThreadContext = AsyncRedisClient::WorkThreadContext;
+using ClusterNode = AsyncRedisClient::ClusterNode;
+
+// 当前 work thread 的上下文, 在其他线程中为 nullptr. 用于 Execute() 识别在 work thread 中发起的请求.
+thread_local WorkThreadContext *tls_thread_ctx = nullptr;
+
+void OnRedisDisconnect(const struct redisAsyncContext *hiredis_async_ctx, int /* status */) noexcept;
+void MaybeCloseDeadlineTimer(WorkThreadContext *thread_ctx) noexcept;
+void EnableTracking(RedisConnectionContext *conn_ctx) noexcept;
+void ConnectTracking(WorkThreadContext *thread_ctx) noexcept;
+redisAsyncContext* GetHIRedisAsyncCtx(RedisConnectionContext *conn_ctx) noexcept;
+
+void OnReconnectTimer(uv_timer_t *timer) noexcept;
+
+// 使 reconnect_timer 不晚于 expire_ms 触发.
+void ArmReconnectTimer(WorkThreadContext *thread_ctx, uint64_t expire_ms) noexcept {
+    if (thread_ctx->reconnect_timer_closed) {
+        return ;
+    }
+    if (thread_ctx->reconnect_armed_ms != 0 && thread_ctx->reconnect_armed_ms <= expire_ms) {
+        return ;
+    }
+
+    uint64_t now_ms = GetMonotonicMs();
+    uv_timer_start(&thread_ctx->reconnect_timer, OnReconnectTimer, expire_ms > now_ms ? expire_ms - now_ms : 0, 0);
+    thread_ctx->reconnect_armed_ms = expire_ms;
+    return ;
+}
+
+// 连续失败 attempt 次之后, 下一次连接之前等待的时间, 参见 AsyncRedisClient::reconnect_min_delay_ms.
+uint64_t GetReconnectDelayMs(WorkThreadContext *thread_ctx, uint32_t attempt) noexcept {
+    if (attempt == 0) {
+        return 0;
+    }
+    AsyncRedisClient *client = thread_ctx->client;
+    uint64_t min_delay_ms = std::max<uint64_t>(client->reconnect_min_delay_ms, 1);
+    uint64_t max_delay_ms = std::max<uint64_t>(client->reconnect_max_delay_ms, min_delay_ms);
+    uint64_t delay_ms = std::min(min_delay_ms << std::min<uint32_t>(attempt - 1, 32), max_delay_ms);
+    return delay_ms - thread_ctx->NextRand() % (delay_ms / 2 + 1);
+}
+
+/* 在连接断开, 或者未能建立之后调用, 此时 conn_ctx->hiredis_async_ctx 为 nullptr. 即使不需要等待, 也在下一轮
+ * 事件循环中才重新连接: hiredis 在调用 disconnect callback 之前会先以 nullptr 回调所有尚未收到响应的请求, 此时
+ * 不应该再使用这个连接.
+ */
+void ScheduleReconnect(RedisConnectionContext *conn_ctx) noexcept {
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+    conn_ctx->reconnect_at_ms = GetMonotonicMs() + GetReconnectDelayMs(thread_ctx, conn_ctx->reconnect_attempt);
+    ++conn_ctx->reconnect_attempt;
+    ArmReconnectTimer(thread_ctx, conn_ctx->reconnect_at_ms);
+    return ;
+}
+
+void OnReconnectTimer(uv_timer_t *timer) noexcept {
+    WorkThreadContext *thread_ctx = (WorkThreadContext*)timer->data;
+    thread_ctx->reconnect_armed_ms = 0;
+    if (thread_ctx->no_new_request) {
+        return ;
+    }
+
+    uint64_t now_ms = GetMonotonicMs();
+    uint64_t next_ms = 0;
+    auto Reconnect = [&] (RedisConnectionContext &conn_ctx) noexcept {
+        if (conn_ctx.reconnect_at_ms == 0) {
+            return ;
+        }
+        if (conn_ctx.reconnect_at_ms > now_ms) {
+            next_ms = next_ms == 0 ? conn_ctx.reconnect_at_ms : std::min(next_ms, conn_ctx.reconnect_at_ms);
+            return ;
+        }
+        conn_ctx.reconnect_at_ms = 0;
+        if (conn_ctx.node && conn_ctx.node->retired) {
+            return ;
+        }
+
+        AddCounter(conn_ctx.thread_stats->reconnect_num, 1);
+        if (&conn_ctx == &thread_ctx->tracking_conn) {
+            ConnectTracking(thread_ctx);
+            return ;
+        }
+        AddCounter(conn_ctx.stats->reconnect_num, 1);
+        conn_ctx.hiredis_async_ctx = GetHIRedisAsyncCtx(&conn_ctx);
+        EnableTracking(&conn_ctx);
+    };
+    thread_ctx->ForEachConn(Reconnect);
+    Reconnect(thread_ctx->tracking_conn);
+    if (next_ms != 0) {
+        ArmReconnectTimer(thread_ctx, next_ms);
+    }
+
+    // 被重试的请求, 此时它们原先所在的连接已经不可用.
+    thread_ctx->DispatchParked();
+    return ;
+}
+
+/* 连接建立失败时, hiredis 在调用该回调之后释放 hiredis_async_ctx, 并且不会调用 disconnect callback, 因此在这里
+ * 按照连接断开处理, 否则 conn_ctx->hiredis_async_ctx 将指向已经释放的内存.
+ */
+void OnRedisConnect(const struct redisAsyncContext *hiredis_async_ctx, int status) noexcept {
+    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)hiredis_async_ctx->data;
+    if (conn_ctx->hiredis_async_ctx != hiredis_async_ctx) {
+        return ;
+    }
+
+    if (status != REDIS_OK) {
+        AddCounter(conn_ctx->thread_stats->connect_fail_num, 1);
+        conn_ctx->connect_failed = true;
+        conn_ctx->on_disconnect(hiredis_async_ctx, status);
+        return ;
+    }
+
+    bool need_auth = !conn_ctx->thread_ctx->client->passwd.empty();
+    conn_ctx->SetState(need_auth ? AsyncRedisClient::ConnState::kAuthenticating : AsyncRedisClient::ConnState::kReady);
+    return ;
+}
+
+/* 密码错误: redis 6.0 及以上返回 WRONGPASS, 之前的版本返回 "ERR invalid password". 重试不会改变结果.
+ */
+bool IsWrongPassword(const redisReply *reply) noexcept {
+    static const char kWrongPass[] = "WRONGPASS";
+    static const char kInvalidPassword[] = "invalid password";
+    if (!reply->str) {
+        return false;
+    }
+    if (reply->len >= sizeof(kWrongPass) - 1 && strncmp(reply->str, kWrongPass, sizeof(kWrongPass) - 1) == 0) {
+        return true;
+    }
+    size_t len = sizeof(kInvalidPassword) - 1;
+    for (size_t idx = 0; idx + len <= reply->len; ++idx) {
+        if (strncasecmp(reply->str + idx, kInvalidPassword, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* AUTH 的响应. 密码错误时连接不会再重新连接, 否则每个连接都会不停地重连. 其他错误, 比如 LOADING, 或者连接数
+ * 超出 maxclients, 可能只是暂时的, 此时按照连接建立失败处理, 由 OnRedisDisconnect() 退避之后重新连接.
+ */
+void OnRedisAuth(redisAsyncContext *ac, void *reply, void *privdata) noexcept {
+    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)privdata;
+    const redisReply *redis_reply = (const redisReply*)reply;
+    if (!redis_reply || ac != conn_ctx->hiredis_async_ctx) { // 连接已经断开.
+        return ;
+    }
+
+    if (redis_reply->type != REDIS_REPLY_ERROR) {
+        conn_ctx->SetState(AsyncRedisClient::ConnState::kReady);
+        return ;
+    }
+    if (IsWrongPassword(redis_reply)) {
+        conn_ctx->SetAuthFailed(redis_reply);
+    } else {
+        AddCounter(conn_ctx->thread_stats->connect_fail_num, 1);
+        conn_ctx->connect_failed = true;
+    }
+    redisAsyncDisconnect(ac);
+    return ;
+}
+
+redisAsyncContext* ConnectRedis(/* const */ RedisConnectionContext *conn_ctx,
+                                redisDisconnectCallback *on_disconnect = OnRedisDisconnect) noexcept {
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+    AsyncRedisClient *client = thread_ctx->client;
+
+    const std::string &host = conn_ctx->node ? conn_ctx->node->host : client->host;
+    in_port_t port = conn_ctx->node ? conn_ctx->node->port : client->port;
+    redisAsyncContext *ac = redisAsyncConnect(host.c_str(), port);
+    if (!ac) {
+        return nullptr;
+    }
+
+    // 注意对 ac 调用 redisAsyncFree();
+    if (ac->err != 0) {
+        redisAsyncFree(ac);
+        return nullptr;
+    }
+
+    if (redisLibuvAttach(ac, &thread_ctx->uv_loop) != REDIS_OK) {
+        redisAsyncFree(ac);
+        return nullptr;
+    }
+
+    if (client->use_reply_arena) {
+        ac->c.reader->fn = ReplyArena::GetObjectFunctions();
+    }
+
+    if (!client->passwd.empty()) {
+        int hiredis_rc = redisAsyncCommand(ac, OnRedisAuth, conn_ctx, "AUTH %b",
+                          client->passwd.data(),
+                          static_cast<size_t>(client->passwd.size()));
+        if (hiredis_rc != REDIS_OK) {
+            redisAsyncFree(ac);
+            return nullptr;
+        }
+    }
+
+    ac->data = conn_ctx;
+    if (redisAsyncSetDisconnectCallback(ac, on_disconnect) != REDIS_OK ||
+        redisAsyncSetConnectCallback(ac, OnRedisConnect) != REDIS_OK) { // unreachable
+        throw std::runtime_error("redisAsyncSetDisconnectCallback FAILED");
+    }
+    conn_ctx->on_disconnect = on_disconnect;
+    conn_ctx->SetState(AsyncRedisClient::ConnState::kConnecting);
+    return ac;
+}
+
+redisAsyncContext* GetHIRedisAsyncCtx(RedisConnectionContext *conn_ctx) noexcept {
+    redisAsyncContext *ac = ConnectRedis(conn_ctx);
+    if (!ac) {
+        AddCounter(conn_ctx->thread_stats->connect_fail_num, 1);
+        conn_ctx->connect_failed = true;
+        conn_ctx->SetState(AsyncRedisClient::ConnState::kDisconnected);
+        ScheduleReconnect(conn_ctx);
+    }
+    return ac;
+}
+
+void OnRedisDisconnect(const struct redisAsyncContext *hiredis_async_ctx, int /* status */) noexcept {
+    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)hiredis_async_ctx->data;
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+
+    // 服务端不再跟踪该连接读取过的 key, 无法确定哪些缓存的响应已经失效.
+    if (conn_ctx->tracking) {
+        conn_ctx->tracking = false;
+        thread_ctx->work_thread->near_cache->Clear();
+    }
+
+    bool auth_failed = conn_ctx->state == AsyncRedisClient::ConnState::kAuthFailed;
+    if (!auth_failed) {
+        // 在就绪之前断开视为连接失败, 参见 reconnect_min_delay_ms.
+        if (conn_ctx->state != AsyncRedisClient::ConnState::kReady) {
+            conn_ctx->connect_failed = true;
+        }
+        conn_ctx->SetState(AsyncRedisClient::ConnState::kDisconnected);
+    }
+    conn_ctx->hiredis_async_ctx = nullptr;
+    if (thread_ctx->no_new_request || (conn_ctx->node && conn_ctx->node->retired) || auth_failed) {
+        MaybeCloseDeadlineTimer(thread_ctx);
+        return ;
+    }
+
+    ScheduleReconnect(conn_ctx);
+    return ;
+}
+
+inline bool IsReplyString(const redisReply *reply, const char *str, size_t len) noexcept {
+    return reply->type == REDIS_REPLY_STRING && reply->len == len && strncasecmp(reply->str, str, len) == 0;
+}
+
+void OnTrackingEnabled(redisAsyncContext *ac, void *reply, void *privdata) noexcept {
+    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)privdata;
+    const redisReply *redis_reply = (const redisReply*)reply;
+    if (!redis_reply || redis_reply->type != REDIS_REPLY_ERROR || ac != conn_ctx->hiredis_async_ctx) {
+        return ;
+    }
+
+    // 比如 redis 版本低于 6.0. 在此之前填充的响应可能不会收到失效消息.
+    conn_ctx->tracking = false;
+    conn_ctx->thread_ctx->work_thread->near_cache->Clear();
+    return ;
+}
+
+/* 在 conn_ctx 上开启 CLIENT TRACKING, 失效消息重定向到 tracking_conn. 先 OFF 再 ON, 使得 tracking_conn 重连之后
+ * 可以更换 REDIRECT 的目标, BCAST 模式下也不会因为 PREFIX 重复而失败.
+ *
+ * redis 按序处理同一个连接上的请求, 因此不需要等待响应: 此后在该连接上发送的读请求都会被跟踪.
+ */
+void EnableTracking(RedisConnectionContext *conn_ctx) noexcept {
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+    AsyncRedisClient *client = thread_ctx->client;
+    redisAsyncContext *ac = conn_ctx->hiredis_async_ctx;
+    if (!thread_ctx->tracking_subscribed || !ac) {
+        return ;
+    }
+
+    try {
+        std::vector<std::string> cmd{"CLIENT", "TRACKING", "ON", "REDIRECT",
+                                     std::to_string(thread_ctx->tracking_client_id)};
+        if (client->near_cache_bcast) {
+            cmd.emplace_back("BCAST");
+            for (const std::string &prefix : client->near_cache_prefixes) {
+                cmd.emplace_back("PREFIX");
+                cmd.emplace_back(prefix);
+            }
+        }
+        if (redisAsyncCommand(ac, nullptr, nullptr, "CLIENT TRACKING OFF") != REDIS_OK ||
+            RedisAsyncCommandArgv(ac, OnTrackingEnabled, conn_ctx, cmd) != REDIS_OK) {
+            return ;
+        }
+    } catch (...) {
+        return ;
+    }
+    conn_ctx->tracking = true;
+    return ;
+}
+
+// tracking_conn 断开之后, 数据连接上的失效消息无处投递, 因此全部视为未开启 CLIENT TRACKING.
+void DisableTracking(WorkThreadContext *thread_ctx) noexcept {
+    thread_ctx->tracking_client_id = 0;
+    thread_ctx->tracking_subscribed = false;
+    thread_ctx->ForEachConn([] (RedisConnectionContext &conn_ctx) noexcept {
+        conn_ctx.tracking = false;
+    });
+    thread_ctx->work_thread->near_cache->Clear();
+    return ;
+}
+
+void OnTrackingClientId(redisAsyncContext *ac, void *reply, void *privdata) noexcept {
+    WorkThreadContext *thread_ctx = (WorkThreadContext*)privdata;
+    const redisReply *redis_reply = (const redisReply*)reply;
+    if (redis_reply && redis_reply->type == REDIS_REPLY_INTEGER && ac == thread_ctx->tracking_conn.hiredis_async_ctx) {
+        thread_ctx->tracking_client_id = redis_reply->integer;
+    }
+    return ;
+}
+
+/* SUBSCRIBE __redis__:invalidate 的回调, 对于订阅成功以及之后的每条消息都会调用一次.
+ *
+ * 订阅成功之后才在数据连接上开启 CLIENT TRACKING, 否则 redis 会丢弃在此之前产生的失效消息. 失效消息的内容为
+ * key 数组, 为 nil 时表明 FLUSHALL, FLUSHDB, 此时清空缓存.
+ */
+void OnInvalidate(redisAsyncContext *ac, void *reply, void *privdata) noexcept {
+    WorkThreadContext *thread_ctx = (WorkThreadContext*)privdata;
+    const redisReply *redis_reply = (const redisReply*)reply;
+    if (!redis_reply || redis_reply->type != REDIS_REPLY_ARRAY || redis_reply->elements < 3 ||
+        ac != thread_ctx->tracking_conn.hiredis_async_ctx) {
+        return ;
+    }
+
+    const redisReply *kind = redis_reply->element[0];
+    if (IsReplyString(kind, "subscribe", 9)) {
+        if (thread_ctx->tracking_client_id != 0) {
+            thread_ctx->tracking_subscribed = true;
+            thread_ctx->ForEachConn([] (RedisConnectionContext &conn_ctx) noexcept {
+                EnableTracking(&conn_ctx);
+            });
+        }
+        return ;
+    }
+    if (!IsReplyString(kind, "message", 7)) {
+        return ;
+    }
+
+    NearCache *near_cache = thread_ctx->work_thread->near_cache.get();
+    const redisReply *keys = redis_reply->element[2];
+    if (keys->type == REDIS_REPLY_ARRAY) {
+        for (size_t idx = 0; idx < keys->elements; ++idx) {
+            if (keys->element[idx]->type == REDIS_REPLY_STRING) {
+                near_cache->Invalidate(keys->element[idx]->str, keys->element[idx]->len);
+            }
+        }
+    } else if (keys->type == REDIS_REPLY_STRING) {
+        near_cache->Invalidate(keys->str, keys->len);
+    } else {
+        near_cache->Clear();
+    }
+    return ;
+}
+
+void OnTrackingDisconnect(const struct redisAsyncContext *hiredis_async_ctx, int /* status */) noexcept;
+
+/* 建立 tracking_conn, 依次发送 CLIENT ID, SUBSCRIBE. 失败时 tracking_conn 保持不可用, 此时 near cache 不会被
+ * 填充.
+ */
+void ConnectTracking(WorkThreadContext *thread_ctx) noexcept {
+    RedisConnectionContext *conn_ctx = &thread_ctx->tracking_conn;
+    redisAsyncContext *ac = ConnectRedis(conn_ctx, OnTrackingDisconnect);
+    if (!ac) {
+        AddCounter(conn_ctx->thread_stats->connect_fail_num, 1);
+        conn_ctx->connect_failed = true;
+        ScheduleReconnect(conn_ctx);
+        return ;
+    }
+
+    if (redisAsyncCommand(ac, OnTrackingClientId, thread_ctx, "CLIENT ID") != REDIS_OK ||
+        redisAsyncCommand(ac, OnInvalidate, thread_ctx, "SUBSCRIBE __redis__:invalidate") != REDIS_OK) {
+        redisAsyncFree(ac); // 此时 hiredis_async_ctx 仍为 nullptr, OnTrackingDisconnect() 会忽略这次断开.
+        AddCounter(conn_ctx->thread_stats->connect_fail_num, 1);
+        conn_ctx->connect_failed = true;
+        conn_ctx->SetState(AsyncRedisClient::ConnState::kDisconnected);
+        ScheduleReconnect(conn_ctx);
+        return ;
+    }
+    conn_ctx->hiredis_async_ctx = ac;
+    return ;
+}
+
+void OnTrackingDisconnect(const struct redisAsyncContext *hiredis_async_ctx, int /* status */) noexcept {
+    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)hiredis_async_ctx->data;
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+    if (conn_ctx->hiredis_async_ctx != hiredis_async_ctx) {
+        return ;
+    }
+
+    conn_ctx->hiredis_async_ctx = nullptr;
+    DisableTracking(thread_ctx);
+    if (thread_ctx->no_new_request || conn_ctx->state == AsyncRedisClient::ConnState::kAuthFailed) {
+        return ;
+    }
+    if (conn_ctx->state != AsyncRedisClient::ConnState::kReady) {
+        conn_ctx->connect_failed = true;
+    }
+    conn_ctx->SetState(AsyncRedisClient::ConnState::kDisconnected);
+    ScheduleReconnect(conn_ctx);
+    return ;
+}
+
+// 在 no_new_request 之后调用.
+void CloseTracking(WorkThreadContext *thread_ctx) noexcept {
+    redisAsyncContext *ac = thread_ctx->tracking_conn.hiredis_async_ctx;
+    if (!ac) {
+        return ;
+    }
+    redisAsyncFree(ac);
+    thread_ctx->tracking_conn.hiredis_async_ctx = nullptr;
+    thread_ctx->tracking_conn.SetState(AsyncRedisClient::ConnState::kDisconnected);
+    DisableTracking(thread_ctx);
+    return ;
+}
+
+/// 参见实现
+uv_async_t* GetAsyncHandle(uv_loop_t *loop, uv_async_cb async_cb) noexcept {
+    uv_async_t *handle = static_cast<uv_async_t*>(malloc(sizeof(uv_async_t)));
+    if (handle == nullptr)
+        return nullptr;
+
+    int uv_rc = uv_async_init(loop, handle, async_cb);
+    if (uv_rc < 0) {
+        free(handle);
+        return nullptr;
+    }
+
+    return handle;
+}
+
+void OnAsyncHandleClose(uv_handle_t* handle) noexcept {
+    free(handle);
+    return ;
+}
+
+void CloseAsyncHandle(uv_async_t *handle) noexcept {
+    uv_close((uv_handle_t*)handle, OnAsyncHandleClose);
+    return ;
+}
+
+void OnDeadlineTimer(uv_timer_t *timer) noexcept;
+void EraseCoalesceLeader(WorkThreadContext *thread_ctx, AsyncRedisClient::RedisRequest *request) noexcept;
+void DeferTimeOut(WorkThreadContext *thread_ctx, AsyncRedisClient::RedisRequest *request) noexcept;
+
+// 使 deadline_timer 不晚于 expire_ms 触发.
+void ArmDeadlineTimer(WorkThreadContext *thread_ctx, uint64_t expire_ms) noexcept {
+    if (expire_ms == 0 || thread_ctx->deadline_timer_closed) {
+        return ;
+    }
+    if (thread_ctx->armed_expire_ms != 0 && thread_ctx->armed_expire_ms <= expire_ms) {
+        return ;
+    }
+
+    uint64_t now_ms = GetMonotonicMs();
+    uv_timer_start(&thread_ctx->deadline_timer, OnDeadlineTimer, expire_ms > now_ms ? expire_ms - now_ms : 0, 0);
+    thread_ctx->armed_expire_ms = expire_ms;
+    return ;
+}
+
+void OnDeadlineTimer(uv_timer_t *timer) noexcept {
+    WorkThreadContext *thread_ctx = (WorkThreadContext*)timer->data;
+    thread_ctx->armed_expire_ms = 0;
+
+    thread_ctx->timer_wheel.Advance(GetMonotonicMs(), [thread_ctx] (TimerWheelNode *node) noexcept {
+        AsyncRedisClient::RedisRequest *request = static_cast<AsyncRedisClient::RedisRequest*>(node->data);
+        // 之后相同的请求不再等待已经超时的 leader. 已有的 followers 仍然在 leader 收到响应时回调.
+        EraseCoalesceLeader(thread_ctx, request);
+        DeferTimeOut(thread_ctx, request);
+        request->TimeOut();
+        AddCounter(thread_ctx->work_thread->stats->timeout_num, 1);
+    });
+    ArmDeadlineTimer(thread_ctx, thread_ctx->timer_wheel.GetNextExpireMs());
+    return ;
+}
+
+void ScheduleDeadline(WorkThreadContext *thread_ctx, AsyncRedisClient::RedisRequest *request) noexcept {
+    request->timer_node.data = request;
+    thread_ctx->timer_wheel.Schedule(&request->timer_node, request->deadline_ms);
+    ArmDeadlineTimer(thread_ctx, request->deadline_ms);
+    return ;
+}
+
+// 将 request 暂存在 parked_requests 中. 若成功, 则返回 true, 此时 request 为空; 等待期间其截止时间仍然有效.
+bool HoldRequest(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request) noexcept {
+    try {
+        thread_ctx->parked_requests.push_back(std::move(request));
+    } catch (...) {
+        return false;
+    }
+    AsyncRedisClient::RedisRequest *req = thread_ctx->parked_requests.back().get();
+    req->parked = true;
+    if (req->deadline_ms != 0) {
+        ScheduleDeadline(thread_ctx, req);
+    }
+    return true;
+}
+
+/* 若 conn_ctxs 中有正在建立的连接, 则将 request 暂存在 parked_requests 中直至连接状态发生变化, 并返回 true, 此时
+ * request 为空.
+ */
+bool ParkRequest(WorkThreadContext *thread_ctx, std::vector<RedisConnectionContext> &conn_ctxs,
+                 AsyncRedisClient::request_ptr_t &request) noexcept {
+    if (!thread_ctx->wait_ready) {
+        return false;
+    }
+    bool has_pending = false;
+    for (const RedisConnectionContext &conn_ctx : conn_ctxs) {
+        has_pending = has_pending || conn_ctx.IsPending();
+    }
+    if (!has_pending || !HoldRequest(thread_ctx, request)) {
+        return false;
+    }
+    AddCounter(thread_ctx->work_thread->stats->parked_num, 1);
+    return true;
+}
+
+inline bool IsIdempotent(const AsyncRedisClient *client, const std::vector<std::string> &cmd) noexcept {
+    if (cmd.empty()) {
+        return false;
+    }
+    for (const std::string &name : client->idempotent_commands) {
+        if (name.size() == cmd[0].size() && strncasecmp(name.data(), cmd[0].data(), name.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 在 request 因为连接断开而以 nullptr 结束时调用. 若 request 是幂等的并且还可以重试, 则将其暂存在
+ * parked_requests 中, 由 reconnect_timer 在下一轮事件循环中重新分发, 并返回 true, 此时 request 为空.
+ *
+ * 合并而成的 MGET, HMGET 与 coalesce_reads 的 leader 连同其 followers 一起重试. leader 不再登记在
+ * coalesce_leaders 中, 之后相同的请求各自发送.
+ */
+bool RetryRequest(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request) noexcept {
+    AsyncRedisClient *client = thread_ctx->client;
+    AsyncRedisClient::RedisRequest *req = request.get();
+    if (thread_ctx->no_new_request || req->retry_num >= client->max_retry_num || req->batch ||
+        !req->frame.empty() || !IsIdempotent(client, req->cmd)) {
+        return false;
+    }
+
+    EraseCoalesceLeader(thread_ctx, req);
+    if (!HoldRequest(thread_ctx, request)) {
+        return false;
+    }
+    ++req->retry_num;
+    req->conn = nullptr;
+    AddCounter(thread_ctx->work_thread->stats->retry_num, 1);
+    ArmReconnectTimer(thread_ctx, GetMonotonicMs());
+    return true;
+}
+
+// 若 work thread 上已经有相同的请求在等待响应, 则将 request 挂在其 followers 上并返回 true, 此时 request 为空.
+bool AttachCoalesced(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request) noexcept {
+    auto iter = thread_ctx->coalesce_leaders.find(request->coalesce_key);
+    if (iter == thread_ctx->coalesce_leaders.end()) {
+        return false;
+    }
+
+    AsyncRedisClient::RedisRequest *leader = iter->second;
+    if (request->deadline_ms != 0) {
+        ScheduleDeadline(thread_ctx, request.get());
+    }
+    request->next = leader->followers;
+    leader->followers = request.release();
+    AddCounter(thread_ctx->work_thread->stats->coalesced_num, 1);
+    return true;
+}
+
+// 在 request 发送成功之后调用. 内存不足时 request 只是不会被合并.
+void AddCoalesceLeader(WorkThreadContext *thread_ctx, AsyncRedisClient::RedisRequest *request) noexcept {
+    try {
+        request->coalesce_leader = thread_ctx->coalesce_leaders.emplace(request->coalesce_key, request).second;
+    } catch (...) {
+    }
+    return ;
+}
+
+void EraseCoalesceLeader(WorkThreadContext *thread_ctx, AsyncRedisClient::RedisRequest *request) noexcept {
+    if (!request->coalesce_leader) {
+        return ;
+    }
+    request->coalesce_leader = false;
+    auto iter = thread_ctx->coalesce_leaders.find(request->coalesce_key);
+    if (iter != thread_ctx->coalesce_leaders.end() && iter->second == request) {
+        thread_ctx->coalesce_leaders.erase(iter);
+    }
+    return ;
+}
+
+void OnCompletionCheck(uv_check_t *check) noexcept;
+
+/* 若启用了 callback_executor, 则取得 reply 的所有权, 并将 request 暂存在 completions 中, 在本轮事件循环的末尾交给
+ * executor, 返回 true, 此时 request 为空. 否则, 或者取得 reply 的所有权失败时返回 false, 此时 request 保持不变,
+ * 由调用者在 work thread 中回调.
+ */
+bool DeferCallback(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request,
+                   redisReply *reply) noexcept {
+    if (thread_ctx->completion_check_closed || request->inline_callback || request->batch || !request->callback) {
+        return false;
+    }
+    if (reply) {
+        request->deferred_reply = AsyncRedisClient::TakeReply(reply);
+        if (!request->deferred_reply) {
+            return false;
+        }
+    }
+
+    AsyncRedisClient::RedisRequest *req = request.release();
+    if (thread_ctx->completions_tail) {
+        thread_ctx->completions_tail->next = req;
+    } else {
+        thread_ctx->completions = req;
+        uv_check_start(&thread_ctx->completion_check, OnCompletionCheck);
+    }
+    thread_ctx->completions_tail = req;
+    ++thread_ctx->completion_num;
+    return true;
+}
+
+/* 在 TimeOut() 之前调用. request 仍由 hiredis 持有, 因此将其回调移到一个新的请求对象中交给 executor. 失败时
+ * 什么也不做, 此时由 TimeOut() 在 work thread 中回调.
+ */
+void DeferTimeOut(WorkThreadContext *thread_ctx, AsyncRedisClient::RedisRequest *request) noexcept {
+    if (thread_ctx->completion_check_closed || request->inline_callback || request->batch || !request->callback) {
+        return ;
+    }
+    AsyncRedisClient::request_ptr_t carrier;
+    try {
+        carrier.reset(ObjectPool<AsyncRedisClient::RedisRequest>::Get());
+    } catch (...) {
+        return ;
+    }
+    carrier->callback = std::move(request->callback);
+    request->callback = nullptr;
+    DeferCallback(thread_ctx, carrier, nullptr);
+    return ;
+}
+
+void FlushCompletions(WorkThreadContext *thread_ctx) noexcept {
+    if (!thread_ctx->completions) {
+        return ;
+    }
+    AsyncRedisClient::CompletionBatch batch(thread_ctx->client, thread_ctx->idx,
+                                            thread_ctx->completions, thread_ctx->completion_num);
+    AddCounter(thread_ctx->work_thread->stats->deferred_num, thread_ctx->completion_num);
+    AddCounter(thread_ctx->work_thread->stats->deferred_batch_num, 1);
+    thread_ctx->completions = nullptr;
+    thread_ctx->completions_tail = nullptr;
+    thread_ctx->completion_num = 0;
+    uv_check_stop(&thread_ctx->completion_check);
+    thread_ctx->callback_executor->Post(std::move(batch));
+    return ;
+}
+
+// 在每一轮事件循环的 I/O 之后执行.
+void OnCompletionCheck(uv_check_t *check) noexcept {
+    FlushCompletions((WorkThreadContext*)check->data);
+    return ;
+}
+
+// 以 nullptr 结束 request, 之后 request 为空.
+void FailRequest(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request) noexcept {
+    if (!DeferCallback(thread_ctx, request, nullptr)) {
+        request->Fail();
+        request.reset();
+    }
+    return ;
+}
+
+/* 以 reply 创建 SharedReply 并取得其所有权, 参见 SharedReply::Adopt(). 内存不足时返回 nullptr, 此时 reply
+ * 保持不变.
+ */
+SharedReply* CreateSharedReply(redisReply *reply, bool split) noexcept {
+    std::unique_ptr<SharedReply> shared(SharedReply::New(split ? reply->elements : 1));
+    if (!shared) {
+        return nullptr;
+    }
+    AsyncRedisClient::redisReply_unique_ptr_t owner = AsyncRedisClient::TakeReply(reply);
+    if (!owner) {
+        return nullptr;
+    }
+    shared->Adopt(std::move(owner), split);
+    return shared.release();
+}
+
+// 正在回调的共享响应, 供 TakeReply() 识别.
+thread_local SharedReply *tls_shared_reply = nullptr;
+
+// CompletionBatch::Run() 中正在回调的请求的 deferred_reply, 供 TakeReply() 识别.
+thread_local AsyncRedisClient::redisReply_unique_ptr_t *tls_deferred_reply = nullptr;
+
+/* 以 reply 回调 request 以及其所有 followers, 并释放 followers. reply 为 nullptr 表示失败. 已经超时的请求不再
+ * 回调.
+ *
+ * - coalesce_reads, 所有请求共享 reply. 内存不足以构建 SharedReply 时, 只有 request 能够得到 reply, followers
+ *   以 nullptr 回调.
+ * - merge_reads, request 本身没有回调, 第 i 个 follower 以 reply 的第 i 个元素回调; reply 为错误时所有 followers
+ *   共享该错误, 其他不符合预期的 reply 以及内存不足时以 nullptr 回调.
+ */
+void CompleteFollowers(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request,
+                       redisReply *reply) noexcept {
+    bool merged = request->merged_num != 0;
+    bool split = merged && reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == request->merged_num;
+    SharedReply *shared = nullptr;
+    if (reply && (!merged || split || reply->type == REDIS_REPLY_ERROR)) {
+        shared = CreateSharedReply(reply, split);
+    }
+    SharedReply *outer_shared = tls_shared_reply; // 回调中可能再次进入, 比如发送失败时 redisAsyncFree().
+    if (shared) {
+        tls_shared_reply = shared;
+    }
+
+    AsyncRedisClient::RedisRequest *followers = request->followers;
+    request->followers = nullptr;
+    if (!merged) {
+        redisReply *leader_reply = shared ? &shared->parts[0].root : reply;
+        if (!DeferCallback(thread_ctx, request, leader_reply)) {
+            request->Success(leader_reply);
+        }
+    }
+
+    for (size_t idx = 0; followers; ++idx) {
+        AsyncRedisClient::request_ptr_t follower(followers);
+        followers = followers->next;
+        follower->next = nullptr;
+        if (follower->timed_out) {
+            continue;
+        }
+        thread_ctx->timer_wheel.Cancel(&follower->timer_node);
+        redisReply *follower_reply = shared ? &shared->parts[split ? idx : 0].root : nullptr;
+        if (!follower_reply) {
+            AddCounter(thread_ctx->work_thread->stats->failed_num, 1);
+        }
+        if (!DeferCallback(thread_ctx, follower, follower_reply)) {
+            follower->Success(follower_reply);
+        }
+    }
+
+    if (shared) {
+        tls_shared_reply = outer_shared;
+        SharedReply::Release(&shared->parts[0].root);
+    }
+    return ;
+}
+
+// 立即以 nullptr 结束 request, 之后 request 为空.
+void FailRequestNow(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request) noexcept {
+    if (request->followers) { // 合并而成的 MGET, HMGET.
+        CompleteFollowers(thread_ctx, request, nullptr);
+        request.reset();
+    } else {
+        FailRequest(thread_ctx, request);
+    }
+    return ;
+}
+
+void OnFailureIdle(uv_idle_t *idle) noexcept;
+
+/* 在下一轮事件循环中以 nullptr 结束 request, 之后 request 为空. 参见 WorkThreadContext::failed_requests.
+ * failure_idle 已经关闭, 或者内存不足时立即结束.
+ */
+void DeferFailure(WorkThreadContext *thread_ctx, AsyncRedisClient::request_ptr_t &request) noexcept {
+    if (!thread_ctx->failure_idle_closed) {
+        try {
+            thread_ctx->failed_requests.push_back(std::move(request));
+            if (thread_ctx->failed_requests.size() == 1) {
+                uv_idle_start(&thread_ctx->failure_idle, OnFailureIdle);
+            }
+            return ;
+        } catch (...) {}
+    }
+    FailRequestNow(thread_ctx, request);
+    return ;
+}
+
+// 回调中新失败的请求进入新的 failed_requests, 在再下一轮事件循环中处理.
+void FlushFailures(WorkThreadContext *thread_ctx) noexcept {
+    std::vector<AsyncRedisClient::request_ptr_t> failed_requests;
+    failed_requests.swap(thread_ctx->failed_requests);
+    uv_idle_stop(&thread_ctx->failure_idle);
+    for (AsyncRedisClient::request_ptr_t &request : failed_requests) {
+        FailRequestNow(thread_ctx, request);
+    }
+    return ;
+}
+
+void OnFailureIdle(uv_idle_t *idle) noexcept {
+    FlushFailures((WorkThreadContext*)idle->data);
+    return ;
+}
+
+void MaybeCloseDeadlineTimer(WorkThreadContext *thread_ctx) noexcept {
+    if (!thread_ctx->no_new_request || thread_ctx->deadline_timer_closed) {
+        return ;
+    }
+
+    bool has_conn = false;
+    thread_ctx->ForEachConn([&] (RedisConnectionContext &conn_ctx) noexcept {
+        has_conn = has_conn || conn_ctx.hiredis_async_ctx;
+    });
+    if (has_conn) {
+        return ;
+    }
+
+    thread_ctx->deadline_timer_closed = true;
+    uv_close((uv_handle_t*)&thread_ctx->deadline_timer, nullptr);
+    thread_ctx->reconnect_timer_closed = true;
+    uv_close((uv_handle_t*)&thread_ctx->reconnect_timer, nullptr);
+
+    // no_new_request 之后回调中不会再产生新的失败请求. 失败的回调可能被交给 callback_executor, 因此先于
+    // completion_check 处理.
+    FlushFailures(thread_ctx);
+    thread_ctx->failure_idle_closed = true;
+    uv_close((uv_handle_t*)&thread_ctx->failure_idle, nullptr);
+
+    // 此时已经不会再有请求完成.
+    if (!thread_ctx->completion_check_closed) {
+        FlushCompletions(thread_ctx);
+        thread_ctx->completion_check_closed = true;
+        uv_close((uv_handle_t*)&thread_ctx->completion_check, nullptr);
+    }
+    return ;
+}
+
+size_t GetDigitNum(long long val) noexcept {
+    unsigned long long abs_val = val < 0 ? 0ULL - val : val;
+    size_t num = val < 0 ? 2 : 1;
+    while (abs_val >= 10) {
+        abs_val /= 10;
+        ++num;
+    }
+    return num;
+}
+
+// 请求按照 RESP 编码之后的长度.
+size_t GetRequestBytes(const AsyncRedisClient::RedisRequest *request) noexcept {
+    return request->frame.empty() ? RespEncoder::GetEncodedSize(request->cmd) : request->frame.size();
+}
+
+/* reply 按照 RESP 编码的长度, 用于统计读取的字节数. 对于数组需要遍历所有元素, RESP3 的类型按照 RESP2 中对应的
+ * 类型估算.
+ */
+uint64_t GetReplySize(const redisReply *reply) noexcept {
+    switch (reply->type) {
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_ERROR:
+        return 1 + reply->len + 2;
+    case REDIS_REPLY_INTEGER:
+        return 1 + GetDigitNum(reply->integer) + 2;
+    case REDIS_REPLY_NIL:
+        return 5; // $-1\r\n
+    case REDIS_REPLY_ARRAY:
+#ifdef REDIS_REPLY_MAP
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH:
+#endif
+    {
+        uint64_t size = 1 + GetDigitNum(reply->elements) + 2;
+        for (size_t idx = 0; idx < reply->elements; ++idx) {
+            size += GetReplySize(reply->element[idx]);
+        }
+        return size;
+    }
+    default: // bulk string
+        return 1 + GetDigitNum(reply->len) + 2 + reply->len + 2;
+    }
+}
+
+void RecordCommandLatency(WorkThreadContext *thread_ctx, const AsyncRedisClient::RedisRequest *request,
+                          uint64_t reply_tsc, uint64_t done_tsc) noexcept {
+    CommandLatencyTable *table = thread_ctx->work_thread->command_latency.get();
+    if (!table || request->dequeue_tsc == 0) {
+        return ;
+    }
+
+    const char *name;
+    size_t len;
+    if (!request->frame.empty()) {
+        if (!request->frame.GetArg(0, &name, &len)) {
+            return ;
+        }
+    } else if (!request->cmd.empty()) {
+        name = request->cmd[0].data();
+        len = request->cmd[0].size();
+    } else {
+        return ;
+    }
+
+    CommandLatencyTable::Entry *entry = table->GetEntry(name, len);
+    if (!entry) {
+        return ;
+    }
+
+    // TSC 在各个核之间同步, 但 submit_tsc 由其他线程记录, 仍然避免出现负值.
+    auto Elapsed = [] (uint64_t begin, uint64_t end) noexcept -> uint64_t {
+        return end > begin ? TscClock::ToNs(end - begin) : 0;
+    };
+    entry->stages[CommandLatencyTable::kQueueWait].Record(Elapsed(request->submit_tsc, request->dequeue_tsc));
+    entry->stages[CommandLatencyTable::kDispatch].Record(Elapsed(request->dequeue_tsc, request->send_tsc));
+    entry->stages[CommandLatencyTable::kRoundTrip].Record(Elapsed(request->send_tsc, reply_tsc));
+    entry->stages[CommandLatencyTable::kCallback].Record(Elapsed(reply_tsc, done_tsc));
+    return ;
+}
+
+const std::string& GetConnHost(const RedisConnectionContext *conn_ctx) noexcept {
+    return conn_ctx->node ? conn_ctx->node->host : conn_ctx->thread_ctx->client->host;
+}
+
+void ConnectClusterNode(ClusterNode *node) noexcept {
+    for (RedisConnectionContext &conn_ctx : node->conn_ctxs) {
+        if (!conn_ctx.hiredis_async_ctx) {
+            conn_ctx.hiredis_async_ctx = GetHIRedisAsyncCtx(&conn_ctx);
+        }
+    }
+    return ;
+}
+
+void RetireClusterNode(ClusterNode *node) noexcept {
+    if (node->retired) {
+        return ;
+    }
+
+    node->retired = true;
+    for (RedisConnectionContext &conn_ctx : node->conn_ctxs) {
+        if (conn_ctx.hiredis_async_ctx) {
+            redisAsyncDisconnect(conn_ctx.hiredis_async_ctx);
+        }
+    }
+    return ;
+}
+
+/* 返回 host:port 对应节点在 cluster_nodes 中的下标, 若节点不存在则创建并建立连接. 若抛出异常, 则
+ * cluster_nodes 保持不变.
+ */
+uint16_t GetClusterNode(WorkThreadContext *thread_ctx, const std::string &host, in_port_t port) {
+    std::vector<std::unique_ptr<ClusterNode>> &nodes = thread_ctx->cluster_nodes;
+    for (size_t idx = 0; idx < nodes.size(); ++idx) {
+        ClusterNode *node = nodes[idx].get();
+        if (node->port != port || node->host != host) {
+            continue;
+        }
+        if (node->retired) {
+            node->retired = false;
+            ConnectClusterNode(node);
+        }
+        return static_cast<uint16_t>(idx);
+    }
+
+    if (nodes.size() >= WorkThreadContext::kNoClusterNode) {
+        throw std::runtime_error("TOO MANY CLUSTER NODES");
+    }
+
+    size_t conn_num = thread_ctx->client->conn_per_thread;
+    std::unique_ptr<ClusterNode> node(new ClusterNode);
+    node->host = host;
+    node->port = port;
+    node->conn_ctxs.resize(conn_num);
+    node->conn_stats.reset(new AsyncRedisClient::ConnStats[conn_num]);
+    for (size_t conn_idx = 0; conn_idx < conn_num; ++conn_idx) {
+        RedisConnectionContext *conn_ctx = &node->conn_ctxs[conn_idx];
+        conn_ctx->idx_in_thread_ctx = conn_idx;
+        conn_ctx->thread_ctx = thread_ctx;
+        conn_ctx->node = node.get();
+        conn_ctx->stats = &node->conn_stats[conn_idx];
+        conn_ctx->thread_stats = thread_ctx->work_thread->stats.get();
+    }
+
+    nodes.push_back(std::move(node));
+    ConnectClusterNode(nodes.back().get());
+    return static_cast<uint16_t>(nodes.size() - 1);
+}
+
+void OnClusterSlots(redisAsyncContext * /* ac */, void *reply, void *privdata) noexcept {
+    RedisConnectionContext *conn_ctx = (RedisConnectionContext*)privdata;
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+
+    thread_ctx->cluster_refreshing = false;
+    if (!reply || thread_ctx->no_new_request) {
+        return ;
+    }
+
+    try {
+        std::vector<ClusterSlotRange> ranges;
+        if (!ParseClusterSlots((redisReply*)reply, &ranges) || ranges.empty()) {
+            return ;
+        }
+
+        std::vector<uint16_t> slot_nodes(kClusterSlotNum, WorkThreadContext::kNoClusterNode);
+        for (const ClusterSlotRange &range : ranges) {
+            const std::string &host = range.host.empty() ? GetConnHost(conn_ctx) : range.host;
+            uint16_t node_idx = GetClusterNode(thread_ctx, host, range.port);
+            std::fill(slot_nodes.begin() + range.begin, slot_nodes.begin() + range.end + 1, node_idx);
+        }
+
+        std::vector<bool> in_use(thread_ctx->cluster_nodes.size(), false);
+        for (uint16_t node_idx : slot_nodes) {
+            if (node_idx != WorkThreadContext::kNoClusterNode) {
+                in_use[node_idx] = true;
+            }
+        }
+
+        thread_ctx->slot_nodes.swap(slot_nodes);
+        for (size_t idx = 0; idx < in_use.size(); ++idx) {
+            if (!in_use[idx]) {
+                RetireClusterNode(thread_ctx->cluster_nodes[idx].get());
+            }
+        }
+    } catch (...) {}
+    return ;
+}
+
+/* 异步地通过 CLUSTER SLOTS 刷新集群拓扑. 同一时刻最多只有一个 CLUSTER SLOTS 请求.
+ *
+ * 随机选择一个节点来执行, 避免所有 work thread 总是询问同一个节点. 尚不知道任何节点时询问 host:port.
+ */
+void RefreshClusterSlots(WorkThreadContext *thread_ctx) noexcept {
+    if (thread_ctx->cluster_refreshing || thread_ctx->no_new_request) {
+        return ;
+    }
+
+    RedisConnectionContext *target = nullptr;
+    auto Find = [&] (std::vector<RedisConnectionContext> &conn_ctxs) noexcept {
+        for (RedisConnectionContext &conn_ctx : conn_ctxs) {
+            if (conn_ctx.hiredis_async_ctx) {
+                target = &conn_ctx;
+                return ;
+            }
+        }
+        return ;
+    };
+
+    std::vector<std::unique_ptr<ClusterNode>> &nodes = thread_ctx->cluster_nodes;
+    if (!nodes.empty()) {
+        size_t begin_idx = thread_ctx->NextRand() % nodes.size();
+        for (size_t step = 0; step < nodes.size() && !target; ++step) {
+            ClusterNode *node = nodes[(begin_idx + step) % nodes.size()].get();
+            if (!node->retired) {
+                Find(node->conn_ctxs);
+            }
+        }
+    }
+    if (!target) {
+        Find(thread_ctx->conn_ctxs);
+    }
+    if (!target) {
+        return ;
+    }
+
+    if (redisAsyncCommand(target->hiredis_async_ctx, OnClusterSlots, target, "CLUSTER SLOTS") == REDIS_OK) {
+        thread_ctx->cluster_refreshing = true;
+        thread_ctx->last_cluster_refresh_ms = GetMonotonicMs();
+    }
+    return ;
+}
+
+void OnClusterRefreshTimer(uv_timer_t *timer) noexcept {
+    RefreshClusterSlots((WorkThreadContext*)timer->data);
+    return ;
+}
+
+void CloseClusterRefreshTimer(WorkThreadContext *thread_ctx) noexcept {
+    if (thread_ctx->cluster_refresh_timer_closed) {
+        return ;
+    }
+    thread_ctx->cluster_refresh_timer_closed = true;
+    uv_close((uv_handle_t*)&thread_ctx->cluster_refresh_timer, nullptr);
+    return ;
+}
+
+// 请求的第 idx 个参数, 参数 0 为命令名.
+bool GetRequestArg(const AsyncRedisClient::RedisRequest *request, size_t idx, const char **arg, size_t *len) noexcept {
+    if (!request->frame.empty()) {
+        return request->frame.GetArg(idx, arg, len);
+    }
+    if (idx >= request->cmd.size()) {
+        return false;
+    }
+    *arg = request->cmd[idx].data();
+    *len = request->cmd[idx].size();
+    return true;
+}
+
+/* 请求的 key 所属的 slot, 参见 AsyncRedisClient::cluster_mode. 若请求没有 key, 则返回 false.
+ */
+bool GetRequestSlot(const AsyncRedisClient::RedisRequest *request, uint16_t *slot) noexcept {
+    const char *name;
+    size_t name_len;
+    if (!GetRequestArg(request, 0, &name, &name_len)) {
+        return false;
+    }
+
+    size_t key_idx = 1;
+    if ((name_len == 4 && strncasecmp(name, "EVAL", 4) == 0) ||
+        (name_len == 7 && strncasecmp(name, "EVALSHA", 7) == 0)) {
+        const char *numkeys;
+        size_t numkeys_len;
+        if (!GetRequestArg(request, 2, &numkeys, &numkeys_len) || (numkeys_len == 1 && numkeys[0] == '0')) {
+            return false;
+        }
+        key_idx = 3;
+    }
+
+    const char *key;
+    size_t key_len;
+    if (!GetRequestArg(request, key_idx, &key, &key_len)) {
+        return false;
+    }
+    *slot = GetClusterHashSlot(key, key_len);
+    return true;
+}
+
+// 负责 request 的集群节点, 若未知则返回 nullptr.
+ClusterNode* GetRequestClusterNode(WorkThreadContext *thread_ctx, const AsyncRedisClient::RedisRequest *request) noexcept {
+    uint16_t slot;
+    if (!GetRequestSlot(request, &slot)) {
+        return nullptr;
+    }
+
+    uint16_t node_idx = thread_ctx->slot_nodes[slot];
+    if (node_idx == WorkThreadContext::kNoClusterNode) {
+        return nullptr;
+    }
+    return thread_ctx->cluster_nodes[node_idx].get();
+}
+
+inline bool IsCommand(const char *name, size_t name_len, const char *command) noexcept {
+    return name_len == strlen(command) && strncasecmp(name, command, name_len) == 0;
+}
+
+// 只读并且响应只取决于参数的命令, 参见 coalesce_reads.
+bool IsReadOnlyCommand(const char *name, size_t name_len) noexcept {
+    static const char *const kCommands[] = {
+        "GET", "MGET", "STRLEN", "GETRANGE", "EXISTS", "TTL", "PTTL", "TYPE",
+        "HGET", "HMGET", "HGETALL", "HKEYS", "HVALS", "HLEN", "HEXISTS",
+        "LRANGE", "LINDEX", "LLEN",
+        "SMEMBERS", "SISMEMBER", "SCARD",
+        "ZRANGE", "ZSCORE", "ZRANK", "ZCARD"
+    };
+    for (const char *command : kCommands) {
+        if (IsCommand(name, name_len, command)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool IsCoalescable(const std::vector<std::string> &cmd) noexcept {
+    return IsReadOnlyCommand(cmd[0].data(), cmd[0].size());
+}
+
+// FNV-1a, 用于将 key 映射到 work thread. 直接基于 key 的内容计算, 不需要构建 std::string.
+inline uint64_t HashKey(const char *key, size_t len) noexcept {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t idx = 0; idx < len; ++idx) {
+        hash ^= static_cast<unsigned char>(key[idx]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 写命令中 key 所在的参数位置.
+enum WrittenKeys : uint8_t {
+    kNotWrite = 0,
+    kFirstKey,      // 第一个参数.
+    kFirstTwoKeys,  // 前两个参数, 如 RENAME.
+    kAllKeys,       // 所有参数, 如 DEL.
+    kKeyValuePairs  // 第 1, 3, 5... 个参数, 如 MSET.
+};
+
+/* 会修改 near cache 中的 string, hash 的写命令, 参见 InvalidateWrittenKeys(). 其他命令, 以及 EVAL, EXEC,
+ * FLUSHALL 等无法由此确定 key 的写入只依赖失效消息.
+ */
+WrittenKeys GetWrittenKeys(const char *name, size_t name_len) noexcept {
+    static const struct {
+        const char *name;
+        WrittenKeys keys;
+    } kCommands[] = {
+        {"SET", kFirstKey}, {"SETNX", kFirstKey}, {"SETEX", kFirstKey}, {"PSETEX", kFirstKey},
+        {"GETSET", kFirstKey}, {"GETDEL", kFirstKey}, {"GETEX", kFirstKey}, {"APPEND", kFirstKey},
+        {"SETRANGE", kFirstKey}, {"INCR", kFirstKey}, {"INCRBY", kFirstKey}, {"INCRBYFLOAT", kFirstKey},
+        {"DECR", kFirstKey}, {"DECRBY", kFirstKey},
+        {"HSET", kFirstKey}, {"HSETNX", kFirstKey}, {"HMSET", kFirstKey}, {"HDEL", kFirstKey},
+        {"HINCRBY", kFirstKey}, {"HINCRBYFLOAT", kFirstKey},
+        {"EXPIRE", kFirstKey}, {"PEXPIRE", kFirstKey}, {"EXPIREAT", kFirstKey}, {"PEXPIREAT", kFirstKey},
+        {"PERSIST", kFirstKey}, {"MOVE", kFirstKey}, {"RESTORE", kFirstKey},
+        {"RENAME", kFirstTwoKeys}, {"RENAMENX", kFirstTwoKeys}, {"COPY", kFirstTwoKeys},
+        {"DEL", kAllKeys}, {"UNLINK", kAllKeys},
+        {"MSET", kKeyValuePairs}, {"MSETNX", kKeyValuePairs}
+    };
+    for (const auto &command : kCommands) {
+        if (IsCommand(name, name_len, command.name)) {
+            return command.keys;
+        }
+    }
+    return kNotWrite;
+}
+
+/* 以各个参数的长度及内容构建 coalesce_key, 复用其已有的内存. 命令名按照大写处理, 使得 get 与 GET 可以合并.
+ * 内存不足时返回 false.
+ */
+bool SetCoalesceKey(AsyncRedisClient::RedisRequest *request) noexcept {
+    std::string &key = request->coalesce_key;
+    key.clear();
+    try {
+        for (const std::string &arg : request->cmd) {
+            key.append(std::to_string(arg.size()));
+            key.push_back(':');
+            key.append(arg);
+        }
+    } catch (...) {
+        return false;
+    }
+    size_t name_begin = key.find(':') + 1;
+    for (size_t idx = name_begin; idx < name_begin + request->cmd[0].size(); ++idx) {
+        key[idx] = toupper(static_cast<unsigned char>(key[idx]));
+    }
+    return true;
+}
+
+inline void SetValueOn(std::promise<void> *p) noexcept {
+    p->set_value();
+    return ;
+}
+
+} // namespace
+
+
+/* 根据 AsyncRedisClient::~AsyncRedisClient() 得知在 AsyncRedisClient 对象被销毁之前已经调用了 Stop()
+ * 或者 Join() 因此在 WorkThreadMain() 运行期间, client 指向的内存始终有效.
+ *
+ * 注意 p 的生命周期.
+ */
+void AsyncRedisClient::WorkThreadMain(AsyncRedisClient *client, size_t idx, std::promise<void> *p) noexcept {
+    /* 在分配任何资源之前绑定, 参见 thread_cpus. 绑定失败时 work thread 照常工作, 只是失去了亲和性, 失败记录在
+     * ThreadStats::bind_fail_num 中.
+     */
+    int bind_rc = 0;
+    if (!client->thread_cpus.empty()) {
+        bind_rc = BindCurrentThread(client->thread_cpus[idx % client->thread_cpus.size()]);
+    }
+
+    WorkThreadContext thread_ctx;
+    thread_ctx.client = client;
+    WorkThread *work_thread = &(*client->work_threads_)[idx];
+    thread_ctx.work_thread = work_thread;
+    thread_ctx.idx = idx;
+    thread_ctx.rand_state += idx;
+
+    ON_SCOPE_EXIT(on_thread_exit_1){
+        if (p) {
+            // 不变量 123: 若 p != nullptr, 则表明尚未对 p 调用过 set_xxx() 系列.
+            SetValueOn(p);
+            p = nullptr;
+        }
+    };
+
+    if (uv_loop_init(&thread_ctx.uv_loop) < 0) {
+        return ;
+    }
+    thread_ctx.uv_loop.data = &thread_ctx;
+    ON_SCOPE_EXIT(on_thread_exit_2){
+        int uv_rc = uv_loop_close(&thread_ctx.uv_loop);
+        if (uv_rc < 0) {
+            THROW(uv_rc, "uv_loop_close ERROR");
+        }
+    };
+
+    uv_async_t *async_handle = GetAsyncHandle(&thread_ctx.uv_loop, AsyncRedisClient::OnAsyncHandle);
+    if (async_handle == nullptr) {
+        return ;
+    }
+    // 此后 async_handle 由 uv_loop 来引用.
+    async_handle->data = &thread_ctx;
+
+    // uv_timer_init() 只是初始化字段, 不会失败.
+    uv_timer_init(&thread_ctx.uv_loop, &thread_ctx.deadline_timer);
+    thread_ctx.deadline_timer.data = &thread_ctx;
+    uv_timer_init(&thread_ctx.uv_loop, &thread_ctx.reconnect_timer);
+    thread_ctx.reconnect_timer.data = &thread_ctx;
+    uv_idle_init(&thread_ctx.uv_loop, &thread_ctx.failure_idle);
+    thread_ctx.failure_idle.data = &thread_ctx;
+
+    bool init_success = true;
+    try {
+        // 所有可能会抛出异常的初始化操作都放在这里进行. 只要确保这其中分配的资源正确释放就行了.
+
+        // 参见 WorkThread::conn_stats 处的注释.
+        work_thread->conn_stats.reset(new ConnStats[client->conn_per_thread]);
+        work_thread->stats.reset(new ThreadStats);
+        if (bind_rc != 0) {
+            AddCounter(work_thread->stats->bind_fail_num, 1);
+        }
+        if (client->collect_command_latency) {
+            work_thread->command_latency.reset(new CommandLatencyTable);
+        }
+        if (client->near_cache_max_bytes > 0) {
+            work_thread->near_cache.reset(
+                new NearCache(std::max<size_t>(client->near_cache_max_bytes / client->thread_num, 1)));
+        }
+
+        thread_ctx.conn_ctxs.resize(client->conn_per_thread);
+        if (client->cluster_mode) {
+            thread_ctx.slot_nodes.assign(kClusterSlotNum, WorkThreadContext::kNoClusterNode);
+        }
+
+        // 整个 for 循环不可能抛出异常.
         for (size_t conn_idx = 0; conn_idx < client->conn_per_thread; ++conn_idx) {
             RedisConnectionContext *conn_ctx = &thread_ctx.conn_ctxs[conn_idx];
 
             conn_ctx->idx_in_thread_ctx = conn_idx;
             conn_ctx->thread_ctx = &thread_ctx;
+            conn_ctx->stats = &work_thread->conn_stats[conn_idx];
+            conn_ctx->thread_stats = work_thread->stats.get();
             conn_ctx->hiredis_async_ctx = GetHIRedisAsyncCtx(conn_ctx);
         }
 
@@ -273,148 +2220,620 @@ void AsyncRedisClient::WorkThreadMain(AsyncRedisClient *client, size_t idx, std:
         };
 #endif
 
-    } catch (...) {
-        init_success = false;
+    } catch (...) {
+        init_success = false;
+    }
+
+    if (init_success) {
+        // request_queue.Open() 使得 async_handle 对压入请求成功的生产者可见.
+        work_thread->async_handle = async_handle;
+        work_thread->request_queue.Open();
+
+        if (client->cluster_mode) {
+            uv_timer_init(&thread_ctx.uv_loop, &thread_ctx.cluster_refresh_timer);
+            thread_ctx.cluster_refresh_timer.data = &thread_ctx;
+            thread_ctx.cluster_refresh_timer_closed = false;
+            if (client->cluster_refresh_interval_ms > 0) {
+                uv_timer_start(&thread_ctx.cluster_refresh_timer, OnClusterRefreshTimer,
+                               client->cluster_refresh_interval_ms, client->cluster_refresh_interval_ms);
+            }
+            RefreshClusterSlots(&thread_ctx);
+        }
+
+        if (client->callback_executor_) {
+            uv_check_init(&thread_ctx.uv_loop, &thread_ctx.completion_check);
+            thread_ctx.completion_check.data = &thread_ctx;
+            thread_ctx.completion_check_closed = false;
+            thread_ctx.callback_executor = client->callback_executor_;
+        }
+
+        if (work_thread->near_cache) {
+            thread_ctx.tracking_conn.thread_ctx = &thread_ctx;
+            thread_ctx.tracking_conn.thread_stats = work_thread->stats.get();
+            ConnectTracking(&thread_ctx);
+        }
+    } else {
+        CloseAsyncHandle(async_handle);
+        thread_ctx.deadline_timer_closed = true;
+        uv_close((uv_handle_t*)&thread_ctx.deadline_timer, nullptr);
+        thread_ctx.reconnect_timer_closed = true;
+        uv_close((uv_handle_t*)&thread_ctx.reconnect_timer, nullptr);
+        thread_ctx.failure_idle_closed = true;
+        uv_close((uv_handle_t*)&thread_ctx.failure_idle, nullptr);
+    }
+
+    SetValueOn(p);
+    p = nullptr;
+
+    if (init_success) {
+        tls_thread_ctx = &thread_ctx;
+    }
+    while (uv_run(&thread_ctx.uv_loop, UV_RUN_DEFAULT)) {
+        ;
+    }
+    tls_thread_ctx = nullptr;
+
+    return ;
+}
+
+/* 失效消息经由 tracking_conn 异步到达, 写请求完成时可能尚未到达, 此时 key 所属的 work thread 仍会以旧值命中.
+ * 因此已知的写命令完成时直接删除其 key 的缓存; 若此时有读请求正在等待响应, 其占位记录也随之删除, 不会以旧值填充.
+ *
+ * 缓存只由所属的 work thread 修改. 单 key 的写请求已经由 RouteByKey() 交给 key 所属的 work thread, 在这里直接
+ * 删除, 使得调用者在回调之后发起的读请求能够读到自己的写入. 其他 key, 比如 DEL, MSET 中的多个 key, 或者以
+ * RespFrame, ExecuteBatch() 提交的写请求, 则按照所属的 work thread 收集起来, 通过其 request_queue 交给它删除,
+ * 此时回调之后的读请求仍可能短暂地读到旧值. 内存不足, 或者所属的 work thread 已经停止时放弃, 只依赖失效消息.
+ */
+void AsyncRedisClient::InvalidateWrittenKeys(WorkThreadContext *thread_ctx, const RedisRequest *request) noexcept {
+    const char *name;
+    size_t name_len;
+    if (!GetRequestArg(request, 0, &name, &name_len)) {
+        return ;
+    }
+    WrittenKeys written_keys = GetWrittenKeys(name, name_len);
+    if (written_keys == kNotWrite) {
+        return ;
+    }
+
+    AsyncRedisClient *client = thread_ctx->client;
+    std::vector<WorkThread> &work_threads = *client->work_threads_;
+    std::vector<request_ptr_t> &invalidations = thread_ctx->invalidations;
+    const char *key;
+    size_t key_len;
+    for (size_t idx = 1; GetRequestArg(request, idx, &key, &key_len); idx += written_keys == kKeyValuePairs ? 2 : 1) {
+        bool cacheable = client->near_cache_prefixes.empty();
+        for (const std::string &prefix : client->near_cache_prefixes) {
+            cacheable = cacheable || (key_len >= prefix.size() && memcmp(key, prefix.data(), prefix.size()) == 0);
+        }
+
+        size_t thread_idx = HashKey(key, key_len) % client->thread_num; // 同 RouteByKey().
+        if (!cacheable) {
+            ;
+        } else if (&work_threads[thread_idx] == thread_ctx->work_thread) {
+            thread_ctx->work_thread->near_cache->Invalidate(key, key_len);
+        } else {
+            try {
+                invalidations.resize(client->thread_num);
+                request_ptr_t &invalidation = invalidations[thread_idx];
+                if (!invalidation) {
+                    invalidation.reset(ObjectPool<RedisRequest>::Get());
+                    invalidation->near_cache_invalidation = true;
+                    invalidation->cmd.clear();
+                }
+                invalidation->cmd.emplace_back(key, key_len);
+            } catch (...) {
+                ;
+            }
+        }
+
+        if (written_keys == kFirstKey || (written_keys == kFirstTwoKeys && idx == 2)) {
+            break;
+        }
+    }
+
+    for (size_t idx = 0; idx < invalidations.size(); ++idx) {
+        if (invalidations[idx]) {
+            work_threads[idx].AddRequest(invalidations[idx]);
+            invalidations[idx].reset(); // request_queue 已经关闭时 AddRequest() 不会取走.
+        }
+    }
+    return ;
+}
+
+void AsyncRedisClient::OnRedisReply(redisAsyncContext * /* ac */, void *reply, void *privdata) noexcept {
+    request_ptr_t redis_request((RedisRequest*)privdata);
+    RedisConnectionContext *conn_ctx = redis_request->conn;
+    conn_ctx->OnRequestDone(redis_request.get());
+    if (reply) {
+        AddCounter(conn_ctx->thread_stats->reply_num, 1);
+        if (conn_ctx->thread_ctx->client->collect_bytes_read) {
+            AddCounter(conn_ctx->thread_stats->bytes_read, GetReplySize((const redisReply*)reply));
+        }
+    }
+    if (redis_request->near_cache_token != 0) {
+        // 在回调之前填充, 回调可能会通过 TakeReply() 取走 reply 的内容. 超时之后才到达的响应仍然可以被缓存.
+        conn_ctx->thread_ctx->work_thread->near_cache->Fill(redis_request->cmd, redis_request->near_cache_kind,
+                                                            redis_request->near_cache_token,
+                                                            (const redisReply*)reply);
+        redis_request->near_cache_token = 0;
+    }
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+    // 无论成功与否都需要失效: 以 nullptr 结束的写请求可能已经被 redis 执行.
+    if (thread_ctx->client->near_cache_max_bytes > 0 && redis_request->near_cache_kind == NearCache::kNone) {
+        InvalidateWrittenKeys(thread_ctx, redis_request.get());
+    }
+    if (redis_request->timed_out) { // 已经以 nullptr 回调过了, 丢弃迟到的响应. followers 仍然需要回调.
+        if (redis_request->followers) {
+            CompleteFollowers(thread_ctx, redis_request, (redisReply*)reply);
+        }
+        return ;
+    }
+    if (!reply && RetryRequest(thread_ctx, redis_request)) {
+        return ;
+    }
+    if (!reply) {
+        AddCounter(conn_ctx->thread_stats->failed_num, 1);
+    }
+
+    // 被重定向的 leader 仍然登记在 coalesce_leaders 中, followers 等待重定向之后的响应.
+    if (reply && thread_ctx->client->cluster_mode &&
+        RedirectRequest(conn_ctx, redis_request, (const redisReply*)reply)) {
+        return ;
+    }
+
+    EraseCoalesceLeader(thread_ctx, redis_request.get());
+    thread_ctx->timer_wheel.Cancel(&redis_request->timer_node);
+    uint64_t reply_tsc = redis_request->submit_tsc != 0 && reply ? TscClock::Now() : 0;
+    /* 交给 callback_executor 的请求在本轮事件循环结束之前仍然有效, 因此之后可以通过 raw_request 记录延迟, 此时
+     * 回调阶段只包括移交的开销.
+     */
+    RedisRequest *raw_request = redis_request.get();
+    if (redis_request->followers) {
+        CompleteFollowers(thread_ctx, redis_request, (redisReply*)reply);
+    } else if (!DeferCallback(thread_ctx, redis_request, (redisReply*)reply)) {
+        redis_request->Success((redisReply*)reply);
+    }
+    if (reply_tsc != 0) {
+        RecordCommandLatency(thread_ctx, raw_request, reply_tsc, TscClock::Now());
+    }
+    return ;
+}
+
+bool AsyncRedisClient::SendRequest(RedisConnectionContext *conn_ctx, request_ptr_t &request) {
+    if (!conn_ctx->hiredis_async_ctx) {
+        return false;
+    }
+
+    int hiredis_rc;
+    if (!request->frame.empty()) {
+        request->bytes = request->frame.size();
+        hiredis_rc = redisAsyncFormattedCommand(conn_ctx->hiredis_async_ctx, OnRedisReply, request.get(),
+                                                request->frame.data(), request->frame.size());
+    } else {
+        request->bytes = RespEncoder::GetEncodedSize(request->cmd);
+        hiredis_rc = RedisAsyncCommandArgv(conn_ctx->hiredis_async_ctx, OnRedisReply,
+                                           request.get(), request->cmd);
+    }
+    if (hiredis_rc != REDIS_OK) {
+        redisAsyncFree(conn_ctx->hiredis_async_ctx);
+        return false;
+    }
+
+    request->conn = conn_ctx;
+    if (request->submit_tsc != 0) {
+        request->send_tsc = TscClock::Now();
+    }
+    conn_ctx->OnRequestSent(request.get());
+    if (request->deadline_ms != 0) {
+        ScheduleDeadline(conn_ctx->thread_ctx, request.get());
+    }
+
+    // 只有 key 所属的 work thread 才会填充缓存, 参见 RouteByKey().
+    WorkThread *work_thread = conn_ctx->thread_ctx->work_thread;
+    if (request->near_cache_kind != NearCache::kNone && conn_ctx->tracking &&
+        work_thread == &(*conn_ctx->thread_ctx->client->work_threads_)[request->key_thread]) {
+        request->near_cache_token = work_thread->near_cache->Reserve(request->cmd, request->near_cache_kind);
+    }
+    request.release(); // 此后 RedisRequest 对象由 OnRedisReply 来负责管理.
+    return true;
+}
+
+bool AsyncRedisClient::RedirectRequest(RedisConnectionContext *conn_ctx, request_ptr_t &request,
+                                       const redisReply *reply) noexcept {
+    constexpr uint8_t kMaxRedirectNum = 5;
+    constexpr uint64_t kMinClusterRefreshIntervalMs = 100;
+
+    WorkThreadContext *thread_ctx = conn_ctx->thread_ctx;
+    ClusterRedirect redirect;
+    try {
+        if (!ParseClusterRedirect(reply, &redirect)) {
+            return false;
+        }
+    } catch (...) {
+        return false;
+    }
+
+    // Join() 之后不会再建立新的连接, 此时将重定向错误原样返回.
+    if (thread_ctx->no_new_request || request->redirect_num >= kMaxRedirectNum) {
+        return false;
+    }
+
+    ClusterNode *node;
+    try {
+        const std::string &host = redirect.host.empty() ? GetConnHost(conn_ctx) : redirect.host;
+        uint16_t node_idx = GetClusterNode(thread_ctx, host, redirect.port);
+        node = thread_ctx->cluster_nodes[node_idx].get();
+        if (!redirect.ask) {
+            thread_ctx->slot_nodes[redirect.slot] = node_idx;
+        }
+    } catch (...) {
+        return false;
+    }
+
+    // MOVED 表明集群拓扑发生了变化, 此时可能有大量请求都被重定向, 因此限制刷新的频率.
+    if (!redirect.ask && GetMonotonicMs() - thread_ctx->last_cluster_refresh_ms >= kMinClusterRefreshIntervalMs) {
+        RefreshClusterSlots(thread_ctx);
+    }
+
+    ++request->redirect_num;
+    std::vector<RedisConnectionContext> &conn_ctxs = node->conn_ctxs;
+    size_t begin_idx = SelectConnection(thread_ctx, conn_ctxs);
+    for (size_t step = 0; step < conn_ctxs.size(); ++step) {
+        RedisConnectionContext *target = &conn_ctxs[(begin_idx + step) % conn_ctxs.size()];
+        if (!target->IsUsable()) {
+            continue;
+        }
+        // ASKING 与请求在同一个连接上依次发送, ASKING 的响应直接丢弃.
+        if (redirect.ask && redisAsyncCommand(target->hiredis_async_ctx, nullptr, nullptr, "ASKING") != REDIS_OK) {
+            continue;
+        }
+
+        try {
+            if (SendRequest(target, request)) {
+                return true;
+            }
+        } catch (...) {}
+    }
+
+    // 新建立连接的节点, 待连接就绪之后由 HandleRequest() 按照更新后的 slot_nodes 重新发送.
+    return ParkRequest(thread_ctx, conn_ctxs, request);
+}
+
+size_t AsyncRedisClient::SelectConnection(WorkThreadContext *thread_ctx,
+                                          std::vector<RedisConnectionContext> &conn_ctxs) noexcept {
+    size_t rr_idx = (++thread_ctx->seq_num) % conn_ctxs.size();
+
+    // 不可用的连接视为负载最大.
+    auto GetLoad = [&] (size_t idx) noexcept -> size_t {
+        return conn_ctxs[idx].IsUsable() ? conn_ctxs[idx].in_flight_num : static_cast<size_t>(-1);
+    };
+
+    switch (thread_ctx->client->conn_select_policy) {
+    case ConnSelectPolicy::kLeastOutstanding: {
+        // 从 rr_idx 开始遍历, 使得负载相同的连接之间仍然是 round-robin.
+        size_t best_idx = rr_idx;
+        size_t best_load = GetLoad(rr_idx);
+        for (size_t step = 1; step < conn_ctxs.size() && best_load > 0; ++step) {
+            size_t idx = (rr_idx + step) % conn_ctxs.size();
+            size_t load = GetLoad(idx);
+            if (load < best_load) {
+                best_idx = idx;
+                best_load = load;
+            }
+        }
+        return best_idx;
+    }
+    case ConnSelectPolicy::kPowerOfTwoChoices: {
+        if (conn_ctxs.size() < 2) {
+            return 0;
+        }
+        size_t first_idx = thread_ctx->NextRand() % conn_ctxs.size();
+        size_t second_idx = (first_idx + 1 + thread_ctx->NextRand() % (conn_ctxs.size() - 1)) % conn_ctxs.size();
+        return GetLoad(second_idx) < GetLoad(first_idx) ? second_idx : first_idx;
+    }
+    case ConnSelectPolicy::kRoundRobin:
+    default:
+        return rr_idx;
+    }
+}
+
+void AsyncRedisClient::HandleRequest(WorkThreadContext *thread_ctx, request_ptr_t &request) noexcept {
+    // 在队列中等待时已经超时的请求不再发送.
+    ThreadStats &stats = *thread_ctx->work_thread->stats;
+    if (request->deadline_ms != 0 && request->deadline_ms <= GetMonotonicMs()) {
+        AddCounter(stats.timeout_num, 1);
+        DeferFailure(thread_ctx, request);
+        return ;
+    }
+
+    if (request->coalesce && AttachCoalesced(thread_ctx, request)) {
+        return ;
+    }
+
+    bool handle_success = false;
+    RedisBatch *batch = request->batch;
+    RedisRequest *raw_request = request.get(); // 发送成功之后 request 为空.
+
+    // 集群模式下按照 key 选择节点, 节点未知时发送到 host:port.
+    bool cluster_mode = thread_ctx->client->cluster_mode;
+    std::vector<RedisConnectionContext> *conn_ctxs = &thread_ctx->conn_ctxs;
+    if (cluster_mode) {
+        ClusterNode *node = GetRequestClusterNode(thread_ctx, request.get());
+        if (node) {
+            conn_ctxs = &node->conn_ctxs;
+        }
+    }
+
+    auto HandleRequestOn = [&] (std::vector<RedisConnectionContext>::iterator iter) noexcept -> int {
+        if (!iter->IsUsable()) {
+            return 0;
+        }
+        try {
+            handle_success = SendRequest(&*iter, request);
+        } catch (...) {
+            return 0;
+        }
+
+        if (handle_success && batch && !cluster_mode) {
+            batch->conn_idx = iter - conn_ctxs->begin();
+        }
+        return handle_success;
+    };
+
+    /* batch 中的请求尽量使用同一个连接, 使得它们可以在一次写操作中被发送. 集群模式下 batch 中的请求可能属于
+     * 不同的节点, 此时各自路由.
+     */
+    size_t begin_idx;
+    if (!cluster_mode && batch && batch->conn_idx != RedisBatch::kNoConn) {
+        begin_idx = batch->conn_idx;
+    } else {
+        begin_idx = SelectConnection(thread_ctx, *conn_ctxs);
+    }
+    LoopbackTraverse(conn_ctxs->begin(), conn_ctxs->end(),
+                     conn_ctxs->begin() + begin_idx,
+                     HandleRequestOn);
+
+    if (!handle_success && ParkRequest(thread_ctx, *conn_ctxs, request)) {
+        return ;
+    }
+    if (!handle_success) {
+        AddCounter(stats.failed_num, 1);
+        DeferFailure(thread_ctx, request);
+    } else if (raw_request->coalesce) {
+        AddCoalesceLeader(thread_ctx, raw_request);
     }
 
-    if (init_success) {
-        work_thread->vec_mux.lock();
-        work_thread->request_vec.reset(request_vec.release());
-        work_thread->vec_mux.unlock();
+    return ;
+}
 
-        work_thread->handle_mux.lock();
-        work_thread->async_handle = async_handle;
-        work_thread->handle_mux.unlock();
+bool AsyncRedisClient::MergeRequest(WorkThreadContext *thread_ctx, request_ptr_t &request) noexcept {
+    RedisRequest *req = request.get();
+    if (!req->frame.empty() || req->batch || req->coalesce || req->near_cache_kind != NearCache::kNone) {
+        return false;
+    }
+    // 已经超时的请求交给 HandleRequest() 处理.
+    if (req->deadline_ms != 0 && req->deadline_ms <= GetMonotonicMs()) {
+        return false;
+    }
+
+    std::vector<request_ptr_t> *group;
+    if (req->cmd.size() == 2 && thread_ctx->client->merge_gets && strcasecmp(req->cmd[0].c_str(), "GET") == 0) {
+        group = &thread_ctx->merge_gets;
+    } else if (req->cmd.size() == 3 && strcasecmp(req->cmd[0].c_str(), "HGET") == 0) {
+        group = &thread_ctx->merge_hgets;
     } else {
-        CloseAsyncHandle(async_handle);
+        return false;
     }
 
-    SetValueOn(p);
-    p = nullptr;
+    try {
+        group->push_back(std::move(request));
+    } catch (...) {
+        return false;
+    }
 
-    while (uv_run(&thread_ctx.uv_loop, UV_RUN_DEFAULT)) {
-        ;
+    if (group->size() >= std::max<size_t>(thread_ctx->client->merge_max_keys, 1)) {
+        FlushMerged(thread_ctx);
+    }
+    return true;
+}
+
+void AsyncRedisClient::FlushMerged(WorkThreadContext *thread_ctx) noexcept {
+    std::vector<request_ptr_t> &gets = thread_ctx->merge_gets;
+    if (!gets.empty()) {
+        SendMerged(thread_ctx, gets.data(), gets.size(), "MGET", nullptr);
+        gets.clear();
     }
 
+    /* 同一个 key 上的 HGET 合并为一个 HMGET. 相邻的 HGET 通常很少, 因此直接按照 key 稳定排序, 同一个 key 上
+     * 的 HGET 之间的顺序保持不变.
+     */
+    std::vector<request_ptr_t> &hgets = thread_ctx->merge_hgets;
+    if (!hgets.empty()) {
+        std::stable_sort(hgets.begin(), hgets.end(), [] (const request_ptr_t &left, const request_ptr_t &right) {
+            return left->cmd[1] < right->cmd[1];
+        });
+        size_t begin = 0;
+        while (begin < hgets.size()) {
+            size_t end = begin + 1;
+            while (end < hgets.size() && hgets[end]->cmd[1] == hgets[begin]->cmd[1]) {
+                ++end;
+            }
+            SendMerged(thread_ctx, hgets.data() + begin, end - begin, "HMGET", &hgets[begin]->cmd[1]);
+            begin = end;
+        }
+        hgets.clear();
+    }
     return ;
 }
 
-void AsyncRedisClient::OnRedisReply(redisAsyncContext * /* ac */, void *reply, void *privdata) noexcept {
-    std::unique_ptr<RedisRequest> redis_request((RedisRequest*)privdata);
-    redis_request->Success((redisReply*)reply);
+void AsyncRedisClient::SendMerged(WorkThreadContext *thread_ctx, request_ptr_t *reqs, size_t num,
+                                  const char *cmd_name, const std::string *key) noexcept {
+    request_ptr_t merged;
+    if (num > 1) {
+        try {
+            merged.reset(ObjectPool<RedisRequest>::Get());
+            std::vector<std::string> &cmd = merged->cmd;
+            cmd.resize(1 + (key ? 1 : 0) + num);
+            cmd[0].assign(cmd_name);
+            size_t arg_idx = 1;
+            if (key) {
+                cmd[arg_idx++].assign(*key);
+            }
+            for (size_t idx = 0; idx < num; ++idx) {
+                cmd[arg_idx++].assign(reqs[idx]->cmd.back());
+            }
+        } catch (...) {
+            merged.reset();
+        }
+    }
+
+    if (!merged) {
+        for (size_t idx = 0; idx < num; ++idx) {
+            HandleRequest(thread_ctx, reqs[idx]);
+        }
+        return ;
+    }
+
+    // 以相反的顺序压入 followers, 使得 followers 与参数的顺序一致.
+    merged->merged_num = static_cast<uint32_t>(num);
+    for (size_t idx = num; idx > 0; --idx) {
+        RedisRequest *req = reqs[idx - 1].release();
+        if (req->deadline_ms != 0) {
+            ScheduleDeadline(thread_ctx, req);
+        }
+        req->next = merged->followers;
+        merged->followers = req;
+    }
+    AddCounter(thread_ctx->work_thread->stats->merged_num, num);
+    HandleRequest(thread_ctx, merged);
     return ;
 }
 
 void AsyncRedisClient::OnAsyncHandle(uv_async_t* handle) noexcept {
     WorkThreadContext *thread_ctx = (WorkThreadContext*)handle->data;
     WorkThread *work_thread = thread_ctx->work_thread;
-    std::unique_ptr<std::vector<std::unique_ptr<RedisRequest>>> request_vec;
 
-    auto HandleRequest = [&] (std::unique_ptr<RedisRequest> &request) noexcept {
-        bool handle_success = false;
-
-        auto DoHandleRequestOn = [] (RedisConnectionContext &conn_ctx, std::unique_ptr<RedisRequest> &request) -> bool {
-            if (!conn_ctx.hiredis_async_ctx) {
-                return false;
+    // 集群模式下 MGET 中的 key 可能属于不同的 slot, 因此不合并.
+    bool merge_reads = thread_ctx->client->merge_reads && !thread_ctx->client->cluster_mode;
+
+    // requests 是按照 next 串联起来的请求链表, 一次遍历处理完毕.
+    auto HandleRequests = [&] (RedisRequest *requests) noexcept {
+        // 同一批次的请求使用同一个出队时间.
+        uint64_t dequeue_tsc = work_thread->command_latency ? TscClock::Now() : 0;
+        uint64_t drain_num = 0;
+        while (requests) {
+            request_ptr_t request(requests);
+            requests = requests->next;
+            request->next = nullptr;
+            request->dequeue_tsc = dequeue_tsc;
+
+            ++drain_num;
+            if (request->near_cache_invalidation) { // 其他 work thread 交来的失效通知, 参见 InvalidateWrittenKeys().
+                for (const std::string &key : request->cmd) {
+                    work_thread->near_cache->Invalidate(key.data(), key.size());
+                }
+                continue;
             }
-
-            int hiredis_rc = RedisAsyncCommandArgv(conn_ctx.hiredis_async_ctx, OnRedisReply,
-                                                   request.get(), request->cmd);
-            if (hiredis_rc != REDIS_OK) {
-                redisAsyncFree(conn_ctx.hiredis_async_ctx);
-                return false;
+            if (merge_reads && MergeRequest(thread_ctx, request)) {
+                continue;
             }
-            request.release(); // 此后 RedisRequest 对象由 OnRedisReply 来负责管理.
-            return true;
-        };
-
-        auto HandleRequestOn = [&] (std::vector<RedisConnectionContext>::iterator iter) noexcept -> int {
-            try {
-                return handle_success = DoHandleRequestOn(*iter, request);
-            } catch (...) {
-                return 0;
+            if (merge_reads) {
+                FlushMerged(thread_ctx);
             }
-        };
-
-        size_t begin_idx = (++thread_ctx->seq_num) % thread_ctx->conn_ctxs.size();
-        LoopbackTraverse(thread_ctx->conn_ctxs.begin(), thread_ctx->conn_ctxs.end(),
-                         thread_ctx->conn_ctxs.begin() + begin_idx,
-                         HandleRequestOn);
-
-        if (!handle_success) {
-            request->Fail();
+            HandleRequest(thread_ctx, request);
+        }
+        if (merge_reads) {
+            FlushMerged(thread_ctx);
         }
 
+        ThreadStats &stats = *work_thread->stats;
+        if (drain_num > 0) {
+            AddCounter(stats.dequeued_num, drain_num);
+            stats.last_drain_num.store(drain_num, std::memory_order_relaxed);
+            if (drain_num > stats.max_drain_num.load(std::memory_order_relaxed)) {
+                stats.max_drain_num.store(drain_num, std::memory_order_relaxed);
+            }
+        }
         return ;
     };
 
-    auto HandleRequests = [&] (std::vector<std::unique_ptr<RedisRequest>> &requests) noexcept {
-        for (auto &request : requests) {
-            HandleRequest(request);
+    auto PopAll = [&] () noexcept -> RedisRequest* {
+        RedisRequest *requests = work_thread->request_queue.PopAll();
+        if (requests) {
+            ++thread_ctx->expected_wakeup_num;
         }
-        return ;
+        return requests;
     };
 
-    auto OnRequest = [&] () noexcept {
-        auto *tmp = new(std::nothrow) std::vector<std::unique_ptr<RedisRequest>>;
-
-        work_thread->vec_mux.lock();
-        request_vec.reset(work_thread->request_vec.release()); // noexcept
-        work_thread->request_vec.reset(tmp); // noexcept
-        work_thread->vec_mux.unlock();
+    /* 关闭 request_queue, 并等待所有唤醒者离开, 此后便可以安全地关闭 async_handle.
+     *
+     * 生产者在压入请求与调用 uv_async_send() 之间的时间窗口很小, 所以这里只是简单地 yield.
+     */
+    auto CloseRequestQueue = [&] () noexcept -> RedisRequest* {
+        RedisRequest *requests = work_thread->request_queue.Close();
+        if (requests) {
+            ++thread_ctx->expected_wakeup_num;
+        }
 
-        if (request_vec) {
-            HandleRequests(*request_vec);
+        while (work_thread->notifier_num.load(std::memory_order_seq_cst) != 0 ||
+               work_thread->wakeup_num.load(std::memory_order_acquire) != thread_ctx->expected_wakeup_num) {
+            std::this_thread::yield();
         }
+        return requests;
+    };
 
+    auto OnRequest = [&] () noexcept {
+        HandleRequests(PopAll());
         return ;
     };
 
     auto OnJoin = [&] () noexcept {
-        work_thread->vec_mux.lock();
-        request_vec.reset(work_thread->request_vec.release()); // noexcept
-        work_thread->vec_mux.unlock();
-
-        work_thread->handle_mux.lock();
-        work_thread->async_handle = nullptr;
-        work_thread->handle_mux.unlock();
-
-        if (request_vec) {
-            HandleRequests(*request_vec);
-        }
+        // 此后的请求直接发送到尚未就绪的连接上, 连接随后被 redisAsyncDisconnect(), 不会再有新的状态变化.
+        thread_ctx->wait_ready = false;
+        HandleRequests(CloseRequestQueue());
+        thread_ctx->DispatchParked();
 
         thread_ctx->no_new_request = true;
-        for (auto &conn_ctx : thread_ctx->conn_ctxs) {
+        CloseClusterRefreshTimer(thread_ctx);
+        CloseTracking(thread_ctx);
+        thread_ctx->ForEachConn([] (RedisConnectionContext &conn_ctx) noexcept {
             if (!conn_ctx.hiredis_async_ctx)
-                continue;
+                return ;
             redisAsyncDisconnect(conn_ctx.hiredis_async_ctx);
-        }
+        });
+        MaybeCloseDeadlineTimer(thread_ctx);
 
         CloseAsyncHandle(handle);
         return ;
     };
 
     auto OnStop = [&] () noexcept {
-        work_thread->vec_mux.lock();
-        request_vec.reset(work_thread->request_vec.release()); // noexcept
-        work_thread->vec_mux.unlock();
-
-        work_thread->handle_mux.lock();
-        work_thread->async_handle = nullptr;
-        work_thread->handle_mux.unlock();
-
-        if (request_vec) {
-            for (auto &request : *request_vec) {
-                request->Fail();
-            }
+        RedisRequest *requests = CloseRequestQueue();
+        while (requests) {
+            request_ptr_t request(requests);
+            requests = requests->next;
+            request->next = nullptr;
+            FailRequest(thread_ctx, request);
+            AddCounter(work_thread->stats->failed_num, 1);
         }
 
+        /* 等待连接就绪的请求被发送到尚未就绪的连接上, 随后与其他已经发送的请求一同在 redisAsyncFree() 中以
+         * nullptr 回调.
+         */
+        thread_ctx->wait_ready = false;
+        thread_ctx->DispatchParked();
+
         thread_ctx->no_new_request = true;
-        for (RedisConnectionContext &conn_ctx : thread_ctx->conn_ctxs) {
+        CloseClusterRefreshTimer(thread_ctx);
+        CloseTracking(thread_ctx);
+        thread_ctx->ForEachConn([] (RedisConnectionContext &conn_ctx) noexcept {
             if (!conn_ctx.hiredis_async_ctx)
-                continue;
+                return ;
             redisAsyncFree(conn_ctx.hiredis_async_ctx);
-        }
+            conn_ctx.hiredis_async_ctx = nullptr;
+            conn_ctx.SetState(ConnState::kDisconnected); // 尚未建立的连接不会调用 OnRedisDisconnect().
+        });
+        MaybeCloseDeadlineTimer(thread_ctx);
 
         CloseAsyncHandle(handle);
         return ;
@@ -470,43 +2889,52 @@ inline redisReply* MoveRedisReply(redisReply *right) noexcept {
 }
 
 
-struct PromiseCallback {
+struct BatchPromiseCallback {
 public:
-    using promise_t = std::promise<AsyncRedisClient::redisReply_unique_ptr_t>;
+    using promise_t = std::promise<std::vector<AsyncRedisClient::redisReply_unique_ptr_t>>;
 
 public:
     std::shared_ptr<promise_t> promise_end;
 
 public:
-    PromiseCallback():
+    BatchPromiseCallback():
         promise_end(std::make_shared<promise_t>()) {
     }
 
-    PromiseCallback(const PromiseCallback &) noexcept = default;
-    PromiseCallback(PromiseCallback &&other) noexcept:
-        promise_end(std::move(other.promise_end)) {
+    void operator()(std::vector<AsyncRedisClient::redisReply_unique_ptr_t> &replies) noexcept {
+        promise_end->set_value(std::move(replies));
+        return ;
     }
+};
 
-    PromiseCallback& operator=(const PromiseCallback &) noexcept = default;
-    PromiseCallback& operator=(PromiseCallback &&other) noexcept {
-        promise_end = std::move(other.promise_end);
-        return *this;
-    }
+/* 只需要被移动, 因此直接持有 promise, 并且可以被存放在 unique_callback_t 内部, 没有额外的内存分配.
+ */
+struct PromiseCallback {
+public:
+    using promise_t = std::promise<AsyncRedisClient::redisReply_unique_ptr_t>;
+
+public:
+    promise_t promise_end;
+
+public:
+    PromiseCallback() = default;
+    PromiseCallback(PromiseCallback &&) noexcept = default;
+    PromiseCallback& operator=(PromiseCallback &&) noexcept = default;
 
     void operator()(redisReply *reply) noexcept;
 };
 
 void PromiseCallback::operator()(redisReply *reply) noexcept {
     if (!reply) {
-        promise_end->set_exception(std::make_exception_ptr(std::runtime_error("reply: nullptr")));
+        promise_end.set_exception(std::make_exception_ptr(std::runtime_error("reply: nullptr")));
         return ;
     }
 
-    redisReply *reply_p = MoveRedisReply(reply);
+    AsyncRedisClient::redisReply_unique_ptr_t reply_p = AsyncRedisClient::TakeReply(reply);
     if (!reply_p) {
-        promise_end->set_exception(std::make_exception_ptr(std::bad_alloc()));
+        promise_end.set_exception(std::make_exception_ptr(std::bad_alloc()));
     } else {
-        promise_end->set_value(AsyncRedisClient::redisReply_unique_ptr_t(reply_p));
+        promise_end.set_value(std::move(reply_p));
     }
     return ;
 }
@@ -514,24 +2942,516 @@ void PromiseCallback::operator()(redisReply *reply) noexcept {
 
 } // namespace
 
+AsyncRedisClient::redisReply_unique_ptr_t AsyncRedisClient::TakeReply(redisReply *reply) noexcept {
+    redisReply_unique_ptr_t *deferred_reply = tls_deferred_reply;
+    if (deferred_reply && reply && deferred_reply->get() == reply) {
+        return std::move(*deferred_reply);
+    }
+    SharedReply *shared = tls_shared_reply;
+    if (shared && shared->Contains(reply)) {
+        shared->AddRef();
+        return redisReply_unique_ptr_t(reply, RedisReplyDeleter(SharedReply::Release));
+    }
+    if (ReplyArena::Detach(reply)) {
+        return redisReply_unique_ptr_t(reply, RedisReplyDeleter(ReplyArena::FreeDetached));
+    }
+    return redisReply_unique_ptr_t(MoveRedisReply(reply));
+}
+
+AsyncRedisClient::CompletionBatch::CompletionBatch(AsyncRedisClient *client, size_t thread_idx,
+                                                   RedisRequest *requests, size_t size) noexcept:
+    client_(client),
+    thread_idx_(thread_idx),
+    requests_(requests),
+    size_(size) {
+    std::lock_guard<std::mutex> guard(client_->batch_mux_);
+    ++client_->outstanding_batch_num_;
+}
+
+void AsyncRedisClient::CompletionBatch::Run() noexcept {
+    RedisRequest *requests = requests_;
+    requests_ = nullptr;
+    size_ = 0;
+    while (requests) {
+        request_ptr_t request(requests);
+        requests = requests->next;
+        request->next = nullptr;
+
+        redisReply_unique_ptr_t *outer_deferred_reply = tls_deferred_reply;
+        tls_deferred_reply = &request->deferred_reply;
+        request->Success(request->deferred_reply.get());
+        tls_deferred_reply = outer_deferred_reply;
+    }
+
+    // 请求都已经释放. 此后 client 可能随时被析构, 因此在持有 batch_mux_ 时 notify, 之后不再访问 client.
+    AsyncRedisClient *client = client_;
+    client_ = nullptr;
+    if (client) {
+        std::lock_guard<std::mutex> guard(client->batch_mux_);
+        if (--client->outstanding_batch_num_ == 0) {
+            client->batch_cv_.notify_all();
+        }
+    }
+    return ;
+}
+
 std::future<AsyncRedisClient::redisReply_unique_ptr_t>
-AsyncRedisClient::Execute(const std::vector<std::string> &cmd) {
+AsyncRedisClient::Execute(const std::vector<std::string> &cmd, uint32_t timeout_ms) {
     PromiseCallback cb;
-    auto future_end = cb.promise_end->get_future();
-    Execute(cmd, std::move(cb));
+    auto future_end = cb.promise_end.get_future();
+    Execute(cmd, std::move(cb), timeout_ms);
     return std::move(future_end);
 }
 
 std::future<AsyncRedisClient::redisReply_unique_ptr_t>
-AsyncRedisClient::Execute(std::vector<std::string> &&cmd) {
+AsyncRedisClient::Execute(std::vector<std::string> &&cmd, uint32_t timeout_ms) {
     PromiseCallback cb;
-    auto future_end = cb.promise_end->get_future();
-    Execute(std::move(cmd), std::move(cb));
+    auto future_end = cb.promise_end.get_future();
+    Execute(std::move(cmd), std::move(cb), timeout_ms);
+    return std::move(future_end);
+}
+
+std::future<AsyncRedisClient::redisReply_unique_ptr_t>
+AsyncRedisClient::Execute(RespFrame &&frame, uint32_t timeout_ms) {
+    PromiseCallback cb;
+    auto future_end = cb.promise_end.get_future();
+    Execute(std::move(frame), std::move(cb), timeout_ms);
     return std::move(future_end);
 }
 
 
-void AsyncRedisClient::Execute(std::unique_ptr<RedisRequest> &req) {
+std::vector<AsyncRedisClient::ConnStat> AsyncRedisClient::GetConnStats() const {
+    std::vector<ConnStat> conn_stats;
+    for (size_t thread_idx = 0; thread_idx < work_threads_->size(); ++thread_idx) {
+        const WorkThread &work_thread = (*work_threads_)[thread_idx];
+        if (!work_thread.conn_stats) {
+            continue;
+        }
+        for (size_t conn_idx = 0; conn_idx < conn_per_thread; ++conn_idx) {
+            const ConnStats &stats = work_thread.conn_stats[conn_idx];
+
+            ConnStat conn_stat;
+            conn_stat.thread_idx = thread_idx;
+            conn_stat.conn_idx = conn_idx;
+            conn_stat.in_flight_num = stats.in_flight_num.load(std::memory_order_relaxed);
+            conn_stat.pending_bytes = stats.pending_bytes.load(std::memory_order_relaxed);
+            conn_stat.sent_num = stats.sent_num.load(std::memory_order_relaxed);
+            conn_stat.reconnect_num = stats.reconnect_num.load(std::memory_order_relaxed);
+            conn_stat.state = stats.state.load(std::memory_order_relaxed);
+            conn_stats.push_back(conn_stat);
+        }
+    }
+    return conn_stats;
+}
+
+std::map<std::string, AsyncRedisClient::CommandLatency> AsyncRedisClient::GetCommandLatency() const {
+    std::map<std::string, CommandLatency> latencies;
+    for (const WorkThread &work_thread : *work_threads_) {
+        if (!work_thread.command_latency) {
+            continue;
+        }
+        work_thread.command_latency->ForEach([&] (const CommandLatencyTable::Entry &entry) {
+            CommandLatency &latency = latencies[entry.name];
+            for (size_t stage = 0; stage < CommandLatencyTable::kStageNum; ++stage) {
+                entry.stages[stage].MergeTo(&latency.stages[stage]);
+            }
+        });
+    }
+    return latencies;
+}
+
+AsyncRedisClient::Stats AsyncRedisClient::GetStats() const {
+    Stats stats;
+    stats.threads.reserve(work_threads_->size());
+    for (size_t thread_idx = 0; thread_idx < work_threads_->size(); ++thread_idx) {
+        static const ThreadStats kEmptyThreadStats{};
+        const ThreadStats *thread_stats_ptr = (*work_threads_)[thread_idx].stats.get();
+        const ThreadStats &thread_stats = thread_stats_ptr ? *thread_stats_ptr : kEmptyThreadStats;
+
+        ThreadStat thread_stat;
+        thread_stat.thread_idx = thread_idx;
+        thread_stat.dequeued_num = thread_stats.dequeued_num.load(std::memory_order_relaxed);
+        thread_stat.last_drain_num = thread_stats.last_drain_num.load(std::memory_order_relaxed);
+        thread_stat.max_drain_num = thread_stats.max_drain_num.load(std::memory_order_relaxed);
+        thread_stat.in_flight_num = thread_stats.in_flight_num.load(std::memory_order_relaxed);
+        thread_stat.pending_bytes = thread_stats.pending_bytes.load(std::memory_order_relaxed);
+        thread_stat.sent_num = thread_stats.sent_num.load(std::memory_order_relaxed);
+        thread_stat.reply_num = thread_stats.reply_num.load(std::memory_order_relaxed);
+        thread_stat.failed_num = thread_stats.failed_num.load(std::memory_order_relaxed);
+        thread_stat.timeout_num = thread_stats.timeout_num.load(std::memory_order_relaxed);
+        thread_stat.reconnect_num = thread_stats.reconnect_num.load(std::memory_order_relaxed);
+        thread_stat.connect_fail_num = thread_stats.connect_fail_num.load(std::memory_order_relaxed);
+        thread_stat.auth_fail_num = thread_stats.auth_fail_num.load(std::memory_order_relaxed);
+        thread_stat.parked_num = thread_stats.parked_num.load(std::memory_order_relaxed);
+        thread_stat.retry_num = thread_stats.retry_num.load(std::memory_order_relaxed);
+        thread_stat.bytes_written = thread_stats.bytes_written.load(std::memory_order_relaxed);
+        thread_stat.bytes_read = thread_stats.bytes_read.load(std::memory_order_relaxed);
+        thread_stat.inline_num = thread_stats.inline_num.load(std::memory_order_relaxed);
+        thread_stat.coalesced_num = thread_stats.coalesced_num.load(std::memory_order_relaxed);
+        thread_stat.merged_num = thread_stats.merged_num.load(std::memory_order_relaxed);
+        thread_stat.deferred_num = thread_stats.deferred_num.load(std::memory_order_relaxed);
+        thread_stat.deferred_batch_num = thread_stats.deferred_batch_num.load(std::memory_order_relaxed);
+        thread_stat.bind_fail_num = thread_stats.bind_fail_num.load(std::memory_order_relaxed);
+
+        const WorkThread &work_thread = (*work_threads_)[thread_idx];
+        thread_stat.admitted_num = work_thread.admitted_num.load(std::memory_order_relaxed);
+        thread_stat.admitted_bytes = work_thread.admitted_bytes.load(std::memory_order_relaxed);
+        thread_stat.rejected_num = work_thread.rejected_num.load(std::memory_order_relaxed);
+        if (work_thread.near_cache) {
+            NearCache::Stats cache_stats = work_thread.near_cache->GetStats();
+            thread_stat.near_cache_hit_num = cache_stats.hit_num;
+            thread_stat.near_cache_miss_num = cache_stats.miss_num;
+            thread_stat.near_cache_invalidate_num = cache_stats.invalidate_num;
+            thread_stat.near_cache_evict_num = cache_stats.evict_num;
+            thread_stat.near_cache_entry_num = cache_stats.entry_num;
+            thread_stat.near_cache_bytes = cache_stats.bytes;
+        }
+        stats.threads.push_back(thread_stat);
+
+        ThreadStat &total = stats.total;
+        total.dequeued_num += thread_stat.dequeued_num;
+        total.last_drain_num = std::max(total.last_drain_num, thread_stat.last_drain_num);
+        total.max_drain_num = std::max(total.max_drain_num, thread_stat.max_drain_num);
+        total.in_flight_num += thread_stat.in_flight_num;
+        total.pending_bytes += thread_stat.pending_bytes;
+        total.sent_num += thread_stat.sent_num;
+        total.reply_num += thread_stat.reply_num;
+        total.failed_num += thread_stat.failed_num;
+        total.timeout_num += thread_stat.timeout_num;
+        total.reconnect_num += thread_stat.reconnect_num;
+        total.connect_fail_num += thread_stat.connect_fail_num;
+        total.auth_fail_num += thread_stat.auth_fail_num;
+        total.parked_num += thread_stat.parked_num;
+        total.retry_num += thread_stat.retry_num;
+        total.bytes_written += thread_stat.bytes_written;
+        total.bytes_read += thread_stat.bytes_read;
+        total.inline_num += thread_stat.inline_num;
+        total.coalesced_num += thread_stat.coalesced_num;
+        total.merged_num += thread_stat.merged_num;
+        total.deferred_num += thread_stat.deferred_num;
+        total.deferred_batch_num += thread_stat.deferred_batch_num;
+        total.bind_fail_num += thread_stat.bind_fail_num;
+        total.admitted_num += thread_stat.admitted_num;
+        total.admitted_bytes += thread_stat.admitted_bytes;
+        total.rejected_num += thread_stat.rejected_num;
+        total.near_cache_hit_num += thread_stat.near_cache_hit_num;
+        total.near_cache_miss_num += thread_stat.near_cache_miss_num;
+        total.near_cache_invalidate_num += thread_stat.near_cache_invalidate_num;
+        total.near_cache_evict_num += thread_stat.near_cache_evict_num;
+        total.near_cache_entry_num += thread_stat.near_cache_entry_num;
+        total.near_cache_bytes += thread_stat.near_cache_bytes;
+    }
+    return stats;
+}
+
+void AsyncRedisClient::RedisBatch::OnReply(size_t idx, redisReply *reply) noexcept {
+    if (reply) {
+        // 当 TakeReply() 失败时, replies[idx] 为空, 与请求失败相同.
+        replies[idx] = TakeReply(reply);
+    }
+
+    if (--pending_num > 0) {
+        return ;
+    }
+
+    std::unique_ptr<RedisBatch> self(this);
+    if (callback) {
+        callback(replies);
+    }
+    return ;
+}
+
+void AsyncRedisClient::ExecuteBatch(std::vector<std::vector<std::string>> cmds, batch_callback_t callback,
+                                    uint32_t timeout_ms) {
+    if (cmds.empty()) {
+        THROW(EINVAL, "INVALID ARGUMENTS; cmds is empty");
+    }
+
+    std::unique_ptr<RedisBatch> batch(new RedisBatch);
+    batch->callback = std::move(callback);
+    batch->replies.resize(cmds.size());
+    batch->pending_num = cmds.size();
+
+    std::vector<request_ptr_t> reqs;
+    reqs.reserve(cmds.size());
+    for (size_t idx = 0; idx < cmds.size(); ++idx) {
+        reqs.emplace_back(NewRequest(std::move(cmds[idx]), nullptr, timeout_ms));
+        reqs.back()->batch = batch.get();
+        reqs.back()->idx_in_batch = idx;
+    }
+
+    Execute(reqs);
+    batch.release(); // 此后 RedisBatch 对象由 RedisBatch::OnReply() 负责释放.
+    return ;
+}
+
+std::future<std::vector<AsyncRedisClient::redisReply_unique_ptr_t>>
+AsyncRedisClient::ExecuteBatch(std::vector<std::vector<std::string>> cmds, uint32_t timeout_ms) {
+    BatchPromiseCallback cb;
+    auto future_end = cb.promise_end->get_future();
+    ExecuteBatch(std::move(cmds), std::move(cb), timeout_ms);
+    return future_end;
+}
+
+bool AsyncRedisClient::ExecuteInline(request_ptr_t &req) noexcept {
+    WorkThreadContext *thread_ctx = tls_thread_ctx;
+    if (!thread_ctx || thread_ctx->client != this || thread_ctx->no_new_request) {
+        return false;
+    }
+
+    // 按照 key 路由的请求需要由 key 所属的 work thread 发送, 参见 RouteByKey().
+    if (req->key_thread != RedisRequest::kNoKeyThread &&
+        &(*work_threads_)[req->key_thread] != thread_ctx->work_thread) {
+        return false;
+    }
+
+    // 容量已满时不能在 work thread 中等待, 在下一轮事件循环中失败.
+    WorkThread *work_thread = thread_ctx->work_thread;
+    if (HasCapacityLimit()) {
+        size_t bytes = GetRequestBytes(req.get());
+        if (!work_thread->TryAdmit(1, bytes, max_pending_requests, max_pending_bytes)) {
+            work_thread->rejected_num.fetch_add(1, std::memory_order_relaxed);
+            AddCounter(work_thread->stats->failed_num, 1);
+            DeferFailure(thread_ctx, req);
+            return true;
+        }
+        req->admitted_thread = work_thread;
+        req->admitted_bytes = bytes;
+    }
+
+    req->dequeue_tsc = req->submit_tsc;
+    AddCounter(work_thread->stats->inline_num, 1);
+    HandleRequest(thread_ctx, req); // 此后 req 总是为空.
+    return true;
+}
+
+AsyncRedisClient::ReplyFuture AsyncRedisClient::ExecuteSync(request_ptr_t &req) {
+    RedisRequest *raw_req = req.get();
+    req->callback = [raw_req] (redisReply *reply) noexcept {
+        raw_req->CompleteSync(reply);
+    };
+    req->inline_callback = true; // CompleteSync() 只是唤醒等待者, 不需要经过 callback_executor.
+
+    // 在交给 work thread 之前增加引用, 此后即使请求立即完成, 请求对象也不会被放回 ObjectPool.
+    req->ref_num.store(2, std::memory_order_relaxed);
+    try {
+        Execute(req);
+    } catch (...) {
+        req->ref_num.store(1, std::memory_order_relaxed);
+        throw;
+    }
+    return ReplyFuture(raw_req, sync_spin_us);
+}
+
+#ifdef ASYNC_REDIS_CLIENT_HAS_COROUTINE
+
+void AsyncRedisClient::Awaitable::State::Signal() noexcept {
+    if (!Arrive()) {
+        return ;
+    }
+    if (executor) {
+        executor->Post(handle);
+    } else {
+        handle.resume();
+    }
+    return ;
+}
+
+void AsyncRedisClient::Awaitable::Arm(State *state) noexcept {
+    req_->callback = [this, state] (redisReply *reply) noexcept {
+        if (reply) {
+            reply_ = TakeReply(reply);
+        }
+        state->Signal();
+    };
+    req_->inline_callback = true; // 协程在哪里恢复由 CoroutineExecutor 决定.
+    return ;
+}
+
+/* 请求交给 work thread 之后, 协程可能在 Execute() 返回之前就已经在其他线程中恢复甚至结束, 因此这里先将请求移到
+ * 局部变量中, 并且在 state_.Arrive() 之前不会再访问协程帧以外的 Awaitable 成员. state_ 本身在 Arrive() 之前总是
+ * 有效的, 因为协程只有在所有信号都到达之后才会恢复.
+ */
+bool AsyncRedisClient::Awaitable::await_suspend(std::coroutine_handle<> handle) {
+    state_.handle = handle;
+    state_.executor = executor_;
+    state_.pending.store(2, std::memory_order_relaxed);
+    Arm(&state_);
+
+    request_ptr_t req(std::move(req_));
+    client_->Execute(req);
+    return !state_.Arrive();
+}
+
+bool AsyncRedisClient::SubmitAll(Awaitable **items, size_t item_num, Awaitable::State *state,
+                                 std::coroutine_handle<> handle) {
+    AsyncRedisClient *client = items[0]->client_;
+    for (size_t idx = 1; idx < item_num; ++idx) {
+        if (items[idx]->client_ != client) {
+            THROW(EINVAL, "INVALID ARGUMENTS; WhenAll() requires Awaitables from the same client");
+        }
+    }
+
+    state->handle = handle;
+    state->executor = items[0]->executor_;
+    state->pending.store(item_num + 1, std::memory_order_relaxed);
+
+    std::vector<request_ptr_t> reqs;
+    reqs.reserve(item_num);
+    for (size_t idx = 0; idx < item_num; ++idx) {
+        items[idx]->Arm(state);
+        reqs.push_back(std::move(items[idx]->req_));
+    }
+    client->Execute(reqs);
+    return !state->Arrive();
+}
+
+#endif
+
+bool AsyncRedisClient::RouteByKey(request_ptr_t &req) noexcept {
+    if ((near_cache_max_bytes == 0 && !coalesce_reads) || !req->frame.empty() || req->batch ||
+        req->cmd.size() < 2) {
+        return false;
+    }
+    NearCache::Kind kind = NearCache::kNone;
+    if (near_cache_max_bytes > 0) {
+        kind = NearCache::GetKind(req->cmd, near_cache_prefixes);
+    }
+    bool coalesce = coalesce_reads && IsCoalescable(req->cmd) && SetCoalesceKey(req.get());
+    bool write = near_cache_max_bytes > 0 && kind == NearCache::kNone &&
+                 GetWrittenKeys(req->cmd[0].data(), req->cmd[0].size()) != kNotWrite;
+    if (kind == NearCache::kNone && !coalesce && !write) {
+        return false;
+    }
+
+    /* 每个 key 只缓存在一个 work thread 上, 使得各个 work thread 的缓存之间没有重复; 相同的请求也总是交给
+     * 同一个 work thread, 使得它们可以被合并. 写请求交给其第一个 key 所属的 work thread, 由其在回调之前删除缓存,
+     * 参见 InvalidateWrittenKeys().
+     */
+    size_t thread_idx = HashKey(req->cmd[1].data(), req->cmd[1].size()) % thread_num;
+    req->key_thread = static_cast<uint32_t>(thread_idx);
+    req->near_cache_kind = kind;
+    req->coalesce = coalesce;
+
+    // Stop(), Join() 之后不再使用缓存.
+    if (kind == NearCache::kNone || GetStatus() != ClientStatus::kStarted) {
+        return false;
+    }
+    NearCache *near_cache = (*work_threads_)[thread_idx].near_cache.get();
+    redisReply *reply = near_cache ? near_cache->Lookup(req->cmd, kind) : nullptr;
+    if (!reply) {
+        return false;
+    }
+
+    // reply 属于缓存中的 SharedReply, 回调中的 TakeReply() 只会增加其引用计数.
+    SharedReply *outer_shared = tls_shared_reply;
+    tls_shared_reply = reinterpret_cast<SharedReplyPart*>(reply)->shared;
+    req->Success(reply);
+    tls_shared_reply = outer_shared;
+    SharedReply::Release(reply);
+    req.reset();
+    return true;
+}
+
+bool AsyncRedisClient::Admit(WorkThread &work_thread, request_ptr_t *reqs, size_t req_num) {
+    if (!HasCapacityLimit()) {
+        return true;
+    }
+
+    uint64_t bytes = 0;
+    for (size_t idx = 0; idx < req_num; ++idx) {
+        reqs[idx]->admitted_bytes = GetRequestBytes(reqs[idx].get());
+        bytes += reqs[idx]->admitted_bytes;
+    }
+
+    bool admitted = work_thread.TryAdmit(req_num, bytes, max_pending_requests, max_pending_bytes);
+    if (!admitted && overload_policy == OverloadPolicy::kBlock) {
+        admitted = work_thread.WaitAdmit(req_num, bytes, max_pending_requests, max_pending_bytes,
+                                         overload_block_timeout_ms);
+    }
+    if (!admitted) {
+        if (!work_thread.request_queue.IsClosed()) {
+            work_thread.rejected_num.fetch_add(1, std::memory_order_relaxed);
+        }
+        return false;
+    }
+
+    for (size_t idx = 0; idx < req_num; ++idx) {
+        reqs[idx]->admitted_thread = &work_thread;
+    }
+    return true;
+}
+
+size_t AsyncRedisClient::SelectWorkThread() noexcept {
+    unsigned int sn = seq_num.fetch_add(1, std::memory_order_relaxed);
+    if (!node_threads_.empty()) {
+        int cpu = GetCurrentCpu();
+        if (cpu >= 0 && static_cast<size_t>(cpu) < cpu_nodes_.size()) {
+            int node = cpu_nodes_[cpu];
+            if (node >= 0 && static_cast<size_t>(node) < node_threads_.size() && !node_threads_[node].empty()) {
+                const std::vector<size_t> &local_threads = node_threads_[node];
+                return local_threads[sn % local_threads.size()];
+            }
+        }
+    }
+    return sn % thread_num;
+}
+
+void AsyncRedisClient::Execute(std::vector<request_ptr_t> &reqs) {
+    // 不变量 2: reqs 中的元素要么都为空, 要么都不为空. 参见 Execute(request_ptr_t &) 中的不变量 1.
+    if (collect_command_latency) {
+        uint64_t now_tsc = TscClock::Now();
+        for (request_ptr_t &req : reqs) {
+            req->submit_tsc = now_tsc;
+        }
+    }
+
+    // ExecuteInline() 要么对所有请求都返回 true, 要么都返回 false.
+    bool all_inline = true;
+    for (request_ptr_t &req : reqs) {
+        all_inline = ExecuteInline(req) && all_inline;
+    }
+    if (all_inline) {
+        return ;
+    }
+
+    bool overloaded = false;
+    auto AddTo = [&] (std::vector<WorkThread>::iterator iter) noexcept -> int {
+        try {
+            if (!Admit(*iter, reqs.data(), reqs.size())) {
+                // work thread 已经停止, 同压入失败.
+                if (iter->request_queue.IsClosed()) {
+                    return 0;
+                }
+                overloaded = true;
+                return overload_policy != OverloadPolicy::kTryOtherThread;
+            }
+            iter->AddRequests(reqs);
+            if (reqs.front()) {
+                for (request_ptr_t &req : reqs) {
+                    req->ReleaseCapacity();
+                }
+                return 0;
+            }
+            return 1;
+        } catch (...) {
+            return 0;
+        }
+    };
+
+    LoopbackTraverse(work_threads_->begin(), work_threads_->end(), work_threads_->begin() + SelectWorkThread(), AddTo);
+
+    if (reqs.front()) {
+        if (overloaded) {
+            THROW(EBUSY, "OVERLOADED; req_num: %zu", reqs.size());
+        }
+        throw std::runtime_error("EXECUTE ERROR");
+    }
+
+    return ;
+}
+
+void AsyncRedisClient::Execute(request_ptr_t &req) {
     /* 不变量 1:
      * - 若 req 为空 <---> 表明 req 已经成功地交给某个 work thread 了.
      * - 若 req 不为空 <---> 表明 req 尚未成功地交给任何一个 work thread.
@@ -542,26 +3462,48 @@ void AsyncRedisClient::Execute(std::unique_ptr<RedisRequest> &req) {
      */
     auto DoAddTo = [&] (WorkThread &work_thread) {
         work_thread.AddRequest(req);
-        if (!req) {
-            work_thread.AsyncSend();
-        }
         return ;
     };
 
+    if (collect_command_latency) {
+        req->submit_tsc = TscClock::Now();
+    }
+    if (RouteByKey(req) || ExecuteInline(req)) {
+        return ;
+    }
+
+    /* 容量已满时, 除了 kTryOtherThread 之外都不再尝试其他 work thread. 压入失败时归还容量, 使得 req 在尝试下一个
+     * work thread 之前保持不变.
+     */
+    bool overloaded = false;
     auto AddTo = [&] (std::vector<WorkThread>::iterator iter) noexcept -> int {
         try {
+            if (!Admit(*iter, &req, 1)) {
+                // work thread 已经停止, 同压入失败.
+                if (iter->request_queue.IsClosed()) {
+                    return 0;
+                }
+                overloaded = true;
+                return overload_policy != OverloadPolicy::kTryOtherThread;
+            }
             DoAddTo(*iter);
-            return (!req);
+            if (req) {
+                req->ReleaseCapacity();
+                return 0;
+            }
+            return 1;
         } catch (...) {
             return 0;
         }
     };
 
-    unsigned int sn = seq_num.fetch_add(1, std::memory_order_relaxed);
-    sn %= thread_num;
-    LoopbackTraverse(work_threads_->begin(), work_threads_->end(), work_threads_->begin() + sn, AddTo);
+    size_t begin_idx = req->key_thread != RedisRequest::kNoKeyThread ? req->key_thread : SelectWorkThread();
+    LoopbackTraverse(work_threads_->begin(), work_threads_->end(), work_threads_->begin() + begin_idx, AddTo);
 
     if (req) {
+        if (overloaded) {
+            THROW(EBUSY, "OVERLOADED;");
+        }
         throw std::runtime_error("EXECUTE ERROR");
     }
 
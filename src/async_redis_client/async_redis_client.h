@@ -6,13 +6,23 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <map>
 #include <functional>
+#include <utility>
 #include <future>
 #include <thread>
+#include <type_traits>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <iostream>
 
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define ASYNC_REDIS_CLIENT_HAS_COROUTINE 1
+#include <coroutine>
+#include <array>
+#endif
+
 #include <concurrent/mutex.h>
 #include <exception/errno_exception.h>
 
@@ -20,16 +30,42 @@
 #include <hiredis/hiredis.h>
 #include <uv.h>
 
+#include "async_redis_client/mpsc_queue.h"
+#include "async_redis_client/object_pool.h"
+#include "async_redis_client/resp_encoder.h"
+#include "async_redis_client/timer_wheel.h"
+#include "async_redis_client/reply_arena.h"
+#include "async_redis_client/tsc_clock.h"
+#include "async_redis_client/command_latency.h"
+#include "async_redis_client/unique_function.h"
+#include "async_redis_client/near_cache.h"
+#include "async_redis_client/shared_reply.h"
 
 
-struct RedisReplyDeleter {
-    void operator()(redisReply *reply) noexcept {
-        freeReplyObject(reply);
-        return ;
-    }
-};
-
 struct AsyncRedisClient {
+    /* work thread 为请求选择连接的策略.
+     *
+     * kRoundRobin, 依次选择.
+     * kLeastOutstanding, 选择尚未收到响应的请求数目最少的连接.
+     * kPowerOfTwoChoices, 随机选择两个连接, 然后选择其中尚未收到响应的请求数目较少的那个.
+     */
+    enum class ConnSelectPolicy : unsigned int {
+        kRoundRobin = 0,
+        kLeastOutstanding,
+        kPowerOfTwoChoices
+    };
+
+    /* work thread 的容量已满时 Execute() 的行为, 参见 max_pending_requests.
+     *
+     * kFailFast, 抛出异常.
+     * kBlock, 阻塞调用者直至有请求结束, 最多等待 overload_block_timeout_ms, 0 表示一直等待; 超时之后抛出异常.
+     * kTryOtherThread, 依次尝试其他 work thread, 都已满时抛出异常.
+     */
+    enum class OverloadPolicy : unsigned int {
+        kFailFast = 0,
+        kBlock,
+        kTryOtherThread
+    };
 
     // 调用 Start() 之后, 这些值将只读.
     std::string host;
@@ -38,10 +74,186 @@ struct AsyncRedisClient {
 
     size_t thread_num = 1;
     size_t conn_per_thread = 3;
+    ConnSelectPolicy conn_select_policy = ConnSelectPolicy::kRoundRobin;
+
+    /* 集群模式. 此时 host:port 为集群中的任一节点, 每个 work thread 通过 CLUSTER SLOTS 获取集群拓扑, 并为每个
+     * master 节点建立 conn_per_thread 个连接. 请求根据其 key 所属的 hash slot 发送到对应节点, MOVED, ASK
+     * 重定向会被透明地处理.
+     *
+     * 请求的 key 为第 1 个参数, EVAL, EVALSHA 则为第 3 个参数. 涉及多个 key 的请求需要通过 {hashtag} 确保这些
+     * key 位于同一个 slot. 没有 key 的请求发送到 host:port.
+     *
+     * cluster_refresh_interval_ms, 后台刷新集群拓扑的周期. 收到 MOVED 时也会触发一次刷新.
+     */
+    bool cluster_mode = false;
+    uint32_t cluster_refresh_interval_ms = 5000;
+
+    /* 若为 true, 则每个响应都被构建在一个可复用的 arena 中, 参见 ReplyArena. 对于元素较多的响应, 可以省去
+     * hiredis 为每个元素, 每个字符串所做的 malloc(), free().
+     *
+     * 启用之后, 回调中的 reply 及其元素只在回调返回之前有效; 若需要在回调之后继续持有, 只能通过 TakeReply()
+     * 取得整个 reply, 不能再自行移动其中的元素.
+     */
+    bool use_reply_arena = false;
+
+    /* 若为 true, 则为每个请求记录 Execute(), work thread 取出请求, 交给 hiredis, 收到响应, 回调结束这几个时间点,
+     * 并按照命令名汇总为各阶段的延迟分布, 参见 GetCommandLatency(). 时间戳基于 TscClock, 每个请求的额外开销
+     * 只是几次 rdtsc 以及直方图的更新.
+     */
+    bool collect_command_latency = false;
+
+    /* 若为 true, 则按照 RESP 编码估算每个响应的长度, 累加到 ThreadStat::bytes_read. 估算需要在 work thread 中遍历
+     * 整个响应, 对于元素较多的数组响应开销明显, 因此默认不统计, 此时 bytes_read 为 0.
+     */
+    bool collect_bytes_read = false;
+
+    /* CPU 亲和性. 若不为空, 则第 i 个 work thread 被绑定到 thread_cpus[i % thread_cpus.size()] 中的 CPU 上;
+     * 绑定失败时 work thread 照常运行, 参见 ThreadStat::bind_fail_num.
+     *
+     * 绑定发生在 work thread 创建 uv_loop, 建立连接, 从 ObjectPool 中取对象之前, 因此在 Linux 默认的 first-touch
+     * 策略下, 这些内存以及 hiredis 的读写缓冲区都分配在 work thread 所在的 NUMA 节点上.
+     */
+    std::vector<std::vector<int>> thread_cpus;
+
+    /* 若为 true, 则 Execute() 优先将请求交给与调用者位于同一 NUMA 节点的 work thread, 这些 work thread 都不可用
+     * 时才交给其他 work thread. work thread 所在的节点由 thread_cpus 中的第一个 CPU 决定, 因此需要与
+     * thread_cpus 一起使用.
+     *
+     * cpu_nodes[cpu] 为 cpu 所在的 NUMA 节点, 为空时从 sysfs 中读取. 主要用于在单节点的机器上模拟多节点的拓扑.
+     */
+    bool numa_aware_routing = false;
+    std::vector<int> cpu_nodes;
+
+    /* 每个 work thread 的容量, 0 表示不限制. 容量由已经提交但尚未结束的请求占用, 包括仍在请求队列中, 以及已经
+     * 发送但尚未收到响应的请求; max_pending_bytes 按照请求的 RESP 编码长度计算. 当 redis 变慢或者不可用时,
+     * 借此限制积压的请求所占用的内存以及排队的时间, 超出时的行为由 overload_policy 决定.
+     *
+     * 单个请求的长度超过 max_pending_bytes, 或者 batch 的请求数目超过 max_pending_requests 时, 只要 work thread
+     * 上没有其他请求, 仍然可以提交.
+     *
+     * 在 work thread 中调用 Execute() 时不会阻塞, 也不会尝试其他 work thread, 容量已满时在下一轮事件循环中以
+     * nullptr 回调.
+     */
+    size_t max_pending_requests = 0;
+    size_t max_pending_bytes = 0;
+    OverloadPolicy overload_policy = OverloadPolicy::kFailFast;
+    uint32_t overload_block_timeout_ms = 0;
+
+    /* ReplyFuture 在进入 futex 等待之前自旋的时间, 0 表示不自旋. 对于 redis 位于本机或者同机房, 响应通常在
+     * 数十 us 内到达的场景, 自旋可以省去一次睡眠与唤醒.
+     */
+    uint32_t sync_spin_us = 0;
+
+    /* near cache, 即客户端缓存. near_cache_max_bytes 为所有 work thread 上缓存的总容量, 0 表示不启用, 按照近似
+     * LRU 淘汰. 需要 redis 6.0 及以上, 不支持 cluster_mode.
+     *
+     * 缓存 GET key, HGET key field, HGETALL key 的响应. 这类请求按照 key 交给固定的 work thread, 由其缓存响应;
+     * Execute() 先在该 work thread 的缓存中查找, 命中时直接在调用者线程中以缓存的响应回调, 不会经过请求队列.
+     * 命中时的 reply 与缓存共享, 是只读的, TakeReply() 只会增加其引用计数. 以 RespFrame, ExecuteBatch() 提交的
+     * 请求不使用缓存.
+     *
+     * 失效基于 CLIENT TRACKING 的 REDIRECT 模式: 每个 work thread 额外建立一个连接订阅 __redis__:invalidate,
+     * 并在其数据连接上开启 CLIENT TRACKING, 将失效消息重定向到该连接, 失效消息在 work thread 中处理. 任一连接
+     * 断开时, 失效消息可能已经丢失, 此时清空该 work thread 的缓存.
+     *
+     * 失效消息与写请求的响应经由不同的连接到达, 因此本客户端已知的 string, hash 写命令, 比如 SET, HSET, DEL,
+     * MSET, 完成时还会直接删除其 key 的缓存. 缓存只由所属的 work thread 修改: 单 key 的写请求同样按照 key 交给
+     * 该 work thread, 在回调之前删除, 使得在回调之后发起的读请求能够读到这次写入; 多 key 写请求中属于其他
+     * work thread 的 key 则异步地交给所属的 work thread 删除. 其他命令, EVAL, MULTI/EXEC 中的写入, 以及其他
+     * 客户端的写入, 仍然只能在失效消息到达之后才可见.
+     *
+     * near_cache_bcast, 是否使用 BCAST 模式, 此时 near_cache_prefixes 会作为 PREFIX 传给 redis. 无论哪种模式,
+     * near_cache_prefixes 不为空时, 都只缓存 key 以其中之一开头的请求.
+     */
+    size_t near_cache_max_bytes = 0;
+    bool near_cache_bcast = false;
+    std::vector<std::string> near_cache_prefixes;
+
+    /* 若为 true, 则合并相同的只读请求, 如 GET, HGET, HGETALL, MGET, LRANGE 等. 这类请求按照 key 交给固定的
+     * work thread, 若 work thread 上已经有参数完全相同并且尚未收到响应的请求, 则新的请求不再发送, 而是等待前者
+     * 的响应, 参见 ThreadStat::coalesced_num. 以 RespFrame, ExecuteBatch() 提交的请求不会被合并.
+     *
+     * 被合并的请求共享同一个响应, 不会拷贝: 回调中的 reply 是只读的, TakeReply() 只会增加其引用计数. 各个请求的
+     * 超时时间仍然各自生效.
+     */
+    bool coalesce_reads = false;
+
+    /* 若为 true, 则 work thread 每次从 request_queue 中取走请求时, 暂存相邻的 HGET key field, 再将其中同一个 key
+     * 上的 HGET 合并为一个 HMGET, 收到数组响应之后再将各个元素分别回调给原来的请求. 参见 ThreadStat::merged_num.
+     *
+     * 遇到其他请求时, 之前暂存的请求会先被发送, 因此与其他请求之间的发送顺序不变; 同一个 key 上的 HGET 之间的
+     * 顺序也不变, 但暂存的不同 key 上的 HGET 按照 key 排序之后发送, 它们之间的顺序可能改变. merge_max_keys 限制
+     * 的是暂存的 HGET 的总数, 而不是每个 HMGET 的 field 数目: 暂存的 HGET 达到 merge_max_keys 个时, 即使分属
+     * 不同的 key, 也会立即全部发送.
+     *
+     * 与 coalesce_reads 相同, 回调中的 reply 与同一个 HMGET 中的其他请求共享, 是只读的. 以 RespFrame,
+     * ExecuteBatch() 提交的请求, 以及可以被缓存或者被合并的请求不会被合并. 集群模式下 merge_reads 不生效.
+     *
+     * merge_gets, 若同时为 true, 则相邻的 GET key 也会被合并为一个 MGET, 同样最多暂存 merge_max_keys 个; 暂存的
+     * GET 在 HGET 之前发送, 因此与交错的 HGET 之间的顺序可能改变. 注意这会改变错误语义: 对于类型不是
+     * string 的 key, GET 返回 WRONGTYPE 错误, 而 MGET 中对应的元素是 nil, 回调无法区分 "key 不存在" 与 "类型
+     * 错误". 只有确定所有 GET 的 key 都是 string, 或者不关心这一区别时才应该启用. HGET 没有这个问题, HMGET 对于
+     * 类型错误的 key 同样返回 WRONGTYPE.
+     */
+    bool merge_reads = false;
+    bool merge_gets = false;
+    size_t merge_max_keys = 64;
+
+    /* 执行回调的 executor. 默认情况下回调直接在 work thread 中执行, 一个耗时的回调会推迟同一个 work thread 上
+     * 所有连接的读写. 若设置了 callback_executor, 则 work thread 在每一轮事件循环的末尾, 将这一轮完成的请求连同
+     * 响应的所有权作为一个 CompletionBatch 交给 callback_executor->Post(), 此后 work thread 只负责网络读写与
+     * 解析. callback_executor 不归 AsyncRedisClient 所有, 需要保持有效直至 Join(), Stop() 返回. Join(), Stop()
+     * 会等待所有已经交给 callback_executor 的 batch 执行完毕之后才返回, 因此不能在执行 batch 的线程中调用它们,
+     * callback_executor 也不能丢弃 batch 而不析构.
+     *
+     * 同一个 batch 中的回调按照完成的顺序执行; 不同 batch 之间的顺序由 callback_executor 决定, 若需要同一个
+     * work thread 上的回调按照完成的顺序执行, 则 executor 应该按照 CompletionBatch::thread_idx() 将 batch 串行
+     * 执行.
+     *
+     * 若未设置 callback_executor 并且 callback_thread_num 大于 0, 则 Start() 会创建一个具有 callback_thread_num
+     * 个线程的内置线程池, 其在 Join(), Stop() 返回之前执行完所有回调. 内置线程池将每个 work thread 固定交给其中
+     * 一个线程, 因此同一个 work thread 上的回调按照完成的顺序串行执行, 回调线程多于 thread_num 时多余的线程空闲.
+     *
+     * 回调中仍然可以通过 TakeReply() 取走 reply, 不会拷贝. ExecuteSync(), co_await Async(), ExecuteBatch() 以及
+     * near cache 命中时的回调不经过 executor. 参见 ThreadStat::deferred_num.
+     */
+    class CallbackExecutor;
+    CallbackExecutor *callback_executor = nullptr;
+    size_t callback_thread_num = 0;
+
+    /* 重新连接. 就绪过的连接断开之后立即重新连接; 连接连续失败(未能建立, 或者在就绪之前断开)时, 第 n 次重新
+     * 连接之前等待 min(reconnect_max_delay_ms, reconnect_min_delay_ms * 2^(n-1)), 并在其 1/2 到 1 倍之间随机
+     * 抖动, 以免 redis 不可用时各个连接同时重试. 连接就绪之后重新计数.
+     *
+     * 若 max_retry_num 大于 0, 则因为连接断开而以 nullptr 结束的幂等请求会被重新发送到其他可用的连接, 最多
+     * max_retry_num 次, 期间截止时间仍然有效. 命令名(不区分大小写)位于 idempotent_commands 中的请求视为幂等;
+     * 其他已经写入连接但尚未收到响应的请求仍然以 nullptr 回调, 因为无法确定 redis 是否已经执行过. 以 RespFrame,
+     * ExecuteBatch() 提交的请求不会被重试. 参见 ThreadStat::retry_num.
+     */
+    uint32_t reconnect_min_delay_ms = 10;
+    uint32_t reconnect_max_delay_ms = 1000;
+    uint32_t max_retry_num = 0;
+    std::vector<std::string> idempotent_commands{
+        "GET", "MGET", "HGET", "HMGET", "HGETALL", "HEXISTS", "HLEN", "EXISTS", "STRLEN", "TTL", "PTTL", "TYPE",
+        "LRANGE", "LLEN", "LINDEX", "SMEMBERS", "SISMEMBER", "SCARD", "ZRANGE", "ZSCORE", "ZCARD", "ZRANK", "PING"
+    };
 
 public:
     using req_callback_t = std::function<void(redisReply *reply)/* noexcept */>;
+
+    /* 只可移动的回调, 捕获不超过 UniqueFunction::kInlineSize 字节时没有任何内存分配. 除了 req_callback_t 之外的
+     * 可调用对象, 如 lambda, 都会直接被存放在 unique_callback_t 中, 不会再经过 std::function.
+     */
+    using unique_callback_t = UniqueFunction<void(redisReply *reply)/* noexcept */>;
     using redisReply_unique_ptr_t = std::unique_ptr<redisReply, RedisReplyDeleter>;
+    using batch_callback_t = std::function<void(std::vector<redisReply_unique_ptr_t> &replies)/* noexcept */>;
+
+private:
+    // req_callback_t 仍然使用原有的重载, 以免与之产生歧义.
+    template <typename Callback>
+    using EnableIfUniqueCallback = typename std::enable_if<
+        !std::is_same<typename std::decay<Callback>::type, req_callback_t>::value &&
+        std::is_constructible<unique_callback_t, Callback&&>::value, int>::type;
 
 public:
     ~AsyncRedisClient() noexcept;
@@ -55,6 +267,17 @@ public:
      */
     void Start();
 
+    /**
+     * 同 Start(), 但是在返回之前等待至少 min_ready_conn_num 个到 host:port 的连接就绪(已经连接并且通过了
+     * AUTH), 或者 timeout_ms 到期. 返回时已经就绪的连接数目, 超时时可能小于 min_ready_conn_num.
+     *
+     * 若在此期间有连接因为密码错误而 AUTH 失败, 则 Stop() 并抛出异常, 此时 AsyncRedisClient 恢复到初始状态.
+     * AUTH 返回的其他错误, 比如 LOADING, 只会使该连接退避之后重新连接.
+     *
+     * 所有 work thread 上的连接都是同时发起的, 因此等待时间大致是一次建立连接与 AUTH 的耗时.
+     */
+    size_t Start(size_t min_ready_conn_num, uint64_t timeout_ms);
+
     /* 只有这里的方法才是线程安全的.
      * 意味着可以在不同的线程同时调用 `Stop()`, 或者 `Execute()`. 但是不能在一个线程中调用 `Stop()`, 另外一个线程
      * 调用 `~AsyncRedisClient()`.
@@ -92,45 +315,279 @@ public:
      *
      * callback() MUST noexcept, 若 callback() 抛出了异常, 则会直接 std::terminate().
      *
+     * timeout_ms, 请求的超时时间, 自调用 Execute() 时开始计算, 0 表示不超时. 若请求在超时之前未完成, 则以
+     * nullptr 调用 callback, 此后即使收到了响应也会被丢弃. 尚未发送的请求若已经超时, 则不会再被发送.
+     *
+     * 在回调中, 即在 work thread 中调用 Execute() 时, 请求直接在当前 work thread 的连接上发送, 不再经过请求队列
+     * 与跨线程唤醒. 此时若请求无法发送, Execute() 不会抛出异常, 而是在下一轮事件循环中以 nullptr 调用 callback,
+     * 因此在回调中重试失败的请求不会无限递归.
+     * 注意不要在 work thread 中等待 Execute() 返回的 future, 这会使得 work thread 死锁.
+     *
+     * 设置了 max_pending_requests, max_pending_bytes 时, 若 work thread 的容量已满, 则按照 overload_policy 处理.
+     *
+     * 启用 near cache 时, 命中缓存的请求在 Execute() 返回之前就已经在当前线程中回调, 参见 near_cache_max_bytes.
+     *
      * TODO(ppqq): 增加 host, port 参数, 表明在指定的 redis 实例上执行请求.
-     * TODO(ppqq): 增加超时参数. 当超时时, 以 nullptr reply 调用回调. 倒是可以通过 future.wait() 来实现超时.
      */
-    void Execute(const std::vector<std::string> &cmd, const req_callback_t &cb) {
-        std::unique_ptr<RedisRequest> req(new RedisRequest(cmd, cb));
+    void Execute(const std::vector<std::string> &cmd, const req_callback_t &cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(cmd, cb, timeout_ms));
         Execute(req);
         return ;
     }
 
-    void Execute(const std::vector<std::string> &cmd, req_callback_t &&cb) {
-        std::unique_ptr<RedisRequest> req(new RedisRequest(cmd, std::move(cb)));
+    void Execute(const std::vector<std::string> &cmd, req_callback_t &&cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(cmd, std::move(cb), timeout_ms));
         Execute(req);
         return ;
     }
 
-    void Execute(std::vector<std::string> &&cmd, const req_callback_t &cb) {
-        std::unique_ptr<RedisRequest> req(new RedisRequest(std::move(cmd), cb));
+    void Execute(std::vector<std::string> &&cmd, const req_callback_t &cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(cmd), cb, timeout_ms));
         Execute(req);
         return ;
     }
 
-    void Execute(std::vector<std::string> &&cmd, req_callback_t &&cb) {
-        std::unique_ptr<RedisRequest> req(new RedisRequest(std::move(cmd), std::move(cb)));
+    void Execute(std::vector<std::string> &&cmd, req_callback_t &&cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(cmd), std::move(cb), timeout_ms));
         Execute(req);
         return ;
     }
 
     void Execute(const std::shared_ptr<std::vector<std::string>> &request,
-                 const std::shared_ptr<req_callback_t> &callback) {
-        Execute(*request, *callback);
+                 const std::shared_ptr<req_callback_t> &callback,
+                 uint32_t timeout_ms = 0) {
+        Execute(*request, *callback, timeout_ms);
+        return ;
+    }
+
+    /* 以 lambda 等可调用对象作为回调时使用这里的重载, 回调被直接存放在请求中, 不要求可以拷贝. 语义同上.
+     */
+    template <typename Callback, EnableIfUniqueCallback<Callback> = 0>
+    void Execute(const std::vector<std::string> &cmd, Callback &&cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(cmd, unique_callback_t(std::forward<Callback>(cb)), timeout_ms));
+        Execute(req);
+        return ;
+    }
+
+    template <typename Callback, EnableIfUniqueCallback<Callback> = 0>
+    void Execute(std::vector<std::string> &&cmd, Callback &&cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(cmd), unique_callback_t(std::forward<Callback>(cb)), timeout_ms));
+        Execute(req);
+        return ;
+    }
+
+    std::future<redisReply_unique_ptr_t> Execute(const std::shared_ptr<std::vector<std::string>> &request,
+                                                 uint32_t timeout_ms = 0) {
+        return Execute(*request, timeout_ms);
+    }
+
+    std::future<redisReply_unique_ptr_t> Execute(const std::vector<std::string> &cmd, uint32_t timeout_ms = 0);
+    std::future<redisReply_unique_ptr_t> Execute(std::vector<std::string> &&cmd, uint32_t timeout_ms = 0);
+
+    /**
+     * 执行一个已经编码好的请求, 语义与上面的 Execute() 一致.
+     *
+     * frame 的内容会被原样追加到连接的输出缓冲区中, 不会再次编码. 调用者需要确保 frame 中是一个合法的 RESP
+     * 请求, 参见 RespEncoder.
+     */
+    void Execute(RespFrame &&frame, const req_callback_t &cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(frame), cb, timeout_ms));
+        Execute(req);
+        return ;
+    }
+
+    void Execute(RespFrame &&frame, req_callback_t &&cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(frame), std::move(cb), timeout_ms));
+        Execute(req);
         return ;
     }
 
-    std::future<redisReply_unique_ptr_t> Execute(const std::shared_ptr<std::vector<std::string>> &request) {
-        return Execute(*request);
+    template <typename Callback, EnableIfUniqueCallback<Callback> = 0>
+    void Execute(RespFrame &&frame, Callback &&cb, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(frame), unique_callback_t(std::forward<Callback>(cb)), timeout_ms));
+        Execute(req);
+        return ;
+    }
+
+    std::future<redisReply_unique_ptr_t> Execute(RespFrame &&frame, uint32_t timeout_ms = 0);
+
+    struct RedisRequest;
+
+    /**
+     * ExecuteSync() 的结果, 只可移动.
+     *
+     * 与 std::future 不同, ReplyFuture 的状态就存放在请求对象中, 请求对象来自 ObjectPool, 因此除了 reply 本身
+     * 之外没有任何内存分配. 响应由 TakeReply() 交给 ReplyFuture, 不会拷贝 reply 的内容. 等待基于 futex,
+     * 可以通过 sync_spin_us 在睡眠之前先自旋一段时间.
+     *
+     * 不要在 work thread 中等待 ReplyFuture, 这会使得 work thread 死锁.
+     */
+    class ReplyFuture {
+    public:
+        ReplyFuture() noexcept = default;
+        ~ReplyFuture() noexcept;
+
+        ReplyFuture(ReplyFuture &&other) noexcept:
+            req_(other.req_),
+            spin_us_(other.spin_us_) {
+            other.req_ = nullptr;
+        }
+
+        ReplyFuture& operator=(ReplyFuture &&other) noexcept;
+
+        ReplyFuture(const ReplyFuture &) = delete;
+        ReplyFuture& operator=(const ReplyFuture &) = delete;
+
+        bool Valid() const noexcept {
+            return req_ != nullptr;
+        }
+
+        // 请求是否已经结束, 不会阻塞.
+        bool IsReady() const noexcept;
+
+        void Wait() const noexcept;
+
+        /* 最多等待 timeout_ms. 若请求在此之前结束, 则返回 true. 超时之后请求仍在进行, 可以再次等待; 若不再关心
+         * 其结果, 直接析构 ReplyFuture 即可.
+         */
+        bool WaitFor(uint32_t timeout_ms) const noexcept;
+
+        /* 等待请求结束并取走响应. 若请求未被成功处理, 或者 TakeReply() 失败, 则返回空. 之后 Valid() 为 false.
+         */
+        redisReply_unique_ptr_t Get() noexcept;
+
+    private:
+        friend struct AsyncRedisClient;
+
+        RedisRequest *req_ = nullptr;
+        uint32_t spin_us_ = 0;
+
+    private:
+        ReplyFuture(RedisRequest *req, uint32_t spin_us) noexcept:
+            req_(req),
+            spin_us_(spin_us) {
+        }
+
+        void Release() noexcept;
+    };
+
+    /**
+     * 一批已经完成的请求, 参见 callback_executor. 持有请求对象以及响应的所有权, 只可移动.
+     *
+     * Run() 按照完成的顺序依次执行各个请求的回调, 然后释放请求与响应, 可以在任意线程中调用. 若析构时尚未 Run(),
+     * 则在析构时执行, 因此每个回调总是恰好被执行一次.
+     */
+    class CompletionBatch {
+    public:
+        CompletionBatch() noexcept = default;
+
+        /* 由 work thread 使用, requests 为通过 next 串联的 size 个请求. 计入 client 的 outstanding_batch_num_, 直至
+         * Run(), 参见 callback_executor.
+         */
+        CompletionBatch(AsyncRedisClient *client, size_t thread_idx, RedisRequest *requests, size_t size) noexcept;
+
+        ~CompletionBatch() noexcept {
+            Run();
+        }
+
+        CompletionBatch(CompletionBatch &&other) noexcept:
+            client_(other.client_),
+            thread_idx_(other.thread_idx_),
+            requests_(other.requests_),
+            size_(other.size_) {
+            other.client_ = nullptr;
+            other.requests_ = nullptr;
+            other.size_ = 0;
+        }
+
+        CompletionBatch& operator=(CompletionBatch &&other) noexcept {
+            if (this != &other) {
+                Run();
+                std::swap(client_, other.client_);
+                std::swap(thread_idx_, other.thread_idx_);
+                std::swap(requests_, other.requests_);
+                std::swap(size_, other.size_);
+            }
+            return *this;
+        }
+
+        CompletionBatch(const CompletionBatch &) = delete;
+        CompletionBatch& operator=(const CompletionBatch &) = delete;
+
+        size_t size() const noexcept {
+            return size_;
+        }
+
+        // 产生该 batch 的 work thread 的下标, 同 ThreadStat::thread_idx.
+        size_t thread_idx() const noexcept {
+            return thread_idx_;
+        }
+
+        void Run() noexcept;
+
+    private:
+        AsyncRedisClient *client_ = nullptr;
+        size_t thread_idx_ = 0;
+        RedisRequest *requests_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    class CallbackExecutor {
+    public:
+        virtual ~CallbackExecutor() = default;
+
+        /* 在 work thread 中调用, MUST noexcept 并且线程安全, 不应该阻塞. 之后需要在某个线程中执行 batch.Run(),
+         * 或者直接析构 batch.
+         */
+        virtual void Post(CompletionBatch &&batch) noexcept = 0;
+    };
+
+    /**
+     * 执行一个请求并返回 ReplyFuture, 语义同 Execute(). 若该函数抛出异常, 则表明请求不会被执行.
+     */
+    ReplyFuture ExecuteSync(const std::vector<std::string> &cmd, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(cmd, nullptr, timeout_ms));
+        return ExecuteSync(req);
+    }
+
+    ReplyFuture ExecuteSync(std::vector<std::string> &&cmd, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(cmd), nullptr, timeout_ms));
+        return ExecuteSync(req);
     }
 
-    std::future<redisReply_unique_ptr_t> Execute(const std::vector<std::string> &cmd);
-    std::future<redisReply_unique_ptr_t> Execute(std::vector<std::string> &&cmd);
+    ReplyFuture ExecuteSync(RespFrame &&frame, uint32_t timeout_ms = 0) {
+        request_ptr_t req(NewRequest(std::move(frame), nullptr, timeout_ms));
+        return ExecuteSync(req);
+    }
+
+    /**
+     * 批量执行 cmds 中的请求.
+     *
+     * cmds 会作为一个整体交给同一个 work thread, 并在同一个连接上连续地写出. 当所有请求都完成之后, 以 replies
+     * 调用一次 callback, 此时 replies.size() == cmds.size(), replies[i] 为 cmds[i] 的响应; 若 cmds[i] 未被成功
+     * 处理, 则 replies[i] 为空. callback 可以将 replies 中的元素 move 走, 剩余的响应会在 callback 返回之后释放.
+     *
+     * 若该函数抛出异常, 则表明 cmds 中的请求都不会被执行.
+     *
+     * timeout_ms 作用于 batch 中的每个请求, 超时的请求其 replies[i] 为空, 语义同 Execute().
+     *
+     * callback() MUST noexcept.
+     */
+    void ExecuteBatch(std::vector<std::vector<std::string>> cmds, batch_callback_t callback, uint32_t timeout_ms = 0);
+    std::future<std::vector<redisReply_unique_ptr_t>> ExecuteBatch(std::vector<std::vector<std::string>> cmds,
+                                                                   uint32_t timeout_ms = 0);
+
+    /**
+     * 在回调中调用, 取得 reply 的所有权, 使得其在回调返回之后仍然有效. reply 必须是传给回调的参数本身, 不能是
+     * 其中的元素.
+     *
+     * 若 reply 由 ReplyArena 构建, 则直接接管整个 arena, 没有任何拷贝与内存分配; 否则会 malloc() 一个新的根节点
+     * 并将 reply 的内容移动过去, 此后 reply 变为 REDIS_REPLY_NIL. 若返回空, 则表明内存不足, 此时 reply 保持不变.
+     *
+     * 若 reply 被多个合并的请求共享, 参见 coalesce_reads, 或者来自 near cache, 则只增加引用计数, 返回的 reply 与
+     * 其他请求共享, 只读.
+     */
+    static redisReply_unique_ptr_t TakeReply(redisReply *reply) noexcept;
 
 
 /* 本来这些都是 private 就行了.
@@ -154,9 +611,132 @@ public:
         kRunning
     };
 
+    /* ExecuteBatch() 提交的一批请求. batch 中的每个请求都对应着一个 RedisRequest 对象, 这些对象都由同一个
+     * work thread 处理, 因此 RedisBatch 只会在该 work thread 中被访问.
+     */
+    struct RedisBatch {
+        static constexpr size_t kNoConn = static_cast<size_t>(-1);
+
+        batch_callback_t callback;
+        std::vector<redisReply_unique_ptr_t> replies;
+        size_t pending_num = 0;
+
+        // batch 中请求所使用的连接在 work thread 中的下标, 当 batch 中第一个请求被发送时确定.
+        size_t conn_idx = kNoConn;
+
+    public:
+        /* batch 中第 idx 个请求完成. 当所有请求都完成时, 调用 callback 并 delete this.
+         *
+         * reply 为 nullptr 表明请求未被成功处理.
+         */
+        void OnReply(size_t idx, redisReply *reply) noexcept;
+    };
+
+    // 仅在 work thread 内部使用, 定义在 async_redis_client.cc 中.
+    struct RedisConnectionContext;
+    struct WorkThreadContext;
+    struct ClusterNode;
+
+    struct WorkThread;
+
     struct RedisRequest {
         std::vector<std::string> cmd;
-        req_callback_t callback;
+        unique_callback_t callback;
+
+        // 若不为空, 则表明请求已经编码好了, 此时忽略 cmd.
+        RespFrame frame;
+
+        // 若不为 nullptr, 则表明当前请求是 batch 中第 idx_in_batch 个请求, 此时忽略 callback.
+        RedisBatch *batch = nullptr;
+        size_t idx_in_batch = 0;
+
+        // 以下字段由 work thread 在发送请求时设置. bytes 为请求编码之后的长度, conn 为发送请求所使用的连接.
+        size_t bytes = 0;
+        RedisConnectionContext *conn = nullptr;
+
+        /* 截止时间, 基于 GetMonotonicMs(), 0 表示不超时. 请求发送之后, timer_node 被放入 work thread 的时间轮
+         * 中; 若到期时仍未收到响应, 则 TimeOut(), 此时 timed_out 为 true, 之后收到的响应会被丢弃.
+         */
+        uint64_t deadline_ms = 0;
+        TimerWheelNode timer_node;
+        bool timed_out = false;
+
+        /* 为 true 表明请求在等待连接就绪, 位于 WorkThreadContext::parked_requests 中, 此时 timer_node 同样在时间轮中.
+         * 等待期间超时的请求同样 TimeOut(), 在离开 parked_requests 时被释放.
+         */
+        bool parked = false;
+
+        // 集群模式下已经被重定向的次数.
+        uint8_t redirect_num = 0;
+
+        // 因为连接断开而被重新发送的次数, 参见 max_retry_num.
+        uint32_t retry_num = 0;
+
+        /* 各阶段的时间戳, 基于 TscClock, 只在 collect_command_latency 时设置. submit_tsc 为 0 表示不统计.
+         * 重定向之后 send_tsc 为最后一次发送的时间.
+         */
+        uint64_t submit_tsc = 0;
+        uint64_t dequeue_tsc = 0;
+        uint64_t send_tsc = 0;
+
+        // 由 WorkThread::request_queue 使用.
+        RedisRequest *next = nullptr;
+
+        /* 请求在 admitted_thread 上占用的容量, admitted_bytes 为请求的 RESP 编码长度. 只在设置了
+         * max_pending_requests 或 max_pending_bytes 时设置, 在 Recycle() 时归还; ExecuteSync() 的请求在
+         * CompleteSync() 中归还.
+         */
+        WorkThread *admitted_thread = nullptr;
+        size_t admitted_bytes = 0;
+
+        /* 若不为 kNoKeyThread, 则表明请求需要交给 key 所属的第 key_thread 个 work thread, 参见 RouteByKey().
+         *
+         * near_cache_kind 不为 kNone 表明请求可以被缓存; near_cache_token 由 key_thread 在发送请求时设置, 参见
+         * NearCache::Reserve().
+         *
+         * near_cache_invalidation 为 true 表明这不是发给 redis 的请求, 而是其他 work thread 交给本 work thread 的
+         * 失效通知, cmd 为需要失效的 key, 参见 InvalidateWrittenKeys().
+         */
+        static constexpr uint32_t kNoKeyThread = static_cast<uint32_t>(-1);
+        uint32_t key_thread = kNoKeyThread;
+        NearCache::Kind near_cache_kind = NearCache::kNone;
+        uint64_t near_cache_token = 0;
+        bool near_cache_invalidation = false;
+
+        /* coalesce_reads. coalesce 表明请求可以被合并. 在 work thread 中, 第一个请求作为 leader 被发送并登记在
+         * WorkThreadContext::coalesce_leaders 中, 此时 coalesce_leader 为 true, coalesce_key 为登记所用的 key;
+         * 之后相同的请求通过 next 串联在 leader 的 followers 上, 由 leader 收到响应时一并回调并释放.
+         */
+        bool coalesce = false;
+        bool coalesce_leader = false;
+        std::string coalesce_key;
+        RedisRequest *followers = nullptr;
+
+        /* merge_reads. 若不为 0, 则表明请求是由 merged_num 个请求合并而成的 MGET 或者 HMGET, 这些请求按照参数的
+         * 顺序通过 next 串联在 followers 上, 第 i 个请求以响应中的第 i 个元素回调.
+         */
+        uint32_t merged_num = 0;
+
+        /* ExecuteSync() 使用. 此时请求对象同时被 work thread 与 ReplyFuture 引用, ref_num 为 2, 由最后一个释放者
+         * 放回 ObjectPool. 其他请求的 ref_num 总是为 1.
+         *
+         * sync_state 是 futex 使用的字: kSyncPending, kSyncWaiting 表示尚未结束, 后者表明有线程在 futex 中等待;
+         * kSyncDone 表示已经结束, 此时 sync_reply 为响应, 为空表明失败.
+         */
+        enum : uint32_t {
+            kSyncPending = 0,
+            kSyncWaiting,
+            kSyncDone
+        };
+        std::atomic<uint32_t> ref_num{1};
+        std::atomic<uint32_t> sync_state{kSyncPending};
+        redisReply_unique_ptr_t sync_reply;
+
+        /* callback_executor. inline_callback 为 true 表明回调总是在 work thread 中执行, 比如 ExecuteSync(). 交给
+         * executor 的请求, 其响应由 deferred_reply 持有, 为空表示以 nullptr 回调.
+         */
+        bool inline_callback = false;
+        redisReply_unique_ptr_t deferred_reply;
 
     public:
         RedisRequest() noexcept = default;
@@ -181,74 +761,417 @@ public:
             callback(std::move(callback_arg)) {
         }
 
-        RedisRequest(const RedisRequest &) = default;
+        RedisRequest(const RedisRequest &) = delete;
+        RedisRequest& operator=(const RedisRequest &) = delete;
+
         RedisRequest(RedisRequest &&other):
             cmd(std::move(other.cmd)),
             callback(std::move(other.callback)) {
         }
 
-        RedisRequest& operator=(const RedisRequest &) = default;
         RedisRequest& operator=(RedisRequest &&other) {
             cmd = std::move(other.cmd);
             callback = std::move(other.callback);
             return *this;
         }
 
+        /* 当对象是从 ObjectPool 取出时, cmd 中 std::string 的内存仍被保留着, 这里逐个 assign 以复用这些内存.
+         */
+        void SetCmd(const std::vector<std::string> &cmd_arg) {
+            cmd.resize(cmd_arg.size());
+            for (size_t idx = 0; idx < cmd_arg.size(); ++idx) {
+                cmd[idx].assign(cmd_arg[idx]);
+            }
+            return ;
+        }
+
+        void SetCmd(std::vector<std::string> &&cmd_arg) noexcept {
+            cmd = std::move(cmd_arg);
+            return ;
+        }
+
+        void SetCmd(RespFrame &&frame_arg) noexcept {
+            cmd.clear();
+            frame = std::move(frame_arg);
+            return ;
+        }
+
+        void SetTimeout(uint32_t timeout_ms) noexcept {
+            deadline_ms = timeout_ms > 0 ? GetMonotonicMs() + timeout_ms : 0;
+            return ;
+        }
+
+        /* 在放回 ObjectPool 之前调用. 会释放 callback 持有的资源, 但是保留 cmd 的内存以便复用, 除非 cmd
+         * 占用的内存过多.
+         */
+        void Recycle() noexcept;
+
+        // 归还请求占用的容量. 可以重复调用.
+        void ReleaseCapacity() noexcept;
+
+        // 作为 ExecuteSync() 请求的回调, 保存 reply 并唤醒等待者.
+        void CompleteSync(redisReply *reply) noexcept;
+
         void Fail() noexcept {
-            if (callback) {
+            if (batch) {
+                batch->OnReply(idx_in_batch, nullptr);
+            } else if (callback) {
                 callback(nullptr);
             }
             return ;
         }
 
         void Success(redisReply *reply) noexcept {
-            if (callback) {
+            if (batch) {
+                batch->OnReply(idx_in_batch, reply);
+            } else if (callback) {
                 callback(reply);
             }
             return ;
         }
+
+        /* 以 nullptr 结束当前请求, 并释放 callback. 请求对象本身仍由 hiredis 持有, 直至收到响应或者连接断开.
+         */
+        void TimeOut() noexcept {
+            Fail();
+            callback = nullptr;
+            batch = nullptr;
+            timed_out = true;
+            return ;
+        }
+    };
+
+    /* RedisRequest 对象总是从 ObjectPool 中分配, 并通过 RedisRequestRecycler 放回. 通常是在调用 Execute() 的
+     * 线程分配, 在 work thread 中释放, ObjectPool 会批量地将对象归还给分配线程.
+     */
+    struct RedisRequestRecycler {
+        void operator()(RedisRequest *req) noexcept {
+            // ref_num 为 1 时当前持有者是唯一的引用者, 不需要原子的 RMW 操作.
+            if (req->ref_num.load(std::memory_order_acquire) != 1 &&
+                req->ref_num.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return ;
+            }
+            req->Recycle();
+            ObjectPool<RedisRequest>::Put(req);
+            return ;
+        }
+    };
+
+    using request_ptr_t = std::unique_ptr<RedisRequest, RedisRequestRecycler>;
+
+#ifdef ASYNC_REDIS_CLIENT_HAS_COROUTINE
+    /**
+     * 协程恢复执行的位置. 不指定时, 协程直接在 work thread 中, 即在回调中恢复执行, 此时协程在下一次挂起之前
+     * 不应该有阻塞操作.
+     */
+    struct CoroutineExecutor {
+        virtual ~CoroutineExecutor() = default;
+
+        /* 在 executor 中恢复 handle. 会在 work thread 中调用, MUST noexcept 并且线程安全.
+         */
+        virtual void Post(std::coroutine_handle<> handle) noexcept = 0;
+    };
+
+    /**
+     * Async() 的结果, 用于 co_await, 结果为响应, 若请求未被成功处理, 则为空.
+     *
+     * Awaitable 在 co_await 期间位于协程帧中, 请求的回调只捕获 Awaitable 的地址, 因此除了 ObjectPool 中的请求
+     * 对象以及 TakeReply() 之外没有任何内存分配.
+     *
+     * 只能在 co_await 之前移动. 若 co_await 时抛出异常, 则表明请求不会被执行.
+     */
+    class Awaitable {
+    public:
+        Awaitable(Awaitable &&other) noexcept:
+            client_(other.client_),
+            req_(std::move(other.req_)),
+            executor_(other.executor_) {
+        }
+
+        Awaitable(const Awaitable &) = delete;
+        Awaitable& operator=(const Awaitable &) = delete;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle);
+
+        redisReply_unique_ptr_t await_resume() noexcept {
+            return std::move(reply_);
+        }
+
+    private:
+        friend struct AsyncRedisClient;
+
+        /* 一次 co_await 的状态. pending 为尚未到达的信号数目: 每个请求完成时一个, await_suspend() 提交完请求
+         * 之后一个. 最后一个到达者负责恢复协程; 若是 await_suspend() 自己, 则直接不挂起.
+         */
+        struct State {
+            std::coroutine_handle<> handle;
+            CoroutineExecutor *executor = nullptr;
+            std::atomic<uint32_t> pending{0};
+
+        public:
+            // 返回 true 表明当前调用者是最后一个到达者.
+            bool Arrive() noexcept {
+                return pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+            }
+
+            void Signal() noexcept;
+        };
+
+        AsyncRedisClient *client_ = nullptr;
+        request_ptr_t req_;
+        CoroutineExecutor *executor_ = nullptr;
+        redisReply_unique_ptr_t reply_;
+        State state_;
+
+    private:
+        Awaitable(AsyncRedisClient *client, request_ptr_t &&req, CoroutineExecutor *executor) noexcept:
+            client_(client),
+            req_(std::move(req)),
+            executor_(executor) {
+        }
+
+        // 将 req_ 的回调设置为: 保存响应, 然后通知 state.
+        void Arm(State *state) noexcept;
+    };
+
+    /**
+     * WhenAll() 的结果, co_await 的结果为各个请求的响应.
+     */
+    template <size_t N>
+    class WhenAllAwaitable {
+    public:
+        explicit WhenAllAwaitable(const std::array<Awaitable*, N> &items) noexcept:
+            items_(items) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            return SubmitAll(items_.data(), N, &state_, handle);
+        }
+
+        std::array<redisReply_unique_ptr_t, N> await_resume() noexcept {
+            std::array<redisReply_unique_ptr_t, N> replies;
+            for (size_t idx = 0; idx < N; ++idx) {
+                replies[idx] = items_[idx]->await_resume();
+            }
+            return replies;
+        }
+
+    private:
+        std::array<Awaitable*, N> items_;
+        Awaitable::State state_;
+    };
+
+    /**
+     * co_await client.Async(cmd), 语义同 Execute(). executor 为 nullptr 时在 work thread 中恢复协程, 否则通过
+     * executor->Post() 恢复.
+     */
+    Awaitable Async(const std::vector<std::string> &cmd, uint32_t timeout_ms = 0,
+                    CoroutineExecutor *executor = nullptr) {
+        return Awaitable(this, NewRequest(cmd, nullptr, timeout_ms), executor);
+    }
+
+    Awaitable Async(std::vector<std::string> &&cmd, uint32_t timeout_ms = 0, CoroutineExecutor *executor = nullptr) {
+        return Awaitable(this, NewRequest(std::move(cmd), nullptr, timeout_ms), executor);
+    }
+
+    Awaitable Async(RespFrame &&frame, uint32_t timeout_ms = 0, CoroutineExecutor *executor = nullptr) {
+        return Awaitable(this, NewRequest(std::move(frame), nullptr, timeout_ms), executor);
+    }
+
+    /**
+     * auto replies = co_await AsyncRedisClient::WhenAll(client.Async(a), client.Async(b));
+     *
+     * 这些请求会作为一个整体交给同一个 work thread, 在同一次唤醒中写出, 只需要一次跨线程唤醒; 全部完成之后恢复
+     * 协程一次, 通过第一个 Awaitable 的 executor. items 必须来自同一个 AsyncRedisClient, 并且在 co_await 结束
+     * 之前有效, 以临时对象的形式传入即可.
+     */
+    template <typename... Items>
+    static WhenAllAwaitable<sizeof...(Items)> WhenAll(Items &&... items) noexcept {
+        static_assert(sizeof...(Items) > 0, "WhenAll() requires at least one Awaitable");
+        return WhenAllAwaitable<sizeof...(Items)>(std::array<Awaitable*, sizeof...(Items)>{{&items...}});
+    }
+
+private:
+    /* 将 items 中的请求作为一个整体提交, 返回值即 await_suspend() 的返回值. 若抛出异常, 则请求不会被执行.
+     */
+    static bool SubmitAll(Awaitable **items, size_t item_num, Awaitable::State *state, std::coroutine_handle<> handle);
+
+public:
+#endif
+
+    /* 连接的状态. 连接发起之后为 kConnecting, 建立之后若设置了 passwd 则为 kAuthenticating, AUTH 成功之后为
+     * kReady; 请求只会被发送到 kReady 的连接上. 因为密码错误而 AUTH 失败的连接为 kAuthFailed, 不会再重新连接;
+     * AUTH 返回其他错误时按照连接建立失败处理, 退避之后重新连接, 参见 reconnect_min_delay_ms.
+     */
+    enum class ConnState : uint8_t {
+        kDisconnected = 0,
+        kConnecting,
+        kAuthenticating,
+        kReady,
+        kAuthFailed
+    };
+
+    /* 连接的运行时统计, 只由连接所属的 work thread 写入, 其他线程可以随时读取.
+     *
+     * 同一个 work thread 上各个连接的统计信息相邻存放, 它们都只由这一个 work thread 写入, 因此不需要按照 cache line
+     * 填充.
+     */
+    struct ConnStats {
+        std::atomic<uint64_t> in_flight_num{0}; // 已经发送但尚未收到响应的请求数目.
+        std::atomic<uint64_t> pending_bytes{0}; // 上述请求编码之后的总长度.
+        std::atomic<uint64_t> sent_num{0}; // 累计发送的请求数目.
+        std::atomic<uint64_t> reconnect_num{0}; // 连接断开之后重新建立连接的次数.
+        std::atomic<ConnState> state{ConnState::kDisconnected};
+    };
+
+    /* work thread 的运行时统计, 只由对应的 work thread 写入, 其他线程可以随时读取.
+     *
+     * 由 work thread 自己分配, 前后各填充一个 cache line, 避免与相邻的堆对象之间出现 false sharing.
+     */
+    struct ThreadStats {
+    private:
+        char head_padding_[64];
+
+    public:
+        std::atomic<uint64_t> dequeued_num{0}; // 从 request_queue 中取走的请求数目.
+        std::atomic<uint64_t> last_drain_num{0}; // 最近一次被唤醒时取走的请求数目.
+        std::atomic<uint64_t> max_drain_num{0}; // 单次被唤醒时取走的最大请求数目.
+        std::atomic<uint64_t> in_flight_num{0}; // 所有连接上已经发送但尚未收到响应的请求数目.
+        std::atomic<uint64_t> pending_bytes{0}; // 上述请求编码之后的总长度.
+        std::atomic<uint64_t> sent_num{0};
+        std::atomic<uint64_t> reply_num{0}; // 收到的响应数目, 包括超时之后才到达的响应.
+        std::atomic<uint64_t> failed_num{0}; // 未能发送, 或者因为连接断开而以 nullptr 回调的请求数目.
+        std::atomic<uint64_t> timeout_num{0};
+        std::atomic<uint64_t> reconnect_num{0};
+        std::atomic<uint64_t> connect_fail_num{0}; // 无法发起连接, 连接未能建立, 或者 AUTH 暂时失败的次数.
+        std::atomic<uint64_t> auth_fail_num{0}; // 因为密码错误而 AUTH 失败的连接数目.
+        std::atomic<uint64_t> parked_num{0}; // 请求因为连接尚未就绪而等待的次数.
+        std::atomic<uint64_t> retry_num{0}; // 因为连接断开而被重新发送的请求数目.
+        std::atomic<uint64_t> bytes_written{0};
+        std::atomic<uint64_t> bytes_read{0}; // 由响应按照 RESP 编码的长度估算, 只在 collect_bytes_read 时统计.
+        std::atomic<uint64_t> inline_num{0}; // 在 work thread 中调用 Execute(), 未经过 request_queue 的请求数目.
+        std::atomic<uint64_t> coalesced_num{0}; // 因为 coalesce_reads 而没有发送, 等待相同请求的响应的请求数目.
+        std::atomic<uint64_t> merged_num{0}; // 因为 merge_reads 而作为 MGET, HMGET 的一部分被发送的请求数目.
+        std::atomic<uint64_t> deferred_num{0}; // 交给 callback_executor 执行的回调数目.
+        std::atomic<uint64_t> deferred_batch_num{0}; // 交给 callback_executor 的 CompletionBatch 数目.
+        std::atomic<uint64_t> bind_fail_num{0}; // 未能绑定到 thread_cpus 时为 1.
+
+    private:
+        char tail_padding_[64];
     };
 
     struct WorkThread {
         bool started = false;
         std::thread thread;
 
-        // NOTE: 总是先 lock vec_mux 再 lock handle_mux.
-        std::mutex vec_mux;
-        /* request_vec 的内存是由 work thread 来分配.
+        /* 以下对象主要由 work thread 写入, 因此由 work thread 在绑定 CPU 之后, 打开 request_queue 之前分配, 使其
+         * 内存按照 first-touch 位于 work thread 所在的 NUMA 节点上. 若 work thread 初始化失败, 则可能为 nullptr.
+         */
+        // conn_stats[i] 为第 i 个连接的统计信息, 共 conn_per_thread 个.
+        std::unique_ptr<ConnStats[]> conn_stats;
+
+        std::unique_ptr<ThreadStats> stats;
+
+        // 各命令各阶段的延迟, 只在 collect_command_latency 时分配.
+        std::unique_ptr<CommandLatencyTable> command_latency;
+
+        // 只在启用 near cache 时分配.
+        std::unique_ptr<NearCache> near_cache;
+
+        /* 尚未被 work thread 处理的请求, work thread 在每次被唤醒时一次性取走所有请求.
          *
-         * 对于其他线程而言, 其检测到若 request_vec 为 nullptr, 则表明对应的 work thread 不再工作, 此时不能往
-         * request_vec 中加入请求. 反之, 则表明 work thread 正常工作, 此时可以压入元素.
+         * request_queue 由 work thread 来打开, 关闭. 对于其他线程而言, 若 request_queue 处于关闭状态, 则表明
+         * 对应的 work thread 不再工作, 此时压入请求会失败. 反之, 则表明 work thread 正常工作, 此时可以压入请求.
          */
-        std::unique_ptr<std::vector<std::unique_ptr<RedisRequest>>> request_vec;
+        IntrusiveMpscQueue<RedisRequest> request_queue;
 
-        std::shared_mutex handle_mux;
-        /* 不变量 3: 若 async_handle != nullptr, 则表明 async_handle 指向着的 uv_async_t 已经被初始化, 此时
-         * 对其调用 uv_async_send() 不会触发 SIGSEGV.
+        /* 不变量 3: async_handle 由 work thread 在打开 request_queue 之前设置, 在 request_queue 关闭并且
+         * 所有唤醒者都已经离开之后才会被 uv_close(). 因此:
          *
-         * 其实这里可以使用读写锁, 因为 uv_async_send() 是线程安全的, 但是 uv_close(), uv_async_init() 这些
-         * 并不是. 也即在执行 uv_async_send() 之前加读锁, 其他操作加写锁.
+         * - 将请求压入 request_queue 成功的生产者总是可以安全地对 async_handle 调用 uv_async_send(),
+         *   因为 work thread 在关闭 request_queue 之后会等待这些生产者完成唤醒.
+         * - 其他线程需要通过 Notify() 来唤醒 work thread.
          */
         uv_async_t *async_handle = nullptr;
 
+        /* 唤醒合并. 只有将 request_queue 由空变为非空的生产者才会调用 uv_async_send(), 在 work thread 两次
+         * 取走请求之间, 最多只会有一个这样的生产者.
+         *
+         * wakeup_num, 这类生产者完成 uv_async_send() 之后加 1. work thread 记录着自己取走非空请求链表的次数,
+         * 在关闭 request_queue 之后, 等待 wakeup_num 追上这一次数, 此时所有生产者都已经完成了唤醒.
+         *
+         * notifier_num, 当前正在 Notify() 中的线程数目. 定义了 ASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST 时, 也包括
+         * 正在 AddRequest(), AddRequests() 中的线程.
+         */
+        std::atomic<uint64_t> wakeup_num{0};
+        std::atomic<uint32_t> notifier_num{0};
+
+        /* 容量, 只在设置了 max_pending_requests 或 max_pending_bytes 时使用. admitted_num, admitted_bytes 为已经
+         * 被占用的容量, 由生产者在压入请求之前增加, 在请求对象被回收时减少. rejected_num 为因为容量已满而拒绝
+         * 的次数.
+         *
+         * blocked_num 为在 WaitAdmit() 中等待的线程数目. 归还容量之后若 blocked_num 不为 0, 则需要通过
+         * capacity_cv 唤醒它们.
+         */
+        std::atomic<uint64_t> admitted_num{0};
+        std::atomic<uint64_t> admitted_bytes{0};
+        std::atomic<uint64_t> rejected_num{0};
+        std::atomic<uint32_t> blocked_num{0};
+        std::mutex capacity_mux;
+        std::condition_variable capacity_cv;
 
     public:
-        void AsyncSend() noexcept {
-            handle_mux.lock_shared();
-            if (async_handle) {
+        /* 唤醒 work thread, 用于 Stop(), Join() 这些非生产者的场景.
+         *
+         * 与 work thread 关闭 request_queue 之后等待 notifier_num 为 0 构成 Dekker 式的同步, 因此这里都使用
+         * seq_cst 内存序.
+         */
+        void Notify() noexcept {
+            notifier_num.fetch_add(1, std::memory_order_seq_cst);
+            if (!request_queue.IsClosed()) {
                 uv_async_send(async_handle); // 当 send() 失败了怎么办???
             }
-            handle_mux.unlock_shared();
+            notifier_num.fetch_sub(1, std::memory_order_release);
             return ;
         }
 
         /*
-         * 将 req 表示的请求追加到当前 work thread 中.
+         * 将 req 表示的请求追加到当前 work thread 中, 并在需要的时候唤醒 work thread.
          *
          * 若抛出异常, 则表明追加失败, 此时 req 引用的对象没有任何变化. 若未抛出异常, 则根据 req
          * 是否为空来判断请求是否成功追加, 即当为空时, 表明请求成功追加到当前 work thread 中.
          */
-        void AddRequest(std::unique_ptr<RedisRequest> &req);
+        void AddRequest(request_ptr_t &req);
+
+        /*
+         * 将 reqs 作为一个整体追加到当前 work thread 中, 语义同 AddRequest(). reqs 要么全部追加成功, 此时 reqs
+         * 中的元素都为空; 要么全部失败, 此时 reqs 中的元素保持不变.
+         */
+        void AddRequests(std::vector<request_ptr_t> &reqs);
+
+        /* 占用 num 个请求, bytes 字节的容量. 若超出 max_num, max_bytes, 则返回 false, 此时容量保持不变.
+         * 超出上限的单个请求或者 batch, 只要 work thread 上没有其他请求, 仍然可以占用.
+         *
+         * 线程安全. capacity_locked 表明调用者已经持有 capacity_mux, 仅供 WaitAdmit() 使用.
+         */
+        bool TryAdmit(uint64_t num, uint64_t bytes, size_t max_num, size_t max_bytes,
+                      bool capacity_locked = false) noexcept;
+
+        /* 同 TryAdmit(), 但是在容量不足时等待, 最多等待 timeout_ms, 0 表示一直等待. request_queue 关闭之后不再
+         * 等待.
+         */
+        bool WaitAdmit(uint64_t num, uint64_t bytes, size_t max_num, size_t max_bytes, uint32_t timeout_ms);
+
+        // 归还 TryAdmit() 占用的容量, 并唤醒等待者.
+        void ReleaseCapacity(uint64_t num, uint64_t bytes) noexcept;
     };
 
 private:
@@ -256,10 +1179,82 @@ private:
     std::atomic_uint seq_num{0};
     std::unique_ptr<std::vector<WorkThread>> work_threads_;
 
+    // numa_aware_routing 时使用. node_threads_[node] 为位于 node 上的 work thread 下标, 由 Start() 设置.
+    std::vector<int> cpu_nodes_;
+    std::vector<std::vector<size_t>> node_threads_;
+
+    // 实际使用的 callback_executor; 若是由 callback_thread_num 创建的内置线程池, 则由 owned_callback_executor_ 持有.
+    CallbackExecutor *callback_executor_ = nullptr;
+    std::unique_ptr<CallbackExecutor> owned_callback_executor_;
+
+    // 已经交给 callback_executor_ 但尚未 Run() 的 CompletionBatch 数目, Join(), Stop() 等待其归零.
+    std::mutex batch_mux_;
+    std::condition_variable batch_cv_;
+    size_t outstanding_batch_num_ = 0;
+
+    /* 到 host:port 的连接中处于 kReady 的数目, 以及最近一次 AUTH 失败的错误信息, 由 work thread 在连接状态变化时
+     * 更新并唤醒 Start(min_ready_conn_num, timeout_ms).
+     */
+    std::mutex ready_mux_;
+    std::condition_variable ready_cv_;
+    size_t ready_conn_num_ = 0;
+    std::string auth_error_;
+
 private:
     /* 若成功, 则 req 指向的内存由 AsyncRedisClient 来管理. 若失败, 则抛出异常, 并且 req 保持不变.
      */
-    void Execute(std::unique_ptr<RedisRequest> &req);
+    void Execute(request_ptr_t &req);
+
+    /* 同 Execute(request_ptr_t &), reqs 会作为一个整体交给同一个 work thread.
+     */
+    void Execute(std::vector<request_ptr_t> &reqs);
+
+    /* 将 req 的回调设置为 RedisRequest::CompleteSync() 并执行. 若抛出异常, 则 req 保持不变.
+     */
+    ReplyFuture ExecuteSync(request_ptr_t &req);
+
+    /* 选择第一个尝试的 work thread 的下标. 参见 numa_aware_routing.
+     */
+    size_t SelectWorkThread() noexcept;
+
+    /* 若当前线程是本实例的 work thread, 比如在回调中发起后续请求, 则直接在当前线程中处理 req, 不再经过
+     * request_queue 与 uv_async_send(), 并返回 true; 此时 req 总是为空, 发送失败的请求会在下一轮事件循环中以
+     * nullptr 回调.
+     * 否则返回 false, req 保持不变.
+     */
+    bool ExecuteInline(request_ptr_t &req) noexcept;
+
+    /* 若 req 可以被缓存或者被合并, 则设置其 key_thread, near_cache_kind, coalesce, 并在 key 所属的 work thread
+     * 的缓存中查找. 若命中, 则以缓存的响应回调 req 并返回 true, 此时 req 为空; 否则返回 false. 启用 near cache
+     * 时, 已知的单 key 写请求也会设置 key_thread, 参见 InvalidateWrittenKeys().
+     */
+    bool RouteByKey(request_ptr_t &req) noexcept;
+
+    /* 若 request 是已知的写命令, 则删除其 key 的缓存, 参见 near_cache_max_bytes. 在 thread_ctx 所在的 work thread
+     * 中调用; 属于其他 work thread 的 key 通过其 request_queue 交给所属的 work thread 删除.
+     */
+    static void InvalidateWrittenKeys(WorkThreadContext *thread_ctx, const RedisRequest *request) noexcept;
+
+    bool HasCapacityLimit() const noexcept {
+        return max_pending_requests > 0 || max_pending_bytes > 0;
+    }
+
+    /* 按照 overload_policy 在 work_thread 上为 reqs[0, req_num) 占用容量. 若成功, 则返回 true, 此时这些请求的
+     * admitted_thread 指向 work_thread; 否则返回 false, 此时 admitted_thread 仍为 nullptr. 未设置容量时总是返回
+     * true. work_thread 已经停止时同样返回 false, 但不计入 rejected_num, 由调用者按照停止处理.
+     */
+    bool Admit(WorkThread &work_thread, request_ptr_t *reqs, size_t req_num);
+
+    /* 从 ObjectPool 中取出一个 RedisRequest 对象并填充. 若抛出异常, 则取出的对象会被放回.
+     */
+    template <typename CmdType, typename CallbackType>
+    static request_ptr_t NewRequest(CmdType &&cmd, CallbackType &&callback, uint32_t timeout_ms = 0) {
+        request_ptr_t req(ObjectPool<RedisRequest>::Get());
+        req->SetCmd(std::forward<CmdType>(cmd));
+        req->callback = std::forward<CallbackType>(callback);
+        req->SetTimeout(timeout_ms);
+        return req;
+    }
 
 private:
     ClientStatus GetStatus() noexcept {
@@ -281,11 +1276,173 @@ private:
     }
 
     void DoStopOrJoin(ClientStatus op);
+
+public:
+    /**
+     * 所有 work thread 上因为请求队列由空变为非空而调用 uv_async_send() 的次数. libuv 会合并尚未被处理的
+     * uv_async_send(), 因此这并不是 eventfd 上实际的 write() 次数, 后者参见 test/main.cc 中的 wr/req.
+     *
+     * 应该在 Start() 之后调用.
+     */
+    uint64_t GetWakeupNum() const noexcept {
+        uint64_t wakeup_num = 0;
+        for (const WorkThread &work_thread : *work_threads_) {
+            wakeup_num += work_thread.wakeup_num.load(std::memory_order_relaxed);
+        }
+        return wakeup_num;
+    }
+
+    struct ConnStat {
+        size_t thread_idx = 0;
+        size_t conn_idx = 0;
+        uint64_t in_flight_num = 0;
+        uint64_t pending_bytes = 0;
+        uint64_t sent_num = 0;
+        uint64_t reconnect_num = 0;
+        ConnState state = ConnState::kDisconnected;
+    };
+
+    /**
+     * 每个连接的统计信息快照. 不会阻塞 work thread, 因此各个值之间并不保证一致.
+     *
+     * 只包含到 host:port 的连接, 集群模式下到其他节点的连接不在其中.
+     *
+     * 应该在 Start() 之后调用.
+     */
+    std::vector<ConnStat> GetConnStats() const;
+
+    struct ThreadStat {
+        size_t thread_idx = 0;
+
+        /* 请求队列. work thread 每次被唤醒时会取走队列中的所有请求, 因此 last_drain_num, max_drain_num 反映了
+         * 请求在队列中的积压程度.
+         */
+        uint64_t dequeued_num = 0;
+        uint64_t last_drain_num = 0;
+        uint64_t max_drain_num = 0;
+
+        // 包括集群模式下到所有节点的连接.
+        uint64_t in_flight_num = 0;
+        uint64_t pending_bytes = 0;
+        uint64_t sent_num = 0;
+        uint64_t reply_num = 0;
+        uint64_t failed_num = 0;
+        uint64_t timeout_num = 0;
+
+        uint64_t reconnect_num = 0;
+        uint64_t connect_fail_num = 0;
+        uint64_t auth_fail_num = 0;
+        uint64_t parked_num = 0;
+        uint64_t retry_num = 0;
+
+        uint64_t bytes_written = 0;
+        uint64_t bytes_read = 0;
+
+        uint64_t inline_num = 0;
+        uint64_t coalesced_num = 0;
+        uint64_t merged_num = 0;
+        uint64_t deferred_num = 0;
+        uint64_t deferred_batch_num = 0;
+
+        // 未能绑定到 thread_cpus 时为 1, 此时 work thread 照常工作, 只是失去了亲和性. total 中为失败的线程数目.
+        uint64_t bind_fail_num = 0;
+
+        /* 容量, 只在设置了 max_pending_requests 或 max_pending_bytes 时统计. admitted_num, admitted_bytes 为当前
+         * 被占用的容量, 即 work thread 的填充程度; rejected_num 为因为容量已满而拒绝的次数.
+         */
+        uint64_t admitted_num = 0;
+        uint64_t admitted_bytes = 0;
+        uint64_t rejected_num = 0;
+
+        /* near cache, 只在启用时统计. near_cache_hit_num, near_cache_miss_num 为在该 work thread 的缓存中查找的
+         * 结果; near_cache_entry_num, near_cache_bytes 为当前缓存的 key 数目与估算的内存占用.
+         */
+        uint64_t near_cache_hit_num = 0;
+        uint64_t near_cache_miss_num = 0;
+        uint64_t near_cache_invalidate_num = 0;
+        uint64_t near_cache_evict_num = 0;
+        uint64_t near_cache_entry_num = 0;
+        uint64_t near_cache_bytes = 0;
+    };
+
+    struct Stats {
+        std::vector<ThreadStat> threads;
+
+        // 所有 work thread 的汇总, 其中 last_drain_num, max_drain_num 取最大值, thread_idx 无意义.
+        ThreadStat total;
+    };
+
+    /**
+     * 所有 work thread 的统计信息快照. 只读取各个线程的计数器, 不会阻塞 work thread, 因此各个值之间并不保证
+     * 一致.
+     *
+     * 应该在 Start() 之后调用.
+     */
+    Stats GetStats() const;
+
+    struct CommandLatency {
+        // stages[CommandLatencyTable::kQueueWait] 等, 单位: ns.
+        LatencyHistogram stages[CommandLatencyTable::kStageNum];
+    };
+
+    /**
+     * 按照命令名(大写)汇总所有 work thread 上各阶段的延迟分布. 只统计收到响应并且未超时的请求. 需要
+     * collect_command_latency, 否则返回空.
+     *
+     * 不会阻塞 work thread. 应该在 Start() 之后调用.
+     */
+    std::map<std::string, CommandLatency> GetCommandLatency() const;
+
+    /**
+     * 进程内 RedisRequest 对象实际被 new 出来的次数. 在稳定状态下, 所有 RedisRequest 对象都来自于 ObjectPool,
+     * 该值不应该再随着请求数目增长.
+     */
+    static uint64_t GetRequestAllocNum() noexcept {
+        return ObjectPool<RedisRequest>::GetAllocNum();
+    }
+
 private:
     static void WorkThreadMain(AsyncRedisClient *client, size_t idx, std::promise<void> *p) noexcept;
 
     static void OnAsyncHandle(uv_async_t* handle) noexcept;
     static void OnRedisReply(redisAsyncContext *c, void *reply, void *privdata) noexcept;
+
+    /* 以下函数只能在 work thread 中调用.
+     */
+
+    /* 为 request 选择一个连接并发送. 若失败, 则在下一轮事件循环中以 nullptr 回调 request.
+     *
+     * 返回时 request 总是为空.
+     */
+    static void HandleRequest(WorkThreadContext *thread_ctx, request_ptr_t &request) noexcept;
+
+    /* merge_reads. 若 request 可以被合并为 MGET, HMGET, 则将其暂存在 thread_ctx 中并返回 true, 此时 request 为空.
+     * 暂存的请求由 FlushMerged() 合并并发送, 调用者需要在处理其他请求之前, 以及本次取走的请求处理完毕之后调用.
+     */
+    static bool MergeRequest(WorkThreadContext *thread_ctx, request_ptr_t &request) noexcept;
+    static void FlushMerged(WorkThreadContext *thread_ctx) noexcept;
+
+    /* 将 reqs 中的 num 个请求合并为一个 cmd_name 命令并发送, key 不为 nullptr 时作为第一个参数, 只在构建合并
+     * 之后的命令时使用. 合并失败时各自发送. 返回时 reqs 中的请求总是为空.
+     */
+    static void SendMerged(WorkThreadContext *thread_ctx, request_ptr_t *reqs, size_t num,
+                           const char *cmd_name, const std::string *key) noexcept;
+
+    /* 在 conn_ctx 上发送 request. 若成功, 则返回 true, 此时 request 为空, 由 OnRedisReply() 负责释放.
+     * 若失败, 则返回 false, 此时 request 保持不变.
+     */
+    static bool SendRequest(RedisConnectionContext *conn_ctx, request_ptr_t &request);
+
+    /* 若 reply 是 MOVED, ASK 重定向, 则将 request 发送到新的节点. 若成功, 则返回 true, 此时 request 为空;
+     * 否则返回 false, 此时 request 保持不变, 由调用者以 reply 回调.
+     */
+    static bool RedirectRequest(RedisConnectionContext *conn_ctx, request_ptr_t &request,
+                                const redisReply *reply) noexcept;
+
+    /* 根据 conn_select_policy 返回 conn_ctxs 中首选连接的下标.
+     */
+    static size_t SelectConnection(WorkThreadContext *thread_ctx,
+                                   std::vector<RedisConnectionContext> &conn_ctxs) noexcept;
 };
 
 inline std::ostream& operator<<(std::ostream &out, AsyncRedisClient::ClientStatus status) {
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "async_redis_client/cluster.h"
+
+namespace {
+
+// CRC16-CCITT(XMODEM), 多项式 0x1021, 初始值 0. 与 Redis 源码中 crc16.c 一致.
+const uint16_t kCrc16Table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+uint16_t Crc16(const char *buf, size_t len) noexcept {
+    uint16_t crc = 0;
+    for (size_t idx = 0; idx < len; ++idx) {
+        crc = (crc << 8) ^ kCrc16Table[((crc >> 8) ^ static_cast<uint8_t>(buf[idx])) & 0xff];
+    }
+    return crc;
+}
+
+bool ParsePort(const char *str, size_t len, in_port_t *port) noexcept {
+    if (len == 0 || len > 5) {
+        return false;
+    }
+
+    unsigned int val = 0;
+    for (size_t idx = 0; idx < len; ++idx) {
+        if (str[idx] < '0' || str[idx] > '9') {
+            return false;
+        }
+        val = val * 10 + (str[idx] - '0');
+    }
+    if (val == 0 || val > 65535) {
+        return false;
+    }
+    *port = static_cast<in_port_t>(val);
+    return true;
+}
+
+} // namespace
+
+uint16_t GetClusterHashSlot(const char *key, size_t len) noexcept {
+    const char *left = static_cast<const char*>(memchr(key, '{', len));
+    if (left) {
+        const char *tag = left + 1;
+        size_t tag_max_len = len - (tag - key);
+        const char *right = static_cast<const char*>(memchr(tag, '}', tag_max_len));
+        if (right && right != tag) {
+            return Crc16(tag, right - tag) & (kClusterSlotNum - 1);
+        }
+    }
+    return Crc16(key, len) & (kClusterSlotNum - 1);
+}
+
+bool ParseClusterSlots(const redisReply *reply, std::vector<ClusterSlotRange> *ranges) {
+    ranges->clear();
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        return false;
+    }
+
+    // 每个元素为 [begin, end, [host, port, id, ...], [replica host, port, id, ...]...].
+    for (size_t idx = 0; idx < reply->elements; ++idx) {
+        const redisReply *entry = reply->element[idx];
+        if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 3) {
+            return false;
+        }
+
+        const redisReply *begin = entry->element[0];
+        const redisReply *end = entry->element[1];
+        const redisReply *master = entry->element[2];
+        if (begin->type != REDIS_REPLY_INTEGER || end->type != REDIS_REPLY_INTEGER ||
+            begin->integer < 0 || begin->integer > end->integer ||
+            end->integer >= static_cast<long long>(kClusterSlotNum)) {
+            return false;
+        }
+        if (master->type != REDIS_REPLY_ARRAY || master->elements < 2 ||
+            master->element[0]->type != REDIS_REPLY_STRING ||
+            master->element[1]->type != REDIS_REPLY_INTEGER ||
+            master->element[1]->integer <= 0 || master->element[1]->integer > 65535) {
+            return false;
+        }
+
+        ClusterSlotRange range;
+        range.begin = static_cast<uint16_t>(begin->integer);
+        range.end = static_cast<uint16_t>(end->integer);
+        range.host.assign(master->element[0]->str, master->element[0]->len);
+        if (range.host == "?") { // Redis 7 中表示未知的 endpoint.
+            range.host.clear();
+        }
+        range.port = static_cast<in_port_t>(master->element[1]->integer);
+        ranges->push_back(std::move(range));
+    }
+    return true;
+}
+
+bool ParseClusterRedirect(const redisReply *reply, ClusterRedirect *redirect) {
+    if (!reply || reply->type != REDIS_REPLY_ERROR) {
+        return false;
+    }
+
+    const char *str = reply->str;
+    const char *str_end = reply->str + reply->len;
+    if (reply->len > 6 && memcmp(str, "MOVED ", 6) == 0) {
+        redirect->ask = false;
+        str += 6;
+    } else if (reply->len > 4 && memcmp(str, "ASK ", 4) == 0) {
+        redirect->ask = true;
+        str += 4;
+    } else {
+        return false;
+    }
+
+    // <slot> <host>:<port>, host 可能是 IPv6 地址, 因此以最后一个 ':' 分隔.
+    const char *space = static_cast<const char*>(memchr(str, ' ', str_end - str));
+    if (!space) {
+        return false;
+    }
+    unsigned long slot = 0;
+    for (const char *ptr = str; ptr < space; ++ptr) {
+        if (*ptr < '0' || *ptr > '9' || slot >= kClusterSlotNum) {
+            return false;
+        }
+        slot = slot * 10 + (*ptr - '0');
+    }
+    if (space == str || slot >= kClusterSlotNum) {
+        return false;
+    }
+
+    const char *endpoint = space + 1;
+    const char *colon = nullptr;
+    for (const char *ptr = str_end; ptr > endpoint; --ptr) {
+        if (ptr[-1] == ':') {
+            colon = ptr - 1;
+            break;
+        }
+    }
+    if (!colon || !ParsePort(colon + 1, str_end - colon - 1, &redirect->port)) {
+        return false;
+    }
+
+    redirect->slot = static_cast<uint16_t>(slot);
+    redirect->host.assign(endpoint, colon - endpoint);
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <hiredis/hiredis.h>
+
+/* Redis Cluster 相关的工具函数, 只负责计算与解析, 不涉及网络.
+ */
+
+constexpr size_t kClusterSlotNum = 16384;
+
+/**
+ * key 所属的 hash slot, 即 CRC16(key) % 16384. 若 key 中存在 `{...}` 并且其中内容不为空, 则只对第一个 `{` 与
+ * 其后第一个 `}` 之间的内容计算.
+ */
+uint16_t GetClusterHashSlot(const char *key, size_t len) noexcept;
+
+struct ClusterSlotRange {
+    uint16_t begin = 0; // 包含.
+    uint16_t end = 0; // 包含.
+
+    // 负责该范围的 master 节点. host 可能为空, 表明与执行 CLUSTER SLOTS 的节点相同.
+    std::string host;
+    in_port_t port = 0;
+};
+
+/**
+ * 解析 CLUSTER SLOTS 的响应. 若响应格式不正确, 则返回 false, 此时 ranges 的内容未定义.
+ */
+bool ParseClusterSlots(const redisReply *reply, std::vector<ClusterSlotRange> *ranges);
+
+struct ClusterRedirect {
+    bool ask = false; // 为 true 表明是 ASK 重定向, 否则是 MOVED 重定向.
+    uint16_t slot = 0;
+
+    // 同 ClusterSlotRange::host, 可能为空.
+    std::string host;
+    in_port_t port = 0;
+};
+
+/**
+ * 若 reply 是 `MOVED <slot> <host>:<port>` 或者 `ASK <slot> <host>:<port>` 错误, 则解析到 redirect 中并返回
+ * true; 否则返回 false.
+ */
+bool ParseClusterRedirect(const redisReply *reply, ClusterRedirect *redirect);
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <strings.h>
+
+#include <atomic>
+#include <new>
+
+#include "async_redis_client/latency_histogram.h"
+
+/**
+ * 按照命令名统计请求在各个阶段的延迟. 只由一个 work thread 写入, 其他线程可以随时通过 ForEach() 读取.
+ *
+ * 最多记录 kMaxCommandNum - 1 种命令, 之后出现的命令, 以及名字长于 kMaxNameLen 的命令都被归入 "OTHER". 每种命令
+ * 对应的 Entry 在首次出现时分配, 并且一直存活到 CommandLatencyTable 析构.
+ */
+class CommandLatencyTable {
+public:
+    enum : size_t {
+        kMaxCommandNum = 64,
+        kMaxNameLen = 31
+    };
+
+    enum Stage : size_t {
+        kQueueWait = 0, // 从 Execute() 到 work thread 从请求队列中取出请求.
+        kDispatch, // 从取出请求到交给 hiredis, 包括处理同一批次中排在前面的请求.
+        kRoundTrip, // 从交给 hiredis 到收到响应, 包括在 hiredis 输出缓冲区中等待写出, 网络以及服务端的时间.
+        kCallback, // 回调的执行时间.
+        kStageNum
+    };
+
+    struct Entry {
+        char name[kMaxNameLen + 1]; // 大写.
+        SingleWriterLatencyHistogram stages[kStageNum]; // 单位: ns.
+    };
+
+public:
+    CommandLatencyTable() noexcept = default;
+
+    ~CommandLatencyTable() noexcept {
+        size_t entry_num = entry_num_.load(std::memory_order_relaxed);
+        for (size_t idx = 0; idx < entry_num; ++idx) {
+            delete entries_[idx];
+        }
+    }
+
+    CommandLatencyTable(const CommandLatencyTable &) = delete;
+    CommandLatencyTable& operator=(const CommandLatencyTable &) = delete;
+
+    /**
+     * 返回命令 name 对应的 Entry, 不存在时创建. 若内存不足则返回 nullptr. 只能在写入线程中调用.
+     */
+    Entry* GetEntry(const char *name, size_t len) noexcept {
+        // 同一种命令往往连续出现.
+        if (last_ && IsName(last_, name, len)) {
+            return last_;
+        }
+
+        size_t entry_num = entry_num_.load(std::memory_order_relaxed);
+        for (size_t idx = 0; idx < entry_num; ++idx) {
+            if (IsName(entries_[idx], name, len)) {
+                last_ = entries_[idx];
+                return last_;
+            }
+        }
+
+        // 总是为 OTHER 保留一个位置.
+        if (len > kMaxNameLen || entry_num + 1 >= kMaxCommandNum) {
+            if (!other_) {
+                other_ = NewEntry("OTHER", 5);
+            }
+            return other_;
+        }
+
+        Entry *entry = NewEntry(name, len);
+        if (entry) {
+            last_ = entry;
+        }
+        return entry;
+    }
+
+    /**
+     * 对当前所有的 Entry 调用 f(const Entry &), 可以在任意线程中调用.
+     */
+    template <typename F>
+    void ForEach(F &&f) const {
+        size_t entry_num = entry_num_.load(std::memory_order_acquire);
+        for (size_t idx = 0; idx < entry_num; ++idx) {
+            f(static_cast<const Entry&>(*entries_[idx]));
+        }
+        return ;
+    }
+
+private:
+    // entries_[0, entry_num_) 有效, 写入线程在填充好 entries_[i] 之后才以 release 语义增加 entry_num_.
+    Entry *entries_[kMaxCommandNum];
+    std::atomic<size_t> entry_num_{0};
+
+    Entry *last_ = nullptr;
+    Entry *other_ = nullptr;
+
+private:
+    static bool IsName(const Entry *entry, const char *name, size_t len) noexcept {
+        return len <= kMaxNameLen && entry->name[len] == '\0' && strncasecmp(entry->name, name, len) == 0;
+    }
+
+    Entry* NewEntry(const char *name, size_t len) noexcept {
+        size_t entry_num = entry_num_.load(std::memory_order_relaxed);
+        if (entry_num >= kMaxCommandNum) {
+            return nullptr;
+        }
+
+        Entry *entry = new (std::nothrow) Entry;
+        if (!entry) {
+            return nullptr;
+        }
+        for (size_t idx = 0; idx < len; ++idx) {
+            entry->name[idx] = toupper(static_cast<unsigned char>(name[idx]));
+        }
+        entry->name[len] = '\0';
+
+        entries_[entry_num] = entry;
+        entry_num_.store(entry_num + 1, std::memory_order_release);
+        return entry;
+    }
+};
@@ -0,0 +1,93 @@
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "async_redis_client/cpu_topology.h"
+
+std::vector<int> ParseCpuList(const std::string &cpu_list) {
+    std::vector<int> cpus;
+    std::stringstream stream(cpu_list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty() || item == "\n") {
+            continue;
+        }
+
+        char *end;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        if ((*end != '\0' && *end != '\n') || first < 0 || last < first || last >= CPU_SETSIZE) {
+            throw std::runtime_error("INVALID CPU LIST: " + cpu_list);
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> GetCpuNodes() noexcept {
+    static const char *kNodeDir = "/sys/devices/system/node";
+
+    std::vector<int> cpu_nodes;
+    DIR *dir = opendir(kNodeDir);
+    if (!dir) {
+        return cpu_nodes;
+    }
+
+    try {
+        while (struct dirent *entry = readdir(dir)) {
+            char *end;
+            if (strncmp(entry->d_name, "node", 4) != 0) {
+                continue;
+            }
+            long node = strtol(entry->d_name + 4, &end, 10);
+            if (end == entry->d_name + 4 || *end != '\0') {
+                continue;
+            }
+
+            std::ifstream cpulist_file(std::string(kNodeDir) + "/" + entry->d_name + "/cpulist");
+            std::string cpu_list;
+            if (!std::getline(cpulist_file, cpu_list)) {
+                continue;
+            }
+            for (int cpu : ParseCpuList(cpu_list)) {
+                if (static_cast<size_t>(cpu) >= cpu_nodes.size()) {
+                    cpu_nodes.resize(cpu + 1, -1);
+                }
+                cpu_nodes[cpu] = static_cast<int>(node);
+            }
+        }
+    } catch (...) {
+        cpu_nodes.clear();
+    }
+
+    closedir(dir);
+    return cpu_nodes;
+}
+
+int BindCurrentThread(const std::vector<int> &cpus) noexcept {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return EINVAL;
+        }
+        CPU_SET(cpu, &cpu_set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+}
+
+int GetCurrentCpu() noexcept {
+    return sched_getcpu();
+}
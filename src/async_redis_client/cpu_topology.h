@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/* CPU 拓扑相关的工具函数, 只依赖 sysfs 与 glibc, 不依赖 libnuma.
+ */
+
+/**
+ * 解析 "0-3,8,10-11" 这种格式的 CPU 列表. 若格式不正确则抛出异常.
+ */
+std::vector<int> ParseCpuList(const std::string &cpu_list);
+
+/**
+ * 当前机器上 CPU 到 NUMA 节点的映射, 即返回值 [cpu] 为 cpu 所在的节点, -1 表示未知. 从
+ * /sys/devices/system/node/node<N>/cpulist 中读取; 若不支持 NUMA, 则返回空.
+ */
+std::vector<int> GetCpuNodes() noexcept;
+
+/**
+ * 将当前线程绑定到 cpus 上. 若失败则返回 errno 风格的错误码, 否则返回 0.
+ */
+int BindCurrentThread(const std::vector<int> &cpus) noexcept;
+
+/**
+ * 当前线程正在运行的 CPU, 失败时返回 -1. 基于 vDSO 中的 sched_getcpu(), 开销很小.
+ */
+int GetCurrentCpu() noexcept;
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+/**
+ * HDR 风格的延迟直方图, 用来统计 p50/p99/p99.9/max 这类分位数.
+ *
+ * 小于 2^kSubBucketBits 的值精确记录; 更大的值按照 2 的幂分段, 每段再等分为 2^(kSubBucketBits - 1) 个桶, 因此
+ * 相对误差不超过 2^-(kSubBucketBits - 1), 即约 1.6%. Record() 为 O(1), 不分配内存.
+ *
+ * 非线程安全. 通常每个线程各自记录, 最后通过 Merge() 合并.
+ */
+class LatencyHistogram {
+public:
+    enum : size_t {
+        kSubBucketBits = 7,
+        kSubBucketNum = 1 << kSubBucketBits,
+        kHalfSubBucketNum = kSubBucketNum / 2,
+        kBucketNum = ((64 - kSubBucketBits) << (kSubBucketBits - 1)) + kSubBucketNum
+    };
+
+public:
+    LatencyHistogram() noexcept {
+        Reset();
+    }
+
+    void Reset() noexcept {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+        return ;
+    }
+
+    void Record(uint64_t value) noexcept {
+        ++counts_[GetBucketIdx(value)];
+        ++count_;
+        sum_ += value;
+        if (value < min_) {
+            min_ = value;
+        }
+        if (value > max_) {
+            max_ = value;
+        }
+        return ;
+    }
+
+    void Merge(const LatencyHistogram &other) noexcept {
+        for (size_t idx = 0; idx < kBucketNum; ++idx) {
+            counts_[idx] += other.counts_[idx];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if (other.min_ < min_) {
+            min_ = other.min_;
+        }
+        if (other.max_ > max_) {
+            max_ = other.max_;
+        }
+        return ;
+    }
+
+    uint64_t GetCount() const noexcept {
+        return count_;
+    }
+
+    uint64_t GetMin() const noexcept {
+        return count_ ? min_ : 0;
+    }
+
+    uint64_t GetMax() const noexcept {
+        return max_;
+    }
+
+    double GetMean() const noexcept {
+        return count_ ? static_cast<double>(sum_) / count_ : 0;
+    }
+
+    /**
+     * 第 percentile 百分位的值, percentile 取值 [0, 100]. 返回的是所在桶能表示的最大值, 但不会超过 GetMax().
+     */
+    uint64_t GetValueAtPercentile(double percentile) const noexcept {
+        if (count_ == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(percentile / 100 * count_ + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        if (rank > count_) {
+            rank = count_;
+        }
+
+        uint64_t seen = 0;
+        for (size_t idx = 0; idx < kBucketNum; ++idx) {
+            seen += counts_[idx];
+            if (seen >= rank) {
+                uint64_t value = GetBucketMaxValue(idx);
+                return value < max_ ? value : max_;
+            }
+        }
+        return max_;
+    }
+
+private:
+    friend class SingleWriterLatencyHistogram;
+
+    uint64_t counts_[kBucketNum];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+
+private:
+    static size_t GetBucketIdx(uint64_t value) noexcept {
+        if (value < kSubBucketNum) {
+            return static_cast<size_t>(value);
+        }
+
+        // value >> shift 落在 [kHalfSubBucketNum, kSubBucketNum) 中.
+        size_t shift = (63 - __builtin_clzll(value)) - (kSubBucketBits - 1);
+        return (shift << (kSubBucketBits - 1)) + static_cast<size_t>(value >> shift);
+    }
+
+    static uint64_t GetBucketMaxValue(size_t idx) noexcept {
+        if (idx < kSubBucketNum) {
+            return idx;
+        }
+
+        size_t shift = (idx >> (kSubBucketBits - 1)) - 1;
+        uint64_t mantissa = idx - (shift << (kSubBucketBits - 1));
+        return (mantissa << shift) + ((1ULL << shift) - 1);
+    }
+};
+
+/**
+ * 单写者的 LatencyHistogram: 只有一个线程调用 Record(), 其他线程可以随时通过 MergeTo() 读取.
+ *
+ * 计数器只由写入线程修改, 因此使用 relaxed 的 load + store 而不是原子的 RMW 操作, Record() 的开销与
+ * LatencyHistogram 相当. 读到的各个计数之间并不保证一致.
+ */
+class SingleWriterLatencyHistogram {
+public:
+    SingleWriterLatencyHistogram() noexcept = default;
+
+    SingleWriterLatencyHistogram(const SingleWriterLatencyHistogram &) = delete;
+    SingleWriterLatencyHistogram& operator=(const SingleWriterLatencyHistogram &) = delete;
+
+    void Record(uint64_t value) noexcept {
+        Add(counts_[LatencyHistogram::GetBucketIdx(value)], 1);
+        Add(count_, 1);
+        Add(sum_, value);
+        if (value < min_.load(std::memory_order_relaxed)) {
+            min_.store(value, std::memory_order_relaxed);
+        }
+        if (value > max_.load(std::memory_order_relaxed)) {
+            max_.store(value, std::memory_order_relaxed);
+        }
+        return ;
+    }
+
+    // 将当前的计数累加到 histogram 中.
+    void MergeTo(LatencyHistogram *histogram) const noexcept {
+        for (size_t idx = 0; idx < LatencyHistogram::kBucketNum; ++idx) {
+            histogram->counts_[idx] += counts_[idx].load(std::memory_order_relaxed);
+        }
+        histogram->count_ += count_.load(std::memory_order_relaxed);
+        histogram->sum_ += sum_.load(std::memory_order_relaxed);
+
+        uint64_t min = min_.load(std::memory_order_relaxed);
+        if (min < histogram->min_) {
+            histogram->min_ = min;
+        }
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        if (max > histogram->max_) {
+            histogram->max_ = max;
+        }
+        return ;
+    }
+
+private:
+    std::atomic<uint64_t> counts_[LatencyHistogram::kBucketNum] {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> min_{UINT64_MAX};
+    std::atomic<uint64_t> max_{0};
+
+private:
+    static void Add(std::atomic<uint64_t> &counter, uint64_t delta) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        return ;
+    }
+};
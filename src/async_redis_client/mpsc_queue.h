@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+/**
+ * 侵入式, 无锁的多生产者单消费者队列.
+ *
+ * T 需要具有 `T *next` 成员, 队列通过该成员将元素串联起来, 因此入队出队都不会有任何内存分配. 当元素在队列中时,
+ * 其 next 成员由队列来使用, 使用者不应该修改.
+ *
+ * 实现上是一个 Treiber stack: 生产者通过 CAS 将元素压入栈顶; 消费者通过一次 exchange 取走整个栈, 然后将其翻转
+ * 从而得到 FIFO 顺序. 因此对于同一个生产者而言, 其压入的元素总是按照压入顺序被消费.
+ *
+ * 队列具有关闭状态, 此时 Push() 总是失败. 新创建的队列处于关闭状态, 需要由消费者调用 Open() 之后才可以使用.
+ *
+ * Push() 会告知调用者队列是否由空变为非空. 由于消费者每次都会取走所有元素, 所以在消费者两次取走元素之间, 只有
+ * 一个生产者会观察到这一转变, 可以由这个生产者来负责唤醒消费者, 从而将唤醒操作合并.
+ */
+template <typename T>
+class IntrusiveMpscQueue {
+public:
+    enum class PushResult {
+        kClosed = 0, // 队列已经关闭, 压入失败.
+        kFirst, // 压入成功, 并且队列由空变为非空.
+        kNotFirst // 压入成功, 在此之前队列非空.
+    };
+
+public:
+    IntrusiveMpscQueue() noexcept:
+        head_(Closed()) {
+    }
+
+    IntrusiveMpscQueue(const IntrusiveMpscQueue &) = delete;
+    IntrusiveMpscQueue& operator=(const IntrusiveMpscQueue &) = delete;
+
+    /**
+     * 将 node 压入队列. 线程安全.
+     *
+     * 压入成功之后, 消费者在 Open() 之前的写入对当前线程可见.
+     *
+     * @return kClosed, 表明队列已经关闭, 此时 node 保持不变. 否则表明压入成功, 此后 node 由消费者来负责.
+     */
+    PushResult Push(T *node) noexcept {
+        return PushChain(node, node);
+    }
+
+    /**
+     * 将 first, ..., last 作为一个整体压入队列, 消费者总是会在一次 PopAll()/Close() 中按照 first, ..., last 的
+     * 顺序连续地取到它们. 线程安全.
+     *
+     * 调用者需要事先通过 next 将元素按照 last -> ... -> first 的顺序串联起来, 即 last->next 指向着倒数第二个元素,
+     * 以此类推. first->next 会被队列改写.
+     *
+     * @return 同 Push(). 当返回 kClosed 时, first->next 为 nullptr, 其他元素保持不变.
+     */
+    PushResult PushChain(T *first, T *last) noexcept {
+        T *old_head = head_.load(std::memory_order_acquire);
+        do {
+            if (old_head == Closed()) {
+                first->next = nullptr;
+                return PushResult::kClosed;
+            }
+            first->next = old_head;
+        } while (!head_.compare_exchange_weak(old_head, last, std::memory_order_acq_rel, std::memory_order_acquire));
+        return old_head ? PushResult::kNotFirst : PushResult::kFirst;
+    }
+
+    /**
+     * 取出队列中所有元素, 按照 FIFO 顺序通过 next 串联. 只能由消费者调用.
+     *
+     * 若队列为空或者已经关闭, 则返回 nullptr.
+     */
+    T* PopAll() noexcept {
+        if (head_.load(std::memory_order_relaxed) == nullptr) {
+            return nullptr;
+        }
+
+        T *head = head_.exchange(nullptr, std::memory_order_acquire);
+        if (head == Closed()) { // 消费者不应该在队列关闭之后再调用 PopAll(), 这里只是保持队列的状态不变.
+            head_.store(Closed(), std::memory_order_relaxed);
+            return nullptr;
+        }
+        return Reverse(head);
+    }
+
+    /**
+     * 关闭队列, 并取出队列中剩余的元素. 只能由消费者调用.
+     *
+     * Close() 与 IsClosed() 都是 seq_cst 的, 使用者可以借此与其他 seq_cst 的原子变量建立全序关系.
+     */
+    T* Close() noexcept {
+        T *head = head_.exchange(Closed(), std::memory_order_seq_cst);
+        if (head == Closed()) {
+            return nullptr;
+        }
+        return Reverse(head);
+    }
+
+    /**
+     * 打开队列. 只能由消费者在队列处于关闭状态时调用.
+     */
+    void Open() noexcept {
+        head_.store(nullptr, std::memory_order_release);
+        return ;
+    }
+
+    bool IsClosed() const noexcept {
+        return head_.load(std::memory_order_seq_cst) == Closed();
+    }
+
+private:
+    /* head_ 会被所有生产者频繁地 CAS, 因此单独占据一个 cache line, 避免与相邻的成员产生 false sharing.
+     */
+    char padding_front_[64];
+    std::atomic<T*> head_;
+    char padding_back_[64 - sizeof(std::atomic<T*>)];
+
+private:
+    static T* Closed() noexcept {
+        return reinterpret_cast<T*>(static_cast<uintptr_t>(1));
+    }
+
+    static T* Reverse(T *head) noexcept {
+        T *prev = nullptr;
+        while (head) {
+            T *next = head->next;
+            head->next = prev;
+            prev = head;
+            head = next;
+        }
+        return prev;
+    }
+};
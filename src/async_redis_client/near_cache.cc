@@ -0,0 +1,393 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "async_redis_client/near_cache.h"
+
+namespace {
+
+// unordered_map 节点, LRU 链表等的额外开销, 只是估算.
+constexpr size_t kEntryOverhead = sizeof(void*) * 4;
+
+inline bool IsCommand(const std::string &arg, const char *name, size_t len) noexcept {
+    return arg.size() == len && strncasecmp(arg.data(), name, len) == 0;
+}
+
+inline bool HasPrefix(const std::string &key, const std::vector<std::string> &prefixes) noexcept {
+    if (prefixes.empty()) {
+        return true;
+    }
+    for (const std::string &prefix : prefixes) {
+        if (key.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// reply 的深拷贝所占用的内存.
+size_t GetReplyBytes(const redisReply *reply) noexcept {
+    size_t bytes = sizeof(redisReply);
+    if (reply->str) {
+        bytes += reply->len + 1;
+    }
+    if (reply->element) {
+        bytes += reply->elements * sizeof(redisReply*);
+        for (size_t idx = 0; idx < reply->elements; ++idx) {
+            bytes += GetReplyBytes(reply->element[idx]);
+        }
+    }
+    return bytes;
+}
+
+/* 返回 reply 的深拷贝, 所有内存都通过 malloc() 分配, 与 hiredis 默认构建的 reply 一致, 因此可以通过
+ * freeReplyObject() 释放. 内存不足时返回 nullptr.
+ */
+redisReply* CopyReply(const redisReply *src) noexcept {
+    redisReply *dst = static_cast<redisReply*>(malloc(sizeof(redisReply)));
+    if (!dst) {
+        return nullptr;
+    }
+    *dst = *src;
+    dst->str = nullptr;
+    dst->element = nullptr;
+    dst->elements = 0;
+
+    if (src->str) {
+        dst->str = static_cast<char*>(malloc(src->len + 1));
+        if (!dst->str) {
+            freeReplyObject(dst);
+            return nullptr;
+        }
+        memcpy(dst->str, src->str, src->len);
+        dst->str[src->len] = '\0';
+    }
+
+    if (src->element && src->elements > 0) {
+        dst->element = static_cast<redisReply**>(calloc(src->elements, sizeof(redisReply*)));
+        if (!dst->element) {
+            freeReplyObject(dst);
+            return nullptr;
+        }
+        dst->elements = src->elements;
+        for (size_t idx = 0; idx < src->elements; ++idx) {
+            dst->element[idx] = CopyReply(src->element[idx]);
+            if (!dst->element[idx]) {
+                freeReplyObject(dst);
+                return nullptr;
+            }
+        }
+    }
+    return dst;
+}
+
+// 以 reply 的深拷贝创建 SharedReply, 内存不足时返回 nullptr.
+SharedReply* CreateSharedCopy(const redisReply *reply) noexcept {
+    std::unique_ptr<SharedReply> shared(SharedReply::New(1));
+    if (!shared) {
+        return nullptr;
+    }
+    std::unique_ptr<redisReply, RedisReplyDeleter> copy(CopyReply(reply));
+    if (!copy) {
+        return nullptr;
+    }
+    shared->Adopt(std::move(copy), false);
+    return shared.release();
+}
+
+// 缓存的响应所占用的内存.
+size_t GetSharedBytes(const SharedReply *shared) noexcept {
+    return sizeof(SharedReply) + sizeof(SharedReplyPart) * shared->part_num + GetReplyBytes(shared->owner.get());
+}
+
+// 错误等响应不会被缓存.
+bool IsCacheableReply(NearCache::Kind kind, const redisReply *reply) noexcept {
+    if (!reply) {
+        return false;
+    }
+    if (kind != NearCache::kHGetAll) {
+        return reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_NIL;
+    }
+    if (reply->type != REDIS_REPLY_ARRAY) {
+        return false;
+    }
+    for (size_t idx = 0; idx < reply->elements; ++idx) {
+        if (reply->element[idx]->type != REDIS_REPLY_STRING) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+NearCache::Kind NearCache::GetKind(const std::vector<std::string> &cmd,
+                                   const std::vector<std::string> &prefixes) noexcept {
+    Kind kind = kNone;
+    if (cmd.size() == 2 && IsCommand(cmd[0], "GET", 3)) {
+        kind = kGet;
+    } else if (cmd.size() == 3 && IsCommand(cmd[0], "HGET", 4)) {
+        kind = kHGet;
+    } else if (cmd.size() == 2 && IsCommand(cmd[0], "HGETALL", 7)) {
+        kind = kHGetAll;
+    }
+    if (kind != kNone && !HasPrefix(cmd[1], prefixes)) {
+        kind = kNone;
+    }
+    return kind;
+}
+
+redisReply* NearCache::Lookup(const std::vector<std::string> &cmd, Kind kind) noexcept {
+    SharedReply *reply = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(mux_);
+        auto iter = entries_.find(cmd[1]);
+        Item *item = iter != entries_.end() ? FindItem(&iter->second, cmd, kind) : nullptr;
+        if (item && item->reply) {
+            reply = item->reply;
+            reply->AddRef();
+            iter->second.referenced = true;
+        }
+    }
+    if (!reply) {
+        miss_num_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    hit_num_.fetch_add(1, std::memory_order_relaxed);
+    return reply->Root();
+}
+
+uint64_t NearCache::Reserve(const std::vector<std::string> &cmd, Kind kind) noexcept {
+    std::lock_guard<std::mutex> guard(mux_);
+    Entry *entry;
+    try {
+        auto result = entries_.emplace(cmd[1], Entry());
+        entry = &result.first->second;
+        if (result.second) {
+            entry->key = &result.first->first;
+            AddBytes(entry, nullptr, kEntryOverhead + sizeof(Entry) + cmd[1].size());
+        }
+    } catch (...) {
+        return 0;
+    }
+    Touch(entry);
+
+    Item *item = FindItem(entry, cmd, kind);
+    if (!item) {
+        try {
+            entry->items.emplace_back();
+            item = &entry->items.back();
+            item->kind = kind;
+            if (kind == kHGet) {
+                item->field = cmd[2];
+            }
+        } catch (...) {
+            if (item) {
+                entry->items.pop_back();
+            }
+            if (entry->items.empty()) {
+                Erase(entry);
+            }
+            SyncSize();
+            return 0;
+        }
+        AddBytes(entry, item, sizeof(Item) + item->field.size());
+    }
+
+    // 已有的响应仍然可以被命中, 直至被 Fill() 替换.
+    uint64_t token = next_token_++;
+    item->token = token;
+    EvictIfNeeded();
+    SyncSize();
+    return token;
+}
+
+void NearCache::Fill(const std::vector<std::string> &cmd, Kind kind, uint64_t token,
+                     const redisReply *reply) noexcept {
+    // 只有当前线程会修改 entries_, 因此查找以及拷贝 reply 都不需要持有 mux_.
+    auto iter = entries_.find(cmd[1]);
+    if (iter == entries_.end()) {
+        return ;
+    }
+    Entry *entry = &iter->second;
+    Item *item = FindItem(entry, cmd, kind);
+    if (!item || item->token != token) { // 占位记录已经被 Invalidate(), 或者被之后的请求取代.
+        return ;
+    }
+    item->token = 0;
+
+    SharedReply *shared = IsCacheableReply(kind, reply) ? CreateSharedCopy(reply) : nullptr;
+    SharedReply *old_reply = item->reply;
+    {
+        std::lock_guard<std::mutex> guard(mux_);
+        if (!shared) {
+            AddBytes(entry, nullptr, 0 - item->bytes);
+            entry->items.erase(entry->items.begin() + (item - entry->items.data()));
+            if (entry->items.empty()) {
+                Erase(entry);
+            }
+        } else {
+            if (old_reply) {
+                AddBytes(entry, item, 0 - GetSharedBytes(old_reply));
+            }
+            item->reply = shared;
+            AddBytes(entry, item, GetSharedBytes(shared));
+            fill_num_.fetch_add(1, std::memory_order_relaxed);
+
+            Touch(entry);
+            EvictIfNeeded();
+        }
+        SyncSize();
+    }
+    if (old_reply) {
+        SharedReply::Release(old_reply->Root());
+    }
+    return ;
+}
+
+void NearCache::Invalidate(const char *key, size_t len) noexcept {
+    // 只有当前线程会修改 entries_, 因此只在删除时持有 mux_.
+    try {
+        key_buf_.assign(key, len);
+    } catch (...) { // 内存不足, 此时无法确定哪些记录已经失效.
+        Clear();
+        return ;
+    }
+    auto iter = entries_.find(key_buf_);
+    if (iter == entries_.end()) {
+        return ;
+    }
+
+    std::lock_guard<std::mutex> guard(mux_);
+    Erase(&iter->second);
+    invalidate_num_.fetch_add(1, std::memory_order_relaxed);
+    SyncSize();
+    return ;
+}
+
+void NearCache::Clear() noexcept {
+    std::lock_guard<std::mutex> guard(mux_);
+    ClearLocked();
+    return ;
+}
+
+NearCache::Stats NearCache::GetStats() const noexcept {
+    Stats stats;
+    stats.hit_num = hit_num_.load(std::memory_order_relaxed);
+    stats.miss_num = miss_num_.load(std::memory_order_relaxed);
+    stats.fill_num = fill_num_.load(std::memory_order_relaxed);
+    stats.invalidate_num = invalidate_num_.load(std::memory_order_relaxed);
+    stats.evict_num = evict_num_.load(std::memory_order_relaxed);
+    stats.entry_num = entry_num_.load(std::memory_order_relaxed);
+    stats.bytes = bytes_num_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+NearCache::Item* NearCache::FindItem(Entry *entry, const std::vector<std::string> &cmd, Kind kind) noexcept {
+    for (Item &item : entry->items) {
+        if (item.kind == kind && (kind != kHGet || item.field == cmd[2])) {
+            return &item;
+        }
+    }
+    return nullptr;
+}
+
+void NearCache::Touch(Entry *entry) noexcept {
+    if (head_ == entry) {
+        return ;
+    }
+    if (entry->prev || entry->next || tail_ == entry) {
+        Unlink(entry);
+    }
+    entry->next = head_;
+    if (head_) {
+        head_->prev = entry;
+    }
+    head_ = entry;
+    if (!tail_) {
+        tail_ = entry;
+    }
+    return ;
+}
+
+void NearCache::Unlink(Entry *entry) noexcept {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        head_ = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        tail_ = entry->prev;
+    }
+    entry->prev = nullptr;
+    entry->next = nullptr;
+    return ;
+}
+
+void NearCache::Erase(Entry *entry) noexcept {
+    Unlink(entry);
+    for (Item &item : entry->items) {
+        if (item.reply) {
+            SharedReply::Release(item.reply->Root());
+        }
+    }
+    bytes_ -= entry->bytes;
+    entries_.erase(entries_.find(*entry->key));
+    return ;
+}
+
+// bytes 可以是 "负数", 即 0 - n. item 为 nullptr 时只计入 entry.
+void NearCache::AddBytes(Entry *entry, Item *item, size_t bytes) noexcept {
+    if (item) {
+        item->bytes += bytes;
+    }
+    entry->bytes += bytes;
+    bytes_ += bytes;
+    return ;
+}
+
+/* 从链表尾部开始淘汰, 直至不超过 max_bytes_. 尾部的 key 若在此期间被 Lookup() 命中过, 则清除 referenced 并移到
+ * 链表头部, 再给一次机会, 即 CLOCK 算法; 每次最多给 entries_.size() 次机会, 以免命中不断发生时无法淘汰. 刚刚被
+ * 访问的 key 位于链表头部, 只有当其本身就超过 max_bytes_ 时才会被淘汰.
+ */
+void NearCache::EvictIfNeeded() noexcept {
+    size_t chance_num = entries_.size();
+    while (bytes_ > max_bytes_ && tail_) {
+        Entry *entry = tail_;
+        if (entry->referenced && chance_num > 0 && entry != head_) {
+            entry->referenced = false;
+            --chance_num;
+            Touch(entry);
+            continue;
+        }
+        Erase(entry);
+        evict_num_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ;
+}
+
+void NearCache::ClearLocked() noexcept {
+    for (auto &kv : entries_) {
+        for (Item &item : kv.second.items) {
+            if (item.reply) {
+                SharedReply::Release(item.reply->Root());
+            }
+        }
+    }
+    invalidate_num_.fetch_add(entries_.size(), std::memory_order_relaxed);
+    entries_.clear();
+    head_ = nullptr;
+    tail_ = nullptr;
+    bytes_ = 0;
+    SyncSize();
+    return ;
+}
+
+void NearCache::SyncSize() noexcept {
+    entry_num_.store(entries_.size(), std::memory_order_relaxed);
+    bytes_num_.store(bytes_, std::memory_order_relaxed);
+    return ;
+}
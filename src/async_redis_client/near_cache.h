@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <hiredis/hiredis.h>
+
+#include "async_redis_client/shared_reply.h"
+
+/**
+ * 一个 work thread 上的客户端缓存, 参见 AsyncRedisClient::near_cache_max_bytes.
+ *
+ * 缓存 GET key, HGET key field, HGETALL key 的响应, 按照 key 组织, 一个 key 下可以有多条记录, 以 key 为单位
+ * 进行近似 LRU 淘汰与失效. 缓存的响应是只读的 SharedReply, 命中时只增加其引用计数, 不会拷贝.
+ *
+ * 只有 Lookup(), GetStats() 可以在任意线程调用; 其他方法, 包括 Invalidate(), Clear(), 都只能在所属的 work thread
+ * 中调用, 其他 work thread 上的写请求需要将 key 交给所属的 work thread 来失效. 因此缓存只有一个写者: 写者在修改
+ * entries_ 时持有 mux_, 读取时则不需要; Lookup() 只在查找并增加引用计数期间持有 mux_, 不会修改 LRU 链表.
+ *
+ * 填充分为两步: 请求发送时 Reserve() 一个占位记录, 收到响应时 Fill(). 若在此期间 key 被 Invalidate(), 或者缓存被
+ * Clear(), 则占位记录随之消失, Fill() 什么也不做. 因此失效消息即使先于响应到达, 也不会将旧值留在缓存中.
+ */
+class NearCache {
+public:
+    enum Kind : uint8_t {
+        kNone = 0,
+        kGet,
+        kHGet,
+        kHGetAll
+    };
+
+    struct Stats {
+        uint64_t hit_num = 0;
+        uint64_t miss_num = 0;
+        uint64_t fill_num = 0;
+        uint64_t invalidate_num = 0; // 因为失效消息, 连接断开而被删除的 key 数目.
+        uint64_t evict_num = 0; // 因为容量不足而被淘汰的 key 数目.
+        uint64_t entry_num = 0; // 当前的 key 数目, 包括只有占位记录的 key.
+        uint64_t bytes = 0; // 当前估算的内存占用.
+    };
+
+public:
+    explicit NearCache(size_t max_bytes) noexcept:
+        max_bytes_(max_bytes) {
+    }
+
+    ~NearCache() noexcept {
+        Clear();
+    }
+
+    NearCache(const NearCache &) = delete;
+    NearCache& operator=(const NearCache &) = delete;
+
+    /**
+     * 若 cmd 可以被缓存, 则返回其 Kind, 否则返回 kNone. 命令名不区分大小写; prefixes 不为空时, 只有 key 以其中
+     * 之一开头的请求才可以被缓存.
+     */
+    static Kind GetKind(const std::vector<std::string> &cmd, const std::vector<std::string> &prefixes) noexcept;
+
+    /**
+     * 若命中, 则返回缓存的响应, 此时调用者持有一个引用, 需要通过 SharedReply::Release() 释放; 否则返回 nullptr.
+     * 返回的响应是只读的. 线程安全.
+     */
+    redisReply* Lookup(const std::vector<std::string> &cmd, Kind kind) noexcept;
+
+    /**
+     * 为即将发送的请求 cmd 创建占位记录, 返回值作为 Fill() 的 token; 返回 0 表示失败, 此时不应该再调用 Fill().
+     */
+    uint64_t Reserve(const std::vector<std::string> &cmd, Kind kind) noexcept;
+
+    /**
+     * 以 reply 填充 token 对应的占位记录. 若占位记录已经不存在, 则什么也不做; 若 reply 为 nullptr, 或者其类型
+     * 不可缓存, 比如错误, 则删除占位记录.
+     */
+    void Fill(const std::vector<std::string> &cmd, Kind kind, uint64_t token, const redisReply *reply) noexcept;
+
+    /**
+     * 删除 key 下的所有记录.
+     */
+    void Invalidate(const char *key, size_t len) noexcept;
+
+    /**
+     * 删除所有记录, 用于无法确定哪些 key 已经失效的场景, 比如 FLUSHALL, 或者失效消息可能已经丢失.
+     */
+    void Clear() noexcept;
+
+    Stats GetStats() const noexcept;
+
+private:
+    struct Item {
+        Kind kind = kNone;
+        std::string field; // 只对 kHGet 有意义.
+        uint64_t token = 0; // 不为 0 表明有尚未收到响应的请求将会填充该记录.
+        SharedReply *reply = nullptr; // 缓存持有一个引用, 为 nullptr 表明只是占位记录.
+        size_t bytes = 0;
+    };
+
+    /* 以 key 为单位的 LRU 链表节点, head_ 为最近由所属 work thread 访问的 key. Lookup() 不修改链表, 只在持有
+     * mux_ 时设置 referenced, 淘汰时被设置了 referenced 的 key 会再得到一次机会, 参见 EvictIfNeeded().
+     */
+    struct Entry {
+        const std::string *key = nullptr; // 指向 entries_ 中的 key, 在 Entry 存活期间有效.
+        Entry *prev = nullptr;
+        Entry *next = nullptr;
+        size_t bytes = 0;
+        bool referenced = false;
+        std::vector<Item> items;
+    };
+
+private:
+    const size_t max_bytes_;
+
+    mutable std::mutex mux_;
+    std::unordered_map<std::string, Entry> entries_;
+    Entry *head_ = nullptr;
+    Entry *tail_ = nullptr;
+    size_t bytes_ = 0;
+    uint64_t next_token_ = 1;
+    std::string key_buf_; // Invalidate() 中用于查找的 key, 复用其内存.
+
+    std::atomic<uint64_t> hit_num_{0};
+    std::atomic<uint64_t> miss_num_{0};
+    std::atomic<uint64_t> fill_num_{0};
+    std::atomic<uint64_t> invalidate_num_{0};
+    std::atomic<uint64_t> evict_num_{0};
+    std::atomic<uint64_t> entry_num_{0};
+    std::atomic<uint64_t> bytes_num_{0};
+
+private:
+    /* Lookup() 在持有 mux_ 时调用 FindItem(), 所属的 work thread 则可以不持有 mux_ 调用; 其他函数都只能由所属的
+     * work thread 在持有 mux_ 时调用.
+     */
+    Item* FindItem(Entry *entry, const std::vector<std::string> &cmd, Kind kind) noexcept;
+    void Touch(Entry *entry) noexcept;
+    void Unlink(Entry *entry) noexcept;
+    void Erase(Entry *entry) noexcept;
+    void AddBytes(Entry *entry, Item *item, size_t bytes) noexcept;
+    void EvictIfNeeded() noexcept;
+    void ClearLocked() noexcept;
+    void SyncSize() noexcept; // 将 entries_.size(), bytes_ 同步到 GetStats() 读取的计数器中.
+};
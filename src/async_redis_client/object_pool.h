@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ * 带有线程本地缓存的对象池.
+ *
+ * T 需要具有 `T *next` 成员, 池通过该成员将空闲对象串联起来. 从池中取出的对象保留着上一次使用时的状态, 由使用者
+ * 负责在放回之前重置.
+ *
+ * 每个线程具有自己的空闲链表, Get()/Put() 在绝大多数情况下只会访问当前线程的空闲链表, 不需要任何同步. 当一个线程
+ * 的空闲链表过长时, 会将 kBatchSize 个对象作为一批交给全局的 depot; 当一个线程的空闲链表为空时, 会从 depot
+ * 中取回一批. 因此对于在 A 线程分配, 在 B 线程释放的对象而言, 每 kBatchSize 个对象才需要对 depot 加一次锁.
+ */
+template <typename T>
+class ObjectPool {
+public:
+    enum : size_t {
+        kBatchSize = 64,
+        kMaxDepotBatchNum = 4096
+    };
+
+public:
+    /**
+     * 取出一个对象. 若池中没有空闲对象, 则 new 一个, 此时可能会抛出异常.
+     */
+    static T* Get() {
+        LocalCache &cache = GetLocalCache();
+        if (!cache.head) {
+            GetDepot().PopBatch(cache);
+        }
+
+        if (cache.head) {
+            T *obj = cache.head;
+            cache.head = obj->next;
+            --cache.num;
+            obj->next = nullptr;
+            return obj;
+        }
+
+        T *obj = new T;
+        GetDepot().alloc_num.fetch_add(1, std::memory_order_relaxed);
+        return obj;
+    }
+
+    /**
+     * 将 obj 放回当前线程的空闲链表.
+     */
+    static void Put(T *obj) noexcept {
+        LocalCache &cache = GetLocalCache();
+        obj->next = cache.head;
+        cache.head = obj;
+        ++cache.num;
+
+        if (cache.num >= 2 * kBatchSize) {
+            GetDepot().PushBatch(cache, kBatchSize);
+        }
+        return ;
+    }
+
+    /**
+     * 池中 new T 的次数. 在稳定状态下, 该值不应该再增长.
+     */
+    static uint64_t GetAllocNum() noexcept {
+        return GetDepot().alloc_num.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct LocalCache {
+        T *head = nullptr;
+        size_t num = 0;
+
+    public:
+        ~LocalCache() noexcept {
+            // 线程退出时, 将空闲对象交给 depot, 使得其他线程仍可以使用.
+            while (num > 0) {
+                GetDepot().PushBatch(*this, num < kBatchSize ? num : kBatchSize);
+            }
+        }
+    };
+
+    struct Batch {
+        T *head = nullptr;
+        size_t num = 0;
+    };
+
+    struct Depot {
+        std::atomic<uint64_t> alloc_num{0};
+
+        std::mutex mux;
+        std::vector<Batch> batches;
+
+    public:
+        // 从 cache 中取出 num 个对象作为一批. 当 depot 已满时, 直接释放这些对象.
+        void PushBatch(LocalCache &cache, size_t num) noexcept {
+            Batch batch;
+            batch.head = cache.head;
+            batch.num = num;
+
+            T *tail = cache.head;
+            for (size_t idx = 1; idx < num; ++idx) {
+                tail = tail->next;
+            }
+            cache.head = tail->next;
+            cache.num -= num;
+            tail->next = nullptr;
+
+            bool pushed = false;
+            try {
+                std::lock_guard<std::mutex> guard(mux);
+                if (batches.size() < kMaxDepotBatchNum) {
+                    batches.push_back(batch);
+                    pushed = true;
+                }
+            } catch (...) {}
+
+            if (!pushed) {
+                while (batch.head) {
+                    T *obj = batch.head;
+                    batch.head = obj->next;
+                    delete obj;
+                }
+            }
+            return ;
+        }
+
+        // 当 cache 为空时调用, 取回一批对象.
+        void PopBatch(LocalCache &cache) noexcept {
+            std::lock_guard<std::mutex> guard(mux);
+            if (batches.empty()) {
+                return ;
+            }
+            cache.head = batches.back().head;
+            cache.num = batches.back().num;
+            batches.pop_back();
+            return ;
+        }
+    };
+
+private:
+    static LocalCache& GetLocalCache() noexcept {
+        static thread_local LocalCache cache;
+        return cache;
+    }
+
+    // depot 永不释放, 因为线程本地的 LocalCache 在析构时仍会访问 depot, 而两者的析构顺序是不确定的.
+    static Depot& GetDepot() noexcept {
+        static Depot *depot = new Depot;
+        return *depot;
+    }
+};
@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "async_redis_client/reply_arena.h"
+
+namespace {
+
+std::atomic<uint64_t> g_chunk_alloc_num{0};
+
+/* 当前线程最近一次创建的响应所在的 arena. hiredis 总是在解析完一个响应之后立即调用其回调, 因此在回调中, 若回调的
+ * reply 是由 ReplyArena 构建的, 则其 arena 必然是 tls_last_arena. Detach() 以此来判断 reply 是否由 ReplyArena
+ * 构建.
+ */
+thread_local ReplyArena *tls_last_arena = nullptr;
+
+} // namespace
+
+ReplyArena::ReplyArena() noexcept:
+    cur_(inline_buf_),
+    end_(inline_buf_ + kInlineSize) {
+    memset(&root_, 0, sizeof(root_));
+}
+
+ReplyArena::~ReplyArena() noexcept {
+    Reset();
+    while (spare_) {
+        Chunk *chunk = spare_;
+        spare_ = chunk->next;
+        free(chunk);
+    }
+}
+
+void* ReplyArena::AllocSlow(size_t size) noexcept {
+    // 优先使用保留着的内存块.
+    Chunk **link = &spare_;
+    while (*link && (*link)->capacity < size) {
+        link = &(*link)->next;
+    }
+
+    Chunk *chunk = *link;
+    if (chunk) {
+        *link = chunk->next;
+        spare_bytes_ -= chunk->capacity;
+    } else {
+        size_t capacity = chunks_ ? chunks_->capacity * 2 : static_cast<size_t>(kMinChunkSize);
+        if (capacity > kMaxChunkSize) {
+            capacity = kMaxChunkSize;
+        }
+        if (capacity < size) {
+            capacity = size;
+        }
+
+        chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + capacity));
+        if (!chunk) {
+            return nullptr;
+        }
+        chunk->capacity = capacity;
+        g_chunk_alloc_num.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    chunk->next = chunks_;
+    chunks_ = chunk;
+    cur_ = chunk->data() + size;
+    end_ = chunk->data() + chunk->capacity;
+    return chunk->data();
+}
+
+char* ReplyArena::CopyString(const char *str, size_t len) noexcept {
+    char *buf = static_cast<char*>(Alloc(len + 1));
+    if (!buf) {
+        return nullptr;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+void ReplyArena::Reset() noexcept {
+    // 在 kMaxRetainedBytes 之内保留用过的内存块, 使得同样大小的响应不再需要 malloc().
+    while (chunks_) {
+        Chunk *chunk = chunks_;
+        chunks_ = chunk->next;
+
+        if (spare_bytes_ + chunk->capacity <= kMaxRetainedBytes) {
+            chunk->next = spare_;
+            spare_ = chunk;
+            spare_bytes_ += chunk->capacity;
+        } else {
+            free(chunk);
+        }
+    }
+
+    cur_ = inline_buf_;
+    end_ = inline_buf_ + kInlineSize;
+    detached_ = false;
+    memset(&root_, 0, sizeof(root_));
+
+    if (tls_last_arena == this) {
+        tls_last_arena = nullptr;
+    }
+    return ;
+}
+
+ReplyArena* ReplyArena::FromRoot(void *reply) noexcept {
+    return reinterpret_cast<ReplyArena*>(static_cast<char*>(reply) - offsetof(ReplyArena, root_));
+}
+
+ReplyArena* ReplyArena::GetArena(const redisReadTask *task) noexcept {
+    if (!task->parent) {
+        ReplyArena *arena;
+        try {
+            arena = ObjectPool<ReplyArena>::Get();
+        } catch (...) {
+            return nullptr;
+        }
+        tls_last_arena = arena;
+        return arena;
+    }
+
+    while (task->parent) {
+        task = task->parent;
+    }
+    return FromRoot(task->obj);
+}
+
+redisReply* ReplyArena::CreateReply(const redisReadTask *task, int type, ReplyArena **arena_out) noexcept {
+    ReplyArena *arena = GetArena(task);
+    if (!arena) {
+        return nullptr;
+    }
+
+    redisReply *reply;
+    if (!task->parent) {
+        reply = &arena->root_;
+    } else {
+        reply = static_cast<redisReply*>(arena->Alloc(sizeof(redisReply)));
+        if (!reply) {
+            return nullptr;
+        }
+        memset(reply, 0, sizeof(*reply));
+
+        redisReply *parent = static_cast<redisReply*>(task->parent->obj);
+        parent->element[task->idx] = reply;
+    }
+    reply->type = type;
+
+    if (arena_out) {
+        *arena_out = arena;
+    }
+    return reply;
+}
+
+// 根节点创建之后, 若后续步骤失败, 则 hiredis 不会对其调用 freeObject(), 需要在这里回收.
+void* ReplyArena::FailCreate(const redisReadTask *task, ReplyArena *arena) noexcept {
+    if (!task->parent) {
+        Release(arena);
+    }
+    return nullptr;
+}
+
+void* ReplyArena::CreateString(const redisReadTask *task, char *str, size_t len) noexcept {
+    ReplyArena *arena;
+    redisReply *reply = CreateReply(task, task->type, &arena);
+    if (!reply) {
+        return nullptr;
+    }
+
+#ifdef REDIS_REPLY_VERB
+    // 与 hiredis 一致, 跳过 "txt:" 这类 4 字节的类型前缀.
+    if (task->type == REDIS_REPLY_VERB) {
+        if (len < 4) {
+            return FailCreate(task, arena);
+        }
+        memcpy(reply->vtype, str, 3);
+        reply->vtype[3] = '\0';
+        str += 4;
+        len -= 4;
+    }
+#endif
+
+    reply->str = arena->CopyString(str, len);
+    if (!reply->str) {
+        return FailCreate(task, arena);
+    }
+    reply->len = len;
+    return reply;
+}
+
+void* ReplyArena::CreateArray(const redisReadTask *task, elements_t elements) noexcept {
+    ReplyArena *arena;
+    redisReply *reply = CreateReply(task, task->type, &arena);
+    if (!reply) {
+        return nullptr;
+    }
+
+    if (elements > 0) {
+        size_t bytes = static_cast<size_t>(elements) * sizeof(redisReply*);
+        reply->element = static_cast<redisReply**>(arena->Alloc(bytes));
+        if (!reply->element) {
+            return FailCreate(task, arena);
+        }
+        memset(reply->element, 0, bytes);
+    }
+    reply->elements = elements;
+    return reply;
+}
+
+void* ReplyArena::CreateInteger(const redisReadTask *task, long long value) noexcept {
+    redisReply *reply = CreateReply(task, REDIS_REPLY_INTEGER, nullptr);
+    if (!reply) {
+        return nullptr;
+    }
+    reply->integer = value;
+    return reply;
+}
+
+void* ReplyArena::CreateNil(const redisReadTask *task) noexcept {
+    return CreateReply(task, REDIS_REPLY_NIL, nullptr);
+}
+
+#if defined(HIREDIS_MAJOR) && HIREDIS_MAJOR >= 1
+
+void* ReplyArena::CreateDouble(const redisReadTask *task, double value, char *str, size_t len) noexcept {
+    ReplyArena *arena;
+    redisReply *reply = CreateReply(task, REDIS_REPLY_DOUBLE, &arena);
+    if (!reply) {
+        return nullptr;
+    }
+
+    reply->dval = value;
+    reply->str = arena->CopyString(str, len);
+    if (!reply->str) {
+        return FailCreate(task, arena);
+    }
+    reply->len = len;
+    return reply;
+}
+
+void* ReplyArena::CreateBool(const redisReadTask *task, int bval) noexcept {
+    redisReply *reply = CreateReply(task, REDIS_REPLY_BOOL, nullptr);
+    if (!reply) {
+        return nullptr;
+    }
+    reply->integer = bval != 0;
+    return reply;
+}
+
+#endif
+
+void ReplyArena::FreeObject(void *reply) noexcept {
+    ReplyArena *arena = FromRoot(reply);
+    if (arena->detached_) { // 所有权已经交给了 Detach() 的调用者.
+        return ;
+    }
+    Release(arena);
+    return ;
+}
+
+void ReplyArena::Release(ReplyArena *arena) noexcept {
+    arena->Reset();
+    ObjectPool<ReplyArena>::Put(arena);
+    return ;
+}
+
+redisReplyObjectFunctions* ReplyArena::GetObjectFunctions() noexcept {
+    static redisReplyObjectFunctions functions = [] () noexcept {
+        redisReplyObjectFunctions fns;
+        memset(&fns, 0, sizeof(fns));
+        fns.createString = CreateString;
+        fns.createArray = CreateArray;
+        fns.createInteger = CreateInteger;
+        fns.createNil = CreateNil;
+#if defined(HIREDIS_MAJOR) && HIREDIS_MAJOR >= 1
+        fns.createDouble = CreateDouble;
+        fns.createBool = CreateBool;
+#endif
+        fns.freeObject = FreeObject;
+        return fns;
+    }();
+    return &functions;
+}
+
+bool ReplyArena::Detach(redisReply *reply) noexcept {
+    ReplyArena *arena = tls_last_arena;
+    if (!arena || &arena->root_ != reply) {
+        return false;
+    }
+    arena->detached_ = true;
+    return true;
+}
+
+void ReplyArena::FreeDetached(redisReply *reply) noexcept {
+    Release(FromRoot(reply));
+    return ;
+}
+
+uint64_t ReplyArena::GetChunkAllocNum() noexcept {
+    return g_chunk_alloc_num.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hiredis/hiredis.h>
+
+#include "async_redis_client/object_pool.h"
+
+/**
+ * 基于 arena 构建 redisReply.
+ *
+ * hiredis 默认为响应中的每个 redisReply 节点, 每个字符串, 每个 element 数组都单独 malloc() 一次, 并在回调之后逐个
+ * free(). ReplyArena 提供了一组 redisReplyObjectFunctions, 将一个响应的所有内容都分配在同一个 arena 中: 根节点
+ * 嵌在 arena 头部, 其余内容在 arena 中顺序分配, 释放时整体归还给 ObjectPool. arena 自带一块内联缓冲区, 大响应
+ * 所需的额外内存块在回收时会在一定额度内保留以便复用.
+ *
+ * 对于使用 GetObjectFunctions() 的 hiredis 连接, 传给回调的 reply 在回调返回之后会被整体回收; 若需要在回调
+ * 之后继续持有 reply, 可以在回调中通过 Detach() 取得整个 arena 的所有权, 之后通过 FreeDetached() 释放.
+ */
+class ReplyArena {
+public:
+    enum : size_t {
+        kInlineSize = 2048,
+        kMinChunkSize = 4096,
+        kMaxChunkSize = 1024 * 1024,
+        /* 回收时最多保留这么多的额外内存块. 空闲的 arena 会一直留在 ObjectPool 中, 因此这里只保留够一个中等
+         * 大小的响应使用的内存块, 大响应的内存块在回收时直接释放.
+         */
+        kMaxRetainedBytes = 4 * kMinChunkSize
+    };
+
+public:
+    /**
+     * 用来设置 redisReader::fn. 返回的对象在进程运行期间一直有效.
+     */
+    static redisReplyObjectFunctions* GetObjectFunctions() noexcept;
+
+    /**
+     * 取得 reply 所在 arena 的所有权, 此后 hiredis 在回调之后不会再回收 reply, 需要由调用者通过
+     * FreeDetached() 释放.
+     *
+     * 只能在 work thread 中, 并且在以 reply 为参数的回调返回之前调用; reply 必须是回调的参数本身, 不能是其中的
+     * 元素. 若 reply 不是由 ReplyArena 构建的, 则返回 false, 此时什么也不做.
+     */
+    static bool Detach(redisReply *reply) noexcept;
+
+    /**
+     * 释放通过 Detach() 取得的 reply, 可以在任意线程调用.
+     */
+    static void FreeDetached(redisReply *reply) noexcept;
+
+    /**
+     * 进程内 arena 额外内存块的 malloc() 次数. 在稳定状态下, 该值的增长应远小于响应数目.
+     */
+    static uint64_t GetChunkAllocNum() noexcept;
+
+    // hiredis 1.0 之前, createArray() 的元素个数参数为 int.
+#if defined(HIREDIS_MAJOR) && HIREDIS_MAJOR >= 1
+    using elements_t = size_t;
+#else
+    using elements_t = int;
+#endif
+
+public:
+    ReplyArena() noexcept;
+    ~ReplyArena() noexcept;
+
+    ReplyArena(const ReplyArena &) = delete;
+    ReplyArena& operator=(const ReplyArena &) = delete;
+
+private:
+    struct Chunk {
+        Chunk *next;
+        size_t capacity;
+
+    public:
+        char* data() noexcept {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+private:
+    template <typename T>
+    friend class ObjectPool;
+
+    // 所有数据成员都具有相同的访问权限, 使得 ReplyArena 是 standard-layout 的, 从而可以通过 offsetof() 由
+    // root_ 找到 arena.
+    ReplyArena *next = nullptr; // 由 ObjectPool 使用.
+
+    redisReply root_; // 响应的根节点.
+    bool detached_ = false;
+
+    char *cur_ = nullptr;
+    char *end_ = nullptr;
+    Chunk *chunks_ = nullptr; // 当前响应所使用的额外内存块, 最新的在前.
+    Chunk *spare_ = nullptr; // 回收时保留的额外内存块.
+    size_t spare_bytes_ = 0;
+
+    alignas(16) char inline_buf_[kInlineSize];
+
+private:
+    void* Alloc(size_t size) noexcept {
+        size = (size + 7) & ~static_cast<size_t>(7);
+        if (static_cast<size_t>(end_ - cur_) >= size) {
+            void *ptr = cur_;
+            cur_ += size;
+            return ptr;
+        }
+        return AllocSlow(size);
+    }
+
+    void* AllocSlow(size_t size) noexcept;
+    char* CopyString(const char *str, size_t len) noexcept;
+
+    // 回收当前响应所使用的内存, 使得 arena 可以被复用.
+    void Reset() noexcept;
+
+    static ReplyArena* FromRoot(void *reply) noexcept;
+
+    // 找到 task 所属响应的 arena. 若 task 是根节点, 则从 ObjectPool 中取出一个新的 arena.
+    static ReplyArena* GetArena(const redisReadTask *task) noexcept;
+
+    /* 分配一个 type 类型的 redisReply 节点, 并链接到父节点中. 若 arena 不为 nullptr, 则 *arena 为节点所在的
+     * arena.
+     */
+    static redisReply* CreateReply(const redisReadTask *task, int type, ReplyArena **arena) noexcept;
+    static void* FailCreate(const redisReadTask *task, ReplyArena *arena) noexcept;
+
+    static void* CreateString(const redisReadTask *task, char *str, size_t len) noexcept;
+    static void* CreateArray(const redisReadTask *task, elements_t elements) noexcept;
+    static void* CreateInteger(const redisReadTask *task, long long value) noexcept;
+    static void* CreateNil(const redisReadTask *task) noexcept;
+#if defined(HIREDIS_MAJOR) && HIREDIS_MAJOR >= 1
+    static void* CreateDouble(const redisReadTask *task, double value, char *str, size_t len) noexcept;
+    static void* CreateBool(const redisReadTask *task, int bval) noexcept;
+#endif
+    static void FreeObject(void *reply) noexcept;
+
+    static void Release(ReplyArena *arena) noexcept;
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * 已经按照 RESP 协议编码好的请求. 可以直接交给 AsyncRedisClient::Execute(), 此时请求会被原样追加到连接的输出缓冲
+ * 区中, 不会再经过 hiredis 的 argv 编码.
+ *
+ * 内容可以由 RespFrame 独占, 也可以通过 shared_ptr 在多个请求之间共享, 后者适合同一请求被反复发送的场景.
+ *
+ * 注意 RespFrame 中只能包含一个请求.
+ */
+class RespFrame {
+public:
+    RespFrame() noexcept = default;
+
+    static RespFrame FromString(std::string buf) noexcept {
+        RespFrame frame;
+        frame.owned_ = std::move(buf);
+        return frame;
+    }
+
+    static RespFrame FromShared(std::shared_ptr<const std::string> buf) noexcept {
+        RespFrame frame;
+        frame.shared_ = std::move(buf);
+        return frame;
+    }
+
+    const char* data() const noexcept {
+        return shared_ ? shared_->data() : owned_.data();
+    }
+
+    size_t size() const noexcept {
+        return shared_ ? shared_->size() : owned_.size();
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    void Clear() noexcept {
+        std::string().swap(owned_);
+        shared_.reset();
+        return ;
+    }
+
+    /**
+     * 取出请求中的第 idx 个参数, 参数 0 为命令名. 若请求格式不正确或者参数不存在, 则返回 false.
+     */
+    bool GetArg(size_t idx, const char **arg, size_t *len) const noexcept {
+        const char *ptr = data();
+        const char *end = ptr + size();
+
+        size_t argc;
+        if (!ParseHeader('*', &ptr, end, &argc) || idx >= argc) {
+            return false;
+        }
+        for (size_t arg_idx = 0; ; ++arg_idx) {
+            size_t arg_len;
+            if (!ParseHeader('$', &ptr, end, &arg_len) || static_cast<size_t>(end - ptr) < arg_len + 2) {
+                return false;
+            }
+            if (arg_idx == idx) {
+                *arg = ptr;
+                *len = arg_len;
+                return true;
+            }
+            ptr += arg_len + 2;
+        }
+    }
+
+private:
+    std::string owned_;
+    std::shared_ptr<const std::string> shared_;
+
+private:
+    // 解析 `<prefix><val>\r\n`, 成功时 *ptr 指向其后的内容.
+    static bool ParseHeader(char prefix, const char **ptr, const char *end, size_t *val) noexcept {
+        const char *cur = *ptr;
+        if (cur >= end || *cur != prefix) {
+            return false;
+        }
+        ++cur;
+
+        size_t num = 0;
+        const char *digits = cur;
+        while (cur < end && *cur >= '0' && *cur <= '9') {
+            num = num * 10 + (*cur - '0');
+            ++cur;
+        }
+        if (cur == digits || end - cur < 2 || cur[0] != '\r' || cur[1] != '\n') {
+            return false;
+        }
+        *val = num;
+        *ptr = cur + 2;
+        return true;
+    }
+};
+
+/**
+ * RESP 编码工具. 所有请求都被编码为 bulk string 组成的 array, 与 hiredis redisFormatCommandArgv() 的结果一致.
+ *
+ * 用法:
+ *
+ *  RespEncoder encoder;
+ *  encoder.BeginCommand(3).AppendArg("SET", 3).AppendArg(key).AppendArg(value);
+ *  RespFrame frame = encoder.ToFrame();
+ */
+class RespEncoder {
+public:
+    RespEncoder& BeginCommand(size_t argc) {
+        AppendHeader('*', argc);
+        return *this;
+    }
+
+    RespEncoder& AppendArg(const char *arg, size_t len) {
+        AppendHeader('$', len);
+        buf_.append(arg, len);
+        buf_.append("\r\n", 2);
+        return *this;
+    }
+
+    RespEncoder& AppendArg(const std::string &arg) {
+        return AppendArg(arg.data(), arg.size());
+    }
+
+    RespEncoder& AppendCommand(const std::vector<std::string> &cmd) {
+        BeginCommand(cmd.size());
+        for (const std::string &arg : cmd) {
+            AppendArg(arg);
+        }
+        return *this;
+    }
+
+    const std::string& buf() const noexcept {
+        return buf_;
+    }
+
+    // 取走编码结果, 此后 encoder 恢复到初始状态.
+    RespFrame ToFrame() noexcept {
+        return RespFrame::FromString(std::move(buf_));
+    }
+
+    std::shared_ptr<const std::string> ToShared() {
+        std::shared_ptr<const std::string> shared = std::make_shared<const std::string>(std::move(buf_));
+        buf_.clear();
+        return shared;
+    }
+
+public:
+    /**
+     * cmd 编码之后的长度.
+     */
+    static size_t GetEncodedSize(const std::vector<std::string> &cmd) noexcept {
+        size_t size = 1 + GetDigitNum(cmd.size()) + 2;
+        for (const std::string &arg : cmd) {
+            size += 1 + GetDigitNum(arg.size()) + 2 + arg.size() + 2;
+        }
+        return size;
+    }
+
+    static std::string Encode(const std::vector<std::string> &cmd) {
+        RespEncoder encoder;
+        encoder.buf_.reserve(GetEncodedSize(cmd));
+        encoder.AppendCommand(cmd);
+        return std::move(encoder.buf_);
+    }
+
+private:
+    std::string buf_;
+
+private:
+    static size_t GetDigitNum(size_t val) noexcept {
+        size_t num = 1;
+        while (val >= 10) {
+            val /= 10;
+            ++num;
+        }
+        return num;
+    }
+
+    void AppendHeader(char prefix, size_t val) {
+        char header[32];
+        int len = snprintf(header, sizeof(header), "%c%zu\r\n", prefix, val);
+        buf_.append(header, len);
+        return ;
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+
+#include <hiredis/hiredis.h>
+
+struct RedisReplyDeleter {
+    // 释放 reply 所使用的函数, 为 nullptr 时使用 freeReplyObject(). 参见 AsyncRedisClient::TakeReply().
+    void (*free_fn)(redisReply *reply) = nullptr;
+
+public:
+    RedisReplyDeleter() noexcept = default;
+
+    explicit RedisReplyDeleter(void (*free_fn_arg)(redisReply *reply)) noexcept:
+        free_fn(free_fn_arg) {
+    }
+
+    void operator()(redisReply *reply) noexcept {
+        if (free_fn) {
+            free_fn(reply);
+        } else {
+            freeReplyObject(reply);
+        }
+        return ;
+    }
+};
+
+struct SharedReply;
+
+// SharedReply 中交给回调的一个部分. root 必须是第一个成员, SharedReply::Release() 据此由 root 找到 SharedReply.
+struct SharedReplyPart {
+    redisReply root;
+    SharedReply *shared;
+};
+
+/**
+ * 多个持有者共享的只读响应, 整个响应由 owner 持有. parts[i].root 是响应根节点, 或者其第 i 个元素的浅拷贝, 其子
+ * 节点仍由 owner 持有. 每个持有者持有一个引用, 由最后一个 Release() 的持有者删除, 因此可以在任意线程中释放.
+ *
+ * 用于 coalesce_reads, merge_reads 中被合并的请求, 以及 near cache 中缓存的响应, 参见 AsyncRedisClient::TakeReply().
+ */
+struct SharedReply {
+    std::atomic<uint32_t> ref_num{1};
+    std::unique_ptr<redisReply, RedisReplyDeleter> owner;
+    std::unique_ptr<SharedReplyPart[]> parts;
+    size_t part_num = 0;
+
+public:
+    /* 创建一个包含 part_num 个部分的 SharedReply, 之后需要通过 Adopt() 设置 owner. 内存不足时返回 nullptr.
+     */
+    static SharedReply* New(size_t part_num) noexcept {
+        std::unique_ptr<SharedReply> shared(new (std::nothrow) SharedReply);
+        if (!shared) {
+            return nullptr;
+        }
+        shared->parts.reset(new (std::nothrow) SharedReplyPart[part_num]);
+        if (!shared->parts) {
+            return nullptr;
+        }
+        shared->part_num = part_num;
+        return shared.release();
+    }
+
+    /* 取得 reply 的所有权. split 为 true 时 reply 必须是元素数目为 part_num 的数组, 每个元素对应一个部分; 否则
+     * part_num 必须为 1, 即 reply 本身.
+     */
+    void Adopt(std::unique_ptr<redisReply, RedisReplyDeleter> reply, bool split) noexcept {
+        owner = std::move(reply);
+        for (size_t idx = 0; idx < part_num; ++idx) {
+            parts[idx].root = split ? *owner->element[idx] : *owner;
+            parts[idx].shared = this;
+        }
+        return ;
+    }
+
+    redisReply* Root(size_t idx = 0) noexcept {
+        return &parts[idx].root;
+    }
+
+    bool Contains(const redisReply *reply) const noexcept {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(reply);
+        return addr >= reinterpret_cast<uintptr_t>(parts.get()) &&
+               addr < reinterpret_cast<uintptr_t>(parts.get() + part_num);
+    }
+
+    void AddRef() noexcept {
+        ref_num.fetch_add(1, std::memory_order_relaxed);
+        return ;
+    }
+
+    // reply 为某个部分的 root.
+    static void Release(redisReply *reply) noexcept {
+        SharedReply *shared = reinterpret_cast<SharedReplyPart*>(reply)->shared;
+        if (shared->ref_num.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete shared;
+        }
+        return ;
+    }
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * 当前的 CLOCK_MONOTONIC 时间, 单位: ms. AsyncRedisClient 中所有的截止时间都基于该时钟.
+ */
+inline uint64_t GetMonotonicMs() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * TimerWheel 中的定时器节点, 由使用者嵌入到自己的对象中, 通过 data 找到所属对象.
+ */
+struct TimerWheelNode {
+    TimerWheelNode *prev = nullptr;
+    TimerWheelNode *next = nullptr;
+    uint64_t expire_ms = 0;
+    void *data = nullptr;
+
+public:
+    TimerWheelNode() noexcept = default;
+
+    // 节点在 TimerWheel 中时, 其地址被链表引用, 因此拷贝时只拷贝 data.
+    TimerWheelNode(const TimerWheelNode &other) noexcept:
+        data(other.data) {
+    }
+
+    TimerWheelNode& operator=(const TimerWheelNode &other) noexcept {
+        data = other.data;
+        return *this;
+    }
+
+    bool IsScheduled() const noexcept {
+        return prev != nullptr;
+    }
+};
+
+/**
+ * 分层时间轮, 精度为 1ms. 与 Linux 内核中 timer wheel 的实现相同:
+ *
+ * - 第 0 层具有 256 个槽, 每个槽对应 1ms.
+ * - 第 1, 2, 3 层各具有 64 个槽, 每个槽分别对应 2^8, 2^14, 2^20 ms.
+ *
+ * 当第 0 层转完一圈时, 将上一层的一个槽中的节点重新分配到下层. 因此 Schedule(), Cancel() 都是 O(1) 的, 每个
+ * 节点在其生命周期中最多被重新分配 3 次. 超出 2^26 ms(约 18 小时) 的节点会先放在最高层, 到期时再重新放置.
+ *
+ * 非线程安全, 通常由一个 uv loop 独占. 在 Advance() 的回调中可以 Schedule(), Cancel() 其他节点.
+ */
+class TimerWheel {
+public:
+    explicit TimerWheel(uint64_t now_ms = GetMonotonicMs()) noexcept:
+        current_ms_(now_ms) {
+        for (size_t idx = 0; idx < kSlotNum; ++idx) {
+            InitList(&slots_[idx]);
+        }
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel& operator=(const TimerWheel &) = delete;
+
+    /**
+     * 使 node 在 expire_ms 时到期. 若 node 已经在时间轮中, 则会先将其移除.
+     *
+     * 若 expire_ms 已经过去, 则 node 会在下一次 Advance() 时到期.
+     */
+    void Schedule(TimerWheelNode *node, uint64_t expire_ms) noexcept {
+        if (node->IsScheduled()) {
+            Cancel(node);
+        }
+        node->expire_ms = expire_ms;
+        Place(node);
+        ++size_;
+        return ;
+    }
+
+    void Cancel(TimerWheelNode *node) noexcept {
+        if (!node->IsScheduled()) {
+            return ;
+        }
+        Unlink(node);
+        --size_;
+        return ;
+    }
+
+    /**
+     * 将时间推进到 now_ms, 对每个到期的节点调用 on_expire(node). 调用 on_expire 时, node 已经不在时间轮中了.
+     */
+    template <typename F>
+    void Advance(uint64_t now_ms, F &&on_expire) {
+        while (current_ms_ <= now_ms) {
+            if (size_ == 0) {
+                current_ms_ = now_ms + 1;
+                break;
+            }
+
+            size_t idx = current_ms_ & kLevel0Mask;
+            if (idx == 0) {
+                // 依次将上层的节点重新分配, 直至某一层没有转完一圈.
+                for (size_t level = 1; level < kLevelNum; ++level) {
+                    size_t level_idx = (current_ms_ >> (kLevel0Bits + (level - 1) * kLevelNBits)) & kLevelNMask;
+                    Cascade(LevelSlot(level, level_idx));
+                    if (level_idx != 0) {
+                        break;
+                    }
+                }
+            }
+
+            // 先将当前槽摘下再推进时间, 使得 on_expire 中新加入的已过期节点在下一次 Advance() 时到期.
+            TimerWheelNode expired;
+            InitList(&expired);
+            SpliceList(&slots_[idx], &expired);
+            ++current_ms_;
+
+            while (expired.next != &expired) {
+                TimerWheelNode *node = expired.next;
+                Unlink(node);
+                if (node->expire_ms >= current_ms_) { // 超出范围被截断的节点, 重新放置.
+                    Place(node);
+                    continue;
+                }
+                --size_;
+                on_expire(node);
+            }
+        }
+        return ;
+    }
+
+    /**
+     * 下一次需要调用 Advance() 的时间. 只是一个提示, 实际到期时间可能更晚, 但是不会更早.
+     *
+     * 当时间轮为空时返回 0.
+     */
+    uint64_t GetNextExpireMs() const noexcept {
+        if (size_ == 0) {
+            return 0;
+        }
+
+        for (size_t step = 0; step < kLevel0SlotNum; ++step) {
+            uint64_t tick = current_ms_ + step;
+            const TimerWheelNode *slot = &slots_[tick & kLevel0Mask];
+            if (slot->next != slot) {
+                return tick;
+            }
+            if ((tick & kLevel0Mask) == 0) { // 到达下一次 Cascade 的时间.
+                return tick;
+            }
+        }
+        return current_ms_ + kLevel0SlotNum;
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+private:
+    static constexpr size_t kLevelNum = 4;
+    static constexpr size_t kLevel0Bits = 8;
+    static constexpr size_t kLevelNBits = 6;
+    static constexpr size_t kLevel0SlotNum = 1 << kLevel0Bits;
+    static constexpr size_t kLevelNSlotNum = 1 << kLevelNBits;
+    static constexpr size_t kLevel0Mask = kLevel0SlotNum - 1;
+    static constexpr size_t kLevelNMask = kLevelNSlotNum - 1;
+    static constexpr size_t kSlotNum = kLevel0SlotNum + (kLevelNum - 1) * kLevelNSlotNum;
+    static constexpr uint64_t kMaxDelta = (1ULL << (kLevel0Bits + (kLevelNum - 1) * kLevelNBits)) - 1;
+
+private:
+    uint64_t current_ms_; // 下一个待处理的时刻.
+    size_t size_ = 0;
+    TimerWheelNode slots_[kSlotNum];
+
+private:
+    TimerWheelNode* LevelSlot(size_t level, size_t idx) noexcept {
+        return &slots_[kLevel0SlotNum + (level - 1) * kLevelNSlotNum + idx];
+    }
+
+    void Place(TimerWheelNode *node) noexcept {
+        uint64_t expire_ms = node->expire_ms;
+        if (expire_ms < current_ms_) {
+            expire_ms = current_ms_;
+        }
+        uint64_t delta = expire_ms - current_ms_;
+        if (delta > kMaxDelta) {
+            delta = kMaxDelta;
+            expire_ms = current_ms_ + delta;
+        }
+
+        TimerWheelNode *slot;
+        if (delta < kLevel0SlotNum) {
+            slot = &slots_[expire_ms & kLevel0Mask];
+        } else {
+            size_t level = 1;
+            while (delta >= (1ULL << (kLevel0Bits + level * kLevelNBits))) {
+                ++level;
+            }
+            slot = LevelSlot(level, (expire_ms >> (kLevel0Bits + (level - 1) * kLevelNBits)) & kLevelNMask);
+        }
+        LinkBefore(slot, node);
+        return ;
+    }
+
+    void Cascade(TimerWheelNode *slot) noexcept {
+        TimerWheelNode nodes;
+        InitList(&nodes);
+        SpliceList(slot, &nodes);
+        while (nodes.next != &nodes) {
+            TimerWheelNode *node = nodes.next;
+            Unlink(node);
+            Place(node);
+        }
+        return ;
+    }
+
+    static void InitList(TimerWheelNode *head) noexcept {
+        head->prev = head;
+        head->next = head;
+        return ;
+    }
+
+    static void LinkBefore(TimerWheelNode *pos, TimerWheelNode *node) noexcept {
+        node->prev = pos->prev;
+        node->next = pos;
+        pos->prev->next = node;
+        pos->prev = node;
+        return ;
+    }
+
+    static void Unlink(TimerWheelNode *node) noexcept {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = nullptr;
+        node->next = nullptr;
+        return ;
+    }
+
+    // 将 from 中的所有节点移动到空链表 to 中.
+    static void SpliceList(TimerWheelNode *from, TimerWheelNode *to) noexcept {
+        if (from->next == from) {
+            return ;
+        }
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        InitList(from);
+        return ;
+    }
+};
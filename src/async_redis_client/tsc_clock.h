@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * 基于 TSC 的时钟. Now() 只是一条 rdtsc 指令, 不经过 vDSO, 适合在每个请求上记录多个时间戳.
+ *
+ * 要求 CPU 支持 invariant TSC, 即 TSC 以恒定频率递增并且在各个核之间同步, 近年的 x86 CPU 都满足. 非 x86 平台
+ * 上退化为 CLOCK_MONOTONIC, 单位为 ns.
+ *
+ * Now() 的返回值只能用来计算差值, 并通过 ToNs() 转换为 ns.
+ */
+class TscClock {
+public:
+    static uint64_t Now() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return GetMonotonicNs();
+#endif
+    }
+
+    static uint64_t ToNs(uint64_t ticks) noexcept {
+        return static_cast<uint64_t>(ticks * GetNsPerTick());
+    }
+
+    /**
+     * 首次调用时会以 CLOCK_MONOTONIC 为基准校准约 10ms, 因此应该在进入关键路径之前调用一次.
+     */
+    static double GetNsPerTick() noexcept {
+        static const double ns_per_tick = Calibrate();
+        return ns_per_tick;
+    }
+
+private:
+    static uint64_t GetMonotonicNs() noexcept {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    static double Calibrate() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        constexpr uint64_t kCalibrateNs = 10 * 1000 * 1000;
+
+        uint64_t begin_ns = GetMonotonicNs();
+        uint64_t begin_tick = Now();
+        uint64_t end_ns;
+        do {
+            end_ns = GetMonotonicNs();
+        } while (end_ns - begin_ns < kCalibrateNs);
+        uint64_t end_tick = Now();
+
+        if (end_tick <= begin_tick) {
+            return 1;
+        }
+        return static_cast<double>(end_ns - begin_ns) / (end_tick - begin_tick);
+#else
+        return 1;
+#endif
+    }
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+template <typename Signature>
+class UniqueFunction;
+
+/**
+ * 只可移动的 std::function.
+ *
+ * 不要求可调用对象可以拷贝, 因此可以直接持有 std::promise, std::unique_ptr 这类对象. 大小不超过 kInlineSize,
+ * 并且移动构造不会抛出异常的可调用对象直接存放在 UniqueFunction 内部, 不会有任何内存分配; 其他的可调用对象会被
+ * new 出来. 整个对象恰好占用一个 cache line.
+ *
+ * 以空的 std::function 或者空的函数指针构造时, UniqueFunction 也为空.
+ */
+template <typename R, typename... Args>
+class UniqueFunction<R(Args...)> {
+public:
+    static constexpr size_t kInlineSize = 48;
+
+    // F 是否会被存放在 UniqueFunction 内部.
+    template <typename F>
+    static constexpr bool IsInline() noexcept {
+        return sizeof(F) <= kInlineSize && alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value;
+    }
+
+private:
+    template <typename F>
+    using EnableIfCallable = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, UniqueFunction>::value &&
+        std::is_convertible<decltype(std::declval<typename std::decay<F>::type&>()(std::declval<Args>()...)), R>::value
+    >::type;
+
+public:
+    UniqueFunction() noexcept = default;
+
+    UniqueFunction(std::nullptr_t) noexcept {
+    }
+
+    template <typename F, typename = EnableIfCallable<F>>
+    UniqueFunction(F &&f) {
+        using Fn = typename std::decay<F>::type;
+        if (IsNull(f)) {
+            return ;
+        }
+        Construct<Fn>(std::forward<F>(f), std::integral_constant<bool, IsInline<Fn>()>());
+    }
+
+    UniqueFunction(UniqueFunction &&other) noexcept {
+        MoveFrom(other);
+    }
+
+    UniqueFunction(const UniqueFunction &) = delete;
+    UniqueFunction& operator=(const UniqueFunction &) = delete;
+
+    ~UniqueFunction() noexcept {
+        Reset();
+    }
+
+    UniqueFunction& operator=(UniqueFunction &&other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    UniqueFunction& operator=(std::nullptr_t) noexcept {
+        Reset();
+        return *this;
+    }
+
+    template <typename F, typename = EnableIfCallable<F>>
+    UniqueFunction& operator=(F &&f) {
+        UniqueFunction tmp(std::forward<F>(f)); // 若抛出异常, 则 *this 保持不变.
+        Reset();
+        MoveFrom(tmp);
+        return *this;
+    }
+
+    explicit operator bool() const noexcept {
+        return invoke_ != nullptr;
+    }
+
+    /* 调用空的 UniqueFunction 行为未定义.
+     */
+    R operator()(Args... args) {
+        return invoke_(&storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    enum class Op {
+        kMove = 0, // 将 src 移动到 dst, 并析构 src.
+        kDestroy
+    };
+
+    using invoke_t = R (*)(void *storage, Args&&... args);
+    using manage_t = void (*)(Op op, void *dst, void *src) noexcept;
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    invoke_t invoke_ = nullptr;
+    manage_t manage_ = nullptr;
+
+private:
+    template <typename F>
+    static bool IsNull(const F &) noexcept {
+        return false;
+    }
+
+    template <typename Sig>
+    static bool IsNull(const std::function<Sig> &f) noexcept {
+        return !f;
+    }
+
+    template <typename Ret, typename... FArgs>
+    static bool IsNull(Ret (* const &f)(FArgs...)) noexcept {
+        return f == nullptr;
+    }
+
+    template <typename Fn, typename F>
+    void Construct(F &&f, std::true_type /* inline */) {
+        new (&storage_) Fn(std::forward<F>(f));
+        invoke_ = [] (void *storage, Args&&... args) -> R {
+            return (*static_cast<Fn*>(storage))(std::forward<Args>(args)...);
+        };
+        manage_ = &ManageInline<Fn>;
+        return ;
+    }
+
+    template <typename Fn, typename F>
+    void Construct(F &&f, std::false_type /* inline */) {
+        Fn *fn = new Fn(std::forward<F>(f));
+        new (&storage_) Fn*(fn);
+        invoke_ = [] (void *storage, Args&&... args) -> R {
+            return (**static_cast<Fn**>(storage))(std::forward<Args>(args)...);
+        };
+        manage_ = &ManageHeap<Fn>;
+        return ;
+    }
+
+    template <typename Fn>
+    static void ManageInline(Op op, void *dst, void *src) noexcept {
+        Fn *src_fn = static_cast<Fn*>(src);
+        if (op == Op::kMove) {
+            new (dst) Fn(std::move(*src_fn));
+        }
+        src_fn->~Fn();
+        return ;
+    }
+
+    template <typename Fn>
+    static void ManageHeap(Op op, void *dst, void *src) noexcept {
+        Fn **src_fn = static_cast<Fn**>(src);
+        if (op == Op::kMove) {
+            new (dst) Fn*(*src_fn);
+        } else {
+            delete *src_fn;
+        }
+        return ;
+    }
+
+    void MoveFrom(UniqueFunction &other) noexcept {
+        if (!other.invoke_) {
+            return ;
+        }
+        other.manage_(Op::kMove, &storage_, &other.storage_);
+        invoke_ = other.invoke_;
+        manage_ = other.manage_;
+        other.invoke_ = nullptr;
+        other.manage_ = nullptr;
+        return ;
+    }
+
+    void Reset() noexcept {
+        if (!invoke_) {
+            return ;
+        }
+        manage_(Op::kDestroy, nullptr, &storage_);
+        invoke_ = nullptr;
+        manage_ = nullptr;
+        return ;
+    }
+};
@@ -0,0 +1,226 @@
+
+/* 对比以 std::function, UniqueFunction 保存回调时的内存分配次数与开销.
+ *
+ * - micro, 模拟一个请求中回调的生命周期: 由 lambda 构造, 移动到请求对象中, 调用, 然后释放. 对于不同大小的捕获
+ *   分别输出每个请求的 operator new 次数以及 TSC ticks.
+ * - client, 通过 MockRedisServer 发送请求, 对比以 req_callback_t 调用 Execute() 与直接以 lambda 调用 Execute()
+ *   时整个进程中每个请求的 operator new 次数与耗时. hiredis 内部使用 malloc(), 不在统计之内.
+ *
+ * 构建: make main_src=bench_callback.cc
+ */
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <functional>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <async_redis_client/async_redis_client.h>
+#include <async_redis_client/unique_function.h>
+#include <async_redis_client/tsc_clock.h>
+
+#include "mock_redis_server.h"
+
+DEFINE_int32(iterations, 1000000, "micro 中每种情况下的请求数目");
+DEFINE_int32(req_num, 200000, "client 中每种情况下的请求数目");
+DEFINE_int32(concurrency, 256, "client 中最多未完成的请求数");
+
+namespace {
+
+std::atomic<uint64_t> g_new_num{0};
+
+} // namespace
+
+void* operator new(size_t size) {
+    g_new_num.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace {
+
+struct Result {
+    double new_per_req = 0;
+    double ticks_per_req = 0;
+};
+
+// 捕获 kCaptureBytes 字节的回调.
+template <size_t kCaptureBytes>
+struct Capture {
+    uint64_t values[kCaptureBytes / sizeof(uint64_t)];
+};
+
+template <typename Function, size_t kCaptureBytes>
+Result RunMicro() {
+    Capture<kCaptureBytes> capture;
+    for (uint64_t &value : capture.values) {
+        value = 1;
+    }
+    uint64_t sum = 0;
+    redisReply reply;
+
+    uint64_t begin_new = g_new_num.load(std::memory_order_relaxed);
+    uint64_t begin_tick = TscClock::Now();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        Function cb = [capture, &sum] (redisReply *) noexcept {
+            sum += capture.values[0];
+        };
+        Function request_cb(std::move(cb)); // 相当于 NewRequest() 中移动到 RedisRequest::callback.
+        request_cb(&reply);
+    }
+    uint64_t end_tick = TscClock::Now();
+
+    Result result;
+    result.new_per_req = static_cast<double>(g_new_num.load(std::memory_order_relaxed) - begin_new) / FLAGS_iterations;
+    result.ticks_per_req = static_cast<double>(end_tick - begin_tick) / FLAGS_iterations;
+    if (sum != static_cast<uint64_t>(FLAGS_iterations)) {
+        std::cerr << "UNEXPECTED SUM: " << sum << std::endl;
+    }
+    return result;
+}
+
+template <size_t kCaptureBytes>
+void PrintMicro() {
+    Result std_result = RunMicro<std::function<void(redisReply*)>, kCaptureBytes>();
+    Result unique_result = RunMicro<AsyncRedisClient::unique_callback_t, kCaptureBytes>();
+    std::cout << std::setw(12) << kCaptureBytes + sizeof(void*)
+              << std::setw(16) << std::fixed << std::setprecision(2) << std_result.new_per_req
+              << std::setw(16) << std::fixed << std::setprecision(1) << std_result.ticks_per_req
+              << std::setw(16) << std::fixed << std::setprecision(2) << unique_result.new_per_req
+              << std::setw(16) << std::fixed << std::setprecision(1) << unique_result.ticks_per_req << std::endl;
+    return ;
+}
+
+class Window {
+public:
+    explicit Window(int limit):
+        limit_(limit) {
+    }
+
+    void Acquire() noexcept {
+        while (outstanding_.load(std::memory_order_acquire) >= limit_) {
+            ;
+        }
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        return ;
+    }
+
+    void Release() noexcept {
+        outstanding_.fetch_sub(1, std::memory_order_release);
+        return ;
+    }
+
+    void WaitAll() noexcept {
+        while (outstanding_.load(std::memory_order_acquire) != 0) {
+            ;
+        }
+        return ;
+    }
+
+private:
+    std::atomic<int> outstanding_{0};
+    int limit_;
+};
+
+// use_std_function 为 true 时以 req_callback_t 调用 Execute(), 否则直接传入 lambda.
+Result RunClient(AsyncRedisClient *client, bool use_std_function) {
+    Window window(FLAGS_concurrency);
+    Capture<32> capture;
+    for (uint64_t &value : capture.values) {
+        value = 1;
+    }
+    std::atomic<uint64_t> sum{0};
+
+    RespEncoder encoder;
+    encoder.AppendCommand({"GET", "key"});
+    std::shared_ptr<const std::string> get_key = encoder.ToShared();
+
+    uint64_t begin_new = g_new_num.load(std::memory_order_relaxed);
+    uint64_t begin_tick = TscClock::Now();
+    for (int i = 0; i < FLAGS_req_num; ++i) {
+        window.Acquire();
+        auto cb = [capture, &sum, &window] (redisReply *) noexcept {
+            sum.fetch_add(capture.values[0], std::memory_order_relaxed);
+            window.Release();
+        };
+        RespFrame frame = RespFrame::FromShared(get_key);
+        if (use_std_function) {
+            client->Execute(std::move(frame), AsyncRedisClient::req_callback_t(std::move(cb)));
+        } else {
+            client->Execute(std::move(frame), std::move(cb));
+        }
+    }
+    window.WaitAll();
+    uint64_t end_tick = TscClock::Now();
+
+    Result result;
+    result.new_per_req = static_cast<double>(g_new_num.load(std::memory_order_relaxed) - begin_new) / FLAGS_req_num;
+    result.ticks_per_req = static_cast<double>(end_tick - begin_tick) / FLAGS_req_num;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("回调类型开销测试");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+    google::InitGoogleLogging(argv[0]);
+
+    TscClock::GetNsPerTick();
+
+    std::cout << "micro, ns/tick: " << TscClock::GetNsPerTick() << std::endl;
+    std::cout << std::setw(12) << "capture"
+              << std::setw(16) << "func new/req"
+              << std::setw(16) << "func ticks/req"
+              << std::setw(16) << "unique new/req"
+              << std::setw(16) << "unique ticks/req" << std::endl;
+    PrintMicro<8>();
+    PrintMicro<32>();
+    PrintMicro<40>();
+    PrintMicro<64>();
+
+    MockRedisServer mock_server;
+    mock_server.Start();
+    mock_server.SetReply("GET", "$5\r\nvalue\r\n");
+
+    AsyncRedisClient client;
+    client.host = mock_server.host;
+    client.port = mock_server.GetPort();
+    client.thread_num = 1;
+    client.conn_per_thread = 1;
+    client.Start();
+
+    // 预热, 使得 ObjectPool 中的 RedisRequest 对象都已经分配好.
+    RunClient(&client, false);
+
+    std::cout << "client, capture: " << sizeof(Capture<32>) + 2 * sizeof(void*) << std::endl;
+    std::cout << std::setw(12) << "callback"
+              << std::setw(16) << "new/req"
+              << std::setw(16) << "ticks/req" << std::endl;
+    for (bool use_std_function : {true, false}) {
+        Result result = RunClient(&client, use_std_function);
+        std::cout << std::setw(12) << (use_std_function ? "function" : "unique")
+                  << std::setw(16) << std::fixed << std::setprecision(2) << result.new_per_req
+                  << std::setw(16) << std::fixed << std::setprecision(1) << result.ticks_per_req << std::endl;
+    }
+
+    client.Join();
+    mock_server.Stop();
+    return 0;
+}
@@ -0,0 +1,213 @@
+
+/* 对比 numa_aware_routing 开启, 关闭时的吞吐与延迟.
+ *
+ * 每个 NUMA 节点上运行 work_thread_per_node 个 work thread 与 test_thread_per_node 个压测线程, 均绑定在该节点的
+ * CPU 上. 请求发送到进程内的 MockRedisServer, 因此结果只反映客户端自身的开销, 包括跨节点访问请求对象, 解析
+ * 响应, 调用回调所带来的开销.
+ *
+ * 在多 socket 机器上直接运行即可; 在单节点机器上可以通过 --emulate_node_num 将 CPU 平均分为若干个模拟的节点,
+ * 此时差异主要来自跨 L2 cache 的访问, 而不是跨 socket. 注意 MockRedisServer 只有一个线程, 在 work thread 较多时
+ * 可能成为瓶颈.
+ *
+ * 构建: make main_src=bench_numa.cc
+ */
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <async_redis_client/async_redis_client.h>
+#include <async_redis_client/cpu_topology.h>
+#include <async_redis_client/latency_histogram.h>
+
+#include "mock_redis_server.h"
+
+DEFINE_int32(work_thread_per_node, 1, "每个节点上的 work thread 数目");
+DEFINE_int32(test_thread_per_node, 1, "每个节点上的压测线程数目");
+DEFINE_int32(conn_per_thread, 2, "connection per thread");
+DEFINE_int32(req_per_thread, 200000, "每个压测线程发送的请求数目");
+DEFINE_int32(concurrency, 32, "每个压测线程最多未完成的请求数");
+DEFINE_int32(emulate_node_num, 0, "大于 0 时, 将所有 CPU 平均分为这么多个模拟的 NUMA 节点");
+
+namespace {
+
+inline uint64_t NowNs() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// node_cpus[node] 为 node 上的 CPU, 只包含当前进程可以使用的 CPU.
+std::vector<std::vector<int>> GetNodeCpus(std::vector<int> *cpu_nodes) {
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    if (FLAGS_emulate_node_num > 0) {
+        cpu_nodes->assign(cpus.back() + 1, -1);
+        size_t cpu_per_node = (cpus.size() + FLAGS_emulate_node_num - 1) / FLAGS_emulate_node_num;
+        for (size_t idx = 0; idx < cpus.size(); ++idx) {
+            (*cpu_nodes)[cpus[idx]] = idx / cpu_per_node;
+        }
+    } else {
+        *cpu_nodes = GetCpuNodes();
+    }
+
+    std::vector<std::vector<int>> node_cpus;
+    for (int cpu : cpus) {
+        if (static_cast<size_t>(cpu) >= cpu_nodes->size() || (*cpu_nodes)[cpu] < 0) {
+            continue;
+        }
+        size_t node = (*cpu_nodes)[cpu];
+        if (node >= node_cpus.size()) {
+            node_cpus.resize(node + 1);
+        }
+        node_cpus[node].push_back(cpu);
+    }
+    return node_cpus;
+}
+
+class Window {
+public:
+    explicit Window(int limit):
+        limit_(limit) {
+    }
+
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(mux_);
+        cv_.wait(lock, [&] () { return outstanding_ < limit_; });
+        ++outstanding_;
+        return ;
+    }
+
+    void Release() {
+        std::lock_guard<std::mutex> guard(mux_);
+        --outstanding_;
+        cv_.notify_one();
+        return ;
+    }
+
+    void WaitAll() {
+        std::unique_lock<std::mutex> lock(mux_);
+        cv_.wait(lock, [&] () { return outstanding_ == 0; });
+        return ;
+    }
+
+private:
+    std::mutex mux_;
+    std::condition_variable cv_;
+    int outstanding_ = 0;
+    int limit_;
+};
+
+void RunOnce(MockRedisServer *mock_server, const std::vector<std::vector<int>> &node_cpus,
+             const std::vector<int> &cpu_nodes, bool numa_aware_routing) {
+    size_t node_num = node_cpus.size();
+
+    AsyncRedisClient client;
+    client.host = mock_server->host;
+    client.port = mock_server->GetPort();
+    client.conn_per_thread = FLAGS_conn_per_thread;
+    client.thread_num = node_num * FLAGS_work_thread_per_node;
+    client.numa_aware_routing = numa_aware_routing;
+    client.cpu_nodes = cpu_nodes;
+    for (size_t idx = 0; idx < client.thread_num; ++idx) {
+        client.thread_cpus.push_back(node_cpus[idx % node_num]);
+    }
+    client.Start();
+
+    RespEncoder encoder;
+    encoder.AppendCommand({"GET", "key"});
+    std::shared_ptr<const std::string> get_key = encoder.ToShared();
+
+    std::mutex latency_mux;
+    LatencyHistogram total_latency;
+
+    uint64_t begin_ns = NowNs();
+    std::vector<std::thread> test_threads;
+    for (size_t idx = 0; idx < node_num * FLAGS_test_thread_per_node; ++idx) {
+        test_threads.emplace_back([&, idx] () {
+            BindCurrentThread(node_cpus[idx % node_num]);
+
+            // 回调在 work thread 中执行, 可能来自多个 work thread, 因此通过 mux 保护 latency.
+            LatencyHistogram latency;
+            std::mutex mux;
+            Window window(FLAGS_concurrency);
+            for (int i = 0; i < FLAGS_req_per_thread; ++i) {
+                window.Acquire();
+                uint64_t start_ns = NowNs();
+                client.Execute(RespFrame::FromShared(get_key), [&, start_ns] (redisReply *) noexcept {
+                    uint64_t end_ns = NowNs();
+                    {
+                        std::lock_guard<std::mutex> guard(mux);
+                        latency.Record(end_ns - start_ns);
+                    }
+                    window.Release();
+                });
+            }
+            window.WaitAll();
+
+            std::lock_guard<std::mutex> guard(latency_mux);
+            total_latency.Merge(latency);
+        });
+    }
+    for (std::thread &test_thread : test_threads) {
+        test_thread.join();
+    }
+    double seconds = (NowNs() - begin_ns) / 1e9;
+    client.Join();
+
+    std::cout << std::setw(22) << (numa_aware_routing ? "numa_aware_routing" : "round_robin")
+              << std::setw(12) << std::fixed << std::setprecision(0) << total_latency.GetCount() / seconds
+              << std::setw(10) << std::fixed << std::setprecision(1) << total_latency.GetValueAtPercentile(50) / 1e3
+              << std::setw(10) << std::fixed << std::setprecision(1) << total_latency.GetValueAtPercentile(99) / 1e3
+              << std::setw(11) << std::fixed << std::setprecision(1) << total_latency.GetValueAtPercentile(99.9) / 1e3
+              << std::endl;
+    return ;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("AsyncRedisClient NUMA Benchmark");
+    google::SetVersionString("1.0.0");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    std::vector<int> cpu_nodes;
+    std::vector<std::vector<int>> node_cpus = GetNodeCpus(&cpu_nodes);
+    if (node_cpus.empty()) {
+        std::cerr << "NO NUMA TOPOLOGY; try --emulate_node_num" << std::endl;
+        return 1;
+    }
+    for (size_t node = 0; node < node_cpus.size(); ++node) {
+        std::cout << "node " << node << ": " << node_cpus[node].size() << " cpus" << std::endl;
+    }
+
+    MockRedisServer mock_server;
+    mock_server.Start();
+    mock_server.SetReply("GET", "$5\r\nvalue\r\n");
+
+    std::cout << std::setw(22) << "routing"
+              << std::setw(12) << "QPS"
+              << std::setw(10) << "p50(us)"
+              << std::setw(10) << "p99(us)"
+              << std::setw(11) << "p99.9(us)" << std::endl;
+    RunOnce(&mock_server, node_cpus, cpu_nodes, false);
+    RunOnce(&mock_server, node_cpus, cpu_nodes, true);
+
+    mock_server.Stop();
+    return 0;
+}
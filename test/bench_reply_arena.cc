@@ -0,0 +1,133 @@
+
+/* 对比 hiredis 默认的 redisReplyObjectFunctions 与 ReplyArena 在解析, 释放数组类响应时的开销.
+ *
+ * 模拟 LRANGE 返回 FLAGS_elements 个长度为 FLAGS_value_size 的元素, 每种情况下解析 FLAGS_iterations 次:
+ *
+ * - free, 即回调中只读取 reply, 回调返回后由 hiredis 释放.
+ * - take, 即 PromiseCallback 所做的事情: 在回调中取得 reply 的所有权, 之后再释放. 默认实现需要 malloc() 一个新
+ *   的根节点并移动内容, ReplyArena 则直接接管整个 arena.
+ *
+ * 构建: make main_src=bench_reply_arena.cc
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <gflags/gflags.h>
+
+#include <hiredis/hiredis.h>
+
+#include <async_redis_client/reply_arena.h>
+
+DEFINE_int32(iterations, 10000, "每种情况下解析的响应数目");
+DEFINE_int32(elements, 1000, "响应中的元素数目");
+DEFINE_int32(value_size, 16, "每个元素的长度");
+
+namespace {
+
+inline uint64_t NowNs() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+std::string MakeArrayReply() {
+    std::string value(FLAGS_value_size, 'v');
+    std::string buf = "*" + std::to_string(FLAGS_elements) + "\r\n";
+    for (int idx = 0; idx < FLAGS_elements; ++idx) {
+        buf += "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+    }
+    return buf;
+}
+
+// 读取 reply 中的所有元素, 避免解析结果被优化掉.
+size_t Consume(const redisReply *reply) noexcept {
+    size_t len = 0;
+    for (size_t idx = 0; idx < reply->elements; ++idx) {
+        len += reply->element[idx]->len;
+    }
+    return len;
+}
+
+// 同 async_redis_client.cc 中的 MoveRedisReply().
+redisReply* MoveRedisReply(redisReply *right) noexcept {
+    redisReply *left = (redisReply*)malloc(sizeof(redisReply));
+    if (!left) {
+        return nullptr;
+    }
+    *left = *right;
+    right->type = REDIS_REPLY_NIL;
+    return left;
+}
+
+// 返回每个响应的平均耗时, ns.
+double Run(const std::string &buf, bool use_arena, bool take, size_t *consumed) {
+    redisReader *reader = use_arena ? redisReaderCreateWithFunctions(ReplyArena::GetObjectFunctions())
+                                    : redisReaderCreate();
+
+    uint64_t begin = NowNs();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        redisReaderFeed(reader, buf.data(), buf.size());
+
+        void *reply = nullptr;
+        if (redisReaderGetReply(reader, &reply) != REDIS_OK || !reply) {
+            std::cerr << "redisReaderGetReply ERROR" << std::endl;
+            break;
+        }
+        *consumed += Consume((redisReply*)reply);
+
+        // 以下模拟 hiredis 在回调之后所做的事情, 以及 take 时回调中所做的事情.
+        if (!take) {
+            reader->fn->freeObject(reply);
+        } else if (use_arena) {
+            ReplyArena::Detach((redisReply*)reply);
+            reader->fn->freeObject(reply);
+            ReplyArena::FreeDetached((redisReply*)reply);
+        } else {
+            redisReply *taken = MoveRedisReply((redisReply*)reply);
+            reader->fn->freeObject(reply);
+            freeReplyObject(taken);
+        }
+    }
+    uint64_t end = NowNs();
+
+    redisReaderFree(reader);
+    return static_cast<double>(end - begin) / FLAGS_iterations;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("ReplyArena 测试");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+
+    std::string buf = MakeArrayReply();
+    size_t consumed = 0;
+
+    std::cout << std::setw(8) << "mode"
+              << std::setw(18) << "default ns/reply"
+              << std::setw(18) << "arena ns/reply"
+              << std::setw(22) << "arena chunk malloc" << std::endl;
+    for (bool take : {false, true}) {
+        double default_ns = Run(buf, false, take, &consumed);
+
+        uint64_t chunk_alloc_num = ReplyArena::GetChunkAllocNum();
+        double arena_ns = Run(buf, true, take, &consumed);
+        chunk_alloc_num = ReplyArena::GetChunkAllocNum() - chunk_alloc_num;
+
+        std::cout << std::setw(8) << (take ? "take" : "free")
+                  << std::setw(18) << std::fixed << std::setprecision(1) << default_ns
+                  << std::setw(18) << std::fixed << std::setprecision(1) << arena_ns
+                  << std::setw(22) << chunk_alloc_num << std::endl;
+    }
+
+    // hiredis 默认实现每个响应需要 2 + 2 * elements 次 malloc(): 根节点, element 数组, 每个元素及其字符串.
+    std::cout << "default malloc per reply: " << 2 + 2 * FLAGS_elements << " (+1 when take)" << std::endl;
+    std::cout << "consumed: " << consumed << std::endl;
+    return 0;
+}
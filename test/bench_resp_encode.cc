@@ -0,0 +1,133 @@
+
+/* 对比 argv 路径与预编码 RespFrame 路径在 client 侧的开销.
+ *
+ * - argv, 即 RedisAsyncCommandArgv() 所做的事情: 根据 std::vector<std::string> 构造 argv, argvlen, 交给 hiredis
+ *   编码, 然后追加到连接的输出缓冲区.
+ * - frame, 即 Execute(RespFrame &&, ...) 所做的事情: 将预编码好的请求原样追加到连接的输出缓冲区.
+ *
+ * 输出缓冲区在这里用一个 std::string 模拟, 每积攒 FLAGS_flush_bytes 字节清空一次, 以模拟写入 socket.
+ *
+ * 构建: make main_src=bench_resp_encode.cc
+ */
+
+#include <time.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <gflags/gflags.h>
+
+#include <hiredis/hiredis.h>
+
+#include <async_redis_client/resp_encoder.h>
+
+DEFINE_int32(iterations, 1000000, "每种情况下的请求数目");
+DEFINE_int32(flush_bytes, 64 * 1024, "模拟的输出缓冲区每积攒多少字节写入一次");
+
+namespace {
+
+inline uint64_t NowNs() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+inline void AppendToOutputBuffer(std::string &obuf, const char *data, size_t len) {
+    obuf.append(data, len);
+    if (obuf.size() >= static_cast<size_t>(FLAGS_flush_bytes)) {
+        obuf.clear();
+    }
+    return ;
+}
+
+// 返回每个请求的平均耗时, ns.
+double RunArgv(const std::vector<std::string> &cmd) {
+    std::string obuf;
+    obuf.reserve(FLAGS_flush_bytes * 2);
+
+    uint64_t begin = NowNs();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        std::vector<const char*> argv(cmd.size());
+        std::vector<size_t> argvlen(cmd.size());
+        for (size_t idx = 0; idx < cmd.size(); ++idx) {
+            argv[idx] = cmd[idx].data();
+            argvlen[idx] = cmd[idx].size();
+        }
+
+        char *formatted = nullptr;
+        int len = redisFormatCommandArgv(&formatted, static_cast<int>(cmd.size()), argv.data(), argvlen.data());
+        if (len < 0) {
+            std::cerr << "redisFormatCommandArgv ERROR" << std::endl;
+            return 0;
+        }
+        AppendToOutputBuffer(obuf, formatted, len);
+        redisFreeCommand(formatted);
+    }
+    return static_cast<double>(NowNs() - begin) / FLAGS_iterations;
+}
+
+double RunFrame(const std::vector<std::string> &cmd) {
+    std::string obuf;
+    obuf.reserve(FLAGS_flush_bytes * 2);
+
+    RespEncoder encoder;
+    encoder.AppendCommand(cmd);
+    std::shared_ptr<const std::string> shared_frame = encoder.ToShared();
+
+    uint64_t begin = NowNs();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        RespFrame frame = RespFrame::FromShared(shared_frame);
+        AppendToOutputBuffer(obuf, frame.data(), frame.size());
+    }
+    return static_cast<double>(NowNs() - begin) / FLAGS_iterations;
+}
+
+std::vector<std::string> MakeCommand(size_t argc) {
+    std::vector<std::string> cmd{"HMGET", "bench:hash"};
+    for (size_t idx = cmd.size(); idx < argc; ++idx) {
+        cmd.emplace_back("field:" + std::to_string(idx));
+    }
+    return cmd;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("RESP 编码开销测试");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+
+    std::vector<std::vector<std::string>> cmds{
+        {"SET", "bench:key", "bench:value"},
+        MakeCommand(100)
+    };
+
+    std::cout << std::setw(8) << "argc"
+              << std::setw(16) << "argv ns/req"
+              << std::setw(16) << "frame ns/req" << std::endl;
+    for (const std::vector<std::string> &cmd : cmds) {
+        // 确保两种路径产生的内容一致.
+        char *formatted = nullptr;
+        std::vector<const char*> cmd_argv;
+        std::vector<size_t> cmd_argvlen;
+        for (const std::string &arg : cmd) {
+            cmd_argv.push_back(arg.data());
+            cmd_argvlen.push_back(arg.size());
+        }
+        int len = redisFormatCommandArgv(&formatted, static_cast<int>(cmd.size()), cmd_argv.data(), cmd_argvlen.data());
+        if (len < 0 || std::string(formatted, len) != RespEncoder::Encode(cmd)) {
+            std::cerr << "RespEncoder MISMATCH; argc: " << cmd.size() << std::endl;
+            return 1;
+        }
+        redisFreeCommand(formatted);
+
+        double argv_ns = RunArgv(cmd);
+        double frame_ns = RunFrame(cmd);
+        std::cout << std::setw(8) << cmd.size()
+                  << std::setw(16) << std::fixed << std::setprecision(1) << argv_ns
+                  << std::setw(16) << std::fixed << std::setprecision(1) << frame_ns << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+
+/* 对比 WorkThread 提交队列的两种实现在多个生产者线程下的吞吐:
+ *
+ * - kMutexVector, 即之前的 std::mutex + std::vector<std::unique_ptr<RedisRequest>> 实现, 消费者每次唤醒都会
+ *   new 一个新的 vector 并与旧的交换.
+ * - kMpscQueue, 即 IntrusiveMpscQueue.
+ *
+ * 生产者线程数从 1 开始倍增直至 FLAGS_max_producer_num, 每个生产者压入 FLAGS_req_per_producer 个元素, 单个消费者
+ * 线程不停地取出元素直至所有元素都被消费.
+ *
+ * 构建: make main_src=bench_submit_queue.cc
+ */
+
+#include <time.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include <gflags/gflags.h>
+
+#include <async_redis_client/mpsc_queue.h>
+
+DEFINE_int32(max_producer_num, 64, "最大生产者线程数");
+DEFINE_int32(req_per_producer, 1000000, "每个生产者压入的元素数目");
+
+namespace {
+
+struct Node {
+    Node *next = nullptr;
+    uint64_t payload = 0;
+};
+
+struct MutexVectorQueue {
+    std::mutex vec_mux;
+    std::unique_ptr<std::vector<std::unique_ptr<Node>>> request_vec{new std::vector<std::unique_ptr<Node>>};
+
+    void Push(std::unique_ptr<Node> &node) {
+        std::lock_guard<std::mutex> guard(vec_mux);
+        request_vec->emplace_back(std::move(node));
+        return ;
+    }
+
+    size_t Drain() {
+        std::unique_ptr<std::vector<std::unique_ptr<Node>>> vec;
+        auto *tmp = new std::vector<std::unique_ptr<Node>>;
+
+        vec_mux.lock();
+        vec.reset(request_vec.release());
+        request_vec.reset(tmp);
+        vec_mux.unlock();
+
+        return vec->size();
+    }
+};
+
+struct MpscQueue {
+    IntrusiveMpscQueue<Node> queue;
+
+    MpscQueue() {
+        queue.Open();
+    }
+
+    void Push(std::unique_ptr<Node> &node) {
+        if (queue.Push(node.get()) != IntrusiveMpscQueue<Node>::PushResult::kClosed) {
+            node.release();
+        }
+        return ;
+    }
+
+    size_t Drain() {
+        size_t num = 0;
+        Node *nodes = queue.PopAll();
+        while (nodes) {
+            std::unique_ptr<Node> node(nodes);
+            nodes = nodes->next;
+            ++num;
+        }
+        return num;
+    }
+};
+
+inline uint64_t NowNs() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+template <typename Queue>
+double RunOnce(int producer_num) {
+    Queue queue;
+    const size_t total = static_cast<size_t>(producer_num) * FLAGS_req_per_producer;
+    std::atomic_bool go{false};
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < producer_num; ++i) {
+        producers.emplace_back([&] () {
+            while (!go.load(std::memory_order_acquire)) {
+                ;
+            }
+            for (int j = 0; j < FLAGS_req_per_producer; ++j) {
+                std::unique_ptr<Node> node(new Node);
+                node->payload = j;
+                queue.Push(node);
+            }
+        });
+    }
+
+    uint64_t begin = NowNs();
+    go.store(true, std::memory_order_release);
+
+    size_t consumed = 0;
+    while (consumed < total) {
+        consumed += queue.Drain();
+    }
+    uint64_t end = NowNs();
+
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+
+    return total * 1000.0 / (end - begin); // Mops/s
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("WorkThread 提交队列竞争测试");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+
+    std::cout << std::setw(10) << "producers"
+              << std::setw(20) << "mutex+vector Mops/s"
+              << std::setw(20) << "mpsc Mops/s" << std::endl;
+    for (int producer_num = 1; producer_num <= FLAGS_max_producer_num; producer_num *= 2) {
+        double mutex_vector = RunOnce<MutexVectorQueue>(producer_num);
+        double mpsc = RunOnce<MpscQueue>(producer_num);
+        std::cout << std::setw(10) << producer_num
+                  << std::setw(20) << std::fixed << std::setprecision(2) << mutex_vector
+                  << std::setw(20) << std::fixed << std::setprecision(2) << mpsc << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+/* 集群模式示例, 依次写入, 读取 FLAGS_key_num 个 key, 并校验读到的值. 这些 key 会分散到集群的各个 slot 上.
+ *
+ * 可以通过 start_local_cluster.sh 在本地启动一个多进程的 redis cluster:
+ *
+ *  ./start_local_cluster.sh start
+ *  make main_src=example_cluster.cc && ./bin/example_cluster --redis_port=30001
+ *
+ * 在运行期间对集群执行 reshard 或者 failover, 请求会通过 MOVED, ASK 重定向以及拓扑刷新被透明地路由到新的节点.
+ */
+
+#include <atomic>
+#include <future>
+
+#include <async_redis_client/async_redis_client.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <hiredis_util/hiredis_util.h>
+
+
+DEFINE_string(redis_host, "127.0.0.1", "集群中任一节点的 host");
+DEFINE_int32(redis_port, 30001, "集群中任一节点的 port");
+DEFINE_string(redis_passwd, "", "redis passwd");
+DEFINE_int32(work_thread_num, 2, "redis async client work thread num");
+DEFINE_int32(conn_per_thread, 1, "每个 work thread 到每个节点的连接数");
+DEFINE_int32(key_num, 10000, "key 的数目");
+DEFINE_int32(rounds, 1, "写入, 读取的轮数; 若为 0, 则一直运行");
+
+AsyncRedisClient g_async_redis_cli;
+
+namespace {
+
+std::string GetKey(int idx) {
+    return "cluster_example:" + std::to_string(idx);
+}
+
+std::string GetValue(int round, int idx) {
+    return std::to_string(round) + ":" + std::to_string(idx);
+}
+
+// 并发地执行 FLAGS_key_num 个请求, 并等待全部完成. 返回失败的请求数目.
+template <typename MakeCmd, typename CheckReply>
+int RunAll(MakeCmd &&make_cmd, CheckReply &&check_reply) {
+    std::atomic<int> pending{FLAGS_key_num};
+    std::atomic<int> failed{0};
+    std::promise<void> done;
+
+    for (int idx = 0; idx < FLAGS_key_num; ++idx) {
+        auto callback = [&, idx] (redisReply *reply) noexcept {
+            if (!check_reply(idx, reply)) {
+                if (failed.fetch_add(1) < 10) { // 只打印前几个.
+                    if (reply) {
+                        LOG(ERROR) << "UNEXPECTED REPLY; key: " << GetKey(idx) << "; reply: " << *reply;
+                    } else {
+                        LOG(ERROR) << "UNEXPECTED REPLY; key: " << GetKey(idx) << "; reply: NULL";
+                    }
+                }
+            }
+            if (pending.fetch_sub(1) == 1) {
+                done.set_value();
+            }
+        };
+
+        try {
+            g_async_redis_cli.Execute(make_cmd(idx), std::move(callback));
+        } catch (const std::exception &e) {
+            LOG(ERROR) << "Execute ERROR; exception: " << e.what();
+            failed.fetch_add(1);
+            if (pending.fetch_sub(1) == 1) {
+                done.set_value();
+            }
+        }
+    }
+
+    done.get_future().wait();
+    return failed.load();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("AsyncRedisClient Cluster Example");
+    google::SetVersionString("1.0.0");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    g_async_redis_cli.conn_per_thread = FLAGS_conn_per_thread;
+    g_async_redis_cli.thread_num = FLAGS_work_thread_num;
+    g_async_redis_cli.host = FLAGS_redis_host;
+    g_async_redis_cli.passwd = FLAGS_redis_passwd;
+    g_async_redis_cli.port = FLAGS_redis_port;
+    g_async_redis_cli.cluster_mode = true;
+    g_async_redis_cli.Start();
+
+    LOG(INFO) << "Start DONE";
+
+    int total_failed = 0;
+    for (int round = 0; FLAGS_rounds == 0 || round < FLAGS_rounds; ++round) {
+        int set_failed = RunAll(
+            [&] (int idx) {
+                return std::vector<std::string>{"SET", GetKey(idx), GetValue(round, idx)};
+            },
+            [&] (int /* idx */, redisReply *reply) {
+                return reply && reply->type == REDIS_REPLY_STATUS;
+            });
+
+        int get_failed = RunAll(
+            [&] (int idx) {
+                return std::vector<std::string>{"GET", GetKey(idx)};
+            },
+            [&] (int idx, redisReply *reply) {
+                std::string expected = GetValue(round, idx);
+                return reply && reply->type == REDIS_REPLY_STRING &&
+                       expected.compare(0, expected.size(), reply->str, reply->len) == 0;
+            });
+
+        LOG(INFO) << "round: " << round << "; SET failed: " << set_failed << "; GET failed: " << get_failed;
+        total_failed += set_failed + get_failed;
+    }
+
+    LOG(INFO) << "Join Begin";
+    g_async_redis_cli.Join();
+    return total_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+
+/* 通过 co_await 使用 AsyncRedisClient, 请求发送到进程内的 MockRedisServer.
+ *
+ * 构建: make main_src=example_coroutine.cc CXX_STD=gnu++20
+ */
+
+#include <exception>
+#include <future>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <hiredis_util/hiredis_util.h>
+
+#include <async_redis_client/async_redis_client.h>
+
+#include "mock_redis_server.h"
+
+#ifdef ASYNC_REDIS_CLIENT_HAS_COROUTINE
+
+namespace {
+
+/* 最简单的协程类型: 立即开始执行, 结束时 set_value(). 只用于演示.
+ */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {
+        }
+
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+/* 在一个单独的线程中恢复协程, 模拟业务自己的事件循环.
+ */
+class ThreadExecutor : public AsyncRedisClient::CoroutineExecutor {
+public:
+    ThreadExecutor():
+        thread_([this] () { Run(); }) {
+    }
+
+    ~ThreadExecutor() {
+        {
+            std::lock_guard<std::mutex> guard(mux_);
+            stopped_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    void Post(std::coroutine_handle<> handle) noexcept override {
+        {
+            std::lock_guard<std::mutex> guard(mux_);
+            handles_.push_back(handle);
+        }
+        cv_.notify_one();
+        return ;
+    }
+
+    bool IsCurrentThread() const noexcept {
+        return std::this_thread::get_id() == thread_.get_id();
+    }
+
+private:
+    std::mutex mux_;
+    std::condition_variable cv_;
+    std::deque<std::coroutine_handle<>> handles_;
+    bool stopped_ = false;
+    std::thread thread_;
+
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(mux_);
+        while (true) {
+            cv_.wait(lock, [this] () { return stopped_ || !handles_.empty(); });
+            if (handles_.empty()) {
+                return ;
+            }
+            std::coroutine_handle<> handle = handles_.front();
+            handles_.pop_front();
+            lock.unlock();
+            handle.resume();
+            lock.lock();
+        }
+    }
+};
+
+void LogReply(const char *scene, const AsyncRedisClient::redisReply_unique_ptr_t &reply) {
+    if (reply) {
+        LOG(INFO) << scene << ", reply: " << *reply;
+    } else {
+        LOG(INFO) << scene << ", reply: NULL";
+    }
+    return ;
+}
+
+/* 命令先构造为具名变量: 部分 GCC 版本不能正确处理 co_await 表达式中的 initializer_list 临时对象.
+ */
+DetachedTask Run(AsyncRedisClient *client, ThreadExecutor *executor, std::promise<void> *done) {
+    std::vector<std::string> set_hello{"SET", "hello", "world"};
+    std::vector<std::string> get_hello{"GET", "hello"};
+    std::vector<std::string> set_foo{"SET", "foo", "bar"};
+    std::vector<std::string> get_foo{"GET", "foo"};
+
+    // 在 work thread 中恢复.
+    LogReply("SET", co_await client->Async(set_hello));
+
+    // 在 executor 中恢复.
+    auto reply = co_await client->Async(get_hello, 0, executor);
+    LogReply("GET", reply);
+    LOG(INFO) << "Resumed on executor: " << executor->IsCurrentThread();
+
+    // 作为一个整体提交, 全部完成之后恢复一次.
+    auto replies = co_await AsyncRedisClient::WhenAll(client->Async(get_hello, 0, executor),
+                                                      client->Async(set_foo),
+                                                      client->Async(get_foo));
+    for (const AsyncRedisClient::redisReply_unique_ptr_t &item : replies) {
+        LogReply("WhenAll", item);
+    }
+
+    done->set_value();
+    co_return;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("AsyncRedisClient Coroutine Example");
+    google::SetVersionString("1.0.0");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    MockRedisServer mock_server;
+    mock_server.Start();
+
+    AsyncRedisClient client;
+    client.host = mock_server.host;
+    client.port = mock_server.GetPort();
+    client.thread_num = 2;
+    client.conn_per_thread = 1;
+    client.Start();
+
+    {
+        ThreadExecutor executor;
+        std::promise<void> done;
+        Run(&client, &executor, &done);
+        done.get_future().get();
+    }
+
+    client.Join();
+    mock_server.Stop();
+    return 0;
+}
+
+#else
+
+int main() {
+    LOG(ERROR) << "需要 C++20 coroutine 支持; make main_src=example_coroutine.cc CXX_STD=gnu++20";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,104 @@
+
+/* 通过 MockRedisServer 复现几种故障场景, 不需要 redis-server.
+ *
+ * 构建: make main_src=example_mock_server.cc
+ */
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <hiredis_util/hiredis_util.h>
+
+#include <async_redis_client/async_redis_client.h>
+
+#include "mock_redis_server.h"
+
+DEFINE_int32(work_thread_num, 1, "redis async client work thread num");
+DEFINE_int32(conn_per_thread, 1, "connection per thread");
+
+namespace {
+
+void LogReply(const char *scene, const AsyncRedisClient::redisReply_unique_ptr_t &reply) {
+    if (reply) {
+        LOG(INFO) << scene << ", reply: " << *reply;
+    } else {
+        LOG(INFO) << scene << ", reply: NULL";
+    }
+    return ;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    google::SetUsageMessage("AsyncRedisClient MockRedisServer Example");
+    google::SetVersionString("1.0.0");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    MockRedisServer mock_server;
+    mock_server.Start();
+
+    AsyncRedisClient client;
+    client.conn_per_thread = FLAGS_conn_per_thread;
+    client.thread_num = FLAGS_work_thread_num;
+    client.host = mock_server.host;
+    client.port = mock_server.GetPort();
+    client.Start();
+
+    LogReply("SET", client.Execute(std::vector<std::string>{"SET", "hello", "world"}).get());
+    LogReply("GET", client.Execute(std::vector<std::string>{"GET", "hello"}).get());
+
+    // 固定响应.
+    mock_server.SetReply("GET", "-ERR canned error\r\n");
+    LogReply("Canned GET", client.Execute(std::vector<std::string>{"GET", "hello"}).get());
+    mock_server.SetReply("GET", "");
+
+    // 服务端延迟 200ms, 请求超时时间 50ms, 应以 NULL 回调.
+    mock_server.SetLatency("GET", 200);
+    LogReply("Slow GET, timeout_ms=50", client.Execute(std::vector<std::string>{"GET", "hello"}, 50).get());
+    mock_server.SetLatency("GET", 0);
+
+    // 服务端在收到请求后关闭连接, 应以 NULL 回调; 之后 AsyncRedisClient 会重新建立连接.
+    mock_server.SetDropEvery(1);
+    LogReply("Dropped GET", client.Execute(std::vector<std::string>{"GET", "hello"}).get());
+    mock_server.SetDropEvery(0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    LogReply("GET after reconnect", client.Execute(std::vector<std::string>{"GET", "hello"}).get());
+
+    // 服务端暂停读取, 请求堆积在客户端中.
+    mock_server.SetReadPaused(true);
+    auto paused_reply = client.Execute(std::vector<std::string>{"GET", "hello"});
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (const AsyncRedisClient::ConnStat &conn_stat : client.GetConnStats()) {
+        LOG(INFO) << "Read paused, Conn " << conn_stat.thread_idx << "." << conn_stat.conn_idx
+                  << ": in_flight_num: " << conn_stat.in_flight_num;
+    }
+    mock_server.SetReadPaused(false);
+    LogReply("GET after resume", paused_reply.get());
+
+    // 在回调中发起后续请求, 后续请求直接在 work thread 中发送, 参见 ThreadStat::inline_num.
+    std::promise<void> chained_done;
+    client.Execute(std::vector<std::string>{"GET", "hello"}, [&] (redisReply *reply) noexcept {
+        if (!reply || reply->type != REDIS_REPLY_STRING) {
+            chained_done.set_value();
+            return ;
+        }
+        client.Execute(std::vector<std::string>{"GET", std::string(reply->str, reply->len)},
+                       [&] (redisReply *) noexcept {
+            chained_done.set_value();
+        });
+    });
+    chained_done.get_future().get();
+    LOG(INFO) << "Chained GET, inline_num: " << client.GetStats().total.inline_num;
+
+    LOG(INFO) << "accept_num: " << mock_server.GetAcceptNum() << ", request_num: " << mock_server.GetRequestNum();
+
+    client.Join();
+    mock_server.Stop();
+    return 0;
+}
@@ -1,8 +1,46 @@
+
+/* AsyncRedisClient 压测工具.
+ *
+ * 需要一个本地启动的 redis-server, 例如:
+ *
+ *  redis-server --port 6379 --save "" --appendonly no --daemonize yes
+ *  make main_src=main.cc && ./bin/main --api_kind=0 --loop_mode=closed --concurrency=64 \
+ *      --work_thread_num=1,2,4 --conn_per_thread=1,3
+ *
+ * 也可以直接运行 run_bench.sh, 其会启动一个临时的 redis-server, 依次运行若干组参数, 并在结束后关闭 redis-server.
+ *
+ * 对于 work_thread_num, conn_per_thread 的每种组合, 都会启动一个新的 AsyncRedisClient, 由 test_thread_num 个
+ * 压测线程各自发送 req_per_thread 个请求, 然后输出一行结果: 吞吐, 以及延迟的 p50/p99/p99.9/max.
+ *
+ * - loop_mode=closed, 闭环. kAsyncAsync 下每个压测线程最多有 concurrency 个未完成的请求; kAsyncSync, kSync,
+ *   kReplyFuture 下每个压测线程同一时刻只有一个请求. 延迟从调用 Execute() 开始计算.
+ * - loop_mode=open, 开环. 所有压测线程共同以 rate 的速率发送请求, 即使之前的请求尚未完成. 延迟从请求预定的发送
+ *   时间开始计算, 因此发送端的排队也会体现在延迟中(避免 coordinated omission).
+ *
+ * 指定 --mock_server 时不需要 redis-server, 此时会在进程内启动一个 MockRedisServer, 并忽略 redis_host,
+ * redis_port. MockRedisServer 的开销很小, 且可以通过 --mock_latency_ms 指定固定的服务端延迟, 适合观察客户端自身
+ * 每个请求的开销.
+ *
+ * 请求为 GET, SET 按 read_ratio 混合, key 从 [0, key_num) 中按照 key_dist 选取, value 长度为 value_size. 在第一组
+ * 组合开始之前会写入所有 key, 使得 GET 总是命中.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
 #include <chrono>
 #include <thread>
-
-#include <signal.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <new>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -12,213 +50,791 @@
 #include <hiredis_util/hiredis_util.h>
 
 #include <async_redis_client/async_redis_client.h>
+#include <async_redis_client/latency_histogram.h>
+
+#include "mock_redis_server.h"
 
 enum class ApiKind : int{
     kAsyncAsync = 0,
     kAsyncSync,
-    kSync
+    kSync,
+    kReplyFuture
 };
 
 DEFINE_string(redis_host, "127.0.0.1", "redis host");
 DEFINE_int32(redis_port, 6379, "redis port");
 DEFINE_string(redis_passwd, "", "redis passwd");
-DEFINE_int32(work_thread_num, 4, "redis async client work thread num");
-DEFINE_int32(conn_per_thread, 3, "connection per thread");
+DEFINE_string(work_thread_num, "4", "redis async client work thread num; 可以是逗号分隔的列表");
+DEFINE_string(conn_per_thread, "3", "connection per thread; 可以是逗号分隔的列表");
 DEFINE_int32(test_thread_num, 1, "test thread number");
-DEFINE_int32(req_per_thread, 1, "每个 test thread 发送的 redis request 数量");
+DEFINE_int32(req_per_thread, 100000, "每个 test thread 发送的 redis request 数量");
 DEFINE_bool(pause, false, "若为真, 则会调用 pause() 在某些时候");
-DEFINE_int32(api_kind, (int)ApiKind::kAsyncSync, "测试所使用 api 的类型;0, kAsyncAsync; 1, kAsyncSync; 2, kSync");
+DEFINE_int32(api_kind, (int)ApiKind::kAsyncAsync, "测试所使用 api 的类型;0, kAsyncAsync; 1, kAsyncSync; 2, kSync; 3, kReplyFuture");
+DEFINE_int32(sync_spin_us, 0, "kReplyFuture 下 AsyncRedisClient::sync_spin_us");
+DEFINE_int32(conn_select_policy, 0, "连接选择策略; 0, kRoundRobin; 1, kLeastOutstanding; 2, kPowerOfTwoChoices");
+DEFINE_int32(timeout_ms, 0, "请求超时时间, ms; 0 表示不超时");
+DEFINE_bool(use_reply_arena, false, "是否启用 AsyncRedisClient::use_reply_arena");
+DEFINE_uint64(near_cache_max_bytes, 0, "AsyncRedisClient::near_cache_max_bytes; 0 表示不启用, 需要 redis 6.0 及以上");
+DEFINE_bool(coalesce_reads, false, "AsyncRedisClient::coalesce_reads");
+DEFINE_bool(merge_reads, false, "AsyncRedisClient::merge_reads");
+DEFINE_bool(merge_gets, false, "AsyncRedisClient::merge_gets; 与 merge_reads 一起使用, 将 GET 合并为 MGET");
+DEFINE_uint64(merge_max_keys, 64, "AsyncRedisClient::merge_max_keys");
+DEFINE_uint64(callback_thread_num, 0, "AsyncRedisClient::callback_thread_num; 0 表示回调在 work thread 中执行");
+DEFINE_int32(warmup_timeout_ms, 0, "若大于 0, 则通过 Start(min_ready_conn_num, timeout_ms) 等待所有连接就绪, 并输出耗时");
+DEFINE_uint64(max_retry_num, 0, "AsyncRedisClient::max_retry_num");
+DEFINE_string(restart_cmd, "", "若不为空, 则在压测开始 restart_after_ms 之后通过 system() 执行, 用来重启 redis-server, "
+                               "并输出从执行完毕到所有连接重新就绪的时间");
+DEFINE_int32(restart_after_ms, 1000, "参见 restart_cmd");
+DEFINE_int32(callback_cost_us, 0, "kAsyncAsync 下每个回调额外忙等的时间, us, 用来模拟耗时的回调");
+
+DEFINE_string(loop_mode, "closed", "closed, 闭环; open, 开环");
+DEFINE_int32(concurrency, 16, "闭环 kAsyncAsync 下每个 test thread 最多未完成的请求数");
+DEFINE_double(rate, 10000, "开环下所有 test thread 总的请求速率, 单位: 请求/秒");
+
+DEFINE_int32(key_num, 100000, "key 的数目");
+DEFINE_string(key_dist, "uniform", "key 的分布; uniform, 均匀; zipf, zipfian 分布");
+DEFINE_double(zipf_theta, 0.99, "zipfian 分布的参数, 取值 (0, 1)");
+DEFINE_int32(value_size, 16, "SET 的 value 长度");
+DEFINE_double(read_ratio, 0.9, "GET 请求所占的比例, 其余为 SET");
+DEFINE_bool(prefill, true, "是否在开始之前写入所有 key");
+DEFINE_bool(mock_server, false, "是否使用进程内的 MockRedisServer 代替 redis-server");
+DEFINE_int32(mock_latency_ms, 0, "MockRedisServer 每个响应的延迟, ms");
+DEFINE_bool(print_command_latency, false, "是否启用 collect_command_latency, 并在每组结束后输出各命令各阶段的延迟");
+DEFINE_bool(print_conn_stats, false, "是否在每组结束后输出每个线程, 每个连接的统计信息");
 
 void OnSig(int) {
     return ;
 }
 
-std::shared_ptr<std::vector<std::string>> g_redis_cmd = std::make_shared<std::vector<std::string>>();
+/* 统计进程内 operator new 的调用次数, 用来观察每个请求的内存分配次数. 注意 hiredis, libuv 内部通过 malloc()
+ * 分配的内存不在统计范围内.
+ */
+std::atomic<uint64_t> g_new_num{0};
+
+void* operator new(size_t size) {
+    g_new_num.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+    return ;
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+    return ;
+}
+
+namespace {
 
-inline bool IsSuccessReply(const struct redisReply *reply) noexcept {
-    return  (reply &&
-            (reply->type == REDIS_REPLY_STATUS) &&
-            (MemCompare("OK", reply->str, reply->len) == 0));
+inline uint64_t NowNs() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-struct OnRedisReply {
-    struct timespec commit_timepoint = {0, 0};
-    struct timespec on_reply_timepoint = {0, 0};
+std::vector<int> ParseIntList(const std::string &str) {
+    std::vector<int> vals;
+    std::stringstream stream(str);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            vals.push_back(std::stoi(item));
+        }
+    }
+    return vals;
+}
+
+/* YCSB 中的 zipfian 生成器, 参见 Gray et al., "Quickly Generating Billion-Record Synthetic Databases".
+ * 返回值 0 最热.
+ */
+class ZipfGenerator {
+public:
+    ZipfGenerator(uint64_t n, double theta):
+        n_(n),
+        theta_(theta),
+        zetan_(Zeta(n, theta)),
+        alpha_(1 / (1 - theta)),
+        eta_((1 - pow(2.0 / n, 1 - theta)) / (1 - Zeta(2, theta) / zetan_)) {
+    }
+
+    // u 为 [0, 1) 上的均匀分布.
+    uint64_t Next(double u) const noexcept {
+        double uz = u * zetan_;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + pow(0.5, theta_)) {
+            return 1;
+        }
+        uint64_t val = static_cast<uint64_t>(n_ * pow(eta_ * u - eta_ + 1, alpha_));
+        return val < n_ ? val : n_ - 1;
+    }
 
-    void operator()(struct redisReply *reply) noexcept;
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+
+private:
+    static double Zeta(uint64_t n, double theta) noexcept {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1 / pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
 };
 
-void OnRedisReply::operator()(struct redisReply *reply) noexcept {
-    clock_gettime(CLOCK_REALTIME, &on_reply_timepoint);
+std::vector<std::string> g_keys;
+std::string g_value;
+std::unique_ptr<ZipfGenerator> g_zipf;
+AsyncRedisClient *g_client = nullptr;
 
-    bool is_success_reply = IsSuccessReply(reply);
-    auto thread_id = std::this_thread::get_id();
-    const char *g_api_kind_desc[] {
-        "kAsyncAsync",
-        "kAsyncSync",
-        "kSync" 
-    };
+// 每个压测线程的请求生成器.
+class RequestGenerator {
+public:
+    explicit RequestGenerator(uint64_t seed):
+        rng_(seed) {
+    }
+
+    std::vector<std::string> Next() {
+        const std::string &key = g_keys[NextKeyIdx()];
+        if (uniform_(rng_) < FLAGS_read_ratio) {
+            return std::vector<std::string>{"GET", key};
+        }
+        return std::vector<std::string>{"SET", key, g_value};
+    }
 
-    LOG(INFO) << "ON REDIS REPLY, " << g_api_kind_desc[FLAGS_api_kind] << ", " << GetTimespecDiff(on_reply_timepoint, commit_timepoint) << ", "
-              << is_success_reply << ","
-              << thread_id;
+private:
+    std::mt19937_64 rng_;
+    std::uniform_real_distribution<double> uniform_{0, 1};
+
+private:
+    size_t NextKeyIdx() noexcept {
+        if (g_zipf) {
+            return g_zipf->Next(uniform_(rng_));
+        }
+        return rng_() % g_keys.size();
+    }
+};
+
+/* 延迟统计. 请求可能在压测线程中完成(kAsyncSync, kSync), 也可能在 work thread 中完成(kAsyncAsync), 因此每个
+ * 线程各自记录, 每组结束时再合并.
+ */
+struct ThreadStats {
+    LatencyHistogram latency; // ns
+    uint64_t error_num = 0;
+};
+
+std::mutex g_stats_mux;
+std::vector<std::unique_ptr<ThreadStats>> g_stats;
+std::atomic<uint64_t> g_stats_generation{0};
+
+ThreadStats* GetThreadStats() {
+    thread_local ThreadStats *stats = nullptr;
+    thread_local uint64_t generation = static_cast<uint64_t>(-1);
+
+    uint64_t current_generation = g_stats_generation.load(std::memory_order_acquire);
+    if (!stats || generation != current_generation) {
+        std::unique_ptr<ThreadStats> new_stats(new ThreadStats);
+        stats = new_stats.get();
+        generation = current_generation;
+
+        std::lock_guard<std::mutex> guard(g_stats_mux);
+        g_stats.push_back(std::move(new_stats));
+    }
+    return stats;
 }
 
-AsyncRedisClient async_redis_cli;
+// 只能在所有记录者都结束之后调用.
+void CollectStats(LatencyHistogram *latency, uint64_t *error_num) {
+    std::lock_guard<std::mutex> guard(g_stats_mux);
+    latency->Reset();
+    *error_num = 0;
+    for (const std::unique_ptr<ThreadStats> &stats : g_stats) {
+        latency->Merge(stats->latency);
+        *error_num += stats->error_num;
+    }
+    g_stats.clear();
+    g_stats_generation.fetch_add(1, std::memory_order_release);
+    return ;
+}
+
+void RecordReply(uint64_t begin_ns, const redisReply *reply) {
+    ThreadStats *stats = GetThreadStats();
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        ++stats->error_num;
+        return ;
+    }
+    uint64_t now_ns = NowNs();
+    stats->latency.Record(now_ns > begin_ns ? now_ns - begin_ns : 0);
+    return ;
+}
+
+// 未完成的请求数目, 用来实现闭环下的并发限制, 以及等待所有请求完成.
+class Window {
+public:
+    explicit Window(int limit):
+        limit_(limit) {
+    }
+
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(mux_);
+        cv_.wait(lock, [&] () { return outstanding_ < limit_; });
+        ++outstanding_;
+        return ;
+    }
+
+    // 在持有锁时 notify, 否则 WaitAll() 返回之后 Window 可能已经被析构.
+    void Release() {
+        std::lock_guard<std::mutex> guard(mux_);
+        --outstanding_;
+        cv_.notify_one();
+        return ;
+    }
+
+    void WaitAll() {
+        std::unique_lock<std::mutex> lock(mux_);
+        cv_.wait(lock, [&] () { return outstanding_ == 0; });
+        return ;
+    }
+
+private:
+    std::mutex mux_;
+    std::condition_variable cv_;
+    int outstanding_ = 0;
+    int limit_;
+};
+
+// 开环下第 idx 个请求预定的发送时间. 返回时已经到达了该时间.
+uint64_t WaitUntilScheduled(uint64_t begin_ns, uint64_t interval_ns, int idx) {
+    uint64_t scheduled_ns = begin_ns + interval_ns * idx;
+    uint64_t now_ns = NowNs();
+    if (now_ns + 50000 < scheduled_ns) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(scheduled_ns - now_ns - 50000));
+    }
+    while (NowNs() < scheduled_ns) {
+        ;
+    }
+    return scheduled_ns;
+}
+
+bool IsOpenLoop() noexcept {
+    return FLAGS_loop_mode == "open";
+}
+
+uint64_t GetIntervalNs() noexcept {
+    return static_cast<uint64_t>(1e9 * FLAGS_test_thread_num / FLAGS_rate);
+}
+
+void AsyncAsyncThreadMain(uint64_t seed) {
+    RequestGenerator generator(seed);
+    // 开环下不限制并发.
+    Window window(IsOpenLoop() ? INT32_MAX : FLAGS_concurrency);
+    uint64_t begin_ns = NowNs();
+    uint64_t interval_ns = GetIntervalNs();
 
-void AsyncAsyncThreadMain() noexcept {
     for (int i = 0; i < FLAGS_req_per_thread; ++i) {
-        OnRedisReply reply_callback;
-        clock_gettime(CLOCK_REALTIME, &reply_callback.commit_timepoint);
+        uint64_t start_ns;
+        if (IsOpenLoop()) {
+            start_ns = WaitUntilScheduled(begin_ns, interval_ns, i);
+            window.Acquire();
+        } else {
+            window.Acquire();
+            start_ns = NowNs();
+        }
 
         try {
-            async_redis_cli.Execute(*g_redis_cmd,
-                                    std::move(reply_callback));
+            g_client->Execute(generator.Next(), [&window, start_ns] (redisReply *reply) noexcept {
+                RecordReply(start_ns, reply);
+                if (FLAGS_callback_cost_us > 0) {
+                    uint64_t end_ns = NowNs() + FLAGS_callback_cost_us * 1000ULL;
+                    while (NowNs() < end_ns) {
+                        ;
+                    }
+                }
+                window.Release();
+            }, FLAGS_timeout_ms);
         } catch (const std::exception &e) {
             LOG(ERROR) << "Execute ERROR; exception: " << e.what();
+            ++GetThreadStats()->error_num;
+            window.Release();
         }
     }
+
+    window.WaitAll();
     return ;
 }
 
-void AsyncSyncThreadMain() noexcept {
+void AsyncSyncThreadMain(uint64_t seed) {
+    RequestGenerator generator(seed);
+    uint64_t begin_ns = NowNs();
+    uint64_t interval_ns = GetIntervalNs();
+
     for (int i = 0; i < FLAGS_req_per_thread; ++i) {
+        uint64_t start_ns = IsOpenLoop() ? WaitUntilScheduled(begin_ns, interval_ns, i) : NowNs();
         try {
-            OnRedisReply reply_callback;
-            clock_gettime(CLOCK_REALTIME, &reply_callback.commit_timepoint);
-            reply_callback(async_redis_cli.Execute(*g_redis_cmd).get().get());
+            auto reply = g_client->Execute(generator.Next(), FLAGS_timeout_ms).get();
+            RecordReply(start_ns, reply.get());
         } catch (const std::exception &e) {
-            LOG(ERROR) << "Execute ERROR; exception: " << e.what();
+            RecordReply(start_ns, nullptr);
         }
     }
     return ;
 }
 
-namespace {
-thread_local std::unique_ptr<redisContext,void(*)(redisContext *)> redis_ctx{nullptr, redisFree};
+// 同 AsyncSyncThreadMain(), 但是通过 ExecuteSync() 等待响应.
+void ReplyFutureThreadMain(uint64_t seed) {
+    RequestGenerator generator(seed);
+    uint64_t begin_ns = NowNs();
+    uint64_t interval_ns = GetIntervalNs();
 
-void OpenRedisContext() {
-    if (redis_ctx)
-        return ;
+    for (int i = 0; i < FLAGS_req_per_thread; ++i) {
+        uint64_t start_ns = IsOpenLoop() ? WaitUntilScheduled(begin_ns, interval_ns, i) : NowNs();
+        try {
+            auto reply = g_client->ExecuteSync(generator.Next(), FLAGS_timeout_ms).Get();
+            RecordReply(start_ns, reply.get());
+        } catch (const std::exception &e) {
+            RecordReply(start_ns, nullptr);
+        }
+    }
+    return ;
+}
 
-    redis_ctx = RedisConnect(FLAGS_redis_host.c_str(), FLAGS_redis_port);
+void SyncThreadMain(uint64_t seed) {
+    RequestGenerator generator(seed);
+    uint64_t begin_ns = NowNs();
+    uint64_t interval_ns = GetIntervalNs();
+
+    auto redis_ctx = RedisConnect(FLAGS_redis_host.c_str(), FLAGS_redis_port);
     if (!redis_ctx || redis_ctx->err != 0) {
-        redis_ctx.reset();
-        THROW(EINVAL, "无法向 redis 建立连接; err: %s",
-              redis_ctx ? redis_ctx->errstr : "UNKNOWN");
+        LOG(ERROR) << "无法向 redis 建立连接; err: " << (redis_ctx ? redis_ctx->errstr : "UNKNOWN");
+        return ;
     }
-
-    if (!FLAGS_redis_passwd.empty())
+    if (!FLAGS_redis_passwd.empty()) {
         RedisCommand(redis_ctx.get(), "AUTH %s", FLAGS_redis_passwd.c_str());
+    }
 
+    for (int i = 0; i < FLAGS_req_per_thread; ++i) {
+        uint64_t start_ns = IsOpenLoop() ? WaitUntilScheduled(begin_ns, interval_ns, i) : NowNs();
+        try {
+            auto reply = RedisCommandArgv(redis_ctx.get(), generator.Next());
+            RecordReply(start_ns, reply.get());
+        } catch (const std::exception &e) {
+            RecordReply(start_ns, nullptr);
+        }
+    }
     return ;
 }
 
-void CloseRedisContext() noexcept {
-    redis_ctx.reset();
-    return ;
-}
+void ThreadMain(uint64_t seed) noexcept {
+    try {
+        switch (FLAGS_api_kind) {
+        case (int)ApiKind::kAsyncAsync:
+            AsyncAsyncThreadMain(seed);
+            break;
 
+        case (int)ApiKind::kAsyncSync:
+            AsyncSyncThreadMain(seed);
+            break;
+
+        case (int)ApiKind::kSync:
+            SyncThreadMain(seed);
+            break;
+
+        case (int)ApiKind::kReplyFuture:
+            ReplyFutureThreadMain(seed);
+            break;
+
+        default: // unreachable
+            throw std::runtime_error("WTF");
+        }
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "ThreadMain ERROR; exception: " << e.what();
+    }
+    return ;
 }
 
-void SyncThreadMain() noexcept {
-    for (int i = 0; i < FLAGS_req_per_thread; ++i) {
-        try {
-            OpenRedisContext();
-            try {
-                OnRedisReply reply_callback;
-                clock_gettime(CLOCK_REALTIME, &reply_callback.commit_timepoint);
-                auto reply = RedisCommandArgv(redis_ctx.get(), *g_redis_cmd);
-                reply_callback(reply.get());
-            } catch (...) {
-                CloseRedisContext();
-                throw ;
+// 通过 ExecuteBatch() 写入所有 key.
+void Prefill() {
+    constexpr size_t kBatchSize = 1000;
+    for (size_t begin = 0; begin < g_keys.size(); begin += kBatchSize) {
+        std::vector<std::vector<std::string>> cmds;
+        for (size_t idx = begin; idx < g_keys.size() && idx < begin + kBatchSize; ++idx) {
+            cmds.push_back(std::vector<std::string>{"SET", g_keys[idx], g_value});
+        }
+        for (const AsyncRedisClient::redisReply_unique_ptr_t &reply : g_client->ExecuteBatch(std::move(cmds)).get()) {
+            if (!reply || reply->type == REDIS_REPLY_ERROR) {
+                throw std::runtime_error("PREFILL ERROR");
             }
-        } catch (const std::exception &e) {
-            LOG(ERROR) << "Execute ERROR; exception: " << e.what();
         }
     }
     return ;
 }
 
-void ThreadMain() noexcept {
-    switch (FLAGS_api_kind) {
-    case (int)ApiKind::kAsyncAsync:
-        AsyncAsyncThreadMain();
-        break;
-
-    case (int)ApiKind::kAsyncSync:
-        AsyncSyncThreadMain();
-        break;
+/* redis-server 累计消耗的 CPU 时间, 单位 ms, 即 INFO cpu 中 used_cpu_sys 与 used_cpu_user 之和. 使用
+ * MockRedisServer 或者获取失败时返回负数.
+ */
+double GetServerCpuMs() {
+    if (FLAGS_mock_server) {
+        return -1;
+    }
 
-    case (int)ApiKind::kSync:
-        SyncThreadMain();
-        break;
+    try {
+        auto redis_ctx = RedisConnect(FLAGS_redis_host.c_str(), FLAGS_redis_port);
+        if (!redis_ctx || redis_ctx->err != 0) {
+            return -1;
+        }
+        if (!FLAGS_redis_passwd.empty()) {
+            RedisCommand(redis_ctx.get(), "AUTH %s", FLAGS_redis_passwd.c_str());
+        }
+        auto reply = RedisCommand(redis_ctx.get(), "INFO cpu");
+        if (!reply || reply->type != REDIS_REPLY_STRING) {
+            return -1;
+        }
 
-    default: // unreachable
-        throw std::runtime_error("WTF");
+        double cpu_seconds = 0;
+        std::istringstream stream(std::string(reply->str, reply->len));
+        std::string line;
+        while (std::getline(stream, line)) {
+            for (const char *name : {"used_cpu_sys:", "used_cpu_user:"}) {
+                size_t len = strlen(name);
+                if (line.compare(0, len, name) == 0) {
+                    cpu_seconds += atof(line.c_str() + len);
+                }
+            }
+        }
+        return cpu_seconds * 1e3;
+    } catch (const std::exception &e) {
+        return -1;
     }
-    return ;
 }
 
-int main(int argc, char **argv) noexcept {
-    signal(SIGINT, OnSig);
+/* 本进程累计的读, 写类系统调用次数, 即 /proc/self/io 中的 syscr, syscw. 除了与 redis-server 之间的 read(), write()
+ * 之外, 也包括 uv_async_send() 在 eventfd 上的 write(), 以及 work thread 被唤醒之后在 eventfd 上的 read().
+ * 使用 MockRedisServer 时也包括其自身的读写. 获取失败时返回 false.
+ */
+bool GetProcSyscalls(uint64_t *syscr, uint64_t *syscw) {
+    std::ifstream stream("/proc/self/io");
+    std::string line;
+    int found_num = 0;
+    while (std::getline(stream, line)) {
+        if (line.compare(0, 6, "syscr:") == 0) {
+            *syscr = strtoull(line.c_str() + 6, nullptr, 10);
+            ++found_num;
+        } else if (line.compare(0, 6, "syscw:") == 0) {
+            *syscw = strtoull(line.c_str() + 6, nullptr, 10);
+            ++found_num;
+        }
+    }
+    return found_num == 2;
+}
 
-    g_redis_cmd->assign({"SET", "hello", "world"});
-    google::SetUsageMessage("AsyncRedisClient Test");
-    google::SetVersionString("1.0.0");
-    google::ParseCommandLineFlags(&argc, &argv, false);
-    google::InitGoogleLogging(argv[0]);
-    google::InstallFailureSignalHandler();
+void PrintHeader() {
+    std::cout << std::setw(8) << "threads"
+              << std::setw(8) << "conns"
+              << std::setw(12) << "requests"
+              << std::setw(10) << "errors"
+              << std::setw(10) << "seconds"
+              << std::setw(12) << "QPS"
+              << std::setw(10) << "p50(us)"
+              << std::setw(10) << "p99(us)"
+              << std::setw(11) << "p99.9(us)"
+              << std::setw(10) << "max(us)"
+              << std::setw(12) << "wakeup/req"
+              << std::setw(10) << "rd/req"
+              << std::setw(10) << "wr/req"
+              << std::setw(10) << "new/req"
+              << std::setw(10) << "cmd/req"
+              << std::setw(13) << "srv_us/req" << std::endl;
+    return ;
+}
 
-    struct timespec start_b = {0, 0};
-    struct timespec start_e = {0, 0};
-    struct timespec join_b = {0, 0};
-    struct timespec join_e = {0, 0};
+/* 在压测进行中执行 restart_cmd, 然后等待所有连接重新就绪. recovery_ms 从 restart_cmd 执行完毕开始计算, 即 redis-server
+ * 可以接受连接之后, 客户端重新连接所需的时间, 反映了 reconnect_min_delay_ms 等参数的影响.
+ */
+void MeasureRecovery(AsyncRedisClient *client) {
+    constexpr uint64_t kMaxWaitNs = 30 * 1000000000ULL;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_restart_after_ms));
+    AsyncRedisClient::ThreadStat before = client->GetStats().total;
+    uint64_t restart_ns = NowNs();
+    int rc = system(FLAGS_restart_cmd.c_str());
+    uint64_t restarted_ns = NowNs();
+
+    auto AllReady = [client] () {
+        for (const AsyncRedisClient::ConnStat &conn_stat : client->GetConnStats()) {
+            if (conn_stat.state != AsyncRedisClient::ConnState::kReady) {
+                return false;
+            }
+        }
+        return true;
+    };
+    // 等待连接断开被察觉, 以免将重启之前的状态当作已经恢复.
+    while (client->GetStats().total.reconnect_num == before.reconnect_num && NowNs() - restarted_ns < kMaxWaitNs) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    while (!AllReady() && NowNs() - restarted_ns < kMaxWaitNs) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t ready_ns = NowNs();
+
+    AsyncRedisClient::ThreadStat after = client->GetStats().total;
+    LOG(INFO) << "Restart; rc: " << rc
+              << ", restart_ms: " << (restarted_ns - restart_ns) / 1e6
+              << ", recovery_ms: " << (ready_ns - restarted_ns) / 1e6
+              << ", reconnect_num: " << after.reconnect_num - before.reconnect_num
+              << ", connect_fail_num: " << after.connect_fail_num - before.connect_fail_num
+              << ", failed_num: " << after.failed_num - before.failed_num
+              << ", retry_num: " << after.retry_num - before.retry_num;
+    return ;
+}
 
-    if (FLAGS_pause) {
-        std::cout << "按 CTRL+C Start..." << std::endl;
-        pause();
+void RunOnce(int work_thread_num, int conn_per_thread, bool prefill) {
+    AsyncRedisClient client;
+    client.conn_per_thread = conn_per_thread;
+    client.thread_num = work_thread_num;
+    client.host = FLAGS_redis_host;
+    client.passwd = FLAGS_redis_passwd;
+    client.port = FLAGS_redis_port;
+    client.conn_select_policy = (AsyncRedisClient::ConnSelectPolicy)FLAGS_conn_select_policy;
+    client.use_reply_arena = FLAGS_use_reply_arena;
+    client.sync_spin_us = FLAGS_sync_spin_us;
+    client.collect_command_latency = FLAGS_print_command_latency;
+    client.collect_bytes_read = FLAGS_print_conn_stats;
+    client.near_cache_max_bytes = FLAGS_near_cache_max_bytes;
+    client.coalesce_reads = FLAGS_coalesce_reads;
+    client.merge_reads = FLAGS_merge_reads;
+    client.merge_gets = FLAGS_merge_gets;
+    client.merge_max_keys = FLAGS_merge_max_keys;
+    client.callback_thread_num = FLAGS_callback_thread_num;
+    client.max_retry_num = FLAGS_max_retry_num;
+    if (FLAGS_warmup_timeout_ms > 0) {
+        uint64_t warmup_begin_ns = NowNs();
+        size_t ready_conn_num = client.Start(work_thread_num * conn_per_thread, FLAGS_warmup_timeout_ms);
+        LOG(INFO) << "Warmup; ready_conn_num: " << ready_conn_num << "/" << work_thread_num * conn_per_thread
+                  << ", elapsed_ms: " << (NowNs() - warmup_begin_ns) / 1000000.0;
+    } else {
+        client.Start();
     }
+    g_client = &client;
 
-    async_redis_cli.conn_per_thread = FLAGS_conn_per_thread;
-    async_redis_cli.thread_num = FLAGS_work_thread_num;
-    async_redis_cli.host = FLAGS_redis_host;
-    async_redis_cli.passwd = FLAGS_redis_passwd;
-    async_redis_cli.port = FLAGS_redis_port;
+    if (prefill) {
+        Prefill();
+    }
 
-    clock_gettime(CLOCK_REALTIME, &start_b);
-    async_redis_cli.Start();
-    clock_gettime(CLOCK_REALTIME, &start_e);
+    LatencyHistogram latency;
+    uint64_t error_num;
+    CollectStats(&latency, &error_num); // 丢弃 Prefill() 期间的记录.
 
-    LOG(INFO) << "Started ...";
+    double server_cpu_begin_ms = GetServerCpuMs();
+    uint64_t sent_num_begin = client.GetStats().total.sent_num;
+    uint64_t new_num_begin = g_new_num.load(std::memory_order_relaxed);
+    uint64_t syscr_begin = 0;
+    uint64_t syscw_begin = 0;
+    bool has_syscalls = GetProcSyscalls(&syscr_begin, &syscw_begin);
+    uint64_t begin_ns = NowNs();
 
     std::vector<std::thread> test_threads;
     test_threads.reserve(FLAGS_test_thread_num);
     for (int i = 0; i < FLAGS_test_thread_num; ++i) {
         try {
-            test_threads.emplace_back(ThreadMain);
+            test_threads.emplace_back(ThreadMain, static_cast<uint64_t>(i) + 1);
         } catch (const std::exception &e) {
             LOG(ERROR) << "Start TEST Thread ERROR; exp: " << e.what();
         }
     }
-    LOG(INFO) << "Test Thread Started; test_thread_num: " << test_threads.size();
-
+    std::thread restart_thread;
+    if (!FLAGS_restart_cmd.empty()) {
+        restart_thread = std::thread(MeasureRecovery, &client);
+    }
     for (std::thread &test_thread : test_threads) {
         test_thread.join();
     }
-    LOG(INFO) << "Test Thread Joined";
+    if (restart_thread.joinable()) {
+        restart_thread.join();
+    }
+
+    uint64_t end_ns = NowNs();
+    uint64_t syscr_end = 0;
+    uint64_t syscw_end = 0;
+    has_syscalls = GetProcSyscalls(&syscr_end, &syscw_end) && has_syscalls;
+    uint64_t new_num = g_new_num.load(std::memory_order_relaxed) - new_num_begin;
+    uint64_t sent_num = client.GetStats().total.sent_num - sent_num_begin;
+    double server_cpu_end_ms = GetServerCpuMs();
+    double server_cpu_ms = server_cpu_begin_ms >= 0 && server_cpu_end_ms >= 0 ?
+                           server_cpu_end_ms - server_cpu_begin_ms : -1;
+
+    client.Join();
+    g_client = nullptr;
+    CollectStats(&latency, &error_num);
+
+    uint64_t req_num = static_cast<uint64_t>(test_threads.size()) * FLAGS_req_per_thread;
+    double seconds = (end_ns - begin_ns) / 1e9;
+    bool is_async = FLAGS_api_kind != (int)ApiKind::kSync;
+
+    /* wakeup/req, 每个请求对应的将请求队列由空变为非空的 uv_async_send() 次数, 参见 GetWakeupNum(). libuv 会合并
+     * 尚未被处理的 uv_async_send(), 因此这并不是实际的系统调用次数.
+     * rd/req, wr/req, 每个请求对应的本进程读, 写类系统调用次数, 参见 GetProcSyscalls(); 与以
+     * -DASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST 构建的 main 对比即可得到唤醒合并前后的差异, 参见 run_bench.sh.
+     * 无法获取时为 -1.
+     * new/req, 每个请求对应的 operator new 次数, 包括压测工具自身构造请求的开销.
+     * cmd/req, 每个请求对应的实际发送的命令数目, 启用 merge_reads, coalesce_reads 之后小于 1.
+     * srv_us/req, 每个请求对应的 redis-server CPU 时间, us; 由 INFO cpu 得到, 精度有限, 无法获取时为 -1.
+     */
+    std::cout << std::setw(8) << work_thread_num
+              << std::setw(8) << conn_per_thread
+              << std::setw(12) << req_num
+              << std::setw(10) << error_num
+              << std::setw(10) << std::fixed << std::setprecision(2) << seconds
+              << std::setw(12) << std::fixed << std::setprecision(0) << (seconds > 0 ? latency.GetCount() / seconds : 0)
+              << std::setw(10) << std::fixed << std::setprecision(1) << latency.GetValueAtPercentile(50) / 1e3
+              << std::setw(10) << std::fixed << std::setprecision(1) << latency.GetValueAtPercentile(99) / 1e3
+              << std::setw(11) << std::fixed << std::setprecision(1) << latency.GetValueAtPercentile(99.9) / 1e3
+              << std::setw(10) << std::fixed << std::setprecision(1) << latency.GetMax() / 1e3
+              << std::setw(12) << std::fixed << std::setprecision(3)
+              << (is_async && req_num ? (double)client.GetWakeupNum() / req_num : 0.0)
+              << std::setw(10) << std::fixed << std::setprecision(3)
+              << (has_syscalls && req_num ? (double)(syscr_end - syscr_begin) / req_num : -1.0)
+              << std::setw(10) << std::fixed << std::setprecision(3)
+              << (has_syscalls && req_num ? (double)(syscw_end - syscw_begin) / req_num : -1.0)
+              << std::setw(10) << std::fixed << std::setprecision(2)
+              << (req_num ? (double)new_num / req_num : 0.0)
+              << std::setw(10) << std::fixed << std::setprecision(3)
+              << (is_async && req_num ? (double)sent_num / req_num : 0.0)
+              << std::setw(13) << std::fixed << std::setprecision(3)
+              << (server_cpu_ms >= 0 && req_num ? server_cpu_ms * 1e3 / req_num : -1.0) << std::endl;
+
+    if (FLAGS_print_command_latency) {
+        const char *stage_names[CommandLatencyTable::kStageNum] = {"queue_wait", "dispatch", "round_trip", "callback"};
+        for (const auto &cmd_latency : client.GetCommandLatency()) {
+            for (size_t stage = 0; stage < CommandLatencyTable::kStageNum; ++stage) {
+                const LatencyHistogram &latency = cmd_latency.second.stages[stage];
+                std::cout << "    " << std::setw(8) << std::left << cmd_latency.first << std::right
+                          << std::setw(12) << stage_names[stage]
+                          << ", count: " << latency.GetCount() << std::fixed << std::setprecision(1)
+                          << ", p50(us): " << latency.GetValueAtPercentile(50) / 1e3
+                          << ", p99(us): " << latency.GetValueAtPercentile(99) / 1e3
+                          << ", p99.9(us): " << latency.GetValueAtPercentile(99.9) / 1e3
+                          << ", max(us): " << latency.GetMax() / 1e3 << std::endl;
+            }
+        }
+    }
 
-    clock_gettime(CLOCK_REALTIME, &join_b);
-    async_redis_cli.Join();
-    clock_gettime(CLOCK_REALTIME, &join_e);
+    if (FLAGS_print_conn_stats) {
+        for (const AsyncRedisClient::ThreadStat &thread_stat : client.GetStats().threads) {
+            std::cout << "    Thread " << thread_stat.thread_idx << ": "
+                      << "dequeued_num: " << thread_stat.dequeued_num << ", "
+                      << "max_drain_num: " << thread_stat.max_drain_num << ", "
+                      << "failed_num: " << thread_stat.failed_num << ", "
+                      << "timeout_num: " << thread_stat.timeout_num << ", "
+                      << "reconnect_num: " << thread_stat.reconnect_num << ", "
+                      << "parked_num: " << thread_stat.parked_num << ", "
+                      << "retry_num: " << thread_stat.retry_num << ", "
+                      << "bytes_written: " << thread_stat.bytes_written << ", "
+                      << "bytes_read: " << thread_stat.bytes_read << ", "
+                      << "coalesced_num: " << thread_stat.coalesced_num << ", "
+                      << "merged_num: " << thread_stat.merged_num << ", "
+                      << "deferred_num: " << thread_stat.deferred_num << ", "
+                      << "deferred_batch_num: " << thread_stat.deferred_batch_num << ", "
+                      << "near_cache_hit_num: " << thread_stat.near_cache_hit_num << ", "
+                      << "near_cache_miss_num: " << thread_stat.near_cache_miss_num << ", "
+                      << "near_cache_invalidate_num: " << thread_stat.near_cache_invalidate_num << ", "
+                      << "near_cache_bytes: " << thread_stat.near_cache_bytes << std::endl;
+        }
+        for (const AsyncRedisClient::ConnStat &conn_stat : client.GetConnStats()) {
+            std::cout << "    Conn " << conn_stat.thread_idx << "." << conn_stat.conn_idx << ": "
+                      << "sent_num: " << conn_stat.sent_num << ", "
+                      << "in_flight_num: " << conn_stat.in_flight_num << ", "
+                      << "pending_bytes: " << conn_stat.pending_bytes << ", "
+                      << "reconnect_num: " << conn_stat.reconnect_num << ", "
+                      << "state: " << static_cast<int>(conn_stat.state) << std::endl;
+        }
+    }
+    return ;
+}
+
+} // namespace
 
-    std::cout << "Start use: " << GetTimespecDiff(start_e, start_b) << " ns, "
-              << "Join use: " << GetTimespecDiff(join_e, join_b) << " ns, " << std::endl;
+int main(int argc, char **argv) noexcept {
+    signal(SIGINT, OnSig);
+
+    google::SetUsageMessage("AsyncRedisClient Benchmark");
+    google::SetVersionString("1.0.0");
+    google::ParseCommandLineFlags(&argc, &argv, false);
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    try {
+        std::vector<int> work_thread_nums = ParseIntList(FLAGS_work_thread_num);
+        std::vector<int> conn_per_threads = ParseIntList(FLAGS_conn_per_thread);
+        if (work_thread_nums.empty() || conn_per_threads.empty() || FLAGS_key_num <= 0 ||
+            FLAGS_test_thread_num <= 0 || FLAGS_concurrency <= 0 || FLAGS_rate <= 0 ||
+            (FLAGS_loop_mode != "closed" && FLAGS_loop_mode != "open")) {
+            std::cerr << "INVALID ARGUMENTS" << std::endl;
+            return 1;
+        }
+
+        g_keys.reserve(FLAGS_key_num);
+        for (int idx = 0; idx < FLAGS_key_num; ++idx) {
+            g_keys.push_back("key:" + std::to_string(idx));
+        }
+        g_value.assign(FLAGS_value_size, 'v');
+
+        if (FLAGS_key_dist == "zipf") {
+            if (FLAGS_zipf_theta <= 0 || FLAGS_zipf_theta >= 1) {
+                std::cerr << "INVALID zipf_theta" << std::endl;
+                return 1;
+            }
+            g_zipf.reset(new ZipfGenerator(FLAGS_key_num, FLAGS_zipf_theta));
+        } else if (FLAGS_key_dist != "uniform") {
+            std::cerr << "INVALID key_dist" << std::endl;
+            return 1;
+        }
+
+        MockRedisServer mock_server;
+        if (FLAGS_mock_server) {
+            mock_server.Start();
+            mock_server.SetLatency("", FLAGS_mock_latency_ms);
+            FLAGS_redis_host = mock_server.host;
+            FLAGS_redis_port = mock_server.GetPort();
+        }
+
+        if (FLAGS_pause) {
+            std::cout << "按 CTRL+C Start..." << std::endl;
+            pause();
+        }
+
+        std::cout << "api_kind: " << FLAGS_api_kind << ", loop_mode: " << FLAGS_loop_mode
+                  << (IsOpenLoop() ? ", rate: " + std::to_string(FLAGS_rate) :
+                                     ", concurrency: " + std::to_string(FLAGS_concurrency))
+                  << ", test_thread_num: " << FLAGS_test_thread_num
+                  << ", key_dist: " << FLAGS_key_dist << ", key_num: " << FLAGS_key_num
+                  << ", value_size: " << FLAGS_value_size << ", read_ratio: " << FLAGS_read_ratio
+                  << (FLAGS_mock_server ? ", server: mock" : ", server: redis") << std::endl;
+        PrintHeader();
+
+        bool prefill = FLAGS_prefill;
+        for (int work_thread_num : work_thread_nums) {
+            for (int conn_per_thread : conn_per_threads) {
+                RunOnce(work_thread_num, conn_per_thread, prefill);
+                prefill = false;
+            }
+        }
+    } catch (const std::exception &e) {
+        LOG(ERROR) << "Benchmark ERROR; exception: " << e.what();
+        return 1;
+    }
 
     if (FLAGS_pause) {
         pause();
     }
     return 0;
 }
-
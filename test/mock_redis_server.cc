@@ -0,0 +1,491 @@
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <string.h>
+
+#include <deque>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include "mock_redis_server.h"
+
+namespace {
+
+struct WriteRequest {
+    uv_write_t req;
+    std::string buf;
+};
+
+std::string ToUpper(const char *str, size_t len) {
+    std::string upper(str, len);
+    for (char &c : upper) {
+        c = toupper(static_cast<unsigned char>(c));
+    }
+    return upper;
+}
+
+std::string ToUpper(const std::string &str) {
+    return ToUpper(str.data(), str.size());
+}
+
+void AppendBulk(std::string *resp, const char *str, size_t len) {
+    *resp += "$" + std::to_string(len) + "\r\n";
+    resp->append(str, len);
+    resp->append("\r\n", 2);
+    return ;
+}
+
+std::runtime_error UVError(const char *what, int uv_rc) {
+    return std::runtime_error(std::string(what) + " ERROR; " + uv_strerror(uv_rc));
+}
+
+} // namespace
+
+struct MockRedisServer::Connection {
+    uv_tcp_t handle;
+    uv_timer_t timer;
+    MockRedisServer *server = nullptr;
+    redisReader *reader = nullptr;
+
+    // 尚未写出的延迟响应, 按照请求的顺序排列; first 为可以写出的时间, 单调不减.
+    std::deque<std::pair<uint64_t, std::string>> pending;
+    std::string out; // 将要在一次 uv_write() 中写出的响应.
+
+    uint64_t request_num = 0;
+    int open_handle_num = 2; // handle, timer 中尚未关闭的数目, 为 0 时释放.
+    bool closing = false;
+
+    char read_buf[16 * 1024];
+
+public:
+    ~Connection() noexcept {
+        if (reader) {
+            redisReaderFree(reader);
+        }
+    }
+};
+
+MockRedisServer::~MockRedisServer() noexcept {
+    Stop();
+}
+
+void MockRedisServer::Start() {
+    std::promise<void> p;
+    std::future<void> f = p.get_future();
+    thread_ = std::thread(&MockRedisServer::ThreadMain, this, &p);
+    try {
+        f.get();
+    } catch (...) {
+        thread_.join();
+        throw ;
+    }
+    started_ = true;
+    return ;
+}
+
+void MockRedisServer::Stop() noexcept {
+    if (!started_) {
+        return ;
+    }
+
+    try {
+        RunInLoop([this] () {
+            stopping_ = true;
+            CloseAll();
+            uv_close((uv_handle_t*)&listener_, nullptr);
+            uv_close((uv_handle_t*)&async_, nullptr);
+        });
+    } catch (...) {
+        // RunInLoop() 只会因为内存不足而失败, 此时也无法做更多的事情了.
+    }
+
+    thread_.join();
+    started_ = false;
+    return ;
+}
+
+void MockRedisServer::RunInLoop(std::function<void()> task) {
+    if (!started_) {
+        task();
+        return ;
+    }
+
+    std::promise<void> done;
+    std::future<void> f = done.get_future();
+    {
+        std::lock_guard<std::mutex> guard(task_mux_);
+        tasks_.emplace_back([&task, &done] () {
+            try {
+                task();
+                done.set_value();
+            } catch (...) {
+                done.set_exception(std::current_exception());
+            }
+        });
+    }
+    uv_async_send(&async_);
+    f.get();
+    return ;
+}
+
+void MockRedisServer::SetReply(const std::string &cmd, std::string resp) {
+    RunInLoop([&] () {
+        if (resp.empty()) {
+            replies_.erase(ToUpper(cmd));
+        } else {
+            replies_[ToUpper(cmd)] = std::move(resp);
+        }
+    });
+    return ;
+}
+
+void MockRedisServer::SetLatency(const std::string &cmd, uint32_t latency_ms) {
+    RunInLoop([&] () {
+        if (cmd.empty()) {
+            default_latency_ms_ = latency_ms;
+        } else {
+            latencies_[ToUpper(cmd)] = latency_ms;
+        }
+    });
+    return ;
+}
+
+void MockRedisServer::SetDropEvery(uint64_t n) {
+    RunInLoop([&] () {
+        drop_every_ = n;
+    });
+    return ;
+}
+
+void MockRedisServer::DropConnections() {
+    RunInLoop([&] () {
+        CloseAll();
+    });
+    return ;
+}
+
+void MockRedisServer::SetReadPaused(bool paused) {
+    RunInLoop([&] () {
+        read_paused_ = paused;
+        for (Connection *conn : conns_) {
+            if (paused) {
+                uv_read_stop((uv_stream_t*)&conn->handle);
+            } else {
+                uv_read_start((uv_stream_t*)&conn->handle, OnAlloc, OnRead);
+            }
+        }
+    });
+    return ;
+}
+
+void MockRedisServer::ThreadMain(std::promise<void> *p) noexcept {
+    int uv_rc = uv_loop_init(&loop_);
+    if (uv_rc < 0) {
+        p->set_exception(std::make_exception_ptr(UVError("uv_loop_init", uv_rc)));
+        return ;
+    }
+
+    // uv_tcp_init(), uv_async_init() 在这里不会失败.
+    uv_tcp_init(&loop_, &listener_);
+    listener_.data = this;
+    uv_async_init(&loop_, &async_, OnAsync);
+    async_.data = this;
+
+    struct sockaddr_in addr;
+    uv_rc = uv_ip4_addr(host.c_str(), port, &addr);
+    if (uv_rc >= 0) {
+        uv_rc = uv_tcp_bind(&listener_, (const struct sockaddr*)&addr, 0);
+    }
+    if (uv_rc >= 0) {
+        uv_rc = uv_listen((uv_stream_t*)&listener_, 128, OnNewConnection);
+    }
+    if (uv_rc >= 0) {
+        struct sockaddr_in bound_addr;
+        int addr_len = sizeof(bound_addr);
+        uv_rc = uv_tcp_getsockname(&listener_, (struct sockaddr*)&bound_addr, &addr_len);
+        bound_port_ = ntohs(bound_addr.sin_port);
+    }
+
+    if (uv_rc < 0) {
+        uv_close((uv_handle_t*)&listener_, nullptr);
+        uv_close((uv_handle_t*)&async_, nullptr);
+        uv_run(&loop_, UV_RUN_DEFAULT);
+        uv_loop_close(&loop_);
+        p->set_exception(std::make_exception_ptr(UVError("listen", uv_rc)));
+        return ;
+    }
+
+    p->set_value();
+
+    while (uv_run(&loop_, UV_RUN_DEFAULT)) {
+        ;
+    }
+    uv_loop_close(&loop_);
+    return ;
+}
+
+void MockRedisServer::OnAsync(uv_async_t *handle) noexcept {
+    MockRedisServer *server = static_cast<MockRedisServer*>(handle->data);
+
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> guard(server->task_mux_);
+        tasks.swap(server->tasks_);
+    }
+    for (std::function<void()> &task : tasks) {
+        task();
+    }
+    return ;
+}
+
+void MockRedisServer::OnNewConnection(uv_stream_t *listener, int status) noexcept {
+    MockRedisServer *server = static_cast<MockRedisServer*>(listener->data);
+    if (status < 0 || server->stopping_) {
+        return ;
+    }
+
+    Connection *conn = new (std::nothrow) Connection;
+    if (!conn) {
+        return ;
+    }
+    try {
+        server->conns_.insert(conn);
+    } catch (...) {
+        delete conn;
+        return ;
+    }
+    conn->server = server;
+    uv_tcp_init(&server->loop_, &conn->handle);
+    conn->handle.data = conn;
+    uv_timer_init(&server->loop_, &conn->timer);
+    conn->timer.data = conn;
+
+    conn->reader = redisReaderCreate();
+    if (!conn->reader || uv_accept(listener, (uv_stream_t*)&conn->handle) < 0) {
+        server->CloseConnection(conn);
+        return ;
+    }
+    uv_tcp_nodelay(&conn->handle, 1);
+    server->accept_num_.fetch_add(1, std::memory_order_relaxed);
+
+    if (!server->read_paused_) {
+        uv_read_start((uv_stream_t*)&conn->handle, OnAlloc, OnRead);
+    }
+    return ;
+}
+
+void MockRedisServer::OnAlloc(uv_handle_t *handle, size_t /* suggested_size */, uv_buf_t *buf) noexcept {
+    Connection *conn = static_cast<Connection*>(handle->data);
+    buf->base = conn->read_buf;
+    buf->len = sizeof(conn->read_buf);
+    return ;
+}
+
+void MockRedisServer::OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) noexcept {
+    Connection *conn = static_cast<Connection*>(stream->data);
+    MockRedisServer *server = conn->server;
+    if (nread < 0) {
+        server->CloseConnection(conn);
+        return ;
+    }
+    if (nread == 0) {
+        return ;
+    }
+
+    if (redisReaderFeed(conn->reader, buf->base, nread) != REDIS_OK) {
+        server->CloseConnection(conn);
+        return ;
+    }
+
+    try {
+        while (!conn->closing) {
+            void *request = nullptr;
+            if (redisReaderGetReply(conn->reader, &request) != REDIS_OK) {
+                server->CloseConnection(conn);
+                return ;
+            }
+            if (!request) {
+                break;
+            }
+
+            std::unique_ptr<redisReply, void(*)(void*)> request_guard(static_cast<redisReply*>(request),
+                                                                      freeReplyObject);
+            server->HandleRequest(conn, request_guard.get());
+        }
+    } catch (...) {
+        server->CloseConnection(conn);
+        return ;
+    }
+
+    server->FlushReplies(conn);
+    return ;
+}
+
+void MockRedisServer::HandleRequest(Connection *conn, const redisReply *request) {
+    request_num_.fetch_add(1, std::memory_order_relaxed);
+    ++conn->request_num;
+    if (drop_every_ != 0 && conn->request_num % drop_every_ == 0) {
+        CloseConnection(conn);
+        return ;
+    }
+
+    std::string cmd;
+    if (request->type == REDIS_REPLY_ARRAY && request->elements > 0 &&
+        request->element[0]->type == REDIS_REPLY_STRING) {
+        cmd = ToUpper(request->element[0]->str, request->element[0]->len);
+    }
+
+    std::string resp = Execute(cmd, request);
+    uint32_t latency_ms = GetLatency(cmd);
+    if (latency_ms == 0 && conn->pending.empty()) {
+        conn->out += resp;
+        return ;
+    }
+
+    uint64_t ready_ms = uv_now(&loop_) + latency_ms;
+    if (!conn->pending.empty() && ready_ms < conn->pending.back().first) {
+        ready_ms = conn->pending.back().first;
+    }
+    conn->pending.emplace_back(ready_ms, std::move(resp));
+    return ;
+}
+
+std::string MockRedisServer::Execute(const std::string &cmd, const redisReply *request) {
+    if (cmd.empty()) {
+        return "-ERR Protocol error\r\n";
+    }
+
+    auto reply_iter = replies_.find(cmd);
+    if (reply_iter != replies_.end()) {
+        return reply_iter->second;
+    }
+
+    size_t argc = request->elements;
+    for (size_t idx = 1; idx < argc; ++idx) {
+        if (request->element[idx]->type != REDIS_REPLY_STRING) {
+            return "-ERR Protocol error\r\n";
+        }
+    }
+    auto arg = [request] (size_t idx) -> std::string {
+        return std::string(request->element[idx]->str, request->element[idx]->len);
+    };
+
+    std::string resp;
+    if (cmd == "PING") {
+        resp = "+PONG\r\n";
+    } else if (cmd == "AUTH" || cmd == "SELECT") {
+        resp = "+OK\r\n";
+    } else if (cmd == "ECHO" && argc == 2) {
+        AppendBulk(&resp, request->element[1]->str, request->element[1]->len);
+    } else if (cmd == "GET" && argc == 2) {
+        auto iter = data_.find(arg(1));
+        if (iter == data_.end()) {
+            resp = "$-1\r\n";
+        } else {
+            AppendBulk(&resp, iter->second.data(), iter->second.size());
+        }
+    } else if (cmd == "SET" && argc >= 3) {
+        data_[arg(1)] = arg(2);
+        resp = "+OK\r\n";
+    } else if (cmd == "DEL" && argc >= 2) {
+        size_t del_num = 0;
+        for (size_t idx = 1; idx < argc; ++idx) {
+            del_num += data_.erase(arg(idx));
+        }
+        resp = ":" + std::to_string(del_num) + "\r\n";
+    } else if (cmd == "MGET" && argc >= 2) {
+        resp = "*" + std::to_string(argc - 1) + "\r\n";
+        for (size_t idx = 1; idx < argc; ++idx) {
+            auto iter = data_.find(arg(idx));
+            if (iter == data_.end()) {
+                resp += "$-1\r\n";
+            } else {
+                AppendBulk(&resp, iter->second.data(), iter->second.size());
+            }
+        }
+    } else if (cmd == "PING" || cmd == "ECHO" || cmd == "GET" || cmd == "SET" || cmd == "DEL" || cmd == "MGET") {
+        resp = "-ERR wrong number of arguments for '" + cmd + "' command\r\n";
+    } else {
+        resp = "-ERR unknown command '" + cmd + "'\r\n";
+    }
+    return resp;
+}
+
+uint32_t MockRedisServer::GetLatency(const std::string &cmd) const noexcept {
+    auto iter = latencies_.find(cmd);
+    return iter != latencies_.end() ? iter->second : default_latency_ms_;
+}
+
+// 写出 conn->out 以及所有已经到期的延迟响应, 若仍有未到期的响应, 则在最早的响应到期时再次调用.
+void MockRedisServer::FlushReplies(Connection *conn) noexcept {
+    if (conn->closing) {
+        return ;
+    }
+
+    uint64_t now_ms = uv_now(&loop_);
+    while (!conn->pending.empty() && conn->pending.front().first <= now_ms) {
+        conn->out += conn->pending.front().second;
+        conn->pending.pop_front();
+    }
+
+    if (!conn->out.empty()) {
+        WriteRequest *write_req = new (std::nothrow) WriteRequest;
+        if (!write_req) {
+            CloseConnection(conn);
+            return ;
+        }
+        write_req->buf.swap(conn->out);
+        write_req->req.data = write_req;
+
+        uv_buf_t buf = uv_buf_init(&write_req->buf[0], write_req->buf.size());
+        if (uv_write(&write_req->req, (uv_stream_t*)&conn->handle, &buf, 1, OnWrite) < 0) {
+            delete write_req;
+            CloseConnection(conn);
+            return ;
+        }
+    }
+
+    if (!conn->pending.empty()) {
+        uv_timer_start(&conn->timer, OnReplyTimer, conn->pending.front().first - now_ms, 0);
+    }
+    return ;
+}
+
+void MockRedisServer::OnWrite(uv_write_t *req, int /* status */) noexcept {
+    // 写出失败时, 对端关闭等错误会在 OnRead() 中处理.
+    delete static_cast<WriteRequest*>(req->data);
+    return ;
+}
+
+void MockRedisServer::OnReplyTimer(uv_timer_t *timer) noexcept {
+    Connection *conn = static_cast<Connection*>(timer->data);
+    conn->server->FlushReplies(conn);
+    return ;
+}
+
+void MockRedisServer::CloseConnection(Connection *conn) noexcept {
+    if (conn->closing) {
+        return ;
+    }
+    conn->closing = true;
+    conns_.erase(conn);
+    uv_close((uv_handle_t*)&conn->handle, OnConnectionClose);
+    uv_close((uv_handle_t*)&conn->timer, OnConnectionClose);
+    return ;
+}
+
+void MockRedisServer::CloseAll() noexcept {
+    // CloseConnection() 会将 conn 从 conns_ 中移除.
+    while (!conns_.empty()) {
+        CloseConnection(*conns_.begin());
+    }
+    return ;
+}
+
+void MockRedisServer::OnConnectionClose(uv_handle_t *handle) noexcept {
+    Connection *conn = static_cast<Connection*>(handle->data);
+    if (--conn->open_handle_num == 0) {
+        delete conn;
+    }
+    return ;
+}
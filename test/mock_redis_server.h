@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+
+#include <uv.h>
+#include <hiredis/hiredis.h>
+
+/**
+ * 进程内的 RESP 服务端, 用来代替 redis-server 进行压测或者测试, 使得结果只反映 AsyncRedisClient 自身的开销, 并且
+ * 可以复现延迟, 故障等场景.
+ *
+ * MockRedisServer 在自己的线程中运行一个 uv_loop, 支持 PING, ECHO, AUTH, SELECT, GET, SET, DEL, MGET 这些命令,
+ * 数据保存在内存中. 此外:
+ *
+ * - SetReply(), 为某个命令指定固定的响应, 优先于内置的实现.
+ * - SetLatency(), 为某个命令指定响应延迟. 同一连接上的响应总是按照请求的顺序写出.
+ * - SetDropEvery(), 每个连接收到第 N 个请求时直接关闭该连接, 不发送响应; DropConnections() 关闭当前所有连接.
+ * - SetReadPaused(), 暂停从连接中读取请求, 模拟处理缓慢的服务端, 此时请求会堆积在客户端的输出缓冲区中.
+ *
+ * 配置字段需要在 Start() 之前设置. 除了 Start(), Stop() 之外的方法都可以在任意线程中调用; 在 Start() 之后, 它们
+ * 会在 MockRedisServer 的线程中执行并等待其完成, 因此返回之后对后续的请求可见. 这些方法不能在 MockRedisServer
+ * 的线程中调用.
+ */
+class MockRedisServer {
+public:
+    std::string host {"127.0.0.1"};
+    uint16_t port = 0; // 为 0 时使用系统分配的端口, 参见 GetPort().
+
+public:
+    MockRedisServer() = default;
+    ~MockRedisServer() noexcept;
+
+    MockRedisServer(const MockRedisServer &) = delete;
+    MockRedisServer& operator=(const MockRedisServer &) = delete;
+
+    /**
+     * 启动线程并开始监听. 若失败则抛出异常.
+     */
+    void Start();
+
+    /**
+     * 关闭所有连接, 并等待线程退出. 可以重复调用.
+     */
+    void Stop() noexcept;
+
+    /**
+     * 实际监听的端口, 在 Start() 之后有效.
+     */
+    uint16_t GetPort() const noexcept {
+        return bound_port_;
+    }
+
+    /**
+     * 之后 cmd 命令总是以 resp 作为响应, resp 需要是完整的 RESP 编码, 如 "+OK\r\n". cmd 不区分大小写. resp 为空时
+     * 恢复为内置的实现.
+     */
+    void SetReply(const std::string &cmd, std::string resp);
+
+    /**
+     * 之后 cmd 命令的响应延迟 latency_ms 再写出. cmd 为空表示所有未单独指定延迟的命令.
+     */
+    void SetLatency(const std::string &cmd, uint32_t latency_ms);
+
+    /**
+     * 之后每个连接收到第 n, 2n, ... 个请求时关闭该连接. 0 表示不关闭.
+     */
+    void SetDropEvery(uint64_t n);
+
+    void DropConnections();
+
+    void SetReadPaused(bool paused);
+
+    uint64_t GetRequestNum() const noexcept {
+        return request_num_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t GetAcceptNum() const noexcept {
+        return accept_num_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Connection;
+
+private:
+    std::thread thread_;
+    uv_loop_t loop_;
+    uv_tcp_t listener_;
+    uv_async_t async_;
+    uint16_t bound_port_ = 0;
+    bool started_ = false;
+
+    // 以下字段只在 MockRedisServer 的线程中访问.
+    std::unordered_set<Connection*> conns_;
+    std::unordered_map<std::string, std::string> data_;
+    std::unordered_map<std::string, std::string> replies_;
+    std::unordered_map<std::string, uint32_t> latencies_;
+    uint32_t default_latency_ms_ = 0;
+    uint64_t drop_every_ = 0;
+    bool read_paused_ = false;
+    bool stopping_ = false;
+
+    // 由 RunInLoop() 使用.
+    std::mutex task_mux_;
+    std::vector<std::function<void()>> tasks_;
+
+    std::atomic<uint64_t> request_num_{0};
+    std::atomic<uint64_t> accept_num_{0};
+
+private:
+    // 在 MockRedisServer 的线程中执行 task, 并等待其完成.
+    void RunInLoop(std::function<void()> task);
+
+    void ThreadMain(std::promise<void> *p) noexcept;
+
+    void HandleRequest(Connection *conn, const redisReply *request);
+    std::string Execute(const std::string &cmd, const redisReply *request);
+    uint32_t GetLatency(const std::string &cmd) const noexcept;
+    void FlushReplies(Connection *conn) noexcept;
+    void CloseConnection(Connection *conn) noexcept;
+    void CloseAll() noexcept;
+
+    static void OnAsync(uv_async_t *handle) noexcept;
+    static void OnNewConnection(uv_stream_t *listener, int status) noexcept;
+    static void OnAlloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) noexcept;
+    static void OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) noexcept;
+    static void OnWrite(uv_write_t *req, int status) noexcept;
+    static void OnReplyTimer(uv_timer_t *timer) noexcept;
+    static void OnConnectionClose(uv_handle_t *handle) noexcept;
+};
@@ -0,0 +1,80 @@
+#!/bin/bash
+#
+# 启动一个临时的 redis-server, 使用 main.cc 依次运行若干组压测, 结束后关闭 redis-server.
+#
+# 用法:
+#   make main_src=main.cc && ./run_bench.sh [额外传给 bin/main 的参数]
+#
+# 环境变量:
+#   REDIS_BIN_DIR, redis-server, redis-cli 所在目录, 默认从 PATH 中查找.
+#   PORT, redis-server 端口, 默认 16379.
+#   WORK_THREAD_NUM, CONN_PER_THREAD, 逗号分隔的列表, 对其每种组合各运行一次.
+#   WAKEUP_PER_REQUEST_BENCH, 以唤醒合并之前的行为构建的 main, 若设置, 则与 bin/main 对比每个请求的系统调用次数,
+#       构建方式:
+#       make main_src=main.cc EXTRA_CXXFLAGS=-DASYNC_REDIS_CLIENT_WAKEUP_PER_REQUEST OBJ_DIR=objs_wpr BIN_DIR=bin_wpr
+#   PERF_STAT, 若不为空, 则上述对比通过 perf stat 额外统计 write, read, epoll_wait 系统调用的次数, 需要有权限
+#       访问 syscalls 下的 tracepoint.
+
+set -e
+
+REDIS_BIN_DIR=${REDIS_BIN_DIR:-}
+PORT=${PORT:-16379}
+WORK_THREAD_NUM=${WORK_THREAD_NUM:-1,2,4}
+CONN_PER_THREAD=${CONN_PER_THREAD:-1,2,4}
+DATA_DIR=${DATA_DIR:-$(pwd)/bench_redis}
+
+redis_server=${REDIS_BIN_DIR:+$REDIS_BIN_DIR/}redis-server
+redis_cli=${REDIS_BIN_DIR:+$REDIS_BIN_DIR/}redis-cli
+bench=$(dirname $0)/bin/main
+
+start_server="$redis_server --port $PORT --appendonly no --save '' --dir $DATA_DIR --daemonize yes --logfile $DATA_DIR/redis.log"
+wait_server="until $redis_cli -p $PORT ping > /dev/null 2>&1; do sleep 0.01; done"
+
+mkdir -p $DATA_DIR
+eval "$start_server"
+trap "$redis_cli -p $PORT shutdown nosave > /dev/null 2>&1 || true" EXIT
+eval "$wait_server"
+
+common="--redis_port=$PORT --work_thread_num=$WORK_THREAD_NUM --conn_per_thread=$CONN_PER_THREAD"
+
+echo "### closed loop, kAsyncAsync"
+$bench $common --api_kind=0 --loop_mode=closed --test_thread_num=4 --concurrency=64 "$@"
+
+# 唤醒合并前后每个请求的系统调用次数, 见 rd/req, wr/req 两列.
+if [ -n "$WAKEUP_PER_REQUEST_BENCH" ]; then
+    perf_stat=${PERF_STAT:+perf stat -e syscalls:sys_enter_write,syscalls:sys_enter_read,syscalls:sys_enter_epoll_wait}
+    for wakeup_bench in $bench $WAKEUP_PER_REQUEST_BENCH; do
+        echo "### closed loop, kAsyncAsync, $wakeup_bench"
+        $perf_stat $wakeup_bench $common --api_kind=0 --loop_mode=closed --test_thread_num=4 --concurrency=64 \
+            --prefill=false "$@"
+    done
+fi
+
+echo "### closed loop, kAsyncSync"
+$bench $common --api_kind=1 --loop_mode=closed --test_thread_num=16 --prefill=false "$@"
+
+echo "### closed loop, kReplyFuture"
+$bench $common --api_kind=3 --loop_mode=closed --test_thread_num=16 --prefill=false "$@"
+
+echo "### closed loop, kSync"
+$bench $common --api_kind=2 --loop_mode=closed --test_thread_num=16 --prefill=false "$@"
+
+echo "### open loop, kAsyncAsync, zipf"
+$bench $common --api_kind=0 --loop_mode=open --test_thread_num=2 --rate=50000 --key_dist=zipf --prefill=false "$@"
+
+echo "### closed loop, kAsyncAsync, GET only, merge_reads=false"
+$bench $common --api_kind=0 --loop_mode=closed --test_thread_num=4 --concurrency=64 --read_ratio=1 --prefill=false "$@"
+
+echo "### closed loop, kAsyncAsync, GET only, merge_reads=true, merge_gets=true"
+$bench $common --api_kind=0 --loop_mode=closed --test_thread_num=4 --concurrency=64 --read_ratio=1 --prefill=false --merge_reads=true --merge_gets=true "$@"
+
+# 压测进行中重启 redis-server, 输出所有连接重新就绪所需的时间(recovery_ms), 以及期间失败, 重试的请求数目.
+restart_cmd="$redis_cli -p $PORT shutdown nosave > /dev/null 2>&1; $start_server; $wait_server"
+
+echo "### closed loop, kAsyncAsync, restart redis-server, max_retry_num=0"
+$bench $common --api_kind=0 --loop_mode=closed --test_thread_num=4 --concurrency=64 --prefill=false \
+    --req_per_thread=1000000 --restart_cmd="$restart_cmd" "$@"
+
+echo "### closed loop, kAsyncAsync, restart redis-server, max_retry_num=2"
+$bench $common --api_kind=0 --loop_mode=closed --test_thread_num=4 --concurrency=64 --prefill=false \
+    --req_per_thread=1000000 --restart_cmd="$restart_cmd" --max_retry_num=2 "$@"
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# 在本地启动一个由 NODE_NUM 个 redis-server 进程组成的 redis cluster, 用于测试 AsyncRedisClient 的集群模式.
+#
+# 用法:
+#   ./start_local_cluster.sh start    # 启动 6 个节点(3 master, 3 replica), 端口 30001 ~ 30006.
+#   ./start_local_cluster.sh stop     # 停止所有节点.
+#   ./start_local_cluster.sh clean    # 停止所有节点并删除数据目录.
+#
+# 环境变量:
+#   REDIS_BIN_DIR, redis-server, redis-cli 所在目录, 默认从 PATH 中查找.
+#   BASE_PORT, 默认 30000, 节点端口为 BASE_PORT + 1 ~ BASE_PORT + NODE_NUM.
+#   NODE_NUM, 默认 6.
+#   REPLICAS, 每个 master 的 replica 数目, 默认 1.
+
+set -e
+
+REDIS_BIN_DIR=${REDIS_BIN_DIR:-}
+BASE_PORT=${BASE_PORT:-30000}
+NODE_NUM=${NODE_NUM:-6}
+REPLICAS=${REPLICAS:-1}
+DATA_DIR=${DATA_DIR:-$(pwd)/local_cluster}
+
+redis_server=${REDIS_BIN_DIR:+$REDIS_BIN_DIR/}redis-server
+redis_cli=${REDIS_BIN_DIR:+$REDIS_BIN_DIR/}redis-cli
+
+start() {
+    local hosts=""
+    for idx in $(seq 1 $NODE_NUM); do
+        local port=$((BASE_PORT + idx))
+        mkdir -p $DATA_DIR/$port
+        $redis_server --port $port --cluster-enabled yes --cluster-config-file nodes.conf \
+            --cluster-node-timeout 2000 --appendonly no --save "" \
+            --dir $DATA_DIR/$port --daemonize yes --logfile $DATA_DIR/$port/redis.log
+        hosts="$hosts 127.0.0.1:$port"
+    done
+
+    for idx in $(seq 1 $NODE_NUM); do
+        until $redis_cli -p $((BASE_PORT + idx)) ping > /dev/null 2>&1; do
+            sleep 0.1
+        done
+    done
+
+    $redis_cli --cluster create $hosts --cluster-replicas $REPLICAS --cluster-yes
+}
+
+stop() {
+    for idx in $(seq 1 $NODE_NUM); do
+        $redis_cli -p $((BASE_PORT + idx)) shutdown nosave > /dev/null 2>&1 || true
+    done
+}
+
+case "$1" in
+start)
+    start
+    ;;
+stop)
+    stop
+    ;;
+clean)
+    stop
+    rm -rf $DATA_DIR
+    ;;
+*)
+    echo "Usage: $0 {start|stop|clean}"
+    exit 1
+    ;;
+esac